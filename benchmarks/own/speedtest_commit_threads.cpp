@@ -0,0 +1,102 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <pthread.h>
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+
+#include <ddt_jit.hpp>
+#include "../../copy_benchmark/hrtimer/hrtimer.h"
+
+// Measures the commit throughput of the library for an increasing number
+// of threads committing datatypes at the same time. Every commit uses a
+// different datatype, so no code is shared between commits.
+
+unsigned long long g_timerfreq;
+
+struct thread_args {
+    int id;
+    int num_commits;
+    farc::Datatype* basetype;
+};
+
+void* commit_types(void* arg) {
+    thread_args* args = (thread_args*) arg;
+
+    for (int i=0; i<args->num_commits; i++) {
+        // the stride makes the type unique among all threads and runs
+        int stride = 2 + args->id * args->num_commits + i;
+        farc::Datatype* t = new farc::VectorDatatype(8, 1, stride, args->basetype);
+        farc::DDT_Commit(t);
+        farc::DDT_Free(t);
+    }
+
+    return NULL;
+}
+
+// Returns the wall time in ticks for num_threads threads committing
+// num_commits datatypes each
+uint64_t benchmark_commit(int num_threads, int num_commits, int run, farc::Datatype* basetype) {
+
+    std::vector<pthread_t> threads(num_threads);
+    std::vector<thread_args> args(num_threads);
+    HRT_TIMESTAMP_T start, stop;
+    uint64_t ticks;
+
+    HRT_GET_TIMESTAMP(start);
+    for (int t=0; t<num_threads; t++) {
+        args[t].id = (run * num_threads) + t;
+        args[t].num_commits = num_commits;
+        args[t].basetype = basetype;
+        pthread_create(&threads[t], NULL, commit_types, &args[t]);
+    }
+    for (int t=0; t<num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    HRT_GET_TIMESTAMP(stop);
+    HRT_GET_ELAPSED_TICKS(start, stop, &ticks);
+
+    return ticks;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 4) {
+        fprintf(stderr, "%s [num-runs] [max-threads] [commits-per-thread]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    MPI_Init(&argc, &argv);
+    HRT_INIT(1, g_timerfreq);
+    farc::DDT_Init();
+
+    int num_runs    = atoi(argv[1]);
+    int max_threads = atoi(argv[2]);
+    int num_commits = atoi(argv[3]);
+
+    farc::Datatype* basetype = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+
+    printf("%10s %10s %15s %15s\n", "threads", "commits", "time_usec", "commits_per_s");
+    for (int num_threads=1; num_threads<=max_threads; num_threads++) {
+        std::vector<uint64_t> times(num_runs, 0);
+        for (int r=0; r<num_runs; r++) {
+            times[r] = benchmark_commit(num_threads, num_commits, r * max_threads + num_threads, basetype);
+        }
+        std::sort(times.begin(), times.end());
+
+        double usec = HRT_GET_USEC(times[num_runs/2]);
+        int commits = num_threads * num_commits;
+        printf("%10i %10i %15.3lf %15.1lf\n", num_threads, commits, usec, commits / (usec * 1e-6));
+    }
+
+    farc::DDT_Free(basetype);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+    return 0;
+
+}
@@ -0,0 +1,134 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+
+#include <ddt_jit.hpp>
+#include "../../copy_benchmark/hrtimer/hrtimer.h"
+
+// Measures commit time and pack bandwidth of hindexed types with an
+// increasing number of irregular blocks, as they are found in unstructured
+// mesh codes. Types with more than HIDX_LOOP_TRESHOLD blocks loop over a
+// table of blocks instead of unrolling them.
+
+unsigned long long g_timerfreq;
+
+void benchmark_hindexed(int num_blocks, int runs) {
+
+    std::vector<int> blocklens(num_blocks);
+    std::vector<long> displs(num_blocks);
+    long pos = 0;
+    for (int i=0; i<num_blocks; i++) {
+        blocklens[i] = 1 + rand() % 4;
+        displs[i] = pos;
+        pos += (blocklens[i] + 1 + rand() % 4) * sizeof(double);
+    }
+
+    std::vector<uint64_t> mpi_type_create(runs, 0);
+    std::vector<uint64_t> farc_type_create(runs, 0);
+    std::vector<uint64_t> mpi_pack(runs, 0);
+    std::vector<uint64_t> farc_pack(runs, 0);
+    HRT_TIMESTAMP_T start, stop;
+
+    char* inbuf = (char*) malloc(pos);
+    char* outbuf = (char*) malloc(pos);
+    for (long i=0; i<pos; i++) {
+        inbuf[i] = i+1;
+        outbuf[i] = 0;
+    }
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+    int data_size = 0;
+
+    for (int r=0; r<runs; r++) {
+        HRT_GET_TIMESTAMP(start);
+        farc::Datatype* t2 = new farc::HIndexedDatatype(num_blocks, &blocklens[0], &displs[0], t1);
+        farc::DDT_Commit(t2);
+        HRT_GET_TIMESTAMP(stop);
+        HRT_GET_ELAPSED_TICKS(start, stop, &farc_type_create[r]);
+        data_size = t2->getSize();
+
+        HRT_GET_TIMESTAMP(start);
+        MPI_Datatype newtype_mpi;
+        MPI_Type_create_hindexed(num_blocks, &blocklens[0], &displs[0], MPI_DOUBLE, &newtype_mpi);
+        MPI_Type_commit(&newtype_mpi);
+        HRT_GET_TIMESTAMP(stop);
+        HRT_GET_ELAPSED_TICKS(start, stop, &mpi_type_create[r]);
+
+        // warmup
+        int position = 0;
+        MPI_Pack(inbuf, 1, newtype_mpi, outbuf, pos, &position, MPI_COMM_WORLD);
+
+        position = 0;
+        HRT_GET_TIMESTAMP(start);
+        MPI_Pack(inbuf, 1, newtype_mpi, outbuf, pos, &position, MPI_COMM_WORLD);
+        HRT_GET_TIMESTAMP(stop);
+        HRT_GET_ELAPSED_TICKS(start, stop, &mpi_pack[r]);
+
+        // warmup
+        farc::DDT_Pack(inbuf, outbuf, t2, 1);
+
+        HRT_GET_TIMESTAMP(start);
+        farc::DDT_Pack(inbuf, outbuf, t2, 1);
+        HRT_GET_TIMESTAMP(stop);
+        HRT_GET_ELAPSED_TICKS(start, stop, &farc_pack[r]);
+
+        MPI_Type_free(&newtype_mpi);
+        farc::DDT_Free(t2);
+    }
+
+    std::sort(mpi_type_create.begin(), mpi_type_create.end());
+    std::sort(farc_type_create.begin(), farc_type_create.end());
+    std::sort(mpi_pack.begin(), mpi_pack.end());
+    std::sort(farc_pack.begin(), farc_pack.end());
+
+    // bandwidth in MB/s from the median times
+    double mpi_bw = data_size / HRT_GET_USEC(mpi_pack[runs/2]);
+    double farc_bw = data_size / HRT_GET_USEC(farc_pack[runs/2]);
+
+    static int firstline=1;
+    if (firstline) printf("%10s %10s %12s %12s %10s %10s %10s %10s\n", "blocks", "size", "mpi_create", "farc_create", "mpi_pack", "farc_pack", "mpi_bw", "farc_bw");
+    firstline=0;
+    printf("%10i %10i %12.3lf %12.3lf %10.3lf %10.3lf %10.1lf %10.1lf\n", num_blocks, data_size,
+           HRT_GET_USEC(mpi_type_create[runs/2]), HRT_GET_USEC(farc_type_create[runs/2]),
+           HRT_GET_USEC(mpi_pack[runs/2]), HRT_GET_USEC(farc_pack[runs/2]), mpi_bw, farc_bw);
+
+    farc::DDT_Free(t1);
+    free(inbuf);
+    free(outbuf);
+
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 5) {
+        fprintf(stderr, "%s [num-runs] [blocks_start] [blocks_end] [blocks_factor]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    MPI_Init(&argc, &argv);
+    HRT_INIT(1, g_timerfreq);
+    farc::DDT_Init();
+
+    int num_runs = atoi(argv[1]);
+    int blocks_start = atoi(argv[2]);
+    int blocks_end = atoi(argv[3]);
+    int blocks_factor = atoi(argv[4]);
+    srand(42);
+
+    for (int blocks=blocks_start; blocks<=blocks_end; blocks *= blocks_factor) {
+        benchmark_hindexed(blocks, num_runs);
+        if (blocks_factor <= 1) break;
+    }
+
+    farc::DDT_Finalize();
+    MPI_Finalize();
+    return 0;
+
+}
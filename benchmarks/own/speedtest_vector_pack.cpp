@@ -58,7 +58,7 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
 
     farc::Datatype* tmp1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
     farc::Datatype* tmp2 = new farc::VectorDatatype(tmp1, inner_cnt, blklen, stride);
-    int data_size   = tmp2->getSize();
+    long data_size   = tmp2->getSize();
     int buffer_size = tmp2->getExtent();
     farc::DDT_Free(tmp1);
     farc::DDT_Free(tmp2);
@@ -143,7 +143,7 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
       static int firstline=1;
       if (firstline) printf("%10s %10s %10s %10s %10s %10s %10s %10s %10s %10s \n", "size", "mpi_create", "farc_create", "cpp_pack", "mpi_pack", "farc_pack", "blklen", "stride", "count", "pack_count");
       firstline=0;
-      printf("%10i %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10i %10i %10i %10i\n", data_size, HRT_GET_USEC(mpi_type_create[r/2]), 
+      printf("%10li %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10i %10i %10i %10i\n", data_size, HRT_GET_USEC(mpi_type_create[r/2]), 
 	  																					      HRT_GET_USEC(farc_type_create[r/2]), 
 																							  HRT_GET_USEC(cpp_pack[r/2]), 
 																							  HRT_GET_USEC(mpi_pack[r/2]), 
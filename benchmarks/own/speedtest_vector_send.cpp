@@ -9,10 +9,13 @@
 #include <mpi.h>
 
 #include "../../ddt_jit.hpp"
+#include "../../interposer_common.h"
 #include "../../tests/test.hpp"
 #include "../../copy_benchmark/hrtimer/hrtimer.h"
 
 unsigned long long g_timerfreq;
+int g_pipeline_segments = 8;
+int g_pipeline_min_segment = 64*1024;
 
 void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int inner_runs, int outer_runs) {
 
@@ -28,6 +31,7 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
 
     HRT_TIMESTAMP_T start, stop;
     uint64_t mpi_type_create, farc_type_create, interposer_type_create, mpi_send, farc_send, interposer_send, cpp_send;
+    uint64_t mono_send, pipe_send;
 
     int rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -88,6 +92,37 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
             MPI_Barrier(MPI_COMM_WORLD);
         }
 
+        // the same message through the interposer, received with the derived
+        // datatype, once in one piece and once in pipelined segments
+        interposer_set_pipeline(1, g_pipeline_min_segment);
+        for (int i=0; i<inner_runs; i++) {
+            HRT_GET_TIMESTAMP(start);
+            if (rank == 0) {
+                MPI_Send(interposer_inbuf, outer_cnt, newtype_farc, 1, 0, MPI_COMM_WORLD);
+            }
+            else {
+                MPI_Recv(interposer_outbuf, outer_cnt, newtype_farc, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            }
+            HRT_GET_TIMESTAMP(stop);
+            HRT_GET_ELAPSED_TICKS(start, stop, &mono_send);
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+
+        interposer_set_pipeline(g_pipeline_segments, g_pipeline_min_segment);
+        for (int i=0; i<inner_runs; i++) {
+            HRT_GET_TIMESTAMP(start);
+            if (rank == 0) {
+                MPI_Send(interposer_inbuf, outer_cnt, newtype_farc, 1, 0, MPI_COMM_WORLD);
+            }
+            else {
+                MPI_Recv(interposer_outbuf, outer_cnt, newtype_farc, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            }
+            HRT_GET_TIMESTAMP(stop);
+            HRT_GET_ELAPSED_TICKS(start, stop, &pipe_send);
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+        interposer_set_pipeline(1, g_pipeline_min_segment);
+
         for (int i=0; i<inner_runs; i++) {
             HRT_GET_TIMESTAMP(start);
             if (rank == 0) {
@@ -123,9 +158,9 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
 
         if (rank == 0) {
             static int firstline=1;
-            if (firstline) printf("%10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "size", "mpi_create", "psr_create", "farc_create", "cpp_send", "mpi_send", "psr_send", "farc_send", "blklen", "stride", "count", "send_count");
+            if (firstline) printf("%10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "size", "mpi_create", "psr_create", "farc_create", "cpp_send", "mpi_send", "psr_send", "farc_send", "mono_send", "pipe_send", "segments", "blklen", "stride", "count", "send_count");
             firstline=0;
-            printf("%10i %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10i %10i %10i %10i\n", data_size, HRT_GET_USEC(mpi_type_create), HRT_GET_USEC(interposer_type_create), HRT_GET_USEC(farc_type_create), HRT_GET_USEC(cpp_send), HRT_GET_USEC(mpi_send), HRT_GET_USEC(interposer_send), HRT_GET_USEC(farc_send), blklen, stride, inner_cnt, outer_cnt);
+            printf("%10i %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10i %10i %10i %10i %10i\n", data_size, HRT_GET_USEC(mpi_type_create), HRT_GET_USEC(interposer_type_create), HRT_GET_USEC(farc_type_create), HRT_GET_USEC(cpp_send), HRT_GET_USEC(mpi_send), HRT_GET_USEC(interposer_send), HRT_GET_USEC(farc_send), HRT_GET_USEC(mono_send), HRT_GET_USEC(pipe_send), g_pipeline_segments, blklen, stride, inner_cnt, outer_cnt);
         }
 
         PMPI_Type_free(&newtype);
@@ -147,7 +182,7 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
 int main(int argc, char** argv) {
 
    if (argc < 14) {
-        fprintf(stderr, "%s [num-runs] [blklen_start] [blklen_end] [blklen_inc] [stride_start] [stride_end] [stride_inc] [inner_cnt_start] [inner_cnt_end] [inner_cnt_inc] [outer_cnt_start] [outer_cnt_end] [outer_cnt_inc]\n", argv[0]);
+        fprintf(stderr, "%s [num-runs] [blklen_start] [blklen_end] [blklen_inc] [stride_start] [stride_end] [stride_inc] [inner_cnt_start] [inner_cnt_end] [inner_cnt_inc] [outer_cnt_start] [outer_cnt_end] [outer_cnt_inc] ([pipeline_segments] [pipeline_min_segment])\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -173,6 +208,9 @@ int main(int argc, char** argv) {
     int outer_cnt_end = atoi(argv[12]);
     int outer_cnt_inc = atoi(argv[13]);
 
+    if (argc > 14) g_pipeline_segments = atoi(argv[14]);
+    if (argc > 15) g_pipeline_min_segment = atoi(argv[15]);
+
     for (int blklen=blklen_start; blklen<=blklen_end; blklen += blklen_inc) {
         for (int stride=stride_start; stride<=stride_end; stride += stride_inc) {
             for (int inner_cnt=inner_cnt_start; inner_cnt<=inner_cnt_end; inner_cnt += inner_cnt_inc) {
@@ -47,7 +47,7 @@ void benchmark_vector(int blklen, int stride, int inner_cnt, int outer_cnt, int
     farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
     farc::Datatype* t2 = new farc::VectorDatatype(t1, inner_cnt, blklen, stride);
     farc::DDT_Commit(t2);
-    int data_size   = t2->getSize();
+    long data_size   = t2->getSize();
     int buffer_size = t2->getExtent();
 
     init_in_and_out_buffer(buffer_size, &farc_inbuf, &farc_outbuf);
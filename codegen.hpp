@@ -16,48 +16,138 @@ class Value;
 class GlobalVariable;
 }
 
+// Defaults of the indexed block loop parameters, see DDT_Target
+#ifndef IDXB_LOOP_TRESHOLD
 #define IDXB_LOOP_TRESHOLD  16
+#endif
+#ifndef IDXB_LOOP_UNROLL
 #define IDXB_LOOP_UNROLL    1
+#endif
+
+// Hindexed types with more blocks, and runs of struct blocks with the same
+// basetype which are longer, loop over tables of displacements and
+// blocklens instead of unrolling the blocks
+#define HIDX_LOOP_TRESHOLD  64
+
+// Nested structs are flattened into the enclosing struct if this results
+// in at most this many additional fields
+#define STRUCT_FLATTEN_TRESHOLD 64
+
+// Copy kernel parameters for hosts without a better choice, see
+// DDT_Target. Copy loops move COPY_LOOP_UNROLL * SIMD_BYTE_SIZE bytes per
+// iteration, the unroll factor is scaled if the vector width changes.
+#ifndef SIMD_BYTE_SIZE
+#define SIMD_BYTE_SIZE 16
+#endif
+#ifndef COPY_LOOP_UNROLL
+#define COPY_LOOP_UNROLL 16
+#endif
+#ifndef COPY_LOOP_TRESHOLD
+#define COPY_LOOP_TRESHOLD 64*8
+#endif
+
+// Vector and indexed block types with single primitive elements of 4 or 8
+// bytes use the gather kernel if they have at least this many blocks,
+// shorter ones are unrolled or looped over element by element
+#define GATHER_MIN_COUNT 8
+
+// Loops over blocks of the scattered buffer prefetch the block which is
+// PREFETCH_DISTANCE bytes of packed data ahead, but at most
+// PREFETCH_MAX_BLOCKS blocks, and at most PREFETCH_MAX_LINES cache lines of
+// it. Strides below PREFETCH_MIN_STRIDE are left to the hardware
+// prefetcher, loops spanning less than PREFETCH_MIN_EXTENT bytes are not
+// worth it.
+#ifndef PREFETCH_DISTANCE
+#define PREFETCH_DISTANCE 2048
+#endif
+#define PREFETCH_MAX_BLOCKS 16
+#define PREFETCH_MAX_LINES  4
+#define PREFETCH_MIN_STRIDE 512
+#define PREFETCH_MIN_EXTENT (32L*1024)
+#define CACHE_LINE_SIZE     64
+
+// Calls packing more bytes use streaming stores if the size of the caches
+// is not known
+#ifndef STREAM_TRESHOLD
+#define STREAM_TRESHOLD (4L*1024*1024)
+#endif
 
 namespace farc {
 
+// The target the code is generated for
+extern DDT_Target TheTarget;
+
+// Parameters of the function being generated by this thread: TheTarget,
+// or the parameters the autotuner chose for the datatype
+extern __thread const DDT_Target *CodeTarget;
+
+// Whether the features of target enable the given one (e.g. "+avx2")
+bool hasFeature(const DDT_Target &target, const char *feature);
+
 void codegenPrimitive(llvm::Value* inbuf, llvm::Value* incount,
                       llvm::Value* outbuf, int size, 
                       PrimitiveDatatype::PrimitiveType type);
 
 void codegenPrimitiveResized(llvm::Value* inbuf, llvm::Value* incount,
-                      llvm::Value* outbuf, int size, int extent, 
-                      PrimitiveDatatype::PrimitiveType type);
+                             llvm::Value* outbuf, long size, long extent,
+                             bool pack);
 
 void codegenContiguous(llvm::Value* inbuf, llvm::Value* incount,
                        llvm::Value* outbuf, Datatype *basetype,
-                       int elemstride_in, int elemstride_out,
+                       long elemstride_in, long elemstride_out,
                        int count, bool pack);
 
 void codegenVector(llvm::Value *inbuf, llvm::Value *incount,
                    llvm::Value *outbuf, Datatype *basetype, int count,
-                   int blocklen, int elemstride_in, int elemstride_out,
-                   int inptr_inc, int outptr_inc, bool pack);
+                   int blocklen, long elemstride_in, long elemstride_out,
+                   long inptr_inc, long outptr_inc, bool pack);
+
+// Loop nest over the dimensions of a collapsed chain of nested vectors,
+// with leafcount elements of leaf in the innermost loop
+void codegenVectorNest(llvm::Value *inbuf, llvm::Value *incount,
+                       llvm::Value *outbuf, Datatype *leaf, int leafcount,
+                       const std::vector<int> &counts,
+                       const std::vector<long> &strides,
+                       long extent, bool pack);
 
 void codegenIndexedBlock(llvm::Value *compactbuf, llvm::Value *scatteredbuf,
-                         llvm::Value* incount, int extent, int size,
+                         llvm::Value* incount, long extent, long size,
                          int count, int blocklen, Datatype *basetype,
                          const std::vector<int> &displs,
                          llvm::Value* indices_arr,
                          bool pack);
 
 void codegenHindexed(llvm::Value *compactbuf, llvm::Value *scatteredbuf,
-                     llvm::Value* incount, int extent, int count,
+                     llvm::Value* incount, long extent, int count,
                      Datatype *basetype, const std::vector<int> &blocklens,
-                     const std::vector<long> &displs, bool pack);
+                     const std::vector<long> &displs,
+                     llvm::Value* displs_arr, llvm::Value* blocklens_arr,
+                     bool pack);
 
 void codegenStruct(llvm::Value *compactbuf, llvm::Value *scatteredbuf,
-                   llvm::Value* incount, int extent, int count,
+                   llvm::Value* incount, long extent, int count,
                    const std::vector<int> &blocklens,
                    const std::vector<long> &displs,
                    const std::vector<Datatype*> &basetypes,
+                   llvm::Value* displs_arr, llvm::Value* blocklens_arr,
                    bool pack);
 
+// Whether the gather kernel is used for count blocks of blocklen basetypes
+bool useGather(Datatype *basetype, int blocklen, int count);
+
+// Moves count elements of size bytes between the scattered buffer (an
+// integer address) and the compact one. The elements are stride bytes
+// apart, or at the byte displacements of the table displs_arr if it is not
+// NULL.
+void codegenGather(llvm::Value *scattered, llvm::Value *compact,
+                   llvm::Value *displs_arr, int count, long size, long stride,
+                   bool pack);
+
+llvm::GlobalVariable* codegenBlockTable(llvm::Module *mod, int count,
+                                        const std::vector<int> &blocklens,
+                                        const std::vector<long> &displs,
+                                        bool blocklens_table);
+
 }
 
 #endif // CODEGEN_H
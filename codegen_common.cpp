@@ -6,42 +6,96 @@
 // License. See LICENSE.TXT in the top level directory for details.
 
 #include "codegen_common.hpp"
+#include "codegen.hpp"
 
 #include <cstdio>
+#include <algorithm>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Intrinsics.h>
 
 using namespace llvm;
 
 namespace farc {
 
-IRBuilder<> Builder(getGlobalContext());
+__thread LLVMContext *ThreadContext = NULL;
+__thread IRBuilder<> *Builder = NULL;
+__thread bool StreamStores = false;
+__thread const DDT_Target *CodeTarget = &TheTarget;
 
-Value* multNode(int op1, Value* op2PtrNode) {
+bool hasFeature(const DDT_Target &target, const char *feature) {
+    return std::find(target.features.begin(), target.features.end(),
+                     std::string(feature)) != target.features.end();
+}
+
+Value* multNode(long op1, Value* op2PtrNode) {
     Value* op1Node = constNode((long)op1);
-    Value* op2Node = Builder.CreateIntCast(op2PtrNode, LLVM_INT64, false); 
-    return Builder.CreateMul(op1Node, op2Node);
+    Value* op2Node = Builder->CreateIntCast(op2PtrNode, LLVM_INT64, false); 
+    return Builder->CreateMul(op1Node, op2Node);
 }
 
 ConstantInt* constNode(int val) {
-    return ConstantInt::get(getGlobalContext(), APInt(32, val, false));
+    return ConstantInt::get(getThreadContext(), APInt(32, val, false));
 }
 
 ConstantInt* constNode(long val) {
-    return ConstantInt::get(getGlobalContext(), APInt(64, val, false));
+    return ConstantInt::get(getThreadContext(), APInt(64, val, false));
 }
 
-void vmove(Value *dst, Value *src, int count, Type *elemtype) {
-	Type *elemvectype_ptr = PointerType::getUnqual(VectorType::get(elemtype, count));
-	Value *in_vec = Builder.CreateBitCast(src, elemvectype_ptr, "in2_addr_vec");
-	Value *out_vec = Builder.CreateBitCast(dst, elemvectype_ptr, "out2_addr_vec");
-	Value *elems = Builder.CreateAlignedLoad(in_vec, 1, "elems");
-	Builder.CreateAlignedStore(elems, out_vec, 1);
+void vmove(Value *dst, Value *src, int count, Type *elemtype, int align, int srcalign) {
+	int bytes = count * elemtype->getPrimitiveSizeInBits() / 8;
+	Type *movetype = VectorType::get(elemtype, count);
+
+	// Non-temporal vector stores need an aligned destination, 4 and 8 byte
+	// stores (movnti) do not
+	bool stream = StreamStores && (align >= bytes || bytes == 4 || bytes == 8);
+	if (stream && align < bytes) movetype = Type::getIntNTy(getThreadContext(), 8 * bytes);
+
+	Type *elemvectype_ptr = PointerType::getUnqual(movetype);
+	Value *in_vec = Builder->CreateBitCast(src, elemvectype_ptr, "in2_addr_vec");
+	Value *out_vec = Builder->CreateBitCast(dst, elemvectype_ptr, "out2_addr_vec");
+	Value *elems = Builder->CreateAlignedLoad(in_vec, srcalign, "elems");
+	StoreInst *store = Builder->CreateAlignedStore(elems, out_vec, align);
+	if (stream) {
+		Value *one = ConstantInt::get(LLVM_INT32, 1);
+		store->setMetadata(getThreadContext().getMDKindID("nontemporal"),
+		                   MDNode::get(getThreadContext(), one));
+	}
 }
 
 Value *incrementPtr(Value *ptr, int byteInc) {
-	Value *addr = Builder.CreatePtrToInt(ptr, LLVM_INT64);
-	Value *newaddr = Builder.CreateAdd(addr, Builder.getInt64(byteInc));
-	return Builder.CreateIntToPtr(newaddr, LLVM_INT8PTR);
+	Value *addr = Builder->CreatePtrToInt(ptr, LLVM_INT64);
+	Value *newaddr = Builder->CreateAdd(addr, Builder->getInt64(byteInc));
+	return Builder->CreateIntToPtr(newaddr, LLVM_INT8PTR);
+}
+
+int prefetchBlocks(long stride, long blockbytes, long count) {
+	long distance = CodeTarget->prefetch_distance;
+	if (stride < 0) stride = -stride;
+	if (distance <= 0 || blockbytes <= 0 || stride < PREFETCH_MIN_STRIDE ||
+	    stride * count < PREFETCH_MIN_EXTENT) {
+		return 0;
+	}
+
+	long blocks = (distance + blockbytes - 1) / blockbytes;
+	return (blocks < PREFETCH_MAX_BLOCKS) ? blocks : PREFETCH_MAX_BLOCKS;
+}
+
+void codegenPrefetch(Value *addr, long blockbytes, bool write) {
+	Module *mod = Builder->GetInsertBlock()->getParent()->getParent();
+	Function *prefetch = Intrinsic::getDeclaration(mod, Intrinsic::prefetch);
+
+	long lines = (blockbytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+	if (lines > PREFETCH_MAX_LINES) lines = PREFETCH_MAX_LINES;
+	for (long l=0; l<lines; l++) {
+		Value *line = Builder->CreateAdd(addr, constNode(l * CACHE_LINE_SIZE));
+		Value *args[] = {Builder->CreateIntToPtr(line, LLVM_INT8PTR),
+		                 constNode((write) ? 1 : 0), // read or write
+		                 constNode(3),               // keep in all levels
+		                 constNode(1)};              // data cache
+		Builder->CreateCall(prefetch, args);
+	}
 }
 
 Type *toLLVMType(PrimitiveDatatype::PrimitiveType type) {
@@ -50,21 +104,15 @@ Type *toLLVMType(PrimitiveDatatype::PrimitiveType type) {
 	case PrimitiveDatatype::DOUBLE:
 		elemtype = LLVM_DOUBLE;
 		break;
-	case PrimitiveDatatype::INT:
-		elemtype = LLVM_INT;
-		break;
 	case PrimitiveDatatype::FLOAT:
 		elemtype = LLVM_FLOAT;
 		break;
-	case PrimitiveDatatype::BYTE:
-		elemtype = LLVM_INT8;
-		break;
-	case PrimitiveDatatype::CHAR:
-		elemtype = LLVM_INT8;
-		break;
 	default:
-		fprintf(stderr, "Type not supported");
-		assert(false);
+		// Everything else is only copied, so an integer of the same
+		// width is as good as the real type (long double and the
+		// complex types included)
+		elemtype = Type::getIntNTy(getThreadContext(),
+		                           8 * PrimitiveDatatype::getTypeSize(type));
 	}
 	assert(elemtype != NULL);
 	return elemtype;
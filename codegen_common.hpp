@@ -14,25 +14,47 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/IRBuilder.h>
 
-#define LLVM_VOID     Type::getVoidTy(getGlobalContext())
-#define LLVM_INT      Type::getInt32Ty(getGlobalContext())
-#define LLVM_INT8     Type::getInt8Ty(getGlobalContext())
-#define LLVM_INT32    Type::getInt32Ty(getGlobalContext())
-#define LLVM_INT64    Type::getInt64Ty(getGlobalContext())
-#define LLVM_INT8PTR  Type::getInt8PtrTy(getGlobalContext())
-#define LLVM_FLOAT    Type::getFloatTy(getGlobalContext())
-#define LLVM_DOUBLE   Type::getDoubleTy(getGlobalContext())
+#define LLVM_VOID     Type::getVoidTy(getThreadContext())
+#define LLVM_INT      Type::getInt32Ty(getThreadContext())
+#define LLVM_INT8     Type::getInt8Ty(getThreadContext())
+#define LLVM_INT32    Type::getInt32Ty(getThreadContext())
+#define LLVM_INT64    Type::getInt64Ty(getThreadContext())
+#define LLVM_INT8PTR  Type::getInt8PtrTy(getThreadContext())
+#define LLVM_FLOAT    Type::getFloatTy(getThreadContext())
+#define LLVM_DOUBLE   Type::getDoubleTy(getThreadContext())
 
 namespace farc {
 
-extern llvm::IRBuilder<> Builder;
+// LLVM contexts can not be used by several threads at once, so every
+// thread that commits datatypes generates code in a context of its own.
+// Both are set up by the JIT before code is generated in a thread.
+extern __thread llvm::LLVMContext *ThreadContext;
+extern __thread llvm::IRBuilder<> *Builder;
 
-llvm::Value* multNode(int op1, llvm::Value* op2PtrNode);
+// Set while the streaming variant of a function is generated, its stores
+// bypass the caches where the target allows it (see vmove)
+extern __thread bool StreamStores;
+
+inline llvm::LLVMContext& getThreadContext() {
+    return *ThreadContext;
+}
+
+llvm::Value* multNode(long op1, llvm::Value* op2PtrNode);
 llvm::ConstantInt* constNode(int val);
 llvm::ConstantInt* constNode(long val);
 
-void vmove(llvm::Value *dst, llvm::Value *src, int count, llvm::Type *elemtype);
+// Moves count elements of elemtype, align and srcalign are the known
+// alignments of dst and src
+void vmove(llvm::Value *dst, llvm::Value *src, int count, llvm::Type *elemtype,
+           int align = 1, int srcalign = 1);
 llvm::Value *incrementPtr(llvm::Value *ptr, int byteInc);
+
+// Number of blocks ahead at which a loop over count blocks of blockbytes,
+// stride bytes apart, prefetches them. 0 if prefetching does not pay off.
+int prefetchBlocks(long stride, long blockbytes, long count);
+
+// Prefetches the first lines of the block at addr (an integer)
+void codegenPrefetch(llvm::Value *addr, long blockbytes, bool write);
 llvm::Type *toLLVMType(PrimitiveDatatype::PrimitiveType type);
 
 }
@@ -0,0 +1,173 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include "codegen.hpp"
+#include "codegen_common.hpp"
+#include "ddt_jit.hpp"
+
+#include <llvm/IR/Value.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Intrinsics.h>
+#include <algorithm>
+
+using namespace llvm;
+
+namespace farc {
+
+bool useGather(Datatype *basetype, int blocklen, int count) {
+    if (blocklen != 1 || basetype->getDatatypeName() != PRIMITIVE) return false;
+    long size = basetype->getSize();
+    return (size == 4 || size == 8) && count >= GATHER_MIN_COUNT;
+}
+
+// Hardware gather of lanes elements of size bytes at the byte offsets
+// from base, NULL if the target has no gather instruction for them
+static Value* codegenHardwareGather(Value *base, Value *offsets, int lanes, long size) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (lanes != 4 || !hasFeature(*CodeTarget, "+avx2")) return NULL;
+
+    Module *mod = Builder->GetInsertBlock()->getParent()->getParent();
+    Type *elemtype = (size == 8) ? LLVM_DOUBLE : LLVM_FLOAT;
+    Type *vectype = VectorType::get(elemtype, lanes);
+    Type *masktype = VectorType::get(IntegerType::get(getThreadContext(), 8 * size), lanes);
+    Function *gather = Intrinsic::getDeclaration(mod, (size == 8) ?
+        Intrinsic::x86_avx2_gather_q_pd_256 : Intrinsic::x86_avx2_gather_q_ps_256);
+
+    // All lanes are enabled by the sign bits of the mask, the offsets are
+    // scaled by one since they are in bytes
+    Value *args[] = {Constant::getNullValue(vectype),
+                     Builder->CreateIntToPtr(base, LLVM_INT8PTR),
+                     offsets,
+                     Builder->CreateBitCast(Constant::getAllOnesValue(masktype), vectype),
+                     Builder->getInt8(1)};
+    return Builder->CreateCall(gather, args, "gathered");
+#else
+    return NULL;
+#endif
+}
+
+// Moves the element at the scattered address (an integer) from or to the
+// compact pointer
+static void codegenElement(Value *scattered, Value *compact, Type *elemtype, bool pack) {
+    Type *elemptr = PointerType::getUnqual(elemtype);
+    Value *scatteredptr = Builder->CreateIntToPtr(scattered, elemptr);
+    Value *compactptr = Builder->CreateBitCast(compact, elemptr);
+    if (pack) Builder->CreateAlignedStore(Builder->CreateAlignedLoad(scatteredptr, 1), compactptr, 1);
+    else      Builder->CreateAlignedStore(Builder->CreateAlignedLoad(compactptr, 1), scatteredptr, 1);
+}
+
+void codegenGather(Value *scattered, Value *compact, Value *displs_arr,
+                   int count, long size, long stride, bool pack) {
+    Function *func = Builder->GetInsertBlock()->getParent();
+
+    // Pack uses a gather instruction where the target has one. Otherwise
+    // (and for unpack, without scatter instructions) the elements are
+    // inserted into (extracted from) a vector, so the compact side is
+    // moved with one vector instruction per group.
+    int lanes = (int) std::min(8L, std::max(2L, (long) CodeTarget->simd_bytes / size));
+#if defined(__x86_64__) || defined(__i386__)
+    if (pack && hasFeature(*CodeTarget, "+avx2")) lanes = 4;
+#endif
+    long groups = count / lanes;
+
+    Type *elemtype = IntegerType::get(getThreadContext(), 8 * size);
+    Type *vectype = VectorType::get(elemtype, lanes);
+    Type *offsettype = VectorType::get(LLVM_INT64, lanes);
+
+    if (groups > 0) {
+        BasicBlock *PreheaderBB = Builder->GetInsertBlock();
+        BasicBlock *LoopBB = BasicBlock::Create(getThreadContext(), "gatherloop", func);
+        Builder->CreateBr(LoopBB);
+        Builder->SetInsertPoint(LoopBB);
+
+        PHINode *g = Builder->CreatePHI(LLVM_INT64, 2, "g");
+        g->addIncoming(constNode(0l), PreheaderBB);
+        PHINode *scattered1 = Builder->CreatePHI(LLVM_INT64, 2, "scattered");
+        scattered1->addIncoming(scattered, PreheaderBB);
+        PHINode *compact1 = Builder->CreatePHI(LLVM_INT8PTR, 2, "compact");
+        compact1->addIncoming(compact, PreheaderBB);
+
+        // Byte offsets of the elements of this group, from the table of
+        // displacements or from the stride
+        Value *offsets = NULL;
+        if (displs_arr != NULL) {
+            std::vector<Value*> arrayidx_list;
+            arrayidx_list.push_back(constNode(0l));
+            arrayidx_list.push_back(Builder->CreateMul(g, constNode((long) lanes)));
+            Value *displloc = Builder->CreateGEP(displs_arr, arrayidx_list, "displloc");
+            displloc = Builder->CreateBitCast(displloc, PointerType::getUnqual(offsettype));
+            offsets = Builder->CreateAlignedLoad(displloc, 8, "offsets");
+        }
+        else {
+            std::vector<Constant*> strides;
+            for (int k=0; k<lanes; k++) strides.push_back(constNode(k * stride));
+            offsets = ConstantVector::get(strides);
+        }
+
+        Value *compactvec = Builder->CreateBitCast(compact1, PointerType::getUnqual(vectype));
+        Value *gathered = (pack) ? codegenHardwareGather(scattered1, offsets, lanes, size) : NULL;
+        if (gathered != NULL) {
+            compactvec = Builder->CreateBitCast(compact1, PointerType::getUnqual(gathered->getType()));
+            Builder->CreateAlignedStore(gathered, compactvec, 1);
+        }
+        else {
+            Value *vec = (pack) ? UndefValue::get(vectype)
+                                : Builder->CreateAlignedLoad(compactvec, 1, "elems");
+            Type *elemptr = PointerType::getUnqual(elemtype);
+            for (int k=0; k<lanes; k++) {
+                Value *offset = Builder->CreateExtractElement(offsets, constNode(k));
+                Value *addr = Builder->CreateIntToPtr(Builder->CreateAdd(scattered1, offset), elemptr);
+                if (pack) {
+                    Value *elem = Builder->CreateAlignedLoad(addr, 1);
+                    vec = Builder->CreateInsertElement(vec, elem, constNode(k));
+                }
+                else {
+                    Builder->CreateAlignedStore(Builder->CreateExtractElement(vec, constNode(k)), addr, 1);
+                }
+            }
+            if (pack) Builder->CreateAlignedStore(vec, compactvec, 1);
+        }
+
+        // With a table the scattered base stays, the offsets advance
+        Value *nextscattered = (displs_arr != NULL) ? (Value*) scattered1
+            : Builder->CreateAdd(scattered1, constNode(lanes * stride));
+        Value *nextcompact = incrementPtr(compact1, lanes * size);
+        Value *nextg = Builder->CreateAdd(g, constNode(1l), "nextg");
+        Value *EndCond = Builder->CreateICmpEQ(nextg, constNode(groups), "gathercond");
+
+        BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+        BasicBlock *AfterBB = BasicBlock::Create(getThreadContext(), "aftergather", func);
+        Builder->CreateCondBr(EndCond, AfterBB, LoopBB);
+        Builder->SetInsertPoint(AfterBB);
+
+        g->addIncoming(nextg, LoopEndBB);
+        scattered1->addIncoming(nextscattered, LoopEndBB);
+        compact1->addIncoming(nextcompact, LoopEndBB);
+
+        scattered = nextscattered;
+        compact = nextcompact;
+    }
+
+    // The elements which do not fill a group
+    for (long k=groups*lanes; k<count; k++) {
+        Value *addr;
+        if (displs_arr != NULL) {
+            std::vector<Value*> arrayidx_list;
+            arrayidx_list.push_back(constNode(0l));
+            arrayidx_list.push_back(constNode(k));
+            Value *displ = Builder->CreateLoad(Builder->CreateGEP(displs_arr, arrayidx_list), "displ");
+            addr = Builder->CreateAdd(scattered, displ);
+        }
+        else {
+            addr = Builder->CreateAdd(scattered, constNode((k - groups*lanes) * stride));
+        }
+        codegenElement(addr, compact, elemtype, pack);
+        compact = incrementPtr(compact, size);
+    }
+}
+
+}
@@ -10,146 +10,272 @@
 #include "ddt_jit.hpp"
 
 #include <llvm/IR/Value.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <string>
 
 using namespace llvm;
 using namespace std;
 
 namespace farc {
 
+static int nonemptyBlocks(const vector<int> &blocklens, int first, int last) {
+    int n = 0;
+    for (int i=first; i<last; i++) {
+        if (blocklens[i] != 0) n++;
+    }
+    return n;
+}
+
+// Creates a constant table with the displacements (or the blocklens) of the
+// non-empty blocks of a hindexed or struct type
+GlobalVariable* codegenBlockTable(Module *mod, int count,
+                                  const vector<int> &blocklens,
+                                  const vector<long> &displs,
+                                  bool blocklens_table) {
+    std::vector<Constant*> vals;
+    for (int i=0; i<count; i++) {
+        if (blocklens[i] == 0) continue;
+        if (blocklens_table) vals.push_back(constNode(blocklens[i]));
+        else                 vals.push_back(constNode(displs[i]));
+    }
+
+    Type* elemtype = (blocklens_table) ? LLVM_INT32 : LLVM_INT64;
+    ArrayType* table_type = ArrayType::get(elemtype, vals.size());
+    GlobalVariable* table = new GlobalVariable(*mod, table_type, true,
+                                               GlobalValue::InternalLinkage,
+                                               0, (blocklens_table) ? "blocklens" : "displacements");
+    table->setAlignment((blocklens_table) ? 4 : 8);
+    table->setInitializer(ConstantArray::get(table_type, vals));
+    return table;
+}
+
+// Loops over the entries [first, first+n) of the block tables, which all
+// have the same basetype. The compact address is returned as an integer,
+// like it is passed in.
+static Value* codegenBlockLoop(Value* compact_addr, Value* scattered_base, Datatype* basetype,
+                               Value* displs_arr, Value* blocklens_arr, int first, int n,
+                               bool pack) {
+    if (n == 0) return compact_addr;
+
+    Function* func = Builder->GetInsertBlock()->getParent();
+
+    BasicBlock* PreheaderBB = Builder->GetInsertBlock();
+    BasicBlock* LoopBB = BasicBlock::Create(getThreadContext(), "blockloop", func);
+    Builder->CreateBr(LoopBB);
+    Builder->SetInsertPoint(LoopBB);
+
+    PHINode* j = Builder->CreatePHI(LLVM_INT64, 2, "j");
+    j->addIncoming(constNode((long)first), PreheaderBB);
+    PHINode* compact = Builder->CreatePHI(LLVM_INT64, 2, "compact");
+    compact->addIncoming(compact_addr, PreheaderBB);
+
+    std::vector<Value*> arrayidx_list;
+    arrayidx_list.push_back(constNode((long)0));
+    arrayidx_list.push_back(j);
+    Value* displloc = Builder->CreateGEP(displs_arr, arrayidx_list, "displloc");
+    Value* displ = Builder->CreateLoad(displloc, "displ");
+    Value* blocklenloc = Builder->CreateGEP(blocklens_arr, arrayidx_list, "blocklenloc");
+    Value* blocklen = Builder->CreateLoad(blocklenloc, "blocklen");
+
+    Value* scattered = Builder->CreateIntToPtr(Builder->CreateAdd(scattered_base, displ), LLVM_INT8PTR);
+    Value* compactptr = Builder->CreateIntToPtr(compact, LLVM_INT8PTR);
+
+    if (pack) basetype->packCodegen(scattered, blocklen, compactptr);
+    else      basetype->unpackCodegen(compactptr, blocklen, scattered);
+
+    // Increment the compact ptr by Size(Basetype) * Blocklen
+    Value* blocklen64 = Builder->CreateZExt(blocklen, LLVM_INT64);
+    Value* compact_bytes = Builder->CreateMul(blocklen64, constNode((long)basetype->getSize()));
+    Value* nextcompact = Builder->CreateAdd(compact, compact_bytes, "nextcompact");
+    Value* nextj = Builder->CreateAdd(j, constNode((long)1), "nextj");
+    Value* EndCond = Builder->CreateICmpEQ(nextj, constNode((long)(first + n)), "blockloopcond");
+
+    // The basetype may have added blocks of its own
+    BasicBlock* LoopEndBB = Builder->GetInsertBlock();
+    BasicBlock* AfterBB = BasicBlock::Create(getThreadContext(), "afterblockloop", func);
+
+    Builder->CreateCondBr(EndCond, AfterBB, LoopBB);
+    Builder->SetInsertPoint(AfterBB);
+
+    j->addIncoming(nextj, LoopEndBB);
+    compact->addIncoming(nextcompact, LoopEndBB);
+
+    return nextcompact;
+}
+
 void codegenIndexedBlock(Value *compactbuf, Value *scatteredbuf, Value* incount,
-                         int extent, int size, int count, int blocklen, Datatype *basetype,
+                         long extent, long size, int count, int blocklen, Datatype *basetype,
                          const vector<int> &displs, Value* indices_arr,
                          bool pack) {
-    Function* func = Builder.GetInsertBlock()->getParent();
+    Function* func = Builder->GetInsertBlock()->getParent();
 
-    if (count > IDXB_LOOP_TRESHOLD) {
+    // The blocks are prefetched if they are far apart on average
+    long blockbytes = (long) blocklen * basetype->getSize();
+    long span = 0;
+    for (int k=1; k<count; k++) {
+        span += labs((long) (displs[k] - displs[k-1]) * basetype->getExtent());
+    }
+    int ahead = (count > 1) ? prefetchBlocks(span / (count - 1), blockbytes, count) : 0;
+
+    if (count > CodeTarget->idxb_treshold) {
         // Entry block
-        BasicBlock* preamble = Builder.GetInsertBlock();
-        Value* noncontig = Builder.CreatePtrToInt(scatteredbuf, LLVM_INT64);
+        BasicBlock* preamble = Builder->GetInsertBlock();
+        Value* noncontig = Builder->CreatePtrToInt(scatteredbuf, LLVM_INT64);
         noncontig->setName("noncontig");
-        Value* contig = Builder.CreatePtrToInt(compactbuf, LLVM_INT64);
+        Value* contig = Builder->CreatePtrToInt(compactbuf, LLVM_INT64);
         contig->setName("contig");
 
-        Value* incount64   = Builder.CreateZExt(incount, LLVM_INT64, "count64");
-        Value* bytestocopy = Builder.CreateMul(incount64, constNode((long)size), "bytestocopy");
-        Value* exitcond = Builder.CreateAdd(contig, bytestocopy, "exitcond");
+        Value* incount64   = Builder->CreateZExt(incount, LLVM_INT64, "count64");
+        Value* bytestocopy = Builder->CreateMul(incount64, constNode((long)size), "bytestocopy");
+        Value* exitcond = Builder->CreateAdd(contig, bytestocopy, "exitcond");
 
         // Outer loop
-        BasicBlock* outerloop = BasicBlock::Create(getGlobalContext(), "outerloop", func);
-        Builder.CreateBr(outerloop);
-        Builder.SetInsertPoint(outerloop);
+        BasicBlock* outerloop = BasicBlock::Create(getThreadContext(), "outerloop", func);
+        Builder->CreateBr(outerloop);
+        Builder->SetInsertPoint(outerloop);
         
-        PHINode* contig1 = Builder.CreatePHI(LLVM_INT64, 2, "contig1");
+        PHINode* contig1 = Builder->CreatePHI(LLVM_INT64, 2, "contig1");
         contig1->addIncoming(contig, preamble);
-        PHINode* noncontig1 = Builder.CreatePHI(LLVM_INT64, 2, "noncontig1");
+        PHINode* noncontig1 = Builder->CreatePHI(LLVM_INT64, 2, "noncontig1");
         noncontig1->addIncoming(noncontig, preamble);
 
-        // Inner loop
-        BasicBlock *innerloop = BasicBlock::Create(getGlobalContext(), "innerloop", func);
-        Builder.CreateBr(innerloop);
-        Builder.SetInsertPoint(innerloop);
-
-        PHINode *i = Builder.CreatePHI(LLVM_INT64, 2, "i");
-        i->addIncoming(constNode((long)0), outerloop);
-        PHINode* contig2 = Builder.CreatePHI(LLVM_INT64, 2, "contig2");
-        contig2->addIncoming(contig1, outerloop);                
-
-        Value* nextcontig2 = contig2;
-        Value* nexti = i;
-        for (int j=0; j<IDXB_LOOP_UNROLL; j++) {
-            std::vector<Value*> arrayidx_list;
-            arrayidx_list.push_back(constNode((long)0));
-            arrayidx_list.push_back(nexti);
-            Value* displloc = Builder.CreateGEP(indices_arr, arrayidx_list, "displloc");
-            Value* displ = Builder.CreateLoad(displloc, "displ");
-            Value* displ64 = Builder.CreateZExt(displ, LLVM_INT64, "displ64");
-            Value *noncontig2 = Builder.CreateAdd(noncontig1, displ64, "noncontig2");
-
-            Value* contig2ptr = Builder.CreateIntToPtr(nextcontig2, LLVM_INT8PTR, "contig2ptr");
-            Value* noncontig2ptr = Builder.CreateIntToPtr(noncontig2, LLVM_INT8PTR, "noncontig2ptr");
-
-            if (pack) basetype->packCodegen(noncontig2ptr, constNode(blocklen), contig2ptr);
-            else      basetype->unpackCodegen(contig2ptr, constNode(blocklen), noncontig2ptr);
-
-            nextcontig2 =
-                Builder.CreateAdd(nextcontig2, constNode((long)blocklen*basetype->getExtent()), "nextcontig2");
-            nexti = Builder.CreateAdd(nexti, constNode((long)1), "nexti");
+        Value* nextcontig2 = NULL;
+        if (useGather(basetype, blocklen, count)) {
+            // Single elements, the whole inner loop is one gather kernel
+            codegenGather(noncontig1, Builder->CreateIntToPtr(contig1, LLVM_INT8PTR), indices_arr,
+                          count, basetype->getSize(), 0, pack);
+            nextcontig2 = Builder->CreateAdd(contig1, constNode(count * blockbytes), "nextcontig2");
         }
-
-        contig2->addIncoming(nextcontig2, innerloop);
-        i->addIncoming(nexti, innerloop);
+        else {
+            // Inner loop
+            BasicBlock *innerloop = BasicBlock::Create(getThreadContext(), "innerloop", func);
+            Builder->CreateBr(innerloop);
+            Builder->SetInsertPoint(innerloop);
+
+            PHINode *i = Builder->CreatePHI(LLVM_INT64, 2, "i");
+            i->addIncoming(constNode((long)0), outerloop);
+            PHINode* contig2 = Builder->CreatePHI(LLVM_INT64, 2, "contig2");
+            contig2->addIncoming(contig1, outerloop);                
+
+            // The loop exits after a whole iteration, so the unroll
+            // factor has to divide the number of blocks
+            int unroll = CodeTarget->idxb_unroll;
+            if (count % unroll != 0) unroll = 1;
+
+            nextcontig2 = contig2;
+            Value* nexti = i;
+            for (int j=0; j<unroll; j++) {
+                std::vector<Value*> arrayidx_list;
+                arrayidx_list.push_back(constNode((long)0));
+                arrayidx_list.push_back(nexti);
+                Value* displloc = Builder->CreateGEP(indices_arr, arrayidx_list, "displloc");
+                Value* displ = Builder->CreateLoad(displloc, "displ");
+                Value* displ64 = Builder->CreateSExt(displ, LLVM_INT64, "displ64");
+                Value *noncontig2 = Builder->CreateAdd(noncontig1, displ64, "noncontig2");
+
+                if (ahead > 0) {
+                    // Stay within the displacement table
+                    Value* aheadidx = Builder->CreateAdd(nexti, constNode((long)ahead));
+                    Value* inrange = Builder->CreateICmpULT(aheadidx, constNode((long)count));
+                    arrayidx_list[1] = Builder->CreateSelect(inrange, aheadidx, constNode((long)count - 1));
+                    Value* aheadloc = Builder->CreateGEP(indices_arr, arrayidx_list, "aheadloc");
+                    Value* aheaddispl = Builder->CreateLoad(aheadloc, "aheaddispl");
+                    codegenPrefetch(Builder->CreateAdd(noncontig1, aheaddispl), blockbytes, !pack);
+                }
+
+                Value* contig2ptr = Builder->CreateIntToPtr(nextcontig2, LLVM_INT8PTR, "contig2ptr");
+                Value* noncontig2ptr = Builder->CreateIntToPtr(noncontig2, LLVM_INT8PTR, "noncontig2ptr");
+
+                if (pack) basetype->packCodegen(noncontig2ptr, constNode(blocklen), contig2ptr);
+                else      basetype->unpackCodegen(contig2ptr, constNode(blocklen), noncontig2ptr);
+
+                nextcontig2 =
+                    Builder->CreateAdd(nextcontig2, constNode((long)blocklen*basetype->getSize()), "nextcontig2");
+                nexti = Builder->CreateAdd(nexti, constNode((long)1), "nexti");
+            }
+
+            contig2->addIncoming(nextcontig2, innerloop);
+            i->addIncoming(nexti, innerloop);
                 
-        Value* innertest =
-            Builder.CreateICmpEQ(nexti, constNode((long)count), "innertest");
-        BasicBlock *innerpost = BasicBlock::Create(getGlobalContext(), "innerpost", func);
-        Builder.CreateCondBr(innertest, innerpost, innerloop);
-        Builder.SetInsertPoint(innerpost);
-        // End of inner loop
+            Value* innertest =
+                Builder->CreateICmpEQ(nexti, constNode((long)count), "innertest");
+            BasicBlock *innerpost = BasicBlock::Create(getThreadContext(), "innerpost", func);
+            Builder->CreateCondBr(innertest, innerpost, innerloop);
+            Builder->SetInsertPoint(innerpost);
+            // End of inner loop
+        }
 
         Value* nextnoncontig1 =
-            Builder.CreateAdd(noncontig1, constNode((long)extent), "nextnoncontig1");
+            Builder->CreateAdd(noncontig1, constNode((long)extent), "nextnoncontig1");
         Value* nextcontig1 = nextcontig2;
-            // Builder.CreateAdd(contig1, constNode((long)size), "nextcontig1");
+            // Builder->CreateAdd(contig1, constNode((long)size), "nextcontig1");
 
-        noncontig1->addIncoming(nextnoncontig1, innerpost);
-        contig1->addIncoming(nextcontig1, innerpost);
+        BasicBlock *outerend = Builder->GetInsertBlock();
+        noncontig1->addIncoming(nextnoncontig1, outerend);
+        contig1->addIncoming(nextcontig1, outerend);
 
-        Value* outertest = Builder.CreateICmpEQ(nextcontig1, exitcond, "outertest");
-        BasicBlock *outerpost = BasicBlock::Create(getGlobalContext(), "outerpost", func);
-        Builder.CreateCondBr(outertest, outerpost, outerloop);
-        Builder.SetInsertPoint(outerpost);
+        Value* outertest = Builder->CreateICmpEQ(nextcontig1, exitcond, "outertest");
+        BasicBlock *outerpost = BasicBlock::Create(getThreadContext(), "outerpost", func);
+        Builder->CreateCondBr(outertest, outerpost, outerloop);
+        Builder->SetInsertPoint(outerpost);
         // End of outer loop
     }
     else {
         // Base address of the input buffer
-        Value* scatteredbuf_orig_int = Builder.CreatePtrToInt(scatteredbuf, LLVM_INT64);
+        Value* scatteredbuf_orig_int = Builder->CreatePtrToInt(scatteredbuf, LLVM_INT64);
         Value* extend = constNode((long)extent);
-        Value* incount_64 = Builder.CreateZExt(incount, LLVM_INT64);
-        Value* incount_expanded = Builder.CreateMul(incount_64, extend);
+        Value* incount_64 = Builder->CreateZExt(incount, LLVM_INT64);
+        Value* incount_expanded = Builder->CreateMul(incount_64, extend);
 
         // Loop
-        BasicBlock* PreheaderBB = Builder.GetInsertBlock();
-        BasicBlock* LoopBB = BasicBlock::Create(getGlobalContext(), "loop", func);
-        Builder.CreateBr(LoopBB);
-        Builder.SetInsertPoint(LoopBB);
+        BasicBlock* PreheaderBB = Builder->GetInsertBlock();
+        BasicBlock* LoopBB = BasicBlock::Create(getThreadContext(), "loop", func);
+        Builder->CreateBr(LoopBB);
+        Builder->SetInsertPoint(LoopBB);
 
-        PHINode *compact = Builder.CreatePHI(LLVM_INT8PTR, 2, "compact");
+        PHINode *compact = Builder->CreatePHI(LLVM_INT8PTR, 2, "compact");
         compact->addIncoming(compactbuf, PreheaderBB);
-        PHINode* i = Builder.CreatePHI(LLVM_INT64, 2, "i");
+        PHINode* i = Builder->CreatePHI(LLVM_INT64, 2, "i");
         i->addIncoming(constNode(0l), PreheaderBB);
 
-        Value* compact_addr = Builder.CreatePtrToInt(compact, LLVM_INT64);
+        Value* compact_addr = Builder->CreatePtrToInt(compact, LLVM_INT64);
 
         // OPT: Make this the loop counter
-        Value* scattered_disp_base = Builder.CreateAdd(scatteredbuf_orig_int, i);
+        Value* scattered_disp_base = Builder->CreateAdd(scatteredbuf_orig_int, i);
 
         Value* nextcompact = compact;
         Value* compact_bytes_to_stride = constNode((long)basetype->getSize() * blocklen);
 
         for (int i=0; i<count; i++) {
-            // Set the scattered ptr to scattered_disp_base + this->Disl[i] * Basetype->size
-            Value* displ_i = constNode((long)displs[i] * basetype->getSize());
-            Value* scattered_disp = Builder.CreateAdd(scattered_disp_base, displ_i);
-            Value* scattered = Builder.CreateIntToPtr(scattered_disp, LLVM_INT8PTR);
+            // Set the scattered ptr to scattered_disp_base + this->Disl[i] * Basetype->extent
+            Value* displ_i = constNode((long)displs[i] * basetype->getExtent());
+            Value* scattered_disp = Builder->CreateAdd(scattered_disp_base, displ_i);
+            Value* scattered = Builder->CreateIntToPtr(scattered_disp, LLVM_INT8PTR);
+
+            if (ahead > 0 && i + ahead < count) {
+                Value* displ_ahead = constNode((long)displs[i + ahead] * basetype->getExtent());
+                codegenPrefetch(Builder->CreateAdd(scattered_disp_base, displ_ahead), blockbytes, !pack);
+            }
 
             if (pack) basetype->packCodegen(scattered, constNode(blocklen), nextcompact);
             else      basetype->unpackCodegen(nextcompact, constNode(blocklen), scattered);
 
             // Increment the compact ptr by Size(Basetype) * Blocklen
-            compact_addr = Builder.CreateAdd(compact_addr, compact_bytes_to_stride);
-            nextcompact = Builder.CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+            compact_addr = Builder->CreateAdd(compact_addr, compact_bytes_to_stride);
+            nextcompact = Builder->CreateIntToPtr(compact_addr, LLVM_INT8PTR);
         }
 
         // Increment the loop index and test for loop exit
-        Value* nexti = Builder.CreateAdd(i, extend, "nexti");
-        Value* EndCond = Builder.CreateICmpEQ(nexti, incount_expanded, "loopcond");
+        Value* nexti = Builder->CreateAdd(i, extend, "nexti");
+        Value* EndCond = Builder->CreateICmpEQ(nexti, incount_expanded, "loopcond");
 
         // Create and branch to the outer loop postamble
-        BasicBlock *LoopEndBB = Builder.GetInsertBlock();
-        BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "afterloop", func);
+        BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+        BasicBlock *AfterBB = BasicBlock::Create(getThreadContext(), "afterloop", func);
 
-        Builder.CreateCondBr(EndCond, AfterBB, LoopBB);
-        Builder.SetInsertPoint(AfterBB);
+        Builder->CreateCondBr(EndCond, AfterBB, LoopBB);
+        Builder->SetInsertPoint(AfterBB);
                             
         // Add backedges for the loop induction variable
         compact->addIncoming(nextcompact, LoopEndBB);
@@ -158,60 +284,69 @@ void codegenIndexedBlock(Value *compactbuf, Value *scatteredbuf, Value* incount,
 }
 
 void codegenHindexed(Value *compactbuf, Value *scatteredbuf, Value* incount,
-                     int extent, int count, Datatype *basetype,
+                     long extent, int count, Datatype *basetype,
                      const vector<int> &blocklens, const vector<long> &displs,
+                     Value* displs_arr, Value* blocklens_arr,
                      bool pack) {
 
-    Function* func = Builder.GetInsertBlock()->getParent();
+    Function* func = Builder->GetInsertBlock()->getParent();
 
     // Base address of the input buffer
-    Value* scatteredbuf_orig_int = Builder.CreatePtrToInt(scatteredbuf, LLVM_INT64);
+    Value* scatteredbuf_orig_int = Builder->CreatePtrToInt(scatteredbuf, LLVM_INT64);
     Value* extend = constNode((long)extent);
-    Value* incount_64 = Builder.CreateZExt(incount, LLVM_INT64);
-    Value* incount_expanded = Builder.CreateMul(incount_64, extend);
+    Value* incount_64 = Builder->CreateZExt(incount, LLVM_INT64);
+    Value* incount_expanded = Builder->CreateMul(incount_64, extend);
 
     // Loop
-    BasicBlock* PreheaderBB = Builder.GetInsertBlock();
-    BasicBlock* LoopBB = BasicBlock::Create(getGlobalContext(), "loop", func);
-    Builder.CreateBr(LoopBB);
-    Builder.SetInsertPoint(LoopBB);
+    BasicBlock* PreheaderBB = Builder->GetInsertBlock();
+    BasicBlock* LoopBB = BasicBlock::Create(getThreadContext(), "loop", func);
+    Builder->CreateBr(LoopBB);
+    Builder->SetInsertPoint(LoopBB);
 
-    PHINode *compact = Builder.CreatePHI(LLVM_INT8PTR, 2, "compact");
+    PHINode *compact = Builder->CreatePHI(LLVM_INT8PTR, 2, "compact");
     compact->addIncoming(compactbuf, PreheaderBB);
-    PHINode* i = Builder.CreatePHI(LLVM_INT64, 2, "i");
+    PHINode* i = Builder->CreatePHI(LLVM_INT64, 2, "i");
     i->addIncoming(constNode(0l), PreheaderBB);
 
-    Value* compact_addr = Builder.CreatePtrToInt(compact, LLVM_INT64);
+    Value* compact_addr = Builder->CreatePtrToInt(compact, LLVM_INT64);
 
     // OPT: Make this the loop counter
-    Value* scattered_disp_base = Builder.CreateAdd(scatteredbuf_orig_int, i);
+    Value* scattered_disp_base = Builder->CreateAdd(scatteredbuf_orig_int, i);
 
     Value* nextcompact = compact;
-    for (int i=0; i<count; i++) {
-        // Set the scattered ptr to scattered_disp_base + this->Disl[i]
-        Value* displ_i = constNode((long)displs[i]);
-        Value* scattered_disp = Builder.CreateAdd(scattered_disp_base, displ_i);
-        Value* scattered = Builder.CreateIntToPtr(scattered_disp, LLVM_INT8PTR);
-
-        if (pack) basetype->packCodegen(scattered, constNode(blocklens[i]), nextcompact);
-        else      basetype->unpackCodegen(nextcompact, constNode(blocklens[i]), scattered);
-
-        // Increment the compact ptr by Size(Basetype) * Blocklen
-        Value* compact_bytes_to_stride = constNode((long)basetype->getSize() * blocklens[i]);
-        compact_addr = Builder.CreateAdd(compact_addr, compact_bytes_to_stride);
-        nextcompact = Builder.CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+    if (displs_arr != NULL) {
+        compact_addr = codegenBlockLoop(compact_addr, scattered_disp_base, basetype,
+                                        displs_arr, blocklens_arr, 0, nonemptyBlocks(blocklens, 0, count),
+                                        pack);
+        nextcompact = Builder->CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+    }
+    else {
+        for (int i=0; i<count; i++) {
+            // Set the scattered ptr to scattered_disp_base + this->Disl[i]
+            Value* displ_i = constNode((long)displs[i]);
+            Value* scattered_disp = Builder->CreateAdd(scattered_disp_base, displ_i);
+            Value* scattered = Builder->CreateIntToPtr(scattered_disp, LLVM_INT8PTR);
+
+            if (pack) basetype->packCodegen(scattered, constNode(blocklens[i]), nextcompact);
+            else      basetype->unpackCodegen(nextcompact, constNode(blocklens[i]), scattered);
+
+            // Increment the compact ptr by Size(Basetype) * Blocklen
+            Value* compact_bytes_to_stride = constNode((long)basetype->getSize() * blocklens[i]);
+            compact_addr = Builder->CreateAdd(compact_addr, compact_bytes_to_stride);
+            nextcompact = Builder->CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+        }
     }
 
     // Increment the loop index and test for loop exit
-    Value* nexti = Builder.CreateAdd(i, extend, "nexti");
-    Value* EndCond = Builder.CreateICmpEQ(nexti, incount_expanded, "loopcond");
+    Value* nexti = Builder->CreateAdd(i, extend, "nexti");
+    Value* EndCond = Builder->CreateICmpEQ(nexti, incount_expanded, "loopcond");
 
     // Create and branch to the outer loop postamble
-    BasicBlock *LoopEndBB = Builder.GetInsertBlock();
-    BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "afterloop", func);
+    BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+    BasicBlock *AfterBB = BasicBlock::Create(getThreadContext(), "afterloop", func);
 
-    Builder.CreateCondBr(EndCond, AfterBB, LoopBB);
-    Builder.SetInsertPoint(AfterBB);
+    Builder->CreateCondBr(EndCond, AfterBB, LoopBB);
+    Builder->SetInsertPoint(AfterBB);
 
     // Add backedges for the loop induction variable
     compact->addIncoming(nextcompact, LoopEndBB);
@@ -219,63 +354,91 @@ void codegenHindexed(Value *compactbuf, Value *scatteredbuf, Value* incount,
 }
 
 void codegenStruct(Value *compactbuf, Value *scatteredbuf,
-                   Value* incount, int extent, int count,
+                   Value* incount, long extent, int count,
                    const vector<int> &blocklens,
                    const vector<long> &displs,
                    const vector<Datatype*> &basetypes,
+                   Value* displs_arr, Value* blocklens_arr,
                    bool pack) {
 
-    Function* func = Builder.GetInsertBlock()->getParent();
+    Function* func = Builder->GetInsertBlock()->getParent();
 
     // Base address of the input buffer
-    Value* scatteredbuf_orig_int = Builder.CreatePtrToInt(scatteredbuf, LLVM_INT64);
+    Value* scatteredbuf_orig_int = Builder->CreatePtrToInt(scatteredbuf, LLVM_INT64);
     Value* extend = constNode((long)extent);
-    Value* incount_64 = Builder.CreateZExt(incount, LLVM_INT64);
-    Value* incount_expanded = Builder.CreateMul(incount_64, extend);
+    Value* incount_64 = Builder->CreateZExt(incount, LLVM_INT64);
+    Value* incount_expanded = Builder->CreateMul(incount_64, extend);
 
     // Loop
-    BasicBlock* PreheaderBB = Builder.GetInsertBlock();
-    BasicBlock* LoopBB = BasicBlock::Create(getGlobalContext(), "loop", func);
-    Builder.CreateBr(LoopBB);
-    Builder.SetInsertPoint(LoopBB);
+    BasicBlock* PreheaderBB = Builder->GetInsertBlock();
+    BasicBlock* LoopBB = BasicBlock::Create(getThreadContext(), "loop", func);
+    Builder->CreateBr(LoopBB);
+    Builder->SetInsertPoint(LoopBB);
 
-    PHINode *compact = Builder.CreatePHI(LLVM_INT8PTR, 2, "compact");
+    PHINode *compact = Builder->CreatePHI(LLVM_INT8PTR, 2, "compact");
     compact->addIncoming(compactbuf, PreheaderBB);
-    PHINode* i = Builder.CreatePHI(LLVM_INT64, 2, "i");
+    PHINode* i = Builder->CreatePHI(LLVM_INT64, 2, "i");
     i->addIncoming(constNode(0l), PreheaderBB);
 
-    Value* compact_addr = Builder.CreatePtrToInt(compact, LLVM_INT64);
+    Value* compact_addr = Builder->CreatePtrToInt(compact, LLVM_INT64);
 
     // OPT: Make this the loop counter
-    Value* scattered_disp_base = Builder.CreateAdd(scatteredbuf_orig_int, i);
+    Value* scattered_disp_base = Builder->CreateAdd(scatteredbuf_orig_int, i);
+
+    // Runs of blocks with the same basetype use the tables (which only
+    // contain non-empty blocks) if they are long enough
+    std::vector<std::string> reprs;
+    if (displs_arr != NULL) {
+        for (int i=0; i<count; i++) reprs.push_back(basetypes[i]->toString());
+    }
 
     Value* nextcompact = compact;
-    for (int i=0; i<count; i++) {
-        // Set the scattered ptr to scattered_disp_base + this->Disl[i]
-        Value* displ_i = ConstantInt::get(getGlobalContext(), APInt(64, displs[i], false));
-        Value* scattered_disp = Builder.CreateAdd(scattered_disp_base, displ_i);
-        Value* scattered = Builder.CreateIntToPtr(scattered_disp, LLVM_INT8PTR);
-
-        if (pack) basetypes[i]->packCodegen(scattered, constNode(blocklens[i]), nextcompact);
-        else      basetypes[i]->unpackCodegen(nextcompact, constNode(blocklens[i]), scattered);
-
-        // Increment the compact ptr by Size(Basetype) * Blocklen
-        Value* compact_bytes_to_stride =
-            constNode((long)basetypes[i]->getSize() * blocklens[i]);
-        compact_addr = Builder.CreateAdd(compact_addr, compact_bytes_to_stride);
-        nextcompact = Builder.CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+    int table_idx = 0;
+    for (int i=0; i<count;) {
+        int run_end = i + 1;
+        if (displs_arr != NULL) {
+            while (run_end < count && reprs[run_end] == reprs[i]) run_end++;
+        }
+
+        int nonempty = nonemptyBlocks(blocklens, i, run_end);
+        if (displs_arr != NULL && nonempty >= HIDX_LOOP_TRESHOLD) {
+            compact_addr = codegenBlockLoop(compact_addr, scattered_disp_base, basetypes[i],
+                                            displs_arr, blocklens_arr, table_idx, nonempty, pack);
+            nextcompact = Builder->CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+            table_idx += nonempty;
+            i = run_end;
+            continue;
+        }
+
+        for (; i<run_end; i++) {
+            if (blocklens[i] != 0) table_idx++;
+
+            // Set the scattered ptr to scattered_disp_base + this->Disl[i]
+            Value* displ_i = ConstantInt::get(getThreadContext(), APInt(64, displs[i], false));
+            Value* scattered_disp = Builder->CreateAdd(scattered_disp_base, displ_i);
+            Value* scattered = Builder->CreateIntToPtr(scattered_disp, LLVM_INT8PTR);
+
+            if (pack) basetypes[i]->packCodegen(scattered, constNode(blocklens[i]), nextcompact);
+            else      basetypes[i]->unpackCodegen(nextcompact, constNode(blocklens[i]), scattered);
+
+            // Increment the compact ptr by Size(Basetype) * Blocklen
+            Value* compact_bytes_to_stride =
+                constNode((long)basetypes[i]->getSize() * blocklens[i]);
+            compact_addr = Builder->CreateAdd(compact_addr, compact_bytes_to_stride);
+            nextcompact = Builder->CreateIntToPtr(compact_addr, LLVM_INT8PTR);
+        }
     }
 
     // Increment the loop index and test for loop exit
-    Value* nexti = Builder.CreateAdd(i, extend, "nexti");
-    Value* EndCond = Builder.CreateICmpEQ(nexti, incount_expanded, "loopcond");
+    Value* nexti = Builder->CreateAdd(i, extend, "nexti");
+    Value* EndCond = Builder->CreateICmpEQ(nexti, incount_expanded, "loopcond");
 
     // Create and branch to the outer loop postamble
-    BasicBlock *LoopEndBB = Builder.GetInsertBlock();
-    BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "afterloop", func);
+    BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+    BasicBlock *AfterBB = BasicBlock::Create(getThreadContext(), "afterloop", func);
 
-    Builder.CreateCondBr(EndCond, AfterBB, LoopBB);
-    Builder.SetInsertPoint(AfterBB);
+    Builder->CreateCondBr(EndCond, AfterBB, LoopBB);
+    Builder->SetInsertPoint(AfterBB);
                             
     // Add backedges for the loop induction variable
     compact->addIncoming(nextcompact, LoopEndBB);
@@ -22,117 +22,268 @@ using namespace llvm;
 
 namespace farc {
 
+#if PACKVAR == 1
+// Loop copying vectors_to_copy vectors of vector_size units of the given
+// size, unrolled copy_unroll times. Advances *inbuf and *outbuf past the
+// copied data.
+static void codegenCopyLoop(Value **inbuf, Value **outbuf, long vectors_to_copy,
+                            int vector_size, int copy_unroll, int size,
+                            Type *elemtype) {
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    const long vector_bytes = (long)size * vector_size;
+
+    Value *inbuf_int = Builder->CreatePtrToInt(*inbuf, LLVM_INT64);
+    Value *exitval   = Builder->CreateAdd(inbuf_int, constNode(vectors_to_copy * vector_bytes), "exitval");
+
+    BasicBlock *header = Builder->GetInsertBlock();
+    BasicBlock *copyloop   =
+        BasicBlock::Create(getThreadContext(), "copyloop", TheFunction);
+    Builder->CreateBr(copyloop);
+    Builder->SetInsertPoint(copyloop);
+
+    PHINode *inphi = Builder->CreatePHI(LLVM_INT8PTR, 2, "in3");
+    inphi->addIncoming(*inbuf, header);
+    PHINode *outphi  = Builder->CreatePHI(LLVM_INT8PTR, 2, "out3");
+    outphi->addIncoming(*outbuf, header);
+    Value *in  = inphi;
+    Value *out = outphi;
+
+    Value *in_addr = NULL;
+    for (int i=0; i<copy_unroll; i++) {
+        vmove(out, in, vector_size, elemtype);
+
+        Value *in_addr_cvi = Builder->CreatePtrToInt(in, LLVM_INT64);
+        in_addr = Builder->CreateAdd(in_addr_cvi, Builder->getInt64(vector_bytes));
+        in = Builder->CreateIntToPtr(in_addr, LLVM_INT8PTR);
+
+        out = incrementPtr(out, vector_bytes);
+    }
+
+    inphi->addIncoming(in, copyloop);
+    outphi->addIncoming(out, copyloop);
+
+    // Create and jump to postamble
+    BasicBlock *copypostamble =
+        BasicBlock::Create(getThreadContext(), "copypostamble", TheFunction);
+    Value *exitcond = Builder->CreateICmpEQ(in_addr, exitval);
+    Builder->CreateCondBr(exitcond, copypostamble, copyloop);
+    Builder->SetInsertPoint(copypostamble);
+
+    *inbuf  = in;
+    *outbuf = out;
+}
+
+// Loop moving copy_unroll vectors of simd_bytes per iteration from the
+// address in (an integer) to out until in reaches in_end. The loop of
+// the aligned kernel runs at least once, the tail loop may run zero times.
+static void codegenAlignedLoop(Value *in, Value *out, Value *in_end,
+                               int simd_bytes, int copy_unroll, int srcalign,
+                               bool may_be_empty) {
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    Type *elemtype = LLVM_INT64;
+    const int vector_size = simd_bytes / 8;
+
+    BasicBlock *header = Builder->GetInsertBlock();
+    BasicBlock *loop = BasicBlock::Create(getThreadContext(), "alignedloop", TheFunction);
+    BasicBlock *after = BasicBlock::Create(getThreadContext(), "afteraligned", TheFunction);
+    if (may_be_empty) Builder->CreateCondBr(Builder->CreateICmpEQ(in, in_end), after, loop);
+    else              Builder->CreateBr(loop);
+    Builder->SetInsertPoint(loop);
+
+    PHINode *inphi = Builder->CreatePHI(LLVM_INT64, 2, "alignedin");
+    inphi->addIncoming(in, header);
+    PHINode *outphi = Builder->CreatePHI(LLVM_INT64, 2, "alignedout");
+    outphi->addIncoming(out, header);
+
+    for (int i=0; i<copy_unroll; i++) {
+        Value *src = Builder->CreateIntToPtr(Builder->CreateAdd(inphi, constNode((long)i * simd_bytes)), LLVM_INT8PTR);
+        Value *dst = Builder->CreateIntToPtr(Builder->CreateAdd(outphi, constNode((long)i * simd_bytes)), LLVM_INT8PTR);
+        vmove(dst, src, vector_size, elemtype, simd_bytes, srcalign);
+    }
+
+    Value *nextin = Builder->CreateAdd(inphi, constNode((long)copy_unroll * simd_bytes));
+    Value *nextout = Builder->CreateAdd(outphi, constNode((long)copy_unroll * simd_bytes));
+    inphi->addIncoming(nextin, loop);
+    outphi->addIncoming(nextout, loop);
+    Builder->CreateCondBr(Builder->CreateICmpEQ(nextin, in_end), after, loop);
+    Builder->SetInsertPoint(after);
+}
+
+// Copies bytes bytes (at least copy_unroll + 1 vectors, the number may
+// only be known at runtime) such that the stores of the loops are aligned
+// to simd_bytes. The alignment of the pointers is only known when the
+// function is called: the first vector is stored unaligned, then the copy
+// continues at the next aligned destination address, and the last vector
+// is stored unaligned again. Both overlap the aligned part, which is
+// harmless for a copy. If the source turns out to be aligned as well, a
+// kernel with aligned loads is selected instead.
+static void codegenPeeledCopy(Value *inbuf, Value *outbuf, Value *bytes,
+                              int simd_bytes, int copy_unroll) {
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    Type *elemtype = LLVM_INT64;
+    const int vector_size = simd_bytes / 8;
+    const long chunk = (long)simd_bytes * copy_unroll;
+    Value *mask = constNode((long)simd_bytes - 1);
+
+    // Prologue
+    vmove(outbuf, inbuf, vector_size, elemtype);
+
+    Value *in_int = Builder->CreatePtrToInt(inbuf, LLVM_INT64);
+    Value *out_int = Builder->CreatePtrToInt(outbuf, LLVM_INT64);
+    Value *peel = Builder->CreateAnd(Builder->CreateNeg(out_int), mask, "peel");
+    Value *in_start = Builder->CreateAdd(in_int, peel);
+    Value *out_start = Builder->CreateAdd(out_int, peel);
+    Value *left = Builder->CreateSub(bytes, peel);
+    Value *loop_bytes = Builder->CreateMul(Builder->CreateUDiv(left, constNode(chunk)), constNode(chunk));
+    Value *in_end = Builder->CreateAdd(in_start, loop_bytes);
+
+    // Kernels with aligned and unaligned loads
+    BasicBlock *loadaligned = BasicBlock::Create(getThreadContext(), "loadaligned", TheFunction);
+    BasicBlock *loadunaligned = BasicBlock::Create(getThreadContext(), "loadunaligned", TheFunction);
+    BasicBlock *kerneldone = BasicBlock::Create(getThreadContext(), "kerneldone", TheFunction);
+    Value *relative = Builder->CreateAnd(Builder->CreateXor(in_int, out_int), mask);
+    Builder->CreateCondBr(Builder->CreateICmpEQ(relative, constNode(0L)), loadaligned, loadunaligned);
+
+    Builder->SetInsertPoint(loadaligned);
+    codegenAlignedLoop(in_start, out_start, in_end, simd_bytes, copy_unroll, simd_bytes, false);
+    Builder->CreateBr(kerneldone);
+
+    Builder->SetInsertPoint(loadunaligned);
+    codegenAlignedLoop(in_start, out_start, in_end, simd_bytes, copy_unroll, 1, false);
+    Builder->CreateBr(kerneldone);
+
+    // Less than chunk bytes are left, the whole vectors of them are still
+    // stored aligned
+    Builder->SetInsertPoint(kerneldone);
+    Value *out_end = Builder->CreateAdd(out_start, loop_bytes);
+    Value *tail_bytes = Builder->CreateAnd(Builder->CreateSub(left, loop_bytes),
+                                           constNode(-(long)simd_bytes));
+    codegenAlignedLoop(in_end, out_end, Builder->CreateAdd(in_end, tail_bytes),
+                       simd_bytes, 1, 1, true);
+
+    // Epilogue
+    Value *last = Builder->CreateSub(bytes, constNode((long)simd_bytes));
+    Value *src = Builder->CreateIntToPtr(Builder->CreateAdd(in_int, last), LLVM_INT8PTR);
+    Value *dst = Builder->CreateIntToPtr(Builder->CreateAdd(out_int, last), LLVM_INT8PTR);
+    vmove(dst, src, vector_size, elemtype);
+}
+
+// Copies a number of bytes only known at runtime with streaming stores,
+// which memcpy does not use. Copies long enough for the peeled kernel use
+// it, so its aligned stores are non-temporal, shorter ones use memcpy.
+static void codegenStreamingCopy(Value *inbuf, Value *outbuf, Value *bytes,
+                                 int simd_bytes, int copy_unroll) {
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
+
+    BasicBlock *peeled = BasicBlock::Create(getThreadContext(), "streampeeled", TheFunction);
+    BasicBlock *small = BasicBlock::Create(getThreadContext(), "streamsmall", TheFunction);
+    BasicBlock *done = BasicBlock::Create(getThreadContext(), "streamdone", TheFunction);
+    Value *minbytes = constNode((long)simd_bytes * (copy_unroll + 1));
+    Builder->CreateCondBr(Builder->CreateICmpSGE(bytes, minbytes), peeled, small);
+
+    Builder->SetInsertPoint(peeled);
+    codegenPeeledCopy(inbuf, outbuf, bytes, simd_bytes, copy_unroll);
+    Builder->CreateBr(done);
+
+    Builder->SetInsertPoint(small);
+    Builder->CreateMemCpy(outbuf, inbuf, bytes, 1);
+    Builder->CreateBr(done);
+
+    Builder->SetInsertPoint(done);
+}
+#endif
+
 void codegenPrimitive(Value* inbuf, Value* incount, Value* outbuf,
                       int size, PrimitiveDatatype::PrimitiveType type) {
-    Function* TheFunction = Builder.GetInsertBlock()->getParent();
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
     llvm::ConstantInt* incount_ci = dyn_cast<llvm::ConstantInt>(incount);
 
-    if (incount_ci == NULL) {
+    // Counts only known at runtime, and targets which prefer the kernel
+    // of the C library, use memcpy, unless the stores have to stream
+    if (incount_ci == NULL || CodeTarget->copy_memcpy) {
         Value* contig_extend = multNode(size, incount);
-        Builder.CreateMemCpy(outbuf, inbuf, contig_extend, 1);
+#if PACKVAR == 1
+        if (StreamStores && CodeTarget->simd_bytes >= 16) {
+            codegenStreamingCopy(inbuf, outbuf, contig_extend,
+                                 CodeTarget->simd_bytes, CodeTarget->copy_unroll);
+        }
+        else
+#endif
+        Builder->CreateMemCpy(outbuf, inbuf, contig_extend, 1);
     }
     else {
             
 #if PACKVAR == 1 // Unaligned loads and stores
         // Kernel that performs unaligned memcopies using vector
         // instructions.  The kernel copies as many elements as
-        // possible using vector instructions of a size specified by
-        // SIMD_BYTE_SIZE in a loop that is unrolled COPY_LOOP_UNROLL
-        // times.
+        // possible using vector instructions of simd_bytes bytes in a
+        // loop that is unrolled copy_unroll times.
         //
         // If the size of the elements is not divisible by
-        // SIMD_BYTE_SIZE then the overflow elements are copied using
+        // simd_bytes then the overflow elements are copied using
         // succesively smaller pow-of-two sized vector instructions in
         // a postamble until all are copied.
         //
         // If the number of bytes to copy is less than
-        // COPY_LOOP_TRESHOLD then the code skips the loop creating
+        // copy_treshold then the code skips the loop creating
         // all-together and falls through to the postamble generator,
         // which produces fully unrolled code.
-
-        // This should be a power of two (on kepler performance is bad
-        // with 32-byte simd)
-        #ifndef SIMD_BYTE_SIZE
-        #define SIMD_BYTE_SIZE 16
-        #endif
-
-        // Number of bytes to allow before introducing a loop.
-        // Tip: Make this 4*8 times larger than COPY_LOOP_UNROLL for
-        // smooth double performance
-        #ifndef COPY_LOOP_TRESHOLD
-        #define COPY_LOOP_TRESHOLD 64*8
-        #endif
-
-        // Number of times to unroll the copy loop
-        #ifndef COPY_LOOP_UNROLL
-        #define COPY_LOOP_UNROLL 16
-        #endif
-
-        const int LOOP_ELEM_TRESHOLD = COPY_LOOP_TRESHOLD / size;
-        const int vector_size = SIMD_BYTE_SIZE / size;
+        //
+        // Copies of at least copy_unroll + 1 vectors check the alignment
+        // of the pointers when called and peel a prologue, so the loop
+        // stores aligned vectors (see codegenPeeledCopy). For pack these
+        // are the stores into the compact buffer.
+        //
+        // The three parameters are chosen for the host cpu, see
+        // DDT_Target.
+        const int simd_bytes = CodeTarget->simd_bytes;
+        const int copy_unroll = CodeTarget->copy_unroll;
+        const int copy_treshold = CodeTarget->copy_treshold;
+
+        // Elements are moved in units of the largest power of two which
+        // divides their size and fits into a vector, so elements wider
+        // than simd_bytes (long double complex) are copied as several
+        // integers of vector width
+        int width = size & -size;
+        if (width > simd_bytes) width = simd_bytes;
+        llvm::Type *elemtype = (width == size) ? toLLVMType(type) :
+            Type::getIntNTy(getThreadContext(), 8 * width);
+
+        // Number of units to copy
+        long incount_val = incount_ci->getSExtValue() * (size / width);
+        size = width;
+
+        const int LOOP_ELEM_TRESHOLD = copy_treshold / size;
+        const int vector_size = simd_bytes / size;
 
         // Assert power-of-two
-        assert((SIMD_BYTE_SIZE & (SIMD_BYTE_SIZE-1)) == 0);
+        assert((simd_bytes & (simd_bytes-1)) == 0);
         assert((vector_size & (vector_size-1)) == 0);
 
-        assert((SIMD_BYTE_SIZE % size) == 0);
-
-        llvm::Type *elemtype = toLLVMType(type);
-
-        // Number of elements to copy
-        int incount_val = incount_ci->getSExtValue();
-
         // Trunk to a multiple of the unroll factor
-        const int vectors_to_copy =
-            ((incount_val / vector_size) / COPY_LOOP_UNROLL) * COPY_LOOP_UNROLL;
+        const long vectors_to_copy =
+            ((incount_val / vector_size) / copy_unroll) * copy_unroll;
 
         // Copy vectors_to_copy vectors of size vecsize.
         // If the number of values is less than the LOOP_ELEM_TRESHOLD
         // treshold then we fall through to the postamble and unroll
         // everything
         if (vectors_to_copy > 0 && incount_val >= LOOP_ELEM_TRESHOLD) {
-            Value *inbuf_int = Builder.CreatePtrToInt(inbuf, LLVM_INT64);
-            Value *exitval   = Builder.CreateAdd(inbuf_int, constNode((long)vectors_to_copy * SIMD_BYTE_SIZE), "exitval");
-
-            BasicBlock *header = Builder.GetInsertBlock();
-            BasicBlock *copyloop   =
-                BasicBlock::Create(getGlobalContext(), "copyloop", TheFunction);
-            Builder.CreateBr(copyloop);
-            Builder.SetInsertPoint(copyloop);
-
-            PHINode *inphi = Builder.CreatePHI(LLVM_INT8PTR, 2, "in3");
-            inphi->addIncoming(inbuf, header);
-            PHINode *outphi  = Builder.CreatePHI(LLVM_INT8PTR, 2, "out3");
-            outphi->addIncoming(outbuf, header);
-            inbuf  = inphi;
-            outbuf = outphi;
-
-            Value *in_addr = NULL;
-            for (int i=0; i<COPY_LOOP_UNROLL; i++) {
-                vmove(outbuf, inbuf, vector_size, elemtype);
-
-                Value *in_addr_cvi = Builder.CreatePtrToInt(inbuf, LLVM_INT64);
-                in_addr = Builder.CreateAdd(in_addr_cvi, Builder.getInt64(size * vector_size));
-                inbuf = Builder.CreateIntToPtr(in_addr, LLVM_INT8PTR);
-
-                outbuf = incrementPtr(outbuf, size * vector_size);
+            const long bytes = incount_val * size;
+            if (simd_bytes >= 16 && bytes >= (long)simd_bytes * (copy_unroll + 1)) {
+                codegenPeeledCopy(inbuf, outbuf, constNode(bytes), simd_bytes, copy_unroll);
+                incount_val = 0;
+            }
+            else {
+                codegenCopyLoop(&inbuf, &outbuf, vectors_to_copy, vector_size,
+                                copy_unroll, size, elemtype);
+                incount_val -= vectors_to_copy * vector_size;
             }
-            incount_val -= vectors_to_copy * vector_size;
-
-            inphi->addIncoming(inbuf, copyloop);
-            outphi->addIncoming(outbuf, copyloop);
-
-            // Create and jump to postamble
-            BasicBlock *copypostamble =
-                BasicBlock::Create(getGlobalContext(), "copypostamble", TheFunction);
-            Value *exitcond = Builder.CreateICmpEQ(in_addr, exitval);
-            Builder.CreateCondBr(exitcond, copypostamble, copyloop);
-            Builder.SetInsertPoint(copypostamble);
         }
 
         // Copy postamble: copy the overflow elements that did not fit in full vector
         for (int vecsize=vector_size; vecsize > 0; vecsize /= 2) {
-            const int veccount = incount_val / vecsize;
+            const long veccount = incount_val / vecsize;
             for (int i=0; i<veccount; i++) {
                 vmove(outbuf, inbuf, vecsize, elemtype);
                 inbuf  = incrementPtr(inbuf, size * vecsize);
@@ -142,9 +293,9 @@ void codegenPrimitive(Value* inbuf, Value* incount, Value* outbuf,
         }
 #elif PACKVAR == 2 // memcopy
         Value* contig_extend = multNode(this->getSize(), incount);
-        Value* memcopy = Builder.CreateMemCpy(outbuf, inbuf, contig_extend, 1);
+        Value* memcopy = Builder->CreateMemCpy(outbuf, inbuf, contig_extend, 1);
 #elif PACKVAR == 3// aligned loads and stores
-        int size_to_pack = this->getSize() * incount_ci->getSExtValue();
+        long size_to_pack = this->getSize() * incount_ci->getSExtValue();
 
         // if we know (at compile time) there are only few bytes (not enough for vector insts), just codegen/unroll unaligned instructions to copy them
         if ((size_to_pack < 16) || ((size_to_pack < 32) && (size_to_pack & ~15))) {
@@ -155,19 +306,19 @@ void codegenPrimitive(Value* inbuf, Value* incount, Value* outbuf,
                 else pack_now = 1;
 
                 // copy packed bytes
-                llvm::Type* vectypeptr = PointerType::getUnqual(VectorType::get(Type::getInt8Ty(getGlobalContext()), pack_now));
-                Value* out_vec = Builder.CreateBitCast(outbuf, vectypeptr, "smallcopy_out_vec");
-                Value* in_vec = Builder.CreateBitCast(inbuf, vectypeptr, "smallcopy_in_vec");
-                Value* bytes = Builder.CreateLoad(in_vec, "bytes");
-                Builder.CreateStore(bytes, out_vec);
+                llvm::Type* vectypeptr = PointerType::getUnqual(VectorType::get(Type::getInt8Ty(getThreadContext()), pack_now));
+                Value* out_vec = Builder->CreateBitCast(outbuf, vectypeptr, "smallcopy_out_vec");
+                Value* in_vec = Builder->CreateBitCast(inbuf, vectypeptr, "smallcopy_in_vec");
+                Value* bytes = Builder->CreateLoad(in_vec, "bytes");
+                Builder->CreateStore(bytes, out_vec);
 
                 //increment inbuf and outbuf by "packed"
-                Value* in_addr_cvi = Builder.CreatePtrToInt(inbuf, LLVM_INT64);
-                Value* in_addr = Builder.CreateAdd(in_addr_cvi, Builder.getInt64(pack_now));
-                inbuf = Builder.CreateIntToPtr(in_addr, LLVM_INT8PTR);
-                Value* out_addr_cvi = Builder.CreatePtrToInt(outbuf, LLVM_INT64);
-                Value* out_addr = Builder.CreateAdd(out_addr_cvi,  Builder.getInt64(pack_now));
-                outbuf = Builder.CreateIntToPtr(out_addr, LLVM_INT8PTR);
+                Value* in_addr_cvi = Builder->CreatePtrToInt(inbuf, LLVM_INT64);
+                Value* in_addr = Builder->CreateAdd(in_addr_cvi, Builder->getInt64(pack_now));
+                inbuf = Builder->CreateIntToPtr(in_addr, LLVM_INT8PTR);
+                Value* out_addr_cvi = Builder->CreatePtrToInt(outbuf, LLVM_INT64);
+                Value* out_addr = Builder->CreateAdd(out_addr_cvi,  Builder->getInt64(pack_now));
+                outbuf = Builder->CreateIntToPtr(out_addr, LLVM_INT8PTR);
 
                 size_to_pack -= pack_now;
             }
@@ -179,146 +330,146 @@ void codegenPrimitive(Value* inbuf, Value* incount, Value* outbuf,
 
             Value* size_to_pack = constNode((long) (this->getSize() * incount_ci->getSExtValue()));
 
-            Value* in = Builder.CreatePtrToInt(inbuf, LLVM_INT64);
-            Value* out = Builder.CreatePtrToInt(outbuf, LLVM_INT64);
+            Value* in = Builder->CreatePtrToInt(inbuf, LLVM_INT64);
+            Value* out = Builder->CreatePtrToInt(outbuf, LLVM_INT64);
 
             // loop
-            BasicBlock *Preheader_prefix_BB = Builder.GetInsertBlock();
-            BasicBlock *Condition_prefix_BB = BasicBlock::Create(getGlobalContext(), "prefixcondition", TheFunction);
-            BasicBlock *Loop_prefix_BB = BasicBlock::Create(getGlobalContext(), "prefixloop", TheFunction);
-            BasicBlock *After_prefix_BB = BasicBlock::Create(getGlobalContext(), "afterprefix", TheFunction);
-            Builder.CreateBr(Condition_prefix_BB);
+            BasicBlock *Preheader_prefix_BB = Builder->GetInsertBlock();
+            BasicBlock *Condition_prefix_BB = BasicBlock::Create(getThreadContext(), "prefixcondition", TheFunction);
+            BasicBlock *Loop_prefix_BB = BasicBlock::Create(getThreadContext(), "prefixloop", TheFunction);
+            BasicBlock *After_prefix_BB = BasicBlock::Create(getThreadContext(), "afterprefix", TheFunction);
+            Builder->CreateBr(Condition_prefix_BB);
 
-            Builder.SetInsertPoint(Condition_prefix_BB);
+            Builder->SetInsertPoint(Condition_prefix_BB);
 
             // Induction var phi nodes
-            PHINode *out2 = Builder.CreatePHI(LLVM_INT64, 2, "out2");
+            PHINode *out2 = Builder->CreatePHI(LLVM_INT64, 2, "out2");
             out2->addIncoming(out, Preheader_prefix_BB);
-            PHINode *in2= Builder.CreatePHI(LLVM_INT64, 2, "in2");
+            PHINode *in2= Builder->CreatePHI(LLVM_INT64, 2, "in2");
             in2->addIncoming(in, Preheader_prefix_BB);
-            PHINode *size_to_pack2 = Builder.CreatePHI(LLVM_INT64, 2, "size_to_pack2");
+            PHINode *size_to_pack2 = Builder->CreatePHI(LLVM_INT64, 2, "size_to_pack2");
             size_to_pack2->addIncoming(size_to_pack, Preheader_prefix_BB);
 
-            Value* out_masked = Builder.CreateAnd(out2, constNode(0xFL));
-            Value* StartCond_prefix = Builder.CreateICmpEQ(out_masked, constNode(0L), "prefixstartcond");
-            Builder.CreateCondBr(StartCond_prefix, After_prefix_BB, Loop_prefix_BB);
-            Builder.SetInsertPoint(Loop_prefix_BB);
+            Value* out_masked = Builder->CreateAnd(out2, constNode(0xFL));
+            Value* StartCond_prefix = Builder->CreateICmpEQ(out_masked, constNode(0L), "prefixstartcond");
+            Builder->CreateCondBr(StartCond_prefix, After_prefix_BB, Loop_prefix_BB);
+            Builder->SetInsertPoint(Loop_prefix_BB);
 
             // Cast out2 and in2 to pointers
-            Value* out2_addr = Builder.CreateIntToPtr(out2, LLVM_INT8PTR, "out2_addr");
-            Value* in2_addr = Builder.CreateIntToPtr(in2, LLVM_INT8PTR, "in2_addr");
+            Value* out2_addr = Builder->CreateIntToPtr(out2, LLVM_INT8PTR, "out2_addr");
+            Value* in2_addr = Builder->CreateIntToPtr(in2, LLVM_INT8PTR, "in2_addr");
 
             //load-store
-            Value* byte = Builder.CreateLoad(in2_addr, "byte");
-            Builder.CreateStore(byte, out2_addr);
+            Value* byte = Builder->CreateLoad(in2_addr, "byte");
+            Builder->CreateStore(byte, out2_addr);
 
             // Increment out2 and in2, decrement next_size_to_pack
-            Value* nextout2 = Builder.CreateAdd(out2, constNode(1L), "nextout2");
-            Value* nextin2 = Builder.CreateAdd(in2, constNode(1L), "nextin2");
-            Value* next_size_to_pack = Builder.CreateSub(size_to_pack2, constNode(1L), "next_size_to_pack");
+            Value* nextout2 = Builder->CreateAdd(out2, constNode(1L), "nextout2");
+            Value* nextin2 = Builder->CreateAdd(in2, constNode(1L), "nextin2");
+            Value* next_size_to_pack = Builder->CreateSub(size_to_pack2, constNode(1L), "next_size_to_pack");
 
             // Create and branch to the prefix loop postamble
-            Builder.CreateBr(Condition_prefix_BB);
+            Builder->CreateBr(Condition_prefix_BB);
 
             // Add backedges for the prefix loop induction variables
             out2->addIncoming(nextout2, Loop_prefix_BB);
             in2->addIncoming(nextin2, Loop_prefix_BB);
             size_to_pack2->addIncoming(next_size_to_pack, Loop_prefix_BB);
-            Builder.SetInsertPoint(After_prefix_BB);
+            Builder->SetInsertPoint(After_prefix_BB);
 
            
             // outbuf is now 16byte aligned, copy as much as possible with aligned stores
 
             // loop
-            BasicBlock *Preheader_aligned_BB = Builder.GetInsertBlock();
-            BasicBlock *Condition_aligned_BB = BasicBlock::Create(getGlobalContext(), "alignedcondition", TheFunction);
-            BasicBlock *Loop_aligned_BB = BasicBlock::Create(getGlobalContext(), "alignedloop", TheFunction);
-            BasicBlock *After_aligned_BB = BasicBlock::Create(getGlobalContext(), "afteraligned", TheFunction);
-            Builder.CreateBr(Condition_aligned_BB);
+            BasicBlock *Preheader_aligned_BB = Builder->GetInsertBlock();
+            BasicBlock *Condition_aligned_BB = BasicBlock::Create(getThreadContext(), "alignedcondition", TheFunction);
+            BasicBlock *Loop_aligned_BB = BasicBlock::Create(getThreadContext(), "alignedloop", TheFunction);
+            BasicBlock *After_aligned_BB = BasicBlock::Create(getThreadContext(), "afteraligned", TheFunction);
+            Builder->CreateBr(Condition_aligned_BB);
 
-            Builder.SetInsertPoint(Condition_aligned_BB);
+            Builder->SetInsertPoint(Condition_aligned_BB);
 
             // Induction var phi nodes
-            PHINode *out_aligned_2 = Builder.CreatePHI(LLVM_INT64, 2, "out_aligned_2");
+            PHINode *out_aligned_2 = Builder->CreatePHI(LLVM_INT64, 2, "out_aligned_2");
             out_aligned_2->addIncoming(out2, Preheader_aligned_BB);
-            PHINode *in_aligned_2= Builder.CreatePHI(LLVM_INT64, 2, "in_aligned_2");
+            PHINode *in_aligned_2= Builder->CreatePHI(LLVM_INT64, 2, "in_aligned_2");
             in_aligned_2->addIncoming(in2, Preheader_aligned_BB);
-            PHINode *size_to_pack_aligned_2 = Builder.CreatePHI(LLVM_INT64, 2, "size_to_pack_aligned_2");
+            PHINode *size_to_pack_aligned_2 = Builder->CreatePHI(LLVM_INT64, 2, "size_to_pack_aligned_2");
             size_to_pack_aligned_2->addIncoming(size_to_pack2, Preheader_aligned_BB);
 
-            Value* StartCond_aligned = Builder.CreateICmpULT(size_to_pack_aligned_2, constNode(16L), "alignedstartcond");
-            Builder.CreateCondBr(StartCond_aligned, After_aligned_BB, Loop_aligned_BB);
-            Builder.SetInsertPoint(Loop_aligned_BB);
+            Value* StartCond_aligned = Builder->CreateICmpULT(size_to_pack_aligned_2, constNode(16L), "alignedstartcond");
+            Builder->CreateCondBr(StartCond_aligned, After_aligned_BB, Loop_aligned_BB);
+            Builder->SetInsertPoint(Loop_aligned_BB);
 
             // Cast out_aligned_2 and in_aligned_2 to pointers
-            Value* out_aligned_2_addr = Builder.CreateIntToPtr(out_aligned_2, LLVM_INT8PTR, "out_aligned_2_addr");
-            Value* in_aligned_2_addr = Builder.CreateIntToPtr(in_aligned_2, LLVM_INT8PTR, "in_aligned_2_addr");
+            Value* out_aligned_2_addr = Builder->CreateIntToPtr(out_aligned_2, LLVM_INT8PTR, "out_aligned_2_addr");
+            Value* in_aligned_2_addr = Builder->CreateIntToPtr(in_aligned_2, LLVM_INT8PTR, "in_aligned_2_addr");
 
             //load-store
-            llvm::Type* vectypeptr = PointerType::getUnqual(VectorType::get(Type::getDoubleTy(getGlobalContext()), 2));
-            Value* out_aligned_vec = Builder.CreateBitCast(out_aligned_2_addr, vectypeptr, "out2_addr_vec");
-            Value* in_aligned_vec = Builder.CreateBitCast(in_aligned_2_addr, vectypeptr, "in2_addr_vec");
-            Value* bytes_aligned = Builder.CreateLoad(in_aligned_vec, "bytes_aligned");
-            Builder.CreateAlignedStore(bytes_aligned, out_aligned_vec, 16);
+            llvm::Type* vectypeptr = PointerType::getUnqual(VectorType::get(Type::getDoubleTy(getThreadContext()), 2));
+            Value* out_aligned_vec = Builder->CreateBitCast(out_aligned_2_addr, vectypeptr, "out2_addr_vec");
+            Value* in_aligned_vec = Builder->CreateBitCast(in_aligned_2_addr, vectypeptr, "in2_addr_vec");
+            Value* bytes_aligned = Builder->CreateLoad(in_aligned_vec, "bytes_aligned");
+            Builder->CreateAlignedStore(bytes_aligned, out_aligned_vec, 16);
 
             // Increment out_aligned_2 and in_aligned_2, decrement size_to_pack_aligned_2
-            Value* nextout_aligned_2 = Builder.CreateAdd(out_aligned_2, constNode(16L), "nextout_aligned_2");
-            Value* nextin_aligned_2 = Builder.CreateAdd(in_aligned_2, constNode(16L), "nextin_aligned_2");
-            Value* next_size_to_pack_aligned = Builder.CreateSub(size_to_pack_aligned_2, constNode(16L), "next_size_to_pack_aligned");
+            Value* nextout_aligned_2 = Builder->CreateAdd(out_aligned_2, constNode(16L), "nextout_aligned_2");
+            Value* nextin_aligned_2 = Builder->CreateAdd(in_aligned_2, constNode(16L), "nextin_aligned_2");
+            Value* next_size_to_pack_aligned = Builder->CreateSub(size_to_pack_aligned_2, constNode(16L), "next_size_to_pack_aligned");
 
             // Create and branch to the aligned loop postamble
-            Builder.CreateBr(Condition_aligned_BB);
+            Builder->CreateBr(Condition_aligned_BB);
 
             // Add backedges for the aligned loop induction variables
             out_aligned_2->addIncoming(nextout_aligned_2, Loop_aligned_BB);
             in_aligned_2->addIncoming(nextin_aligned_2, Loop_aligned_BB);
             size_to_pack_aligned_2->addIncoming(next_size_to_pack_aligned, Loop_aligned_BB);
-            Builder.SetInsertPoint(After_aligned_BB);
+            Builder->SetInsertPoint(After_aligned_BB);
 
 
             // copy the remaining bytes in an unaligned manner
 
-            BasicBlock *Preheader_tail_BB = Builder.GetInsertBlock();
-            BasicBlock *Condition_tail_BB = BasicBlock::Create(getGlobalContext(), "tailcondition", TheFunction);
-            BasicBlock *Loop_tail_BB = BasicBlock::Create(getGlobalContext(), "tailloop", TheFunction);
-            BasicBlock *After_tail_BB = BasicBlock::Create(getGlobalContext(), "aftertail", TheFunction);
-            Builder.CreateBr(Condition_tail_BB);
+            BasicBlock *Preheader_tail_BB = Builder->GetInsertBlock();
+            BasicBlock *Condition_tail_BB = BasicBlock::Create(getThreadContext(), "tailcondition", TheFunction);
+            BasicBlock *Loop_tail_BB = BasicBlock::Create(getThreadContext(), "tailloop", TheFunction);
+            BasicBlock *After_tail_BB = BasicBlock::Create(getThreadContext(), "aftertail", TheFunction);
+            Builder->CreateBr(Condition_tail_BB);
 
-            Builder.SetInsertPoint(Condition_tail_BB);
+            Builder->SetInsertPoint(Condition_tail_BB);
 
             // Induction var phi nodes
-            PHINode *out_tail_2 = Builder.CreatePHI(LLVM_INT64, 2, "out_tail_2");
+            PHINode *out_tail_2 = Builder->CreatePHI(LLVM_INT64, 2, "out_tail_2");
             out_tail_2->addIncoming(out_aligned_2, Preheader_tail_BB);
-            PHINode *in_tail_2= Builder.CreatePHI(LLVM_INT64, 2, "in_tail_2");
+            PHINode *in_tail_2= Builder->CreatePHI(LLVM_INT64, 2, "in_tail_2");
             in_tail_2->addIncoming(in_aligned_2, Preheader_tail_BB);
-            PHINode *size_to_pack_tail_2 = Builder.CreatePHI(LLVM_INT64, 2, "size_to_pack_tail_2");
+            PHINode *size_to_pack_tail_2 = Builder->CreatePHI(LLVM_INT64, 2, "size_to_pack_tail_2");
             size_to_pack_tail_2->addIncoming(size_to_pack_aligned_2, Preheader_tail_BB);
 
-            Value* StartCond_tail = Builder.CreateICmpEQ(size_to_pack_tail_2, constNode(0L), "tailstartcond");
-            Builder.CreateCondBr(StartCond_tail, After_tail_BB, Loop_tail_BB);
-            Builder.SetInsertPoint(Loop_tail_BB);
+            Value* StartCond_tail = Builder->CreateICmpEQ(size_to_pack_tail_2, constNode(0L), "tailstartcond");
+            Builder->CreateCondBr(StartCond_tail, After_tail_BB, Loop_tail_BB);
+            Builder->SetInsertPoint(Loop_tail_BB);
 
             // Cast out_tail_2 and in_tail_2 to pointers
-            Value* out_tail_2_addr = Builder.CreateIntToPtr(out_tail_2, LLVM_INT8PTR, "out_tail_2_addr");
-            Value* in_tail_2_addr = Builder.CreateIntToPtr(in_tail_2, LLVM_INT8PTR, "in_tail_2_addr");
+            Value* out_tail_2_addr = Builder->CreateIntToPtr(out_tail_2, LLVM_INT8PTR, "out_tail_2_addr");
+            Value* in_tail_2_addr = Builder->CreateIntToPtr(in_tail_2, LLVM_INT8PTR, "in_tail_2_addr");
 
             //load-store
-            Value* byte_tail = Builder.CreateLoad(in_tail_2_addr, "byte");
-            Builder.CreateStore(byte_tail, out_tail_2_addr);
+            Value* byte_tail = Builder->CreateLoad(in_tail_2_addr, "byte");
+            Builder->CreateStore(byte_tail, out_tail_2_addr);
 
             // Increment out_tail_2 and in_tail_2, decrement size_to_pack_tail_2
-            Value* nextout_tail_2 = Builder.CreateAdd(out_tail_2, constNode(1L), "nextout_tail_2");
-            Value* nextin_tail_2 = Builder.CreateAdd(in_tail_2, constNode(1L), "nextin_tail_2");
-            Value* next_size_to_pack_tail = Builder.CreateSub(size_to_pack_tail_2, constNode(1L), "next_size_to_pack_tail");
+            Value* nextout_tail_2 = Builder->CreateAdd(out_tail_2, constNode(1L), "nextout_tail_2");
+            Value* nextin_tail_2 = Builder->CreateAdd(in_tail_2, constNode(1L), "nextin_tail_2");
+            Value* next_size_to_pack_tail = Builder->CreateSub(size_to_pack_tail_2, constNode(1L), "next_size_to_pack_tail");
 
             // Create and branch to the tail loop postamble
-            Builder.CreateBr(Condition_tail_BB);
+            Builder->CreateBr(Condition_tail_BB);
 
             // Add backedges for the tail loop induction variables
             out_tail_2->addIncoming(nextout_tail_2, Loop_tail_BB);
             in_tail_2->addIncoming(nextin_tail_2, Loop_tail_BB);
             size_to_pack_tail_2->addIncoming(next_size_to_pack_tail, Loop_tail_BB);
-            Builder.SetInsertPoint(After_tail_BB);
+            Builder->SetInsertPoint(After_tail_BB);
 
         }
 #else
@@ -329,38 +480,37 @@ void codegenPrimitive(Value* inbuf, Value* incount, Value* outbuf,
 }
 
 void codegenPrimitiveResized(Value* inbuf, Value* incount, Value* outbuf,
-                      int size, int extent, PrimitiveDatatype::PrimitiveType type) {
+                             long size, long extent, bool pack) {
 
-    Function* TheFunction = Builder.GetInsertBlock()->getParent();
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
 
     // loop over incount
-    BasicBlock *header = Builder.GetInsertBlock();
-    BasicBlock *copyloop = BasicBlock::Create(getGlobalContext(), "copyloop", TheFunction);
-    Builder.CreateBr(copyloop);
-    Builder.SetInsertPoint(copyloop);
-
-    PHINode *inphi = Builder.CreatePHI(LLVM_INT8PTR, 2, "in");
-    PHINode *outphi  = Builder.CreatePHI(LLVM_INT8PTR, 2, "out");
-    PHINode *incntphi  = Builder.CreatePHI(LLVM_INT32, 2, "incntphi");
+    BasicBlock *header = Builder->GetInsertBlock();
+    BasicBlock *copyloop = BasicBlock::Create(getThreadContext(), "copyloop", TheFunction);
+    Builder->CreateBr(copyloop);
+    Builder->SetInsertPoint(copyloop);
+
+    PHINode *inphi = Builder->CreatePHI(LLVM_INT8PTR, 2, "in");
+    PHINode *outphi  = Builder->CreatePHI(LLVM_INT8PTR, 2, "out");
+    PHINode *incntphi  = Builder->CreatePHI(LLVM_INT64, 2, "incntphi");
  
     outphi->addIncoming(outbuf, header);
     inphi->addIncoming(inbuf, header);
-    incntphi->addIncoming(incount, header);
+    incntphi->addIncoming(Builder->CreateZExt(incount, LLVM_INT64), header);
 
-    Builder.CreateMemCpy(outphi, inphi, size, 1);
+    Builder->CreateMemCpy(outphi, inphi, size, 1);
 
-    // inbuf += extent
-    Value* in_addr_cvi = Builder.CreatePtrToInt(inphi, LLVM_INT64);
-    Value* in_addr_cvi_next = Builder.CreateAdd(in_addr_cvi, Builder.getInt64(extent));
-    Value* inbuf_next = Builder.CreateIntToPtr(in_addr_cvi_next, LLVM_INT8PTR);
+    // the scattered buffer advances by extent, the compact one by size
+    Value* in_addr_cvi = Builder->CreatePtrToInt(inphi, LLVM_INT64);
+    Value* in_addr_cvi_next = Builder->CreateAdd(in_addr_cvi, Builder->getInt64(pack ? extent : size));
+    Value* inbuf_next = Builder->CreateIntToPtr(in_addr_cvi_next, LLVM_INT8PTR);
 
-    // outbuf += size
-    Value* out_addr_cvi = Builder.CreatePtrToInt(outphi, LLVM_INT64);
-    Value* out_addr_cvi_next = Builder.CreateAdd(out_addr_cvi, Builder.getInt64(size));
-    Value* outbuf_next = Builder.CreateIntToPtr(out_addr_cvi_next, LLVM_INT8PTR);
+    Value* out_addr_cvi = Builder->CreatePtrToInt(outphi, LLVM_INT64);
+    Value* out_addr_cvi_next = Builder->CreateAdd(out_addr_cvi, Builder->getInt64(pack ? size : extent));
+    Value* outbuf_next = Builder->CreateIntToPtr(out_addr_cvi_next, LLVM_INT8PTR);
 
     // incount -= 1
-    Value* incount_next = Builder.CreateSub(incntphi, Builder.getInt32(1));
+    Value* incount_next = Builder->CreateSub(incntphi, Builder->getInt64(1));
 
 
     inphi->addIncoming(inbuf_next, copyloop);
@@ -369,11 +519,11 @@ void codegenPrimitiveResized(Value* inbuf, Value* incount, Value* outbuf,
 
     // Create and jump to postamble
     BasicBlock *copypostamble =
-        BasicBlock::Create(getGlobalContext(), "copypostamble", TheFunction);
-    Value *exitval = constNode((int) 0);
-    Value *exitcond = Builder.CreateICmpEQ(incount_next, exitval);
-    Builder.CreateCondBr(exitcond, copypostamble, copyloop);
-    Builder.SetInsertPoint(copypostamble);
+        BasicBlock::Create(getThreadContext(), "copypostamble", TheFunction);
+    Value *exitval = constNode(0l);
+    Value *exitcond = Builder->CreateICmpEQ(incount_next, exitval);
+    Builder->CreateCondBr(exitcond, copypostamble, copyloop);
+    Builder->SetInsertPoint(copypostamble);
 
 }
 
@@ -20,8 +20,8 @@ std::vector<llvm::Type*> printf_arg_types;
 printf_arg_types.push_back(LLVM_INT8PTR);
 FunctionType* printf_type = FunctionType::get(LLVM_INT32, printf_arg_types, true);
 Function *func = Function::Create(printf_type, Function::ExternalLinkage, Twine("printf"), TheModule);
-Value *fmt_ptr = Builder.CreateGlobalStringPtr("stride to add: %i\n\0");
-Value *fmt_ptr2 = Builder.CreateGlobalStringPtr("restore stride\n\0");
+Value *fmt_ptr = Builder->CreateGlobalStringPtr("stride to add: %i\n\0");
+Value *fmt_ptr2 = Builder->CreateGlobalStringPtr("restore stride\n\0");
 // now we can print as follows:
 //llvm::CallInst *call = builder.CreateCall2(func, fmt_ptr, ValueToPrint);
 */
@@ -30,106 +30,126 @@ namespace farc {
 
 void codegenVector(Value* inbuf, Value* incount, Value* outbuf,
                    Datatype* basetype, int count, int blocklen,
-                   int elemstride_in, int elemstride_out, 
-                   int extent, int size, bool pack) {
+                   long elemstride_in, long elemstride_out, 
+                   long extent, long size, bool pack) {
 
-    Function *TheFunction = Builder.GetInsertBlock()->getParent();
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    Value* incount64 = Builder->CreateZExt(incount, LLVM_INT64);
 
     // Entry block
-    Value* out = Builder.CreatePtrToInt(outbuf, LLVM_INT64);
+    Value* out = Builder->CreatePtrToInt(outbuf, LLVM_INT64);
     out->setName("out");
-    Value* in = Builder.CreatePtrToInt(inbuf, LLVM_INT64);
+    Value* in = Builder->CreatePtrToInt(inbuf, LLVM_INT64);
     in->setName("in");
 
 
     // Outer loop
-    BasicBlock *Preheader_outer_BB = Builder.GetInsertBlock();
-    BasicBlock *Loop_outer_BB = BasicBlock::Create(getGlobalContext(), "outerloop", TheFunction);
-    Builder.CreateBr(Loop_outer_BB);
-    Builder.SetInsertPoint(Loop_outer_BB);
+    BasicBlock *Preheader_outer_BB = Builder->GetInsertBlock();
+    BasicBlock *Loop_outer_BB = BasicBlock::Create(getThreadContext(), "outerloop", TheFunction);
+    Builder->CreateBr(Loop_outer_BB);
+    Builder->SetInsertPoint(Loop_outer_BB);
 
     // Induction var phi nodes
-    PHINode *out1 = Builder.CreatePHI(LLVM_INT64, 2, "out1");
+    PHINode *out1 = Builder->CreatePHI(LLVM_INT64, 2, "out1");
     out1->addIncoming(out, Preheader_outer_BB);
-    PHINode *in1= Builder.CreatePHI(LLVM_INT64, 2, "in1");
+    PHINode *in1= Builder->CreatePHI(LLVM_INT64, 2, "in1");
     in1->addIncoming(in, Preheader_outer_BB);
-    PHINode *i = Builder.CreatePHI(LLVM_INT32, 2, "i");
-    i->addIncoming(constNode(0), Preheader_outer_BB);
+    PHINode *i = Builder->CreatePHI(LLVM_INT64, 2, "i");
+    i->addIncoming(constNode(0l), Preheader_outer_BB);
     
     // Compute the size of the data written to the out buffer in the inner loop
     Value* nextin1 = NULL;
     Value* nextout1 = NULL;
     if (pack) {
-        nextout1 = Builder.CreateAdd(out1, constNode((long) size));
+        nextout1 = Builder->CreateAdd(out1, constNode((long) size));
 		nextout1->setName("nextout1");
     } 
     else {
-        nextin1 = Builder.CreateAdd(in1, constNode((long) extent));
+        nextin1 = Builder->CreateAdd(in1, constNode((long) extent));
 		nextin1->setName("nextin1");
     }
 
-    // Inner loop
-    BasicBlock *Preheader_inner_BB = Builder.GetInsertBlock();
-    BasicBlock *Loop_inner_BB = BasicBlock::Create(getGlobalContext(), "innerloop", TheFunction);
-    Builder.CreateBr(Loop_inner_BB);
-    Builder.SetInsertPoint(Loop_inner_BB);
+    if (useGather(basetype, blocklen, count)) {
+        // Single elements, the whole inner loop is one gather kernel
+        if (pack) codegenGather(in1, Builder->CreateIntToPtr(out1, LLVM_INT8PTR), NULL,
+                                count, basetype->getSize(), elemstride_in, true);
+        else      codegenGather(out1, Builder->CreateIntToPtr(in1, LLVM_INT8PTR), NULL,
+                                count, basetype->getSize(), elemstride_out, false);
+    }
+    else {
+        // Inner loop
+        BasicBlock *Preheader_inner_BB = Builder->GetInsertBlock();
+        BasicBlock *Loop_inner_BB = BasicBlock::Create(getThreadContext(), "innerloop", TheFunction);
+        Builder->CreateBr(Loop_inner_BB);
+        Builder->SetInsertPoint(Loop_inner_BB);
     
-    // Induction var phi nodes
-    PHINode *out2 = Builder.CreatePHI(LLVM_INT64, 2, "out2");
-    out2->addIncoming(out1, Preheader_inner_BB);
-    PHINode *in2= Builder.CreatePHI(LLVM_INT64, 2, "in2");
-    in2->addIncoming(in1, Preheader_inner_BB);
+        // Induction var phi nodes
+        PHINode *out2 = Builder->CreatePHI(LLVM_INT64, 2, "out2");
+        out2->addIncoming(out1, Preheader_inner_BB);
+        PHINode *in2= Builder->CreatePHI(LLVM_INT64, 2, "in2");
+        in2->addIncoming(in1, Preheader_inner_BB);
     
-    // Cast out2 and in2 to pointers
-    Value* out2_addr = Builder.CreateIntToPtr(out2, LLVM_INT8PTR);
-    out2_addr->setName("out2_addr");
-    Value* in2_addr = Builder.CreateIntToPtr(in2, LLVM_INT8PTR);
-    in2_addr->setName("in2_addr");
+        // Cast out2 and in2 to pointers
+        Value* out2_addr = Builder->CreateIntToPtr(out2, LLVM_INT8PTR);
+        out2_addr->setName("out2_addr");
+        Value* in2_addr = Builder->CreateIntToPtr(in2, LLVM_INT8PTR);
+        in2_addr->setName("in2_addr");
+
+        // Prefetch a block of the scattered buffer a few blocks ahead
+        long blockbytes = (long) blocklen * basetype->getSize();
+        long scattered_stride = (pack) ? elemstride_in : elemstride_out;
+        int ahead = prefetchBlocks(scattered_stride, blockbytes, count);
+        if (ahead > 0) {
+            Value* scattered = (pack) ? (Value*) in2 : (Value*) out2;
+            codegenPrefetch(Builder->CreateAdd(scattered, constNode(ahead * scattered_stride)),
+                            blockbytes, !pack);
+        }
     
-    // Basetype Code Generation
-    if (pack) basetype->packCodegen(in2_addr, ConstantInt::get(getGlobalContext(), APInt(32, blocklen, false)), out2_addr);
-    else      basetype->unpackCodegen(in2_addr, ConstantInt::get(getGlobalContext(), APInt(32, blocklen, false)), out2_addr);
-
-    // Increment out2 and in2
-    Value* nextout2 = Builder.CreateAdd(out2, constNode((long)elemstride_out));
-    nextout2->setName("nextout2");
-    Value* nextin2 = Builder.CreateAdd(in2, constNode((long)elemstride_in));
-    nextin2->setName("nextin2");
+        // Basetype Code Generation
+        if (pack) basetype->packCodegen(in2_addr, ConstantInt::get(getThreadContext(), APInt(32, blocklen, false)), out2_addr);
+        else      basetype->unpackCodegen(in2_addr, ConstantInt::get(getThreadContext(), APInt(32, blocklen, false)), out2_addr);
+
+        // Increment out2 and in2
+        Value* nextout2 = Builder->CreateAdd(out2, constNode((long)elemstride_out));
+        nextout2->setName("nextout2");
+        Value* nextin2 = Builder->CreateAdd(in2, constNode((long)elemstride_in));
+        nextin2->setName("nextin2");
     
-    // check if we are finished with the loop over count
-    Value* EndCond_inner = (pack) ? Builder.CreateICmpEQ(nextout2, nextout1, "innercond")
-            : Builder.CreateICmpEQ(nextin2, nextin1, "innercond");
+        // check if we are finished with the loop over count
+        Value* EndCond_inner = (pack) ? Builder->CreateICmpEQ(nextout2, nextout1, "innercond")
+                : Builder->CreateICmpEQ(nextin2, nextin1, "innercond");
     
-    // Create and branch to the inner loop postamble
-    BasicBlock *LoopEnd_inner_BB = Builder.GetInsertBlock();
-    BasicBlock *After_inner_BB = BasicBlock::Create(getGlobalContext(), "afterinner", TheFunction);
-    Builder.CreateCondBr(EndCond_inner, After_inner_BB, Loop_inner_BB);
-    Builder.SetInsertPoint(After_inner_BB);
-
-    // Add backedges for the inner loop induction variables
-    out2->addIncoming(nextout2, LoopEnd_inner_BB);
-    in2->addIncoming(nextin2, LoopEnd_inner_BB);
+        // Create and branch to the inner loop postamble
+        BasicBlock *LoopEnd_inner_BB = Builder->GetInsertBlock();
+        BasicBlock *After_inner_BB = BasicBlock::Create(getThreadContext(), "afterinner", TheFunction);
+        Builder->CreateCondBr(EndCond_inner, After_inner_BB, Loop_inner_BB);
+        Builder->SetInsertPoint(After_inner_BB);
+
+        // Add backedges for the inner loop induction variables
+        out2->addIncoming(nextout2, LoopEnd_inner_BB);
+        in2->addIncoming(nextin2, LoopEnd_inner_BB);
+    }
 
 
     // Move the the extend-stride ptr back Extent(Basetype) * Stride - Size(Basetype) * Blocklen  
     if (pack) {
-        nextin1 = Builder.CreateAdd(in1, constNode((long) extent ));
+        nextin1 = Builder->CreateAdd(in1, constNode((long) extent ));
 	    nextin1->setName("nextin1");
     }
     else {
-	    nextout1 = Builder.CreateAdd(out1, constNode((long) size ));
+	    nextout1 = Builder->CreateAdd(out1, constNode((long) size ));
 	    nextout1->setName("nextout1");
     }
     
     // Increment outer loop index
-    Value* nexti = Builder.CreateAdd(i, constNode(1), "nexti");
-    Value* EndCond_outer = Builder.CreateICmpEQ(nexti, incount, "outercond");
+    Value* nexti = Builder->CreateAdd(i, constNode(1l), "nexti");
+    Value* EndCond_outer = Builder->CreateICmpEQ(nexti, incount64, "outercond");
 
     // Create and branch to the outer loop postamble
-    BasicBlock *LoopEnd_outer_BB = Builder.GetInsertBlock();
-    BasicBlock *After_outer_BB = BasicBlock::Create(getGlobalContext(), "afterouter", TheFunction);
-    Builder.CreateCondBr(EndCond_outer, After_outer_BB, Loop_outer_BB);
-    Builder.SetInsertPoint(After_outer_BB);
+    BasicBlock *LoopEnd_outer_BB = Builder->GetInsertBlock();
+    BasicBlock *After_outer_BB = BasicBlock::Create(getThreadContext(), "afterouter", TheFunction);
+    Builder->CreateCondBr(EndCond_outer, After_outer_BB, Loop_outer_BB);
+    Builder->SetInsertPoint(After_outer_BB);
 
     // Add backedges for the outer loop induction variable
     out1->addIncoming(nextout1, LoopEnd_outer_BB);
@@ -137,4 +157,84 @@ void codegenVector(Value* inbuf, Value* incount, Value* outbuf,
     i->addIncoming(nexti, LoopEnd_outer_BB);
 }
 
+// Generates one level of the loop nest of codegenVectorNest, level -1 is
+// the loop over incount. Returns the compact address after the loop.
+static Value* codegenNestLevel(Value* scattered, Value* compact, int level,
+                               Value* incount, long extent,
+                               Datatype* leaf, int leafcount,
+                               const std::vector<int> &counts,
+                               const std::vector<long> &strides, bool pack) {
+
+    if (level == (int) counts.size()) {
+        Value* scattered_addr = Builder->CreateIntToPtr(scattered, LLVM_INT8PTR);
+        Value* compact_addr = Builder->CreateIntToPtr(compact, LLVM_INT8PTR);
+        if (pack) leaf->packCodegen(scattered_addr, constNode(leafcount), compact_addr);
+        else      leaf->unpackCodegen(compact_addr, constNode(leafcount), scattered_addr);
+        return Builder->CreateAdd(compact, constNode((long) leaf->getSize() * leafcount));
+    }
+
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    Value* count = (level < 0) ? Builder->CreateZExt(incount, LLVM_INT64)
+                               : constNode((long) counts[level]);
+    long stride = (level < 0) ? extent : strides[level];
+
+    BasicBlock *PreheaderBB = Builder->GetInsertBlock();
+    BasicBlock *LoopBB = BasicBlock::Create(getThreadContext(), "nestloop", TheFunction);
+    Builder->CreateBr(LoopBB);
+    Builder->SetInsertPoint(LoopBB);
+
+    // Induction var phi nodes
+    PHINode *scattered1 = Builder->CreatePHI(LLVM_INT64, 2, "scattered");
+    scattered1->addIncoming(scattered, PreheaderBB);
+    PHINode *compact1 = Builder->CreatePHI(LLVM_INT64, 2, "compact");
+    compact1->addIncoming(compact, PreheaderBB);
+    PHINode *i = Builder->CreatePHI(LLVM_INT64, 2, "i");
+    i->addIncoming(constNode(0l), PreheaderBB);
+
+    // The innermost loop prefetches the leaf blocks
+    if (level == (int) counts.size() - 1) {
+        long leafbytes = (long) leafcount * leaf->getSize();
+        int ahead = prefetchBlocks(stride, leafbytes, counts[level]);
+        if (ahead > 0) {
+            codegenPrefetch(Builder->CreateAdd(scattered1, constNode(ahead * stride)),
+                            leafbytes, !pack);
+        }
+    }
+
+    // Body: the next inner dimension
+    Value* nextcompact = codegenNestLevel(scattered1, compact1, level + 1, incount, extent,
+                                          leaf, leafcount, counts, strides, pack);
+    Value* nextscattered = Builder->CreateAdd(scattered1, constNode(stride));
+
+    // Increment loop index
+    Value* nexti = Builder->CreateAdd(i, constNode(1l), "nexti");
+    Value* EndCond = Builder->CreateICmpEQ(nexti, count, "nestcond");
+
+    // Create and branch to the loop postamble
+    BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+    BasicBlock *AfterBB = BasicBlock::Create(getThreadContext(), "afternest", TheFunction);
+    Builder->CreateCondBr(EndCond, AfterBB, LoopBB);
+    Builder->SetInsertPoint(AfterBB);
+
+    // Add backedges for the induction variables
+    scattered1->addIncoming(nextscattered, LoopEndBB);
+    compact1->addIncoming(nextcompact, LoopEndBB);
+    i->addIncoming(nexti, LoopEndBB);
+
+    return nextcompact;
+}
+
+void codegenVectorNest(Value* inbuf, Value* incount, Value* outbuf,
+                       Datatype* leaf, int leafcount,
+                       const std::vector<int> &counts,
+                       const std::vector<long> &strides,
+                       long extent, bool pack) {
+
+    Value* scattered = Builder->CreatePtrToInt((pack) ? inbuf : outbuf, LLVM_INT64);
+    Value* compact = Builder->CreatePtrToInt((pack) ? outbuf : inbuf, LLVM_INT64);
+
+    codegenNestLevel(scattered, compact, -1, incount, extent,
+                     leaf, leafcount, counts, strides, pack);
+}
+
 }
@@ -0,0 +1,250 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include "ddt_cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "llvm/IR/Module.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+// The library version should be picked up from the environment by the
+// build system, so a rebuilt library does not load code of an older one
+#ifndef LIBPACK_VERSION
+#define LIBPACK_VERSION "unknown"
+#endif
+
+#ifndef PACKVAR
+#define PACKVAR 0
+#endif
+
+using namespace llvm;
+
+namespace farc {
+
+static JITCache *TheCache = NULL;
+
+// The generated code may use any instruction the host supports, so the
+// raw feature words are part of the signature, not only the cpu name.
+static std::string hostFeatures() {
+    std::stringstream res;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        res << std::hex << ecx << ":" << edx;
+    }
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        res << ":" << std::hex << ebx << ":" << ecx;
+    }
+#endif
+    return res.str();
+}
+
+// 64 bit FNV-1a
+unsigned long long hashString(const std::string &str) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i=0; i<str.size(); i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool readFile(const std::string &path, std::string &content) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL) return false;
+
+    char buf[4096];
+    size_t n;
+    content.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        content.append(buf, n);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// Writes to a temporary file first and renames it, so concurrent processes
+// (and threads) sharing the cache directory never see a partially written
+// entry
+static bool writeFile(const std::string &path, const char *data, size_t size) {
+    static unsigned long tmpcount = 0;
+    std::stringstream tmppath;
+    tmppath << path << "." << getpid() << "." << __sync_fetch_and_add(&tmpcount, 1) << ".tmp";
+
+    FILE *f = fopen(tmppath.str().c_str(), "wb");
+    if (f == NULL) return false;
+
+    bool ok = (fwrite(data, 1, size, f) == size);
+    ok = (fclose(f) == 0) && ok;
+    if (ok) ok = (rename(tmppath.str().c_str(), path.c_str()) == 0);
+    if (!ok) unlink(tmppath.str().c_str());
+    return ok;
+}
+
+
+/* JITCache */
+JITCache::JITCache(const std::string &dir) {
+    this->dir = dir;
+    this->hits = 0;
+    this->misses = 0;
+    pthread_mutex_init(&lock, NULL);
+
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create JIT cache directory %s\n", dir.c_str());
+    }
+}
+
+JITCache::~JITCache() {
+    std::map<std::string, Entry>::iterator it;
+    for (it = entries.begin(); it != entries.end(); it++) {
+        delete it->second.object;
+    }
+    pthread_mutex_destroy(&lock);
+}
+
+std::string JITCache::path(const std::string &key, const char *suffix) {
+    return dir + "/" + key + suffix;
+}
+
+std::string JITCache::signature(Datatype *ddt, Datatype::CompilationType type, int tier, bool stream,
+                                const DDT_Target &target) {
+    std::stringstream sig;
+    sig << "format "  << DDT_CACHE_FORMAT << "\n";
+    sig << "libpack " << LIBPACK_VERSION << "\n";
+    sig << "llvm "    << LLVM_VERSION_MAJOR << "." << LLVM_VERSION_MINOR << "\n";
+    sig << "cpu "     << target.cpu << " " << hostFeatures() << "\n";
+    sig << "target ";
+    for (size_t i=0; i<target.features.size(); i++) sig << target.features[i] << " ";
+    sig << target.simd_bytes << " " << target.copy_unroll << " " << target.copy_treshold << " "
+        << target.copy_memcpy << " " << target.idxb_treshold << " " << target.idxb_unroll << " "
+        << target.prefetch_distance << "\n";
+    sig << "packvar " << PACKVAR << "\n";
+    sig << "type "    << type << "\n";
+    sig << "tier "    << tier << "\n";
+    sig << "stream "  << stream << "\n";
+    sig << ddt->toString() << "\n";
+    return sig.str();
+}
+
+std::string JITCache::key(const std::string &signature) {
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", hashString(signature));
+    return std::string(key);
+}
+
+bool JITCache::lookup(const std::string &key, const std::string &signature) {
+    pthread_mutex_lock(&lock);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+        // Another thread is compiling the same module right now
+        it->second.refcount++;
+        bool hit = (it->second.object != NULL);
+        if (hit) hits++;
+        else     misses++;
+        pthread_mutex_unlock(&lock);
+        return hit;
+    }
+
+    Entry &entry = entries[key];
+    entry.signature = signature;
+    entry.object = NULL;
+    entry.refcount = 1;
+    pthread_mutex_unlock(&lock);
+
+    // Files are read without holding the lock, the entry does not change
+    // until the object is set below
+    MemoryBuffer *object = NULL;
+    std::string stored_sig, obj;
+    if (readFile(path(key, ".sig"), stored_sig) && stored_sig == signature &&
+        readFile(path(key, ".o"), obj) && !obj.empty()) {
+        object = MemoryBuffer::getMemBufferCopy(obj, key);
+    }
+
+    pthread_mutex_lock(&lock);
+    entries[key].object = object;
+    if (object != NULL) hits++;
+    else                misses++;
+    pthread_mutex_unlock(&lock);
+
+    return (object != NULL);
+}
+
+void JITCache::release(const std::string &key) {
+    pthread_mutex_lock(&lock);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it != entries.end() && --it->second.refcount == 0) {
+        delete it->second.object;
+        entries.erase(it);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void JITCache::notifyObjectCompiled(const Module *M, const MemoryBuffer *Obj) {
+    const std::string &key = M->getModuleIdentifier();
+
+    pthread_mutex_lock(&lock);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    std::string sig = it->second.signature;
+    pthread_mutex_unlock(&lock);
+
+    // Write the object before the signature, an entry is only valid once
+    // its signature exists. Concurrent writers of the same entry write the
+    // same content, and renaming is atomic.
+    unlink(path(key, ".sig").c_str());
+    if (!writeFile(path(key, ".o"), Obj->getBufferStart(), Obj->getBufferSize()) ||
+        !writeFile(path(key, ".sig"), sig.data(), sig.size())) {
+        fprintf(stderr, "Could not write JIT cache entry %s\n", path(key, "").c_str());
+    }
+}
+
+const MemoryBuffer* JITCache::getObject(const Module *M) {
+    pthread_mutex_lock(&lock);
+    const MemoryBuffer *object = NULL;
+    std::map<std::string, Entry>::iterator it = entries.find(M->getModuleIdentifier());
+    if (it != entries.end()) object = it->second.object;
+    pthread_mutex_unlock(&lock);
+    return object;
+}
+
+
+JITCache* DDT_Cache() {
+    return TheCache;
+}
+
+// The cache is enabled by pointing LIBPACK_CACHE_DIR to a directory
+void DDT_Cache_Init() {
+    const char *dir = getenv("LIBPACK_CACHE_DIR");
+    if (dir != NULL && dir[0] != '\0' && TheCache == NULL) {
+        TheCache = new JITCache(dir);
+    }
+}
+
+void DDT_Cache_Finalize() {
+    delete TheCache;
+    TheCache = NULL;
+}
+
+} // namespace farc
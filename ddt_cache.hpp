@@ -0,0 +1,86 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#ifndef DDT_CACHE_H
+#define DDT_CACHE_H
+
+#include "ddt_jit.hpp"
+
+#include <map>
+#include <string>
+#include <pthread.h>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+
+// Bump this whenever the on-disk format of the cache changes
+#define DDT_CACHE_FORMAT 2
+
+namespace llvm {
+class MemoryBuffer;
+}
+
+namespace farc {
+
+/* On-disk cache of the object code generated for committed datatypes.
+ *
+ * Every entry consists of two files in the cache directory: <key>.o holds
+ * the object code emitted by the MCJIT, <key>.sig holds the full signature
+ * the key was derived from. The signature contains the canonical
+ * serialization of the compressed datatype as well as everything else the
+ * generated code depends on (library version, LLVM version, host cpu and
+ * build configuration), so a stale or colliding entry is never loaded. */
+class JITCache : public llvm::ObjectCache {
+public:
+    JITCache(const std::string &dir);
+    virtual ~JITCache();
+
+    // The signature of code generated for target
+    std::string signature(Datatype *ddt, Datatype::CompilationType type, int tier, bool stream,
+                          const DDT_Target &target);
+    std::string key(const std::string &signature);
+
+    // Registers the signature for key and returns true if a matching
+    // object was found on disk. The entry must be released after the
+    // module with the identifier key has been compiled. Threads may use
+    // the same key at the same time.
+    bool lookup(const std::string &key, const std::string &signature);
+    void release(const std::string &key);
+
+    void notifyObjectCompiled(const llvm::Module *M, const llvm::MemoryBuffer *Obj);
+
+    unsigned long hits;
+    unsigned long misses;
+
+protected:
+    const llvm::MemoryBuffer* getObject(const llvm::Module *M);
+
+private:
+    std::string path(const std::string &key, const char *suffix);
+
+    // Modules currently being compiled through the cache
+    struct Entry {
+        std::string signature;
+        llvm::MemoryBuffer *object;
+        int refcount;
+    };
+
+    std::string dir;
+    std::map<std::string, Entry> entries;
+    pthread_mutex_t lock;
+};
+
+unsigned long long hashString(const std::string &str);
+
+// Returns the process wide cache, NULL if caching is disabled
+JITCache* DDT_Cache();
+
+void DDT_Cache_Init();
+void DDT_Cache_Finalize();
+
+} // namespace farc
+
+#endif // DDT_CACHE_H
@@ -0,0 +1,257 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include "ddt_jit.hpp"
+
+#include <cstring>
+
+/* Interpreter for datatypes which have no generated code (yet). Each
+ * datatype packs count elements starting at scatteredbuf into compactbuf
+ * (or unpacks them in the other direction) by walking its subtypes, the
+ * same way the generated code does, but without any of its optimizations.
+ *
+ * interpretPartial() only packs the bytes [lo, hi) of the packed
+ * representation of a single element into compactbuf, which is used for
+ * elements cut by segment boundaries (see DDT_Pack_partial). */
+
+namespace farc {
+
+static inline void copy(char *scattered, char *compact, long bytes, bool pack) {
+    if (pack) memcpy(compact, scattered, bytes);
+    else      memcpy(scattered, compact, bytes);
+}
+
+static inline long min(long a, long b) {
+    return (a < b) ? a : b;
+}
+
+static inline long max(long a, long b) {
+    return (a > b) ? a : b;
+}
+
+// Packs the bytes [lo, hi) of the packed representation of count elements
+// of type, whole elements in one go and cut elements partially. Bytes past
+// the last element are not touched.
+void interpretWindow(Datatype* type, char* scatteredbuf, long count, char* compactbuf,
+                     long lo, long hi, bool pack) {
+    long size = type->getSize();
+    long extent = type->getExtent();
+    hi = min(hi, count * size);
+    if (size == 0 || lo >= hi) return;
+
+    long elem = lo / size;
+    long start = lo % size;
+
+    // first element is cut
+    if (start != 0) {
+        long end = min(size, start + (hi - lo));
+        type->interpretPartial(scatteredbuf + elem*extent, compactbuf, start, end, pack);
+        compactbuf += end - start;
+        lo += end - start;
+        elem++;
+    }
+
+    long whole = (hi - lo) / size;
+    if (whole > 0) {
+        type->interpret(scatteredbuf + elem*extent, whole, compactbuf, pack);
+        compactbuf += whole * size;
+        lo += whole * size;
+        elem += whole;
+    }
+
+    // last element is cut
+    if (lo < hi) {
+        type->interpretPartial(scatteredbuf + elem*extent, compactbuf, 0, hi - lo, pack);
+    }
+}
+
+// Packs the part of the window [lo, hi) of an element which falls into the
+// block of count elements of type, which starts at byte pos of the packed
+// element and at scattered in memory
+static inline void interpretBlock(Datatype* type, char* scattered, long count, long pos,
+                                  char* compactbuf, long lo, long hi, bool pack) {
+    long blocksize = count * (long) type->getSize();
+    long from = max(lo, pos);
+    long to = min(hi, pos + blocksize);
+    if (from >= to) return;
+
+    interpretWindow(type, scattered, count, compactbuf + (from - lo), from - pos, to - pos, pack);
+}
+
+void Datatype::packInterpret(void* inbuf, long count, void* outbuf) {
+    this->interpret((char*) inbuf, count, (char*) outbuf, true);
+}
+
+void Datatype::unpackInterpret(void* inbuf, long count, void* outbuf) {
+    this->interpret((char*) outbuf, count, (char*) inbuf, false);
+}
+
+
+void Datatype::packInterpretPartial(void* inbuf, long count, void* outbuf, long offset, long length) {
+    interpretWindow(this, (char*) inbuf, count, (char*) outbuf, offset, offset + length, true);
+}
+
+void Datatype::unpackInterpretPartial(void* inbuf, long count, void* outbuf, long offset, long length) {
+    interpretWindow(this, (char*) outbuf, count, (char*) inbuf, offset, offset + length, false);
+}
+
+
+void PrimitiveDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    copy(scatteredbuf, compactbuf, (long) count * this->size, pack);
+}
+
+void ContiguousDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+    long size = this->getSize();
+
+    for (long i=0; i<count; i++) {
+        this->basetype->interpret(scatteredbuf + i*extent, this->count, compactbuf + i*size, pack);
+    }
+}
+
+void VectorDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+    long stride = (long) this->stride * this->basetype->getExtent();
+    long blocksize = (long) this->blocklen * this->basetype->getSize();
+
+    for (long i=0; i<count; i++) {
+        char* scattered = scatteredbuf + i*extent;
+        for (int j=0; j<this->count; j++) {
+            this->basetype->interpret(scattered + j*stride, this->blocklen, compactbuf, pack);
+            compactbuf += blocksize;
+        }
+    }
+}
+
+void HVectorDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+    long blocksize = (long) this->blocklen * this->basetype->getSize();
+
+    for (long i=0; i<count; i++) {
+        char* scattered = scatteredbuf + i*extent;
+        for (int j=0; j<this->count; j++) {
+            this->basetype->interpret(scattered + j*(long)this->stride, this->blocklen, compactbuf, pack);
+            compactbuf += blocksize;
+        }
+    }
+}
+
+void IndexedBlockDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+    long base_extent = this->basetype->getExtent();
+    long blocksize = (long) this->blocklen * this->basetype->getSize();
+
+    for (long i=0; i<count; i++) {
+        char* scattered = scatteredbuf + i*extent;
+        for (int j=0; j<this->count; j++) {
+            this->basetype->interpret(scattered + this->displs[j]*base_extent, this->blocklen, compactbuf, pack);
+            compactbuf += blocksize;
+        }
+    }
+}
+
+void HIndexedDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+    long base_size = this->basetype->getSize();
+
+    for (long i=0; i<count; i++) {
+        char* scattered = scatteredbuf + i*extent;
+        for (int j=0; j<this->count; j++) {
+            this->basetype->interpret(scattered + this->displs[j], this->blocklens[j], compactbuf, pack);
+            compactbuf += this->blocklens[j] * base_size;
+        }
+    }
+}
+
+void StructDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+
+    for (long i=0; i<count; i++) {
+        char* scattered = scatteredbuf + i*extent;
+        for (int j=0; j<this->count; j++) {
+            this->basetypes[j]->interpret(scattered + this->displs[j], this->blocklens[j], compactbuf, pack);
+            compactbuf += (long) this->blocklens[j] * this->basetypes[j]->getSize();
+        }
+    }
+}
+
+void ResizedDatatype::interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) {
+    long extent = this->getExtent();
+    long size = this->getSize();
+
+    for (long i=0; i<count; i++) {
+        this->basetype->interpret(scatteredbuf + i*extent, 1, compactbuf + i*size, pack);
+    }
+}
+
+
+void PrimitiveDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    copy(scatteredbuf + lo, compactbuf, hi - lo, pack);
+}
+
+void ContiguousDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    interpretWindow(this->basetype, scatteredbuf, this->count, compactbuf, lo, hi, pack);
+}
+
+void VectorDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    long stride = (long) this->stride * this->basetype->getExtent();
+    long blocksize = (long) this->blocklen * this->basetype->getSize();
+    if (blocksize == 0) return;
+
+    for (long j=lo/blocksize; j<this->count && j*blocksize<hi; j++) {
+        interpretBlock(this->basetype, scatteredbuf + j*stride, this->blocklen, j*blocksize,
+                       compactbuf, lo, hi, pack);
+    }
+}
+
+void HVectorDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    long blocksize = (long) this->blocklen * this->basetype->getSize();
+    if (blocksize == 0) return;
+
+    for (long j=lo/blocksize; j<this->count && j*blocksize<hi; j++) {
+        interpretBlock(this->basetype, scatteredbuf + j*(long)this->stride, this->blocklen, j*blocksize,
+                       compactbuf, lo, hi, pack);
+    }
+}
+
+void IndexedBlockDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    long base_extent = this->basetype->getExtent();
+    long blocksize = (long) this->blocklen * this->basetype->getSize();
+    if (blocksize == 0) return;
+
+    for (long j=lo/blocksize; j<this->count && j*blocksize<hi; j++) {
+        interpretBlock(this->basetype, scatteredbuf + this->displs[j]*base_extent, this->blocklen, j*blocksize,
+                       compactbuf, lo, hi, pack);
+    }
+}
+
+void HIndexedDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    long base_size = this->basetype->getSize();
+    long pos = 0;
+
+    for (int j=0; j<this->count && pos<hi; j++) {
+        interpretBlock(this->basetype, scatteredbuf + this->displs[j], this->blocklens[j], pos,
+                       compactbuf, lo, hi, pack);
+        pos += this->blocklens[j] * base_size;
+    }
+}
+
+void StructDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    long pos = 0;
+
+    for (int j=0; j<this->count && pos<hi; j++) {
+        interpretBlock(this->basetypes[j], scatteredbuf + this->displs[j], this->blocklens[j], pos,
+                       compactbuf, lo, hi, pack);
+        pos += (long) this->blocklens[j] * this->basetypes[j]->getSize();
+    }
+}
+
+void ResizedDatatype::interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) {
+    interpretWindow(this->basetype, scatteredbuf, 1, compactbuf, lo, hi, pack);
+}
+
+} // namespace farc
@@ -10,9 +10,24 @@
 
 #include "codegen.hpp"
 #include "codegen_common.hpp"
+#include "ddt_cache.hpp"
+#include "ddt_tune.hpp"
+#include "ddt_parallel.hpp"
 
 #include <map>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 #include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <stdint.h>
 #include <iostream>
 #include <sstream>
 
@@ -21,8 +36,11 @@
 #include "llvm/IR/Intrinsics.h"
 
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Host.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
 
 
 #define LAZY           0
@@ -42,146 +60,890 @@
 #include "llvm/Analysis/Verifier.h"
 #endif
 
-#if LLVM_OPTIMIZE
+// The optimizer pipeline is used for tier 2 code (see DDT_Init)
 #include "llvm/PassManager.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/LinkAllPasses.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
-static llvm::FunctionPassManager *TheFPM;
-#endif
 
 using namespace std;
 using namespace llvm;
 
 namespace farc {
 
-static Module *module;
-static std::map<std::string, Value*> NamedValues;
-static ExecutionEngine *TheExecutionEngine;
+static const char *Args[] = {"inbuf", "count", "outbuf"};
+
+// Tiers of the generated code: tier 0 means the datatype is interpreted,
+// tier 1 code is generated without optimizations, tier 2 code with all of
+// them. Without tiered compilation (see DDT_Init) commits go to tier 2.
+#define FULL_TIER 2
+
+static bool Tiered = false;
+static bool CountCalls = false;
+static bool PrintStats = false;
+static unsigned long Tier1Calls = 2;
+static unsigned long Tier2Calls = 1000;
+
+// The optimizer pipeline is only run for tier 2 code, and only if tiered
+// compilation is enabled or LLVM_OPTIMIZE is set
+static bool OptimizeFull = LLVM_OPTIMIZE;
+
+static DDT_Stats Stats;
+static pthread_mutex_t StatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+DDT_Target TheTarget;
+
+/* Code generation state of a thread. The machine code generated in it must
+   stay valid after the thread has exited, since the datatype may be used
+   by other threads. DDT_Finalize() drops all states, but a state is only
+   freed once the last code generated in it is released. */
+struct CodegenState {
+    LLVMContext *context;
+    IRBuilder<> *builder;
+    FunctionType *FT;
+
+    // Module and JIT of each tier (index 0 is unused), created on first use
+    Module *module[FULL_TIER+1];
+    ExecutionEngine *engine[FULL_TIER+1];
+
+    // Optimizer pipeline of the tier 2 module, NULL if it is not used
+    FunctionPassManager *fpm;
 
-std::vector<std::string> Args;
-FunctionType *FT;
+    // Held while code is generated in, or freed from, this state
+    pthread_mutex_t lock;
+
+    // Number of CompiledCode living in this state, and whether it was
+    // dropped by DDT_Finalize(), protected by StatesLock
+    int codes;
+    bool finalized;
+};
+
+static pthread_mutex_t StatesLock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<CodegenState*> States;
+
+// The state of a thread is only valid in the generation it was created
+// in, DDT_Finalize() starts a new one
+static unsigned long StatesGeneration = 0;
+static __thread CodegenState *TheState = NULL;
+static __thread unsigned long TheStateGeneration = 0;
+
+static CodegenState* createCodegenState();
+static ExecutionEngine* createEngine(Module *mod, int tier, bool mcjit);
+static FunctionPassManager* createOptimizer(Module *mod, const DataLayout *layout);
+
+// Returns the code generation state of the calling thread, which is
+// created on first use
+static CodegenState* getCodegenState() {
+    unsigned long generation = __atomic_load_n(&StatesGeneration, __ATOMIC_ACQUIRE);
+    if (TheState == NULL || TheStateGeneration != generation) {
+        TheState = createCodegenState();
+
+        pthread_mutex_lock(&StatesLock);
+        States.push_back(TheState);
+        TheStateGeneration = StatesGeneration;
+        pthread_mutex_unlock(&StatesLock);
+    }
+
+    ThreadContext = TheState->context;
+    Builder = TheState->builder;
+    return TheState;
+}
+
+// Returns the JIT of the given tier of state, the lock of state must be held
+static ExecutionEngine* getEngine(CodegenState *state, int tier) {
+    if (state->engine[tier] == NULL) {
+        // The JIT takes ownership of the module
+        state->module[tier] = new Module("FARC-JIT", *state->context);
+        state->engine[tier] = createEngine(state->module[tier], tier, false);
+        if (state->engine[tier] == NULL) exit(1);
+
+        if (tier == FULL_TIER && OptimizeFull) {
+            state->fpm = createOptimizer(state->module[tier], state->engine[tier]->getDataLayout());
+        }
+    }
+    return state->engine[tier];
+}
+
+typedef void (*PackFunction)(void*, long, void*);
+
+/* Machine code of a pack or unpack function. Structurally identical
+   datatypes, i.e., datatypes which compress to the same tree, share the
+   same code, which is freed when the last of them is freed. */
+struct CompiledCode {
+    void (*function)(void*, long, void*);
+    Function *F;
+    int tier;
+
+    // State the code was generated in
+    CodegenState *state;
+
+    // Engine owning the code if it was compiled through the JIT cache,
+    // NULL if F lives in the module of its tier in the state
+    ExecutionEngine *engine;
+
+    unsigned long long hash;
+    std::string key;
+    int refcount;
+};
+
+// Maps the hash of the canonical serialization of a compressed datatype
+// (and the direction and tier of the function) to the code generated for it
+static std::multimap<unsigned long long, CompiledCode*> CodeTable;
+static pthread_mutex_t CodeTableLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cancelJob(Datatype *target);
+static void freeCodegenState(CodegenState *state);
+
+// Drops a reference of code to the state it was generated in
+static void releaseState(CodegenState *state) {
+    pthread_mutex_lock(&StatesLock);
+    bool last = (--state->codes == 0) && state->finalized;
+    pthread_mutex_unlock(&StatesLock);
+
+    if (last) freeCodegenState(state);
+}
+
+static void releaseCode(CompiledCode *code) {
+    if (code == NULL) return;
+
+    pthread_mutex_lock(&CodeTableLock);
+    if (--code->refcount > 0) {
+        pthread_mutex_unlock(&CodeTableLock);
+        return;
+    }
+
+    std::multimap<unsigned long long, CompiledCode*>::iterator it;
+    for (it = CodeTable.find(code->hash);
+         it != CodeTable.end() && it->first == code->hash; it++) {
+        if (it->second == code) {
+            CodeTable.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&CodeTableLock);
+
+    // The code may be freed by another thread than the one it was
+    // generated in, which may be generating code in the same state
+    pthread_mutex_lock(&code->state->lock);
+    if (code->engine != NULL) {
+        // deleting the engine also frees the module and the machine code
+        delete code->engine;
+    }
+    else {
+        code->state->engine[code->tier]->freeMachineCodeForFunction(code->F);
+        code->F->eraseFromParent();
+    }
+    pthread_mutex_unlock(&code->state->lock);
+    releaseState(code->state);
+    delete code;
+}
 
 
 /* Datatype */
 Datatype::~Datatype() {
-    if (this->pack != NULL) {
-        TheExecutionEngine->freeMachineCodeForFunction(this->fpack);
-        this->fpack->eraseFromParent();
-        this->pack = NULL;
-    }
-    if (this->unpack != NULL) {
-        TheExecutionEngine->freeMachineCodeForFunction(this->funpack);
-        this->funpack->eraseFromParent();
-        this->unpack = NULL;
+    cancelJob(this);
+    releaseCode(this->packcode);
+    releaseCode(this->unpackcode);
+    releaseCode(this->packstreamcode);
+    releaseCode(this->unpackstreamcode);
+    for (size_t i=0; i<this->retired.size(); i++) {
+        releaseCode(this->retired[i]);
     }
+    this->pack = NULL;
+    this->unpack = NULL;
+    this->packstream = NULL;
+    this->unpackstream = NULL;
+    delete this->outer;
     cleanup();
 }
 
-static inline Function* createFunctionHeader(const char *name) {
-    Function* F = Function::Create(FT, Function::ExternalLinkage, name, module);
+static inline Function* createFunctionHeader(CodegenState *state, const char *name, Module *mod) {
+    Function* F = Function::Create(state->FT, Function::ExternalLinkage, name, mod);
     F->setDoesNotThrow();
     F->setDoesNotAlias(1);
     F->setDoesNotAlias(3);
 
     // Set names for all arguments.
     unsigned Idx = 0;
-    for (Function::arg_iterator AI = F->arg_begin(); Idx != Args.size(); ++AI, ++Idx) {
-        assert(AI !=  F->arg_end());
+    for (Function::arg_iterator AI = F->arg_begin(); AI != F->arg_end(); ++AI, ++Idx) {
         AI->setName(Args[Idx]);
-        NamedValues[Args[Idx]] = AI;
     }
 
     return F;
 }
 
-static inline void postProcessFunction(Function *F) {
+static inline void postProcessFunction(FunctionPassManager *fpm, Function *F) {
 #if LLVM_VERIFY
     //F->viewCFG();
     verifyFunction(*F);
 #endif
-#if LLVM_OPTIMIZE
-    TheFPM->run(*F);
+    if (fpm != NULL) fpm->run(*F);
+}
+
+// Generates the pack (or unpack) function of ddt with the parameters of
+// target, including the global arrays it needs
+static Function* codegenFunction(CodegenState *state, Datatype *ddt, const char *name,
+                                 Module *mod, FunctionPassManager *fpm, bool pack, bool stream,
+                                 const DDT_Target *target) {
+    CodeTarget = target;
+    ddt->globalCodegen(mod);
+
+    Function *F = createFunctionHeader(state, name, mod);
+
+    Function::arg_iterator AI = F->arg_begin();
+    Value *inbuf  = AI++;
+    Value *count  = AI++;
+    Value *outbuf = AI;
+
+    // Create a new basic block to start insertion into.
+    BasicBlock *BB = BasicBlock::Create(getThreadContext(), "entry", F);
+    Builder->SetInsertPoint(BB);
+
+    // generate code for the datatype
+    StreamStores = stream;
+    if (pack) ddt->packCodegen(inbuf, count, outbuf);
+    else      ddt->unpackCodegen(inbuf, count, outbuf);
+    StreamStores = false;
+
+    // Streaming stores are weakly ordered, the fence makes them visible
+    // to other threads (and the network card) before the function returns
+#if defined(__x86_64__) || defined(__i386__)
+    if (stream) Builder->CreateCall(Intrinsic::getDeclaration(mod, Intrinsic::x86_sse_sfence));
 #endif
-}
+    Builder->CreateRetVoid();
+    CodeTarget = &TheTarget;
 
-void Datatype::compile(CompilationType type) {
-    // Compress the datatype, by substituting datatypes for
-    // equivalent, but more compact, datatypes
-    #if DDT_OPTIMIZE
-    Datatype *ddt = this->compress();
-    #else
-    Datatype *ddt = this;
-    #endif
+    postProcessFunction(fpm, F);
 
-    // Create the global arrays needed by the datatypes
-    ddt->globalCodegen(module);
+    return F;
+}
 
-    bool pack   = (type == PACK_UNPACK || type == PACK)   ? true : false;
-    bool unpack = (type == PACK_UNPACK || type == UNPACK) ? true : false;
-    if (pack) {
-        this->fpack = createFunctionHeader("pack");
+// Functions which only serve as a symbol to look up cached object code,
+// they are never compiled
+static Function* createStubFunction(CodegenState *state, const char *name, Module *mod) {
+    Function *F = createFunctionHeader(state, name, mod);
+    BasicBlock *BB = BasicBlock::Create(getThreadContext(), "entry", F);
+    Builder->SetInsertPoint(BB);
+    Builder->CreateRetVoid();
+    return F;
+}
 
-        // Create a new basic block to start insertion into.
-        BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", this->fpack);
-        Builder.SetInsertPoint(BB);
+// Compiles ddt into a module of its own using the MCJIT, so that the
+// generated object code can be stored in (or loaded from) the JIT cache.
+// Returns false if the cache can not be used for this datatype.
+static bool compileCached(CodegenState *state, CompiledCode *code, Datatype *ddt, bool pack, bool stream,
+                          const DDT_Target *target) {
+    const char *name = (pack) ? "pack" : "unpack";
 
-        // generate code for the datatype
-        ddt->packCodegen(NamedValues["inbuf"], NamedValues["count"], NamedValues["outbuf"]);
-        Builder.CreateRetVoid();
+    JITCache *cache = DDT_Cache();
+    std::string sig = cache->signature(ddt, (pack) ? Datatype::PACK : Datatype::UNPACK, code->tier, stream, *target);
+    std::string key = cache->key(sig);
+    bool hit = cache->lookup(key, sig);
 
-        postProcessFunction(this->fpack);
+    // The module identifier is used by the cache to find the object
+    ExecutionEngine *tierengine = getEngine(state, code->tier);
+    Module *mod = new Module(key, getThreadContext());
+    mod->setDataLayout(state->module[code->tier]->getDataLayout());
+    mod->setTargetTriple(state->module[code->tier]->getTargetTriple());
 
-        #if !LLVM_OUTPUT
-        this->pack = (void (*)(void*,int,void*))(intptr_t)
-            TheExecutionEngine->getPointerToFunction(this->fpack);
+    Function *F = NULL;
+    if (hit) {
+        F = createStubFunction(state, name, mod);
+    }
+    else {
+        FunctionPassManager *fpm = NULL;
+        if (code->tier == FULL_TIER && OptimizeFull) {
+            fpm = createOptimizer(mod, tierengine->getDataLayout());
+        }
+
+        F = codegenFunction(state, ddt, name, mod, fpm, pack, stream, target);
+        delete fpm;
+        #if LLVM_OUTPUT
+        mod->dump();
         #endif
     }
 
-    if (unpack) {
-        this->funpack = createFunctionHeader("unpack");
+    ExecutionEngine *engine = createEngine(mod, code->tier, true);
+    if (!engine) {
+        cache->release(key);
+        delete mod;
+        return false;
+    }
+    engine->setObjectCache(cache);
+
+    // Generates (or loads) the object code for the whole module
+    void *ptr = engine->getPointerToFunction(F);
+    engine->finalizeObject();
+    cache->release(key);
+
+    code->engine = engine;
+    code->F = F;
+    code->function = (void (*)(void*,long,void*))(intptr_t) ptr;
+
+    return true;
+}
+
+// Code generated with different target parameters is never shared, so
+// changing the target (or tuning a datatype) takes effect right away
+static std::string codeKey(const std::string &repr, bool pack, int tier, bool stream,
+                           const DDT_Target &target) {
+    std::stringstream key;
+    key << repr << "\n" << ((pack) ? "pack" : "unpack") << " " << tier;
+    if (stream) key << " stream";
+    key << "\n" << target.cpu;
+    for (size_t i=0; i<target.features.size(); i++) key << " " << target.features[i];
+    key << "\n" << target.simd_bytes << " " << target.copy_unroll << " " << target.copy_treshold << " "
+        << target.copy_memcpy << " " << target.idxb_treshold << " " << target.idxb_unroll << " "
+        << target.prefetch_distance;
+    return key.str();
+}
+
+// Returns the code of a structurally identical datatype committed before
+// with the parameters of target, NULL if there is none
+static CompiledCode* findCode(const std::string &repr, bool pack, int tier, bool stream,
+                              const DDT_Target &target) {
+    std::string key = codeKey(repr, pack, tier, stream, target);
+    unsigned long long hash = hashString(key);
+    CompiledCode *code = NULL;
+
+    pthread_mutex_lock(&CodeTableLock);
+    std::multimap<unsigned long long, CompiledCode*>::iterator it;
+    for (it = CodeTable.find(hash); it != CodeTable.end() && it->first == hash; it++) {
+        if (it->second->key == key) {
+            code = it->second;
+            code->refcount++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&CodeTableLock);
+
+    if (code != NULL) {
+        pthread_mutex_lock(&StatsLock);
+        Stats.shared++;
+        pthread_mutex_unlock(&StatsLock);
+    }
+
+    return code;
+}
+
+static double wtime() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+/* Autotuning (see ddt_tune.hpp). The variants are compiled into modules
+   of their own, which are freed after they have been timed. */
+
+// Compiles the pack and unpack function of ddt with the parameters of
+// target. Returns the engine owning them, NULL if compilation failed.
+static ExecutionEngine* compileVariant(CodegenState *state, Datatype *ddt, const DDT_Target *target,
+                                       PackFunction *pack, PackFunction *unpack) {
+    pthread_mutex_lock(&state->lock);
+
+    ExecutionEngine *tierengine = getEngine(state, FULL_TIER);
+    Module *mod = new Module("FARC-TUNE", getThreadContext());
+    mod->setDataLayout(state->module[FULL_TIER]->getDataLayout());
+    mod->setTargetTriple(state->module[FULL_TIER]->getTargetTriple());
+
+    FunctionPassManager *fpm = NULL;
+    if (OptimizeFull) fpm = createOptimizer(mod, tierengine->getDataLayout());
+    Function *packF = codegenFunction(state, ddt, "pack", mod, fpm, true, false, target);
+    Function *unpackF = codegenFunction(state, ddt, "unpack", mod, fpm, false, false, target);
+    delete fpm;
+
+    ExecutionEngine *engine = createEngine(mod, FULL_TIER, true);
+    if (engine != NULL) {
+        *pack = (PackFunction)(intptr_t) engine->getPointerToFunction(packF);
+        *unpack = (PackFunction)(intptr_t) engine->getPointerToFunction(unpackF);
+        engine->finalizeObject();
+    }
+    else {
+        delete mod;
+    }
+
+    pthread_mutex_unlock(&state->lock);
+    return engine;
+}
+
+// Seconds of the fastest of AUTOTUNE_RUNS pack and unpack calls of the
+// variant of ddt for target, a negative value if it can not be compiled
+static double timeVariant(CodegenState *state, Datatype *ddt, const DDT_Target *target,
+                          char *scattered, char *compact, long count) {
+    PackFunction pack, unpack;
+    ExecutionEngine *engine = compileVariant(state, ddt, target, &pack, &unpack);
+    if (engine == NULL) return -1.0;
+
+    // The first calls fault in the code and warm up the buffers
+    pack(scattered, count, compact);
+    unpack(compact, count, scattered);
+
+    double best = -1.0;
+    for (int run=0; run<AUTOTUNE_RUNS; run++) {
+        double start = wtime();
+        pack(scattered, count, compact);
+        unpack(compact, count, scattered);
+        double time = wtime() - start;
+        if (best < 0 || time < best) best = time;
+    }
 
-        // Create a new basic block to start insertion into.
-        BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", this->funpack);
-        Builder.SetInsertPoint(BB);
+    pthread_mutex_lock(&state->lock);
+    delete engine;
+    pthread_mutex_unlock(&state->lock);
+
+    return best;
+}
+
+// Variants of base which differ in the parameter with the given index,
+// AUTOTUNE_PARAMS in total. The unroll factor of the copy loops is scaled
+// with the vector width, like in initTarget().
+static std::vector<DDT_Target> tuningVariants(const DDT_Target &base, int param) {
+    std::vector<DDT_Target> variants;
+    DDT_Target v = base;
+
+    switch (param) {
+    case 0:
+        for (int width=16; width<=64; width*=2) {
+            if (width == 32 && hasFeature(base, "-avx")) continue;
+            if (width == 64 && !hasFeature(base, "+avx512f")) continue;
+            v = base;
+            v.simd_bytes = width;
+            v.copy_unroll = std::max(1, base.copy_unroll * base.simd_bytes / width);
+            variants.push_back(v);
+        }
+        break;
+    case 1:
+        for (int bytes=128; bytes<=512; bytes*=2) {
+            v = base;
+            v.copy_unroll = std::max(1, bytes / base.simd_bytes);
+            variants.push_back(v);
+        }
+        break;
+    case 2:
+        for (int treshold=128; treshold<=2048; treshold*=4) {
+            v = base;
+            v.copy_treshold = treshold;
+            variants.push_back(v);
+        }
+        break;
+    case 3:
+        v.copy_memcpy = !base.copy_memcpy;
+        variants.push_back(v);
+        break;
+    case 4:
+        for (int treshold=4; treshold<=64; treshold*=4) {
+            v = base;
+            v.idxb_treshold = treshold;
+            variants.push_back(v);
+        }
+        break;
+    case 5:
+        for (int unroll=1; unroll<=4; unroll*=2) {
+            v = base;
+            v.idxb_unroll = unroll;
+            variants.push_back(v);
+        }
+        break;
+    case 6:
+        for (long distance=0; distance<=4096; distance=(distance == 0) ? 1024 : distance*4) {
+            v = base;
+            v.prefetch_distance = distance;
+            variants.push_back(v);
+        }
+        break;
+    }
+
+    return variants;
+}
+
+static bool sameParameters(const DDT_Target &a, const DDT_Target &b) {
+    return a.simd_bytes == b.simd_bytes && a.copy_unroll == b.copy_unroll &&
+        a.copy_treshold == b.copy_treshold && a.copy_memcpy == b.copy_memcpy &&
+        a.idxb_treshold == b.idxb_treshold && a.idxb_unroll == b.idxb_unroll &&
+        a.prefetch_distance == b.prefetch_distance;
+}
+
+// Chooses the parameters of target for the compressed datatype ddt with
+// the serialization repr and records them. Starting from target, one
+// parameter after the other is set to the value of the fastest variant.
+// The variants pack and unpack count elements of ddt on scratch buffers,
+// where count is the smallest one moving at least AUTOTUNE_MIN_BYTES, as
+// long as the elements span at most AUTOTUNE_MAX_SPAN bytes.
+static void tuneTarget(Datatype *ddt, const std::string &repr, DDT_Target *target) {
+    long size = ddt->getSize();
+    if (size <= 0) return;
 
-        // generate code for the datatype
-        ddt->unpackCodegen(NamedValues["inbuf"], NamedValues["count"], NamedValues["outbuf"]);
-        Builder.CreateRetVoid();
+    double start = wtime();
+    long count = (AUTOTUNE_MIN_BYTES + size - 1) / size;
+    long extent = ddt->getExtent();
+    if (labs(extent) * count > AUTOTUNE_MAX_SPAN) {
+        count = std::max(1L, AUTOTUNE_MAX_SPAN / labs(extent));
+    }
+    long lb = ddt->getTrueLowerBound() + std::min(0L, (count - 1) * extent);
+    long ub = ddt->getTrueUpperBound() + std::max(0L, (count - 1) * extent);
+
+    char *scratch = (char*) calloc(ub - lb, 1);
+    char *compact = (char*) calloc(size * count, 1);
+    if (scratch == NULL || compact == NULL) {
+        fprintf(stderr, "Could not allocate %li bytes to tune a datatype\n", ub - lb + size * count);
+        free(scratch);
+        free(compact);
+        return;
+    }
 
-        postProcessFunction(this->funpack);
+    CodegenState *state = getCodegenState();
+    DDT_Target best = *target;
+    double besttime = timeVariant(state, ddt, &best, scratch - lb, compact, count);
+    for (int param=0; param<AUTOTUNE_PARAMS && besttime >= 0; param++) {
+        std::vector<DDT_Target> variants = tuningVariants(best, param);
+        DDT_Target base = best;
+        for (size_t i=0; i<variants.size(); i++) {
+            if (sameParameters(variants[i], base)) continue;
+            double time = timeVariant(state, ddt, &variants[i], scratch - lb, compact, count);
+            if (time >= 0 && time < besttime) {
+                besttime = time;
+                best = variants[i];
+            }
+        }
+    }
 
-        #if !LLVM_OUTPUT
-        this->unpack = (void (*)(void*,int,void*))(intptr_t)
-            TheExecutionEngine->getPointerToFunction(this->funpack);
+    free(scratch);
+    free(compact);
+
+    if (besttime < 0) return;
+    *target = best;
+    DDT_Tuning_Record(repr, best);
+
+    pthread_mutex_lock(&StatsLock);
+    Stats.tunings++;
+    Stats.tuning_time += wtime() - start;
+    pthread_mutex_unlock(&StatsLock);
+}
+
+// Sets target to the parameters the code of the datatype with the
+// serialization repr is generated with at the given tier. Returns false if
+// these are the ones of TheTarget because there is no tuning decision.
+static bool codeTarget(const std::string &repr, int tier, DDT_Target *target) {
+    *target = TheTarget;
+    return tier == FULL_TIER && DDT_Tuning_Lookup(repr, target);
+}
+
+// Returns the code for the pack (or unpack) function of the compressed
+// datatype ddt at the given tier, which is only generated if no
+// structurally identical datatype has been compiled at that tier before.
+// If stream is set, the function uses streaming stores.
+static CompiledCode* acquireCode(Datatype *ddt, const std::string &repr, bool pack, int tier, bool stream) {
+    // Full tier code uses the parameters tuned for the datatype, which
+    // are chosen before its first full tier function is generated
+    DDT_Target target;
+    if (!codeTarget(repr, tier, &target) && tier == FULL_TIER && DDT_Autotune()) {
+        tuneTarget(ddt, repr, &target);
+    }
+
+    CompiledCode *found = findCode(repr, pack, tier, stream, target);
+    if (found != NULL) return found;
+
+    std::string key = codeKey(repr, pack, tier, stream, target);
+    unsigned long long hash = hashString(key);
+    double start = wtime();
+
+    // The table is not locked during code generation, so threads can
+    // commit in parallel. Two threads committing identical datatypes at
+    // the same time both generate code, which is harmless.
+    CodegenState *state = getCodegenState();
+
+    CompiledCode *code = new CompiledCode();
+    code->hash = hash;
+    code->key = key;
+    code->refcount = 1;
+    code->tier = tier;
+    code->state = state;
+    code->engine = NULL;
+
+    pthread_mutex_lock(&StatesLock);
+    state->codes++;
+    pthread_mutex_unlock(&StatesLock);
+
+    pthread_mutex_lock(&state->lock);
+
+    // Try to reuse the code generated by an earlier run first
+    if (DDT_Cache() == NULL || !compileCached(state, code, ddt, pack, stream, &target)) {
+        ExecutionEngine *engine = getEngine(state, tier);
+        Module *module = state->module[tier];
+        FunctionPassManager *fpm = (tier == FULL_TIER) ? state->fpm : NULL;
+
+        code->F = codegenFunction(state, ddt, (pack) ? "pack" : "unpack", module, fpm, pack, stream, &target);
+
+        #if LLVM_OUTPUT
+        // std::vector<Type *> arg_type;
+        // arg_type.push_back(LLVM_INT8PTR);
+        // arg_type.push_back(LLVM_INT8PTR);
+        // arg_type.push_back(LLVM_INT64);
+        // Function *memcopy = Intrinsic::getDeclaration(module, Intrinsic::memcpy, arg_type);
+        // memcopy->dump();
+
+        // std::vector<Type *> prefetch_arg_type;
+        // Function *prefetch = Intrinsic::getDeclaration(module,Intrinsic::prefetch, prefetch_arg_type);
+        // prefetch->dump();
+
+        module->dump();
         #endif
+
+        code->function = (void (*)(void*,long,void*))(intptr_t)
+            engine->getPointerToFunction(code->F);
     }
 
-    #if LLVM_OUTPUT
-    // std::vector<Type *> arg_type;
-    // arg_type.push_back(LLVM_INT8PTR);
-    // arg_type.push_back(LLVM_INT8PTR);
-    // arg_type.push_back(LLVM_INT64);
-    // Function *memcopy = Intrinsic::getDeclaration(module, Intrinsic::memcpy, arg_type);
-    // memcopy->dump();
+    pthread_mutex_unlock(&state->lock);
+
+    pthread_mutex_lock(&CodeTableLock);
+    CodeTable.insert(std::make_pair(hash, code));
+    pthread_mutex_unlock(&CodeTableLock);
 
-    // std::vector<Type *> prefetch_arg_type;
-    // Function *prefetch = Intrinsic::getDeclaration(module,Intrinsic::prefetch, prefetch_arg_type);
-    // prefetch->dump();
+    pthread_mutex_lock(&StatsLock);
+    Stats.compiles[tier]++;
+    Stats.compile_time[tier] += wtime() - start;
+    pthread_mutex_unlock(&StatsLock);
 
-    module->dump();
+    return code;
+}
+
+// Makes code the pack (or unpack) function of target. Threads packing with
+// target concurrently either see the old or the new function.
+static void installCode(Datatype *target, CompiledCode *code, bool pack) {
+    // Recommitting finds the code which is installed already, which only
+    // needs to drop the reference it took
+    if (code == ((pack) ? target->packcode : target->unpackcode)) {
+        releaseCode(code);
+        return;
+    }
 
+    CompiledCode *old;
     if (pack) {
-        this->pack = (void (*)(void*,int,void*))(intptr_t)
-            TheExecutionEngine->getPointerToFunction(this->fpack);
+        old = target->packcode;
+        target->packcode = code;
+        target->packtier = code->tier;
+        __atomic_store_n(&target->pack, code->function, __ATOMIC_RELEASE);
+    }
+    else {
+        old = target->unpackcode;
+        target->unpackcode = code;
+        target->unpacktier = code->tier;
+        __atomic_store_n(&target->unpack, code->function, __ATOMIC_RELEASE);
+    }
+
+    // Recommitting (or recompiling) a datatype replaces its code. The old
+    // code may still be running in another thread, which loaded the
+    // function before it was replaced, so it is kept until the datatype
+    // is freed.
+    if (old != NULL) target->retired.push_back(old);
+}
+
+
+/* Background compilation. If enabled, commits (and promotions to a higher
+   tier) only queue a job for the compiler thread and return. Until the job
+   is done, pack and unpack run the code they had before, or interpret the
+   datatype. */
+struct CompileJob {
+    // The committed datatype, NULL if it was freed while the job was
+    // compiled
+    Datatype *target;
+
+    // Compressed copy of target, owned by the job
+    Datatype *ddt;
+
+    bool pack;
+    bool unpack;
+    int tier;
+};
+
+static bool AsyncCommit = false;
+static bool CompilerShutdown = false;
+static pthread_t CompilerThread;
+static std::deque<CompileJob*> Jobs;
+static pthread_mutex_t JobsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t JobsCond = PTHREAD_COND_INITIALIZER;
+
+// Drops the pending job of target, if there is one
+static void cancelJob(Datatype *target) {
+    pthread_mutex_lock(&JobsLock);
+    CompileJob *job = target->job;
+    if (job != NULL) {
+        std::deque<CompileJob*>::iterator it = std::find(Jobs.begin(), Jobs.end(), job);
+        if (it != Jobs.end()) {
+            Jobs.erase(it);
+            delete job->ddt;
+            delete job;
+        }
+        else {
+            // The job is compiled right now, its compiler frees it
+            job->target = NULL;
+        }
+        target->job = NULL;
+    }
+    pthread_mutex_unlock(&JobsLock);
+}
+
+static void runJob(CompileJob *job) {
+    std::string repr = job->ddt->toString();
+    CompiledCode *packcode = (job->pack) ? acquireCode(job->ddt, repr, true, job->tier, false) : NULL;
+    CompiledCode *unpackcode = (job->unpack) ? acquireCode(job->ddt, repr, false, job->tier, false) : NULL;
+
+    pthread_mutex_lock(&JobsLock);
+    Datatype *target = job->target;
+    if (target != NULL) {
+        if (packcode != NULL) installCode(target, packcode, true);
+        if (unpackcode != NULL) installCode(target, unpackcode, false);
+        target->job = NULL;
+    }
+    pthread_mutex_unlock(&JobsLock);
+
+    if (target == NULL) {
+        releaseCode(packcode);
+        releaseCode(unpackcode);
+    }
+    delete job->ddt;
+    delete job;
+}
+
+static void* compilerThread(void *arg) {
+    pthread_mutex_lock(&JobsLock);
+    while (true) {
+        while (Jobs.empty() && !CompilerShutdown) {
+            pthread_cond_wait(&JobsCond, &JobsLock);
+        }
+        if (CompilerShutdown) break;
+
+        CompileJob *job = Jobs.front();
+        Jobs.pop_front();
+        pthread_mutex_unlock(&JobsLock);
+
+        runJob(job);
+
+        pthread_mutex_lock(&JobsLock);
+    }
+    pthread_mutex_unlock(&JobsLock);
+
+    return NULL;
+}
+
+// Brings the pack and/or unpack function of target up to the given tier.
+// Code of identical datatypes at this (or a higher) tier is used right
+// away, everything else is compiled in the background if enabled, and in
+// the calling thread otherwise. If generate is false no code is generated.
+static void raiseTier(Datatype *target, bool pack, bool unpack, int tier, bool generate) {
+    // Datatypes are immutable, so code which is already there (or which
+    // is being generated) stays valid
+    if (__atomic_load_n(&target->job, __ATOMIC_RELAXED) != NULL) return;
+    pack   = pack   && (target->packtier < tier);
+    unpack = unpack && (target->unpacktier < tier);
+    if (!pack && !unpack) return;
+
+    #if DDT_OPTIMIZE
+    Datatype *ddt = target->compress();
+    #else
+    Datatype *ddt = target->clone();
+    #endif
+
+    std::string repr = ddt->toString();
+    CompiledCode *packcode = NULL;
+    CompiledCode *unpackcode = NULL;
+    for (int t=FULL_TIER; t>=tier; t--) {
+        DDT_Target codetarget;
+        codeTarget(repr, t, &codetarget);
+        if (pack && packcode == NULL) packcode = findCode(repr, true, t, false, codetarget);
+        if (unpack && unpackcode == NULL) unpackcode = findCode(repr, false, t, false, codetarget);
     }
-    if (unpack) {
-        this->unpack = (void (*)(void*,int,void*))(intptr_t)
-            TheExecutionEngine->getPointerToFunction(this->funpack);
+
+    CompileJob *job = NULL;
+    pthread_mutex_lock(&JobsLock);
+    if (target->job == NULL) {
+        if (packcode != NULL && packcode->tier > target->packtier) {
+            installCode(target, packcode, true);
+            packcode = NULL;
+        }
+        if (unpackcode != NULL && unpackcode->tier > target->unpacktier) {
+            installCode(target, unpackcode, false);
+            unpackcode = NULL;
+        }
+
+        pack   = pack   && (target->packtier < tier);
+        unpack = unpack && (target->unpacktier < tier);
+        if (generate && (pack || unpack)) {
+            job = new CompileJob();
+            job->target = target;
+            job->ddt = ddt;
+            job->pack = pack;
+            job->unpack = unpack;
+            job->tier = tier;
+            target->job = job;
+
+            if (AsyncCommit) {
+                Jobs.push_back(job);
+                pthread_cond_signal(&JobsCond);
+            }
+        }
     }
+    pthread_mutex_unlock(&JobsLock);
+
+    // Code which was found, but not needed
+    releaseCode(packcode);
+    releaseCode(unpackcode);
+
+    if (job == NULL) delete ddt;
+    else if (!AsyncCommit) runJob(job);
+}
+
+static void startCompilerThread() {
+    if (!AsyncCommit) return;
+
+    CompilerShutdown = false;
+    if (pthread_create(&CompilerThread, NULL, compilerThread, NULL) != 0) {
+        fprintf(stderr, "Could not start the compiler thread, compiling synchronously\n");
+        AsyncCommit = false;
+    }
+}
+
+// Pending jobs are dropped, their datatypes keep running what they have
+static void stopCompilerThread() {
+    if (!AsyncCommit) return;
+
+    pthread_mutex_lock(&JobsLock);
+    CompilerShutdown = true;
+    pthread_cond_signal(&JobsCond);
+    pthread_mutex_unlock(&JobsLock);
+    pthread_join(CompilerThread, NULL);
+
+    while (!Jobs.empty()) {
+        CompileJob *job = Jobs.front();
+        Jobs.pop_front();
+        if (job->target != NULL) job->target->job = NULL;
+        delete job->ddt;
+        delete job;
+    }
+    AsyncCommit = false;
+}
+
+void Datatype::compile(CompilationType type) {
+    // Compress the datatype, by substituting datatypes for
+    // equivalent, but more compact, datatypes
+    #if DDT_OPTIMIZE
+    Datatype *ddt = this->compress();
+    #else
+    Datatype *ddt = this;
     #endif
 
+    bool pack   = (type == PACK_UNPACK || type == PACK)   ? true : false;
+    bool unpack = (type == PACK_UNPACK || type == UNPACK) ? true : false;
+
+    // The canonical serialization of the compressed datatype identifies
+    // structurally identical datatypes
+    std::string repr = ddt->toString();
+
+    if (pack)   installCode(this, acquireCode(ddt, repr, true, FULL_TIER, false), true);
+    if (unpack) installCode(this, acquireCode(ddt, repr, false, FULL_TIER, false), false);
+
     #if DDT_OPTIMIZE
     delete ddt;
     #endif
@@ -193,16 +955,51 @@ void Datatype::print(bool summary) {
 
 
 /* PrimitiveDatatype */
+// Name and size of the primitive types, in the order of PrimitiveType
+static const struct {
+    const char* name;
+    int size;
+} primitive_types[PrimitiveDatatype::NUM_PRIMITIVE_TYPES] = {
+    {"byte",        1},
+    {"char",        sizeof(char)},
+    {"double",      sizeof(double)},
+    {"float",       sizeof(float)},
+    {"int",         sizeof(int)},
+    {"schar",       sizeof(signed char)},
+    {"uchar",       sizeof(unsigned char)},
+    {"wchar",       sizeof(wchar_t)},
+    {"short",       sizeof(short)},
+    {"ushort",      sizeof(unsigned short)},
+    {"unsigned",    sizeof(unsigned int)},
+    {"long",        sizeof(long)},
+    {"ulong",       sizeof(unsigned long)},
+    {"ldouble",     sizeof(long double)},
+    {"longlong",    sizeof(long long)},
+    {"ulonglong",   sizeof(unsigned long long)},
+    {"int8",        sizeof(int8_t)},
+    {"int16",       sizeof(int16_t)},
+    {"int32",       sizeof(int32_t)},
+    {"int64",       sizeof(int64_t)},
+    {"uint8",       sizeof(uint8_t)},
+    {"uint16",      sizeof(uint16_t)},
+    {"uint32",      sizeof(uint32_t)},
+    {"uint64",      sizeof(uint64_t)},
+    {"bool",        sizeof(bool)},
+    {"aint",        sizeof(long)},
+    {"offset",      sizeof(long long)},
+    {"fcomplex",    2*sizeof(float)},
+    {"dcomplex",    2*sizeof(double)},
+    {"ldcomplex",   2*sizeof(long double)},
+};
+
+int PrimitiveDatatype::getTypeSize(PrimitiveDatatype::PrimitiveType type) {
+    return primitive_types[type].size;
+}
+
 PrimitiveDatatype::PrimitiveDatatype(PrimitiveDatatype::PrimitiveType type) : Datatype() {
 
     this->type = type;
-
-    if (type == BYTE)   this->size = 1;
-    if (type == CHAR)   this->size = 1;
-    if (type == DOUBLE) this->size = sizeof(double);
-    if (type == FLOAT)  this->size = sizeof(float);
-    if (type == INT)    this->size = sizeof(int);
-    //TODO add more. Remember to also add them to the print function.
+    this->size = getTypeSize(type);
 
     this->true_lower_bound = 0;
     this->true_upper_bound = this->size;
@@ -243,57 +1040,78 @@ std::vector<Datatype*> PrimitiveDatatype::getSubtypes() {
     return subtypes;
 }
 
-int PrimitiveDatatype::getExtent() {
+long PrimitiveDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int PrimitiveDatatype::getTrueExtent() {
+long PrimitiveDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int PrimitiveDatatype::getLowerBound() {
+long PrimitiveDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int PrimitiveDatatype::getTrueLowerBound() {
+long PrimitiveDatatype::getTrueLowerBound() {
     return this->true_lower_bound;
 }
 
-int PrimitiveDatatype::getUpperBound() {
+long PrimitiveDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int PrimitiveDatatype::getTrueUpperBound() {
+long PrimitiveDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
-int PrimitiveDatatype::getSize() {
+long PrimitiveDatatype::getSize() {
     return this->size;
 }
 
 string PrimitiveDatatype::toString(bool summary) {
-    string res = "";
-    switch (this->type) {
-    case BYTE:
-        res.append("byte");
-        break;
-    case CHAR:
-        res.append("char");
-        break;
-    case DOUBLE:
-        res.append("double");
-        break;
-    case FLOAT:
-        res.append("float");
-        break;
-    case INT:
-        res.append("int");
-        break;
-    default:
-        res.append("N/A");
-        break;
+    return primitive_types[this->type].name;
+}
+
+
+/* Bounds of derived types */
+
+// Extends the bounds by blocklen consecutive elements of basetype at the
+// byte displacement displ. Like in MPI, empty blocks do not contribute to
+// the bounds, and the bounds of a type without any non-empty block are 0.
+// The strides and displacements may be negative.
+static void extendBounds(Datatype *basetype, long displ, int blocklen, bool *empty,
+                         long *lb, long *ub, long *true_lb, long *true_ub) {
+    if (blocklen <= 0) return;
+
+    // The last element is the lowest one if the extent is negative
+    long last = displ + (long) (blocklen - 1) * basetype->getExtent();
+    long first = std::min(displ, last);
+    last = std::max(displ, last);
+
+    long block_lb = first + basetype->getLowerBound();
+    long block_ub = last + basetype->getUpperBound();
+    long block_true_lb = first + basetype->getTrueLowerBound();
+    long block_true_ub = last + basetype->getTrueUpperBound();
+
+    if (*empty) {
+        *lb = block_lb;
+        *ub = block_ub;
+        *true_lb = block_true_lb;
+        *true_ub = block_true_ub;
+        *empty = false;
     }
-    return res;
+    else {
+        *lb = std::min(*lb, block_lb);
+        *ub = std::max(*ub, block_ub);
+        *true_lb = std::min(*true_lb, block_true_lb);
+        *true_ub = std::max(*true_ub, block_true_ub);
+    }
+}
+
+// Counts and strides of compressed types are ints, a compression whose
+// products do not fit into one is not done
+static inline bool fitsInt(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
 }
 
 
@@ -303,11 +1121,13 @@ ContiguousDatatype::ContiguousDatatype(int count, Datatype* basetype) {
     this->basetype = basetype->clone();
     this->count = count;
 
-    this->lower_bound = basetype->getLowerBound();
-    this->true_lower_bound = basetype->getTrueLowerBound();
-    int basetype_ub = basetype->getLowerBound() + basetype->getExtent();
-    this->upper_bound = basetype_ub + basetype->getExtent() * (count - 1);
-    this->true_upper_bound = basetype->getTrueUpperBound() + basetype->getExtent() * (count - 1);
+    bool empty = true;
+    this->lower_bound = 0;
+    this->upper_bound = 0;
+    this->true_lower_bound = 0;
+    this->true_upper_bound = 0;
+    extendBounds(basetype, 0, count, &empty, &this->lower_bound, &this->upper_bound,
+                 &this->true_lower_bound, &this->true_upper_bound);
 
     this->size = this->count * this->basetype->getSize();
 
@@ -322,12 +1142,21 @@ ContiguousDatatype* ContiguousDatatype::clone() {
 }
 
 void ContiguousDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    // Contiguous primitives are copied in one go
+    if (dynamic_cast<PrimitiveDatatype*>(this->basetype) != NULL) {
+        basetype->packCodegen(inbuf, multNode(this->count, incount), outbuf);
+        return;
+    }
     codegenContiguous(inbuf, incount, outbuf, this->basetype, 
                       this->getExtent(), this->getSize(), 
                       this->count, true);
 }
 
 void ContiguousDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    if (dynamic_cast<PrimitiveDatatype*>(this->basetype) != NULL) {
+        basetype->unpackCodegen(inbuf, multNode(this->count, incount), outbuf);
+        return;
+    }
     codegenContiguous(inbuf, incount, outbuf, this->basetype, 
                       this->getSize(), this->getExtent(), 
                       this->count, false);
@@ -341,7 +1170,8 @@ Datatype *ContiguousDatatype::compress() {
     // Compress contiguous basetypes into count.  Only applies if
     // basetype's extent is the same as its size.
     ContiguousDatatype *ctg = dynamic_cast<ContiguousDatatype*>(cbasetype);
-    if (ctg != NULL && ctg->getExtent() == ctg->getSize()) {
+    if (ctg != NULL && ctg->getExtent() == ctg->getSize() &&
+        fitsInt((long) this->count * ctg->getCount())) {
         datatype = new ContiguousDatatype(this->count * ctg->getCount(), ctg->getBasetype());
         delete cbasetype;
     }
@@ -369,31 +1199,31 @@ std::vector<Datatype*> ContiguousDatatype::getSubtypes() {
     return subtypes;
 }
 
-int ContiguousDatatype::getExtent() {
+long ContiguousDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int ContiguousDatatype::getTrueExtent() {
+long ContiguousDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int ContiguousDatatype::getSize() {
+long ContiguousDatatype::getSize() {
     return this->size;
 }
 
-int ContiguousDatatype::getLowerBound() {
+long ContiguousDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int ContiguousDatatype::getTrueLowerBound() {
+long ContiguousDatatype::getTrueLowerBound() {
     return this->true_lower_bound;
 }
 
-int ContiguousDatatype::getUpperBound() {
+long ContiguousDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int ContiguousDatatype::getTrueUpperBound() {
+long ContiguousDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
@@ -412,6 +1242,125 @@ string ContiguousDatatype::toString(bool summary) {
 }
 
 
+/* Nested vector types */
+
+// Returns candidate if the generated code for it accesses the same memory
+// as the code for orig, otherwise deletes it and returns NULL
+static Datatype* sameLayout(Datatype *orig, Datatype *candidate) {
+    if (candidate->getSize() == orig->getSize() &&
+        candidate->getExtent() == orig->getExtent() &&
+        candidate->getLowerBound() == orig->getLowerBound()) {
+        return candidate;
+    }
+    delete candidate;
+    return NULL;
+}
+
+// Describes a chain of nested (h)vectors as a loop nest over counts[d]
+// elements with a byte stride of strides[d] (outermost dimension first)
+// around leafcount consecutive elements of leaf. Dimensions whose strides
+// compose are collapsed, so the innermost run is as long as possible.
+// Returns the number of (h)vectors in the chain, or 0 if it is empty.
+static int vectorChain(Datatype *ddt, std::vector<int> &counts, std::vector<long> &strides,
+                       Datatype **leaf, int *leafcount) {
+    std::vector<int> dimcounts;
+    std::vector<long> dimstrides;
+    int levels = 0;
+    while (true) {
+        VectorDatatype *vec = dynamic_cast<VectorDatatype*>(ddt);
+        HVectorDatatype *hvec = dynamic_cast<HVectorDatatype*>(ddt);
+        if (vec != NULL) {
+            Datatype *basetype = vec->getBasetype();
+            dimcounts.push_back(vec->getCount());
+            dimstrides.push_back((long) vec->getStride() * basetype->getExtent());
+            dimcounts.push_back(vec->getBlocklen());
+            dimstrides.push_back(basetype->getExtent());
+            ddt = basetype;
+        }
+        else if (hvec != NULL) {
+            Datatype *basetype = hvec->getBasetype();
+            dimcounts.push_back(hvec->getCount());
+            dimstrides.push_back(hvec->getStride());
+            dimcounts.push_back(hvec->getBlocklen());
+            dimstrides.push_back(basetype->getExtent());
+            ddt = basetype;
+        }
+        else break;
+        levels++;
+    }
+
+    *leaf = ddt;
+    *leafcount = 1;
+    counts.clear();
+    strides.clear();
+
+    // Collapse from the innermost dimension outwards
+    for (int d=dimcounts.size()-1; d>=0; d--) {
+        if (dimcounts[d] == 0) return 0;
+        if (dimcounts[d] == 1) continue;
+
+        if (counts.empty() && dimstrides[d] == *leafcount * (long) ddt->getExtent()) {
+            *leafcount *= dimcounts[d];
+        }
+        else if (!counts.empty() && dimstrides[d] == counts.back() * strides.back()) {
+            counts.back() *= dimcounts[d];
+        }
+        else {
+            counts.push_back(dimcounts[d]);
+            strides.push_back(dimstrides[d]);
+        }
+    }
+    std::reverse(counts.begin(), counts.end());
+    std::reverse(strides.begin(), strides.end());
+
+    return levels;
+}
+
+// Replaces a chain of nested (h)vectors by a single one if all but one
+// dimension collapse
+static Datatype* collapseVectorChain(Datatype *datatype) {
+    std::vector<int> counts;
+    std::vector<long> strides;
+    Datatype *leaf;
+    int leafcount;
+    if (vectorChain(datatype, counts, strides, &leaf, &leafcount) < 2 || counts.size() > 1) {
+        return datatype;
+    }
+
+    Datatype *candidate;
+    long leafextent = leaf->getExtent();
+    if (counts.empty()) {
+        candidate = new ContiguousDatatype(leafcount, leaf);
+    }
+    else if (leafextent > 0 && strides[0] % leafextent == 0) {
+        candidate = new VectorDatatype(counts[0], leafcount, strides[0] / leafextent, leaf);
+    }
+    else {
+        candidate = new HVectorDatatype(counts[0], leafcount, strides[0], leaf);
+    }
+
+    candidate = sameLayout(datatype, candidate);
+    if (candidate == NULL) return datatype;
+    delete datatype;
+    return candidate;
+}
+
+// Generates a single loop nest for chains of nested (h)vectors instead of
+// one codegenVector loop pair per level. Returns false for single vectors.
+static bool codegenVectorChain(Datatype *ddt, Value* inbuf, Value* incount,
+                               Value* outbuf, bool pack) {
+    std::vector<int> counts;
+    std::vector<long> strides;
+    Datatype *leaf;
+    int leafcount;
+    if (vectorChain(ddt, counts, strides, &leaf, &leafcount) < 2) return false;
+
+    codegenVectorNest(inbuf, incount, outbuf, leaf, leafcount, counts, strides,
+                      ddt->getExtent(), pack);
+    return true;
+}
+
+
 /* Class VectorDatatype */
 VectorDatatype::VectorDatatype(int count, int blocklen, int stride, Datatype* basetype) {
 
@@ -420,21 +1369,22 @@ VectorDatatype::VectorDatatype(int count, int blocklen, int stride, Datatype* ba
     this->stride = stride;
     this->basetype = basetype->clone();
 
-    //TODO how does the typemap look if  blocklen > stride?
-    if (stride > 0) {
-        this->lower_bound = basetype->getLowerBound();
-        this->true_lower_bound = basetype->getTrueLowerBound();
-        this->upper_bound = basetype->getUpperBound() + (stride * (count-1) + blocklen-1) * basetype->getExtent();
-        this->true_upper_bound = basetype->getTrueUpperBound() + (stride * (count-1) + blocklen-1) * basetype->getExtent();
-    }
-    else {
-        this->lower_bound = basetype->getUpperBound() + (stride * (count-1) + blocklen-1) * basetype->getExtent();
-        this->true_lower_bound = basetype->getUpperBound() + (stride * (count-1) + blocklen-1) * basetype->getExtent();
-        this->upper_bound = blocklen * basetype->getExtent();
-        this->true_upper_bound = blocklen * basetype->getTrueExtent();
+    // The blocks are equally spaced, so only the first and the last one
+    // can be at the bounds
+    bool empty = true;
+    this->lower_bound = 0;
+    this->upper_bound = 0;
+    this->true_lower_bound = 0;
+    this->true_upper_bound = 0;
+    if (count > 0) {
+        long last = (long) stride * (count-1) * basetype->getExtent();
+        extendBounds(basetype, 0, blocklen, &empty, &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
+        extendBounds(basetype, last, blocklen, &empty, &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
     }
-    
-    this->size = count * blocklen * this->basetype->getSize();
+
+    this->size = (long) count * blocklen * this->basetype->getSize();
 
 }
 
@@ -448,6 +1398,7 @@ VectorDatatype* VectorDatatype::clone() {
 }
 
 void VectorDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    if (codegenVectorChain(this, inbuf, incount, outbuf, true)) return;
     codegenVector(inbuf, incount, outbuf, this->basetype, this->count,
                   this->blocklen, 
                   this->basetype->getExtent() * this->stride,
@@ -456,6 +1407,7 @@ void VectorDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
 }
 
 void VectorDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    if (codegenVectorChain(this, inbuf, incount, outbuf, false)) return;
     codegenVector(inbuf, incount, outbuf, this->basetype, this->count,
                   this->blocklen, 
                   this->basetype->getSize() * this->blocklen,
@@ -470,7 +1422,9 @@ Datatype *VectorDatatype::compress() {
     // Compress contiguous basetypes into blocklen.  Only applies if
     // basetype's extent is the same as its size.
     ContiguousDatatype *ctg = dynamic_cast<ContiguousDatatype*>(cbasetype);
-    if (ctg != NULL && ctg->getExtent() == ctg->getSize()) {
+    if (ctg != NULL && ctg->getExtent() == ctg->getSize() &&
+        fitsInt((long) this->blocklen * ctg->getCount()) &&
+        fitsInt((long) this->stride * ctg->getCount())) {
         datatype = new VectorDatatype(this->count,
                                       this->blocklen * ctg->getCount(),
                                       this->stride * ctg->getCount(),
@@ -486,11 +1440,14 @@ Datatype *VectorDatatype::compress() {
 
     // Try to promote the vector to a contiguous type
     VectorDatatype *vecdt = (VectorDatatype*)datatype;
-    if (vecdt->getStride() == vecdt->getBlocklen()) {
-        int contigCount = vecdt->getCount() * vecdt->getBlocklen();
+    long contigCount = (long) vecdt->getCount() * vecdt->getBlocklen();
+    if (vecdt->getStride() == vecdt->getBlocklen() && fitsInt(contigCount)) {
         datatype = new ContiguousDatatype(contigCount, vecdt->getBasetype());
         delete vecdt;
     }
+    else {
+        datatype = collapseVectorChain(datatype);
+    }
 
     assert(datatype->getSize() == this->getSize());
     assert(datatype->getExtent() == this->getExtent());
@@ -512,31 +1469,31 @@ std::vector<Datatype*> VectorDatatype::getSubtypes() {
     return subtypes;
 }
 
-int VectorDatatype::getExtent() {
+long VectorDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int VectorDatatype::getTrueExtent() {
+long VectorDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int VectorDatatype::getSize() {
+long VectorDatatype::getSize() {
     return this->size;
 }
 
-int VectorDatatype::getLowerBound() {
+long VectorDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int VectorDatatype::getTrueLowerBound() {
-    return this->lower_bound;
+long VectorDatatype::getTrueLowerBound() {
+    return this->true_lower_bound;
 }
 
-int VectorDatatype::getUpperBound() {
+long VectorDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int VectorDatatype::getTrueUpperBound() {
+long VectorDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
@@ -566,35 +1523,29 @@ string VectorDatatype::toString(bool summary) {
 
 
 /* Class HVectorDatatype */
-HVectorDatatype::HVectorDatatype(int count, int blocklen, int stride, Datatype* basetype) {
+HVectorDatatype::HVectorDatatype(int count, int blocklen, long stride, Datatype* basetype) {
 
     this->count = count;
     this->blocklen = blocklen;
     this->stride = stride;
     this->basetype = basetype->clone();
 
-    //TODO how does the typemap look if blocklen > stride or stride == 0?
-    if (stride > 0) {
-        this->lower_bound = basetype->getLowerBound();
-        this->true_lower_bound = basetype->getTrueLowerBound();
-        this->upper_bound = basetype->getUpperBound() + stride * (count-1) + (blocklen-1) * basetype->getExtent();
-        this->true_upper_bound = basetype->getTrueUpperBound() + stride * (count-1) + (blocklen-1) * basetype->getExtent();
-    }
-    else {
-        this->lower_bound = basetype->getUpperBound() + (stride * (count-1) + blocklen-1) * basetype->getExtent();
-        this->true_lower_bound = basetype->getUpperBound() + stride * (count-1) + (blocklen-1) * basetype->getExtent();
-        this->upper_bound = blocklen * basetype->getExtent();
-        this->true_upper_bound = blocklen * basetype->getTrueExtent();
-    }
-
-    if (count == 0) {
-        this->lower_bound = 0;
-        this->upper_bound = 0;
-        this->true_lower_bound = 0;
-        this->true_upper_bound = 0;
+    // The blocks are equally spaced, so only the first and the last one
+    // can be at the bounds
+    bool empty = true;
+    this->lower_bound = 0;
+    this->upper_bound = 0;
+    this->true_lower_bound = 0;
+    this->true_upper_bound = 0;
+    if (count > 0) {
+        long last = (long) stride * (count-1);
+        extendBounds(basetype, 0, blocklen, &empty, &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
+        extendBounds(basetype, last, blocklen, &empty, &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
     }
 
-    this->size = this->count * this->blocklen*this->basetype->getSize();
+    this->size = (long) this->count * this->blocklen * this->basetype->getSize();
 } 
 
 HVectorDatatype* HVectorDatatype::clone() {
@@ -606,12 +1557,14 @@ HVectorDatatype::~HVectorDatatype(void) {
 }
 
 void HVectorDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    if (codegenVectorChain(this, inbuf, incount, outbuf, true)) return;
     codegenVector(inbuf, incount, outbuf, this->basetype, this->count,
                   this->blocklen, this->stride, this->basetype->getSize() * this->blocklen, 
                   this->getExtent(), this->getSize(), true);
 }
 
 void HVectorDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    if (codegenVectorChain(this, inbuf, incount, outbuf, false)) return;
     codegenVector(inbuf, incount, outbuf, this->basetype, this->count,
                   this->blocklen, this->basetype->getSize() * this->blocklen, 
                   this->stride, this->getSize(), this->getExtent(), false);
@@ -624,7 +1577,8 @@ Datatype *HVectorDatatype::compress() {
     // Compress contiguous basetypes into blocklen.  Only applies if
     // basetype's extent is the same as its size.
     ContiguousDatatype *ctg = dynamic_cast<ContiguousDatatype*>(cbasetype);
-    if (ctg != NULL && ctg->getExtent() == ctg->getSize()) {
+    if (ctg != NULL && ctg->getExtent() == ctg->getSize() &&
+        fitsInt((long) this->blocklen * ctg->getCount())) {
         datatype = new HVectorDatatype(this->count,
                                        this->blocklen * ctg->getCount(),
                                        this->stride,
@@ -640,11 +1594,15 @@ Datatype *HVectorDatatype::compress() {
 
     // Try to promote the vector to a contiguous type
     HVectorDatatype *vecdt = (HVectorDatatype*)datatype;
-    if (vecdt->getStride() == (vecdt->getBlocklen() * vecdt->getBasetype()->getExtent())) {
-        int contigCount = vecdt->getCount() * vecdt->getBlocklen();
+    long contigCount = (long) vecdt->getCount() * vecdt->getBlocklen();
+    if (vecdt->getStride() == (vecdt->getBlocklen() * vecdt->getBasetype()->getExtent()) &&
+        fitsInt(contigCount)) {
         datatype = new ContiguousDatatype(contigCount, vecdt->getBasetype());
         delete vecdt;
     }
+    else {
+        datatype = collapseVectorChain(datatype);
+    }
 
     assert(datatype->getSize() == this->getSize());
     assert(datatype->getExtent() == this->getExtent());
@@ -666,36 +1624,36 @@ std::vector<Datatype*> HVectorDatatype::getSubtypes() {
     return subtypes;
 }
 
-int HVectorDatatype::getExtent() {
+long HVectorDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int HVectorDatatype::getTrueExtent() {
+long HVectorDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int HVectorDatatype::getSize() {
+long HVectorDatatype::getSize() {
     return this->size;
 }
 
-int HVectorDatatype::getLowerBound() {
+long HVectorDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int HVectorDatatype::getTrueLowerBound() {
-    return this->lower_bound;
+long HVectorDatatype::getTrueLowerBound() {
+    return this->true_lower_bound;
 }
 
-int HVectorDatatype::getUpperBound() {
+long HVectorDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int HVectorDatatype::getTrueUpperBound() {
+long HVectorDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
 /*
-int HVectorDatatype::getExtent() {
+long HVectorDatatype::getExtent() {
     if (this->stride > 0) return (this->count-1)*this->stride + this->blocklen*this->basetype->getExtent();
     else return (-((this->count-1)*this->stride + this->blocklen*this->basetype->getExtent()) + this->count*this->blocklen*this->basetype->getExtent());
 }
@@ -709,7 +1667,7 @@ int HVectorDatatype::getBlocklen() {
     return blocklen;
 }
 
-int HVectorDatatype::getStride() {
+long HVectorDatatype::getStride() {
     return stride;
 }
 
@@ -725,6 +1683,81 @@ string HVectorDatatype::toString(bool summary) {
 }
 
 
+/* Pattern recognition for indexed types */
+
+// Rewrites blocks of a (compressed) basetype at byte displacements into a
+// simpler datatype if they follow a pattern: touching blocks are merged,
+// uniform blocks with a constant stride become a (h)vector or contiguous
+// type and other uniform blocks an indexed block type. Returns NULL if
+// nothing could be simplified.
+static Datatype* compressBlocks(Datatype *orig, int count, const vector<int> &blocklens,
+                                const vector<long> &displs, Datatype *basetype) {
+    long extent = basetype->getExtent();
+
+    // Merge blocks where the next one starts right after the previous one
+    std::vector<int> mblocklens;
+    std::vector<long> mdispls;
+    for (int i=0; i<count; i++) {
+        int n = mblocklens.size();
+        if (n > 0 && mdispls[n-1] + mblocklens[n-1] * extent == displs[i]) {
+            mblocklens[n-1] += blocklens[i];
+        }
+        else {
+            mblocklens.push_back(blocklens[i]);
+            mdispls.push_back(displs[i]);
+        }
+    }
+
+    int n = mblocklens.size();
+    if (n == 0) return NULL;
+
+    bool uniform = true;
+    bool arithmetic = (n == 1) || (mdispls[1] > mdispls[0]);
+    for (int i=1; i<n; i++) {
+        uniform = uniform && (mblocklens[i] == mblocklens[0]);
+        arithmetic = arithmetic && (mdispls[i] - mdispls[i-1] == mdispls[1] - mdispls[0]);
+    }
+
+    Datatype *datatype = NULL;
+    if (uniform && arithmetic && mdispls[0] == 0) {
+        Datatype *candidate;
+        long stride = (n > 1) ? mdispls[1] : mblocklens[0] * extent;
+        if (n == 1) {
+            candidate = new ContiguousDatatype(mblocklens[0], basetype);
+        }
+        else if (extent > 0 && stride % extent == 0) {
+            candidate = new VectorDatatype(n, mblocklens[0], stride / extent, basetype);
+        }
+        else {
+            candidate = new HVectorDatatype(n, mblocklens[0], stride, basetype);
+        }
+        // fold it further, i.e., into a contiguous type
+        datatype = candidate->compress();
+        delete candidate;
+        datatype = sameLayout(orig, datatype);
+    }
+
+    // Indexed block displacements are in units of the basetype extent
+    if (datatype == NULL && uniform && n > 1 && extent > 0) {
+        std::vector<int> idispls(n);
+        bool multiple = true;
+        for (int i=0; i<n && multiple; i++) {
+            multiple = (mdispls[i] % extent == 0);
+            idispls[i] = mdispls[i] / extent;
+        }
+        if (multiple) {
+            datatype = sameLayout(orig, new IndexedBlockDatatype(n, mblocklens[0], &idispls[0], basetype));
+        }
+    }
+
+    if (datatype == NULL && n < count) {
+        datatype = sameLayout(orig, new HIndexedDatatype(n, &mblocklens[0], &mdispls[0], basetype));
+    }
+
+    return datatype;
+}
+
+
 /* Class IndexedBlockDatatype */
 IndexedBlockDatatype::IndexedBlockDatatype(int count, int blocklen, int* displ, Datatype* basetype) : Datatype() {
 
@@ -733,32 +1766,18 @@ IndexedBlockDatatype::IndexedBlockDatatype(int count, int blocklen, int* displ,
     this->blocklen = blocklen;
     this->lower_bound = 0;
     this->true_lower_bound = 0;
-    this->upper_bound = 0;
-    this->true_upper_bound = 0;
-    this->size = basetype->getSize() * count;
-
-    if (count > 0) {
-        // initialize lb and ub to real values
-        this->lower_bound = displ[0];
-        this->upper_bound = displ[0] + blocklen * basetype->getExtent(); 
-    }
+    this->upper_bound = 0;
+    this->true_upper_bound = 0;
+    this->size = basetype->getSize() * blocklen * count;
 
+    bool empty = true;
     for (int i=0; i<count; i++) {
         this->displs.push_back(displ[i]);
-        int tmp_ub = (displ[i] + blocklen) * this->basetype->getExtent();
-        int tmp_lb = displ[i] * this->basetype->getExtent();
-        if (tmp_ub > this->upper_bound) {
-            this->upper_bound = tmp_ub;
-        }
-        if (tmp_lb < this->lower_bound) {
-            this->lower_bound = tmp_lb;
-        }
+        extendBounds(basetype, (long) displ[i] * basetype->getExtent(), blocklen, &empty,
+                     &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
     }
 
-    //FIXME this could be different
-    this->true_upper_bound = this->upper_bound;
-    this->true_lower_bound = this->lower_bound;
-
     indices_arr = NULL;
 
 }
@@ -788,21 +1807,37 @@ void IndexedBlockDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* ou
 
 Datatype *IndexedBlockDatatype::compress() {
     Datatype *cbasetype = this->basetype->compress();
-    return new IndexedBlockDatatype(this->count, this->blocklen,
-                                    &(this->displs[0]), cbasetype);
+
+    std::vector<int> blocklens(this->count, this->blocklen);
+    std::vector<long> bytedispls(this->count);
+    for (int i=0; i<this->count; i++) {
+        bytedispls[i] = (long) this->displs[i] * cbasetype->getExtent();
+    }
+
+    Datatype *datatype = compressBlocks(this, this->count, blocklens, bytedispls, cbasetype);
+    if (datatype == NULL) {
+        datatype = new IndexedBlockDatatype(this->count, this->blocklen,
+                                            &(this->displs[0]), cbasetype);
+    }
+    delete cbasetype;
+
+    assert(datatype->getSize() == this->getSize());
+    assert(datatype->getExtent() == this->getExtent());
+
+    return datatype;
 }
 
 void IndexedBlockDatatype::globalCodegen(llvm::Module *mod) {
-    if(count > IDXB_LOOP_TRESHOLD) {
-        ArrayType* indices_types = ArrayType::get(LLVM_INT32, count);
+    if(count > CodeTarget->idxb_treshold) {
+        ArrayType* indices_types = ArrayType::get(LLVM_INT64, count);
         this->indices_arr = new GlobalVariable(*mod, indices_types, true,
                                                GlobalValue::InternalLinkage,
                                                0, "displacements");
-        indices_arr->setAlignment(4);
+        indices_arr->setAlignment(8);
 
         std::vector<Constant*> indices_vals(count);
         for (int i=0; i<count; i++) {
-            indices_vals[i] = constNode(displs[i] * basetype->getExtent());
+            indices_vals[i] = constNode((long) displs[i] * basetype->getExtent());
         }
         Constant* indices_initializer = ConstantArray::get(indices_types, indices_vals);
         indices_arr->setInitializer(indices_initializer);
@@ -821,31 +1856,31 @@ std::vector<Datatype*> IndexedBlockDatatype::getSubtypes() {
     return subtypes;
 }
 
-int IndexedBlockDatatype::getExtent() {
+long IndexedBlockDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int IndexedBlockDatatype::getTrueExtent() {
+long IndexedBlockDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int IndexedBlockDatatype::getSize() {
+long IndexedBlockDatatype::getSize() {
     return this->size;
 }
 
-int IndexedBlockDatatype::getLowerBound() {
+long IndexedBlockDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int IndexedBlockDatatype::getTrueLowerBound() {
-    return this->lower_bound;
+long IndexedBlockDatatype::getTrueLowerBound() {
+    return this->true_lower_bound;
 }
 
-int IndexedBlockDatatype::getUpperBound() {
+long IndexedBlockDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int IndexedBlockDatatype::getTrueUpperBound() {
+long IndexedBlockDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
@@ -880,31 +1915,19 @@ HIndexedDatatype::HIndexedDatatype(int count, int* blocklen, long* displ, Dataty
     this->upper_bound = 0;
     this->true_upper_bound = 0;
 
-    if (count > 0) {
-        // initialize lb and ub to real values
-        this->lower_bound = displ[0];
-        this->upper_bound = displ[0] + blocklen[0] * basetype->getExtent(); 
-    }
-
+    bool empty = true;
     for (int i=0; i<count; i++) {
         this->blocklens.push_back(blocklen[i]);
         this->displs.push_back(displ[i]);
 
         this->size += basetype->getSize() * blocklen[i];
-
-        int tmp_ub = displs[i] + blocklen[i] * basetype->getExtent();
-        int tmp_lb = displs[i];
-        if (tmp_ub > this->upper_bound) {
-            this->upper_bound = tmp_ub;
-        }
-        if (tmp_lb < this->lower_bound) {
-            this->lower_bound = tmp_lb;
-        }
+        extendBounds(basetype, displ[i], blocklen[i], &empty,
+                     &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
     }
 
-    //FIXME this could be different
-    this->true_upper_bound = this->upper_bound;
-    this->true_lower_bound = this->lower_bound;
+    displs_arr = NULL;
+    blocklens_arr = NULL;
 
 }
 
@@ -917,23 +1940,55 @@ HIndexedDatatype* HIndexedDatatype::clone() {
     return t_new;
 }
 
+void HIndexedDatatype::cleanup() {
+    if (displs_arr != NULL) displs_arr->eraseFromParent();
+    if (blocklens_arr != NULL) blocklens_arr->eraseFromParent();
+}
+
 void HIndexedDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
     codegenHindexed(outbuf, inbuf, incount, this->getExtent(), this->count,
-                    this->basetype, this->blocklens, this->displs, true);
+                    this->basetype, this->blocklens, this->displs,
+                    displs_arr, blocklens_arr, true);
 }
 
 void HIndexedDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
     codegenHindexed(inbuf, outbuf, incount, this->getExtent(), this->count,
-                    this->basetype, this->blocklens, this->displs, false);
+                    this->basetype, this->blocklens, this->displs,
+                    displs_arr, blocklens_arr, false);
 }
 
 Datatype *HIndexedDatatype::compress() {
     Datatype *cbasetype = this->basetype->compress();
-    return new HIndexedDatatype(this->count, &(this->blocklens[0]),
-                                &(this->displs[0]), cbasetype);
+    std::vector<int> cblocklens(this->blocklens);
+
+    // Compress contiguous basetypes into the blocklens.  Only applies if
+    // basetype's extent is the same as its size.
+    ContiguousDatatype *ctg = dynamic_cast<ContiguousDatatype*>(cbasetype);
+    if (ctg != NULL && ctg->getExtent() == ctg->getSize()) {
+        for (int i=0; i<this->count; i++) cblocklens[i] *= ctg->getCount();
+        cbasetype = ctg->getBasetype()->clone();
+        delete ctg;
+    }
+
+    Datatype *datatype = compressBlocks(this, this->count, cblocklens, this->displs, cbasetype);
+    if (datatype == NULL) {
+        datatype = new HIndexedDatatype(this->count, &(cblocklens[0]),
+                                        &(this->displs[0]), cbasetype);
+    }
+    delete cbasetype;
+
+    assert(datatype->getSize() == this->getSize());
+    assert(datatype->getExtent() == this->getExtent());
+
+    return datatype;
 }
 
 void HIndexedDatatype::globalCodegen(llvm::Module *mod) {
+    if (count > HIDX_LOOP_TRESHOLD) {
+        this->displs_arr = codegenBlockTable(mod, count, blocklens, displs, false);
+        this->blocklens_arr = codegenBlockTable(mod, count, blocklens, displs, true);
+    }
+
     basetype->globalCodegen(mod);
 };
 
@@ -947,31 +2002,31 @@ std::vector<Datatype*> HIndexedDatatype::getSubtypes() {
     return subtypes;
 }
 
-int HIndexedDatatype::getExtent() {
+long HIndexedDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int HIndexedDatatype::getTrueExtent() {
+long HIndexedDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int HIndexedDatatype::getSize() {
+long HIndexedDatatype::getSize() {
     return this->size;
 }
 
-int HIndexedDatatype::getLowerBound() {
+long HIndexedDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int HIndexedDatatype::getTrueLowerBound() {
-    return this->lower_bound;
+long HIndexedDatatype::getTrueLowerBound() {
+    return this->true_lower_bound;
 }
 
-int HIndexedDatatype::getUpperBound() {
+long HIndexedDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int HIndexedDatatype::getTrueUpperBound() {
+long HIndexedDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
@@ -993,10 +2048,6 @@ string HIndexedDatatype::toString(bool summary) {
 /* Class StructDatatype */
 StructDatatype::StructDatatype(int count, int* blocklen, long*  displ,
                                Datatype** types) : Datatype() {
-    for (int i=0; i<count; i++) blocklens.push_back(blocklen[i]);
-    for (int i=0; i<count; i++) displs.push_back(displ[i]);
-    for (int i=0; i<count; i++) basetypes.push_back(types[i]->clone());
-
     this->count = count;
     this->size = 0;
     this->lower_bound = 0;
@@ -1004,26 +2055,20 @@ StructDatatype::StructDatatype(int count, int* blocklen, long*  displ,
     this->upper_bound = 0;
     this->true_upper_bound = 0;
 
+    bool empty = true;
     for (int i=0; i<count; i++) {
         this->blocklens.push_back(blocklen[i]);
         this->displs.push_back(displ[i]);
         this->basetypes.push_back(types[i]->clone());
 
         this->size += types[i]->getSize() * blocklen[i];
-
-        int tmp_ub = displs[i] + blocklen[i] * types[i]->getExtent();
-        int tmp_lb = displs[i];
-        if (tmp_ub > this->upper_bound) {
-            this->upper_bound = tmp_ub;
-        }
-        if (tmp_lb < this->lower_bound) {
-            this->lower_bound = tmp_lb;
-        }
+        extendBounds(types[i], displ[i], blocklen[i], &empty,
+                     &this->lower_bound, &this->upper_bound,
+                     &this->true_lower_bound, &this->true_upper_bound);
     }
 
-    //FIXME this could be different
-    this->true_upper_bound = this->upper_bound;
-    this->true_lower_bound = this->lower_bound;
+    displs_arr = NULL;
+    blocklens_arr = NULL;
 
 }
 
@@ -1036,26 +2081,127 @@ StructDatatype* StructDatatype::clone() {
     return t_new;
 }
 
+void StructDatatype::cleanup() {
+    if (displs_arr != NULL) displs_arr->eraseFromParent();
+    if (blocklens_arr != NULL) blocklens_arr->eraseFromParent();
+}
+
 void StructDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
     codegenStruct(outbuf, inbuf, incount, this->getExtent(), this->count,
-                  this->blocklens, this->displs, this->basetypes, true);
+                  this->blocklens, this->displs, this->basetypes,
+                  displs_arr, blocklens_arr, true);
 }
 
 void StructDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
     codegenStruct(inbuf, outbuf, incount, this->getExtent(), this->count,
-                  this->blocklens, this->displs, this->basetypes, false);
+                  this->blocklens, this->displs, this->basetypes,
+                  displs_arr, blocklens_arr, false);
+}
+
+// Returns true if the datatype covers all bytes between its lower and
+// upper bound, so it can be copied as plain bytes
+static bool isDense(Datatype *datatype) {
+    ContiguousDatatype *ctg = dynamic_cast<ContiguousDatatype*>(datatype);
+    if (ctg != NULL) datatype = ctg->getBasetype();
+    return dynamic_cast<PrimitiveDatatype*>(datatype) != NULL;
 }
 
 Datatype *StructDatatype::compress() {
-    std::vector<Datatype*> cbasetypes(this->basetypes.size());
-    for (unsigned int i=0 ; i<this->basetypes.size(); i++) {
+    std::vector<Datatype*> cbasetypes(this->count);
+    for (int i=0 ; i<this->count; i++) {
         cbasetypes[i] = this->basetypes[i]->compress();
     }
-    return new StructDatatype(this->count, &(this->blocklens[0]),
-                                  &(this->displs[0]), &(this->basetypes[0]));
+
+    // Flatten nested structs into their fields, as long as that does not
+    // unroll too many fields
+    std::vector<int> fblocklens;
+    std::vector<long> fdispls;
+    std::vector<Datatype*> fbasetypes;
+    for (int i=0; i<this->count; i++) {
+        StructDatatype *nested = dynamic_cast<StructDatatype*>(cbasetypes[i]);
+        if (nested != NULL &&
+            (long) this->blocklens[i] * nested->count <= STRUCT_FLATTEN_TRESHOLD) {
+            for (int k=0; k<this->blocklens[i]; k++) {
+                long displ = this->displs[i] + (long) k * nested->getExtent();
+                for (int j=0; j<nested->count; j++) {
+                    fblocklens.push_back(nested->blocklens[j]);
+                    fdispls.push_back(displ + nested->displs[j]);
+                    fbasetypes.push_back(nested->basetypes[j]);
+                }
+            }
+        }
+        else {
+            fblocklens.push_back(this->blocklens[i]);
+            fdispls.push_back(this->displs[i]);
+            fbasetypes.push_back(cbasetypes[i]);
+        }
+    }
+
+    // Merge touching fields: dense fields of any type become byte runs,
+    // other fields are merged with touching fields of the same type
+    PrimitiveDatatype bytetype(PrimitiveDatatype::BYTE);
+    std::vector<int> mblocklens;
+    std::vector<long> mdispls;
+    std::vector<Datatype*> mbasetypes;
+    std::vector<std::string> reprs;
+    for (unsigned int i=0; i<fblocklens.size(); i++) {
+        if (fblocklens[i] == 0) continue;
+
+        int n = mblocklens.size();
+        std::string repr = fbasetypes[i]->toString();
+        bool touching = (n > 0) &&
+            (mdispls[n-1] + mblocklens[n-1] * (long) mbasetypes[n-1]->getExtent() == fdispls[i]);
+
+        if (touching && repr == reprs[n-1]) {
+            mblocklens[n-1] += fblocklens[i];
+        }
+        else if (touching && isDense(mbasetypes[n-1]) && isDense(fbasetypes[i])) {
+            mblocklens[n-1] = mblocklens[n-1] * mbasetypes[n-1]->getSize() +
+                              fblocklens[i] * fbasetypes[i]->getSize();
+            mbasetypes[n-1] = &bytetype;
+            reprs[n-1] = bytetype.toString();
+        }
+        else {
+            mblocklens.push_back(fblocklens[i]);
+            mdispls.push_back(fdispls[i]);
+            mbasetypes.push_back(fbasetypes[i]);
+            reprs.push_back(repr);
+        }
+    }
+
+    // A struct of a single basetype is a hindexed type. A gap-free struct
+    // ends up as a single byte run here, which becomes a contiguous type.
+    Datatype *datatype = NULL;
+    int n = mblocklens.size();
+    bool single = (n > 0);
+    for (int i=1; i<n; i++) single = single && (reprs[i] == reprs[0]);
+    if (single) {
+        datatype = compressBlocks(this, n, mblocklens, mdispls, mbasetypes[0]);
+    }
+
+    if (datatype == NULL && n > 0 && n < this->count) {
+        datatype = sameLayout(this, new StructDatatype(n, &(mblocklens[0]),
+                                                       &(mdispls[0]), &(mbasetypes[0])));
+    }
+
+    if (datatype == NULL) {
+        datatype = new StructDatatype(this->count, &(this->blocklens[0]),
+                                      &(this->displs[0]), &(cbasetypes[0]));
+    }
+    for (int i=0 ; i<this->count; i++) delete cbasetypes[i];
+
+    assert(datatype->getSize() == this->getSize());
+    assert(datatype->getExtent() == this->getExtent());
+
+    return datatype;
 }
 
 void StructDatatype::globalCodegen(llvm::Module *mod) {
+    if (count > HIDX_LOOP_TRESHOLD) {
+        this->displs_arr = codegenBlockTable(mod, count, blocklens, displs, false);
+        this->blocklens_arr = codegenBlockTable(mod, count, blocklens, displs, true);
+    }
+
     for (unsigned int i=0 ; i<this->basetypes.size(); i++) {
         basetypes[i]->globalCodegen(mod);
     }
@@ -1069,31 +2215,31 @@ std::vector<Datatype*> StructDatatype::getSubtypes() {
     return this->basetypes;
 }
 
-int StructDatatype::getExtent() {
+long StructDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int StructDatatype::getTrueExtent() {
+long StructDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int StructDatatype::getSize() {
+long StructDatatype::getSize() {
     return this->size;
 }
 
-int StructDatatype::getLowerBound() {
+long StructDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int StructDatatype::getTrueLowerBound() {
-    return this->lower_bound;
+long StructDatatype::getTrueLowerBound() {
+    return this->true_lower_bound;
 }
 
-int StructDatatype::getUpperBound() {
+long StructDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int StructDatatype::getTrueUpperBound() {
+long StructDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
@@ -1113,7 +2259,7 @@ string StructDatatype::toString(bool summary) {
 
 
 /* Class ResizedDatatype */
-ResizedDatatype::ResizedDatatype(Datatype* basetype, int lb, int extent) {
+ResizedDatatype::ResizedDatatype(Datatype* basetype, long lb, long extent) {
 
     this->basetype = basetype->clone();
     this->size = basetype->getSize();
@@ -1134,100 +2280,81 @@ ResizedDatatype* ResizedDatatype::clone() {
 }
 
 void ResizedDatatype::packCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    codegenResized(inbuf, incount, outbuf, true);
+}
 
-    if (basetype->getDatatypeName() == PRIMITIVE) {
-        codegenPrimitiveResized(inbuf, incount, outbuf, 
-                                this->size, this->getExtent(), 
-                                PrimitiveDatatype::BYTE);
+void ResizedDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+    codegenResized(inbuf, incount, outbuf, false);
+}
+
+// Resizing only changes the distance between consecutive elements, the
+// data of an element stays where the basetype puts it. Constructors which
+// loop over the elements themselves get the new extent directly, all other
+// basetypes are packed one element per iteration of a contiguous loop.
+void ResizedDatatype::codegenResized(Value* inbuf, Value* incount, Value* outbuf, bool pack) {
+    long extent = this->getExtent();
+    long size = this->getSize();
+    long in_inc  = pack ? extent : size;
+    long out_inc = pack ? size : extent;
+
+    if (extent == basetype->getExtent()) {
+        if (pack) basetype->packCodegen(inbuf, incount, outbuf);
+        else      basetype->unpackCodegen(inbuf, incount, outbuf);
+    }
+    else if (basetype->getDatatypeName() == PRIMITIVE) {
+        codegenPrimitiveResized(inbuf, incount, outbuf, size, extent, pack);
     }
     else if (basetype->getDatatypeName() == CONTIGUOUS) {
-        Datatype* cont_basetype = this->basetype->getSubtypes().at(0);
-        codegenContiguous(inbuf, incount, outbuf, cont_basetype, 
-                          this->getExtent(), this->getSize(), 
-                          ((ContiguousDatatype*) this->basetype)->getCount(),
-                          true);
+        ContiguousDatatype* ctgtype = (ContiguousDatatype*) this->basetype;
+        codegenContiguous(inbuf, incount, outbuf, ctgtype->getBasetype(),
+                          in_inc, out_inc, ctgtype->getCount(), pack);
     }
     else if (basetype->getDatatypeName() == VECTOR) {
-        Datatype* vec_basetype = this->basetype->getSubtypes().at(0);
         VectorDatatype* vectype = (VectorDatatype*) this->basetype;
+        Datatype* vec_basetype = vectype->getBasetype();
+        long stride = vec_basetype->getExtent() * vectype->getStride();
+        long blocksize = vec_basetype->getSize() * vectype->getBlocklen();
         codegenVector(inbuf, incount, outbuf, vec_basetype, vectype->getCount(),
-                      vectype->getBlocklen(), vec_basetype->getExtent()*vectype->getStride(),
-                      vec_basetype->getSize() * vectype->getBlocklen(), 
-                      this->getExtent(), this->getSize(), true);
+                      vectype->getBlocklen(), pack ? stride : blocksize,
+                      pack ? blocksize : stride, in_inc, out_inc, pack);
     }
     else if (basetype->getDatatypeName() == HVECTOR) {
-        Datatype* vec_basetype = this->basetype->getSubtypes().at(0);
-        VectorDatatype* vectype = (VectorDatatype*) this->basetype;
+        HVectorDatatype* vectype = (HVectorDatatype*) this->basetype;
+        Datatype* vec_basetype = vectype->getBasetype();
+        long stride = vectype->getStride();
+        long blocksize = vec_basetype->getSize() * vectype->getBlocklen();
         codegenVector(inbuf, incount, outbuf, vec_basetype, vectype->getCount(),
-                      vectype->getBlocklen(), vectype->getStride(), 
-                      vec_basetype->getSize() * vectype->getBlocklen(), 
-                      this->getExtent(), this->getSize(), true);
-
-    }
-    else if (basetype->getDatatypeName() == INDEXEDBLOCK) {
-   
+                      vectype->getBlocklen(), pack ? stride : blocksize,
+                      pack ? blocksize : stride, in_inc, out_inc, pack);
     }
-    else if (basetype->getDatatypeName() == HINDEXED) {
-
-    }
-    else if (basetype->getDatatypeName() == STRUCT) {
-    
-    }
-    else if (basetype->getDatatypeName() == RESIZED) {
-
+    else {
+        codegenContiguous(inbuf, incount, outbuf, this->basetype,
+                          in_inc, out_inc, 1, pack);
     }
-
 }
 
-void ResizedDatatype::unpackCodegen(Value* inbuf, Value* incount, Value* outbuf) {
+Datatype *ResizedDatatype::compress() {
+    Datatype* cbasetype = this->basetype->compress();
+    long extent = this->upper_bound - this->lower_bound;
 
-    if (basetype->getDatatypeName() == PRIMITIVE) {
-        codegenPrimitiveResized(inbuf, incount, outbuf, 
-                                this->size, this->getExtent(), 
-                                PrimitiveDatatype::BYTE);
-    }
-    else if (basetype->getDatatypeName() == CONTIGUOUS) {
-        Datatype* cont_basetype = this->basetype->getSubtypes().at(0);
-        codegenContiguous(inbuf, incount, outbuf, cont_basetype, 
-                          this->getExtent(), this->getSize(), 
-                          ((ContiguousDatatype*) this->basetype)->getCount(),
-                          true);
-    }
-    else if (basetype->getDatatypeName() == VECTOR) {
-        Datatype* vec_basetype = this->basetype->getSubtypes().at(0);
-        VectorDatatype* vectype = (VectorDatatype*) this->basetype;
-        codegenVector(inbuf, incount, outbuf, vec_basetype, vectype->getCount(),
-                      vectype->getBlocklen(), vec_basetype->getSize() * vectype->getBlocklen(),
-                      vec_basetype->getExtent() * vectype->getStride(), 
-                      this->getSize(), this->getExtent(), false);
-    }
-    else if (basetype->getDatatypeName() == HVECTOR) {
-        Datatype* vec_basetype = this->basetype->getSubtypes().at(0);
-        VectorDatatype* vectype = (VectorDatatype*) this->basetype;
-        codegenVector(inbuf, incount, outbuf, vec_basetype, vectype->getCount(),
-                      vectype->getBlocklen(), 
-                      vec_basetype->getSize() * vectype->getBlocklen(),
-                      vectype->getStride(), this->getSize(), this->getExtent(),
-                      false);
-    }
-    else if (basetype->getDatatypeName() == INDEXEDBLOCK) {
-   
-    }
-    else if (basetype->getDatatypeName() == HINDEXED) {
+    // Only the outermost resize determines the bounds, and a resize to the
+    // bounds the basetype has anyway is dropped
+    ResizedDatatype* rsztype = dynamic_cast<ResizedDatatype*>(cbasetype);
+    Datatype* inner = (rsztype != NULL) ? rsztype->basetype : cbasetype;
 
+    Datatype* datatype;
+    if (inner->getLowerBound() == this->lower_bound && inner->getExtent() == extent) {
+        datatype = inner->clone();
     }
-    else if (basetype->getDatatypeName() == STRUCT) {
-    
-    }
-    else if (basetype->getDatatypeName() == RESIZED) {
-
+    else {
+        datatype = new ResizedDatatype(inner, this->lower_bound, extent);
     }
+    delete cbasetype;
 
-}
+    assert(datatype->getSize() == this->getSize());
+    assert(datatype->getExtent() == this->getExtent());
 
-Datatype *ResizedDatatype::compress() {
-    Datatype* cbasetype = this->basetype->compress();
-    return new ResizedDatatype(cbasetype, this->lower_bound, this->upper_bound - this->lower_bound);
+    return datatype;
 }
 
 void ResizedDatatype::globalCodegen(llvm::Module *mod) {
@@ -1244,31 +2371,31 @@ std::vector<Datatype*> ResizedDatatype::getSubtypes() {
     return subtypes;
 }
 
-int ResizedDatatype::getExtent() {
+long ResizedDatatype::getExtent() {
     return this->upper_bound - this->lower_bound;
 }
 
-int ResizedDatatype::getTrueExtent() {
+long ResizedDatatype::getTrueExtent() {
     return this->true_upper_bound - this->true_lower_bound;
 }
 
-int ResizedDatatype::getSize() {
+long ResizedDatatype::getSize() {
     return this->size;
 }
 
-int ResizedDatatype::getLowerBound() {
+long ResizedDatatype::getLowerBound() {
     return this->lower_bound;
 }
 
-int ResizedDatatype::getTrueLowerBound() {
-    return this->lower_bound;
+long ResizedDatatype::getTrueLowerBound() {
+    return this->true_lower_bound;
 }
 
-int ResizedDatatype::getUpperBound() {
+long ResizedDatatype::getUpperBound() {
     return this->upper_bound;
 }
 
-int ResizedDatatype::getTrueUpperBound() {
+long ResizedDatatype::getTrueUpperBound() {
     return this->true_upper_bound;
 }
 
@@ -1285,17 +2412,251 @@ void DDT_Commit(Datatype* ddt) {
 #if DDT_OUTPUT
     ddt->print();
 #endif
+    __atomic_add_fetch(&Stats.commits, 1, __ATOMIC_RELAXED);
 #if !LAZY
-    ddt->compile(Datatype::PACK_UNPACK);
+    if (Tiered) {
+        // Only code of identical datatypes is used until the datatype has
+        // been used often enough
+        raiseTier(ddt, true, true, 1, Tier1Calls == 0);
+    }
+    else if (AsyncCommit) {
+        raiseTier(ddt, true, true, FULL_TIER, true);
+    }
+    else {
+        ddt->compile(Datatype::PACK_UNPACK);
+    }
 #endif
 }
 
-// this calls the pack/unpack function
-void DDT_Pack(void* inbuf, void* outbuf, Datatype* ddt, int count) {
+// Counts a call to DDT_Pack or DDT_Unpack and promotes the datatype to the
+// next tier once it has been called often enough
+static inline void countCall(Datatype* ddt, bool pack) {
+    unsigned long calls = __atomic_add_fetch((pack) ? &ddt->packcalls : &ddt->unpackcalls, 1, __ATOMIC_RELAXED);
+    if (!Tiered) return;
+
+    int tier = (pack) ? ddt->packtier : ddt->unpacktier;
+    if (calls >= Tier2Calls && tier < FULL_TIER) raiseTier(ddt, pack, !pack, FULL_TIER, true);
+    else if (calls >= Tier1Calls && tier < 1)    raiseTier(ddt, pack, !pack, 1, true);
+}
+
+// Generates the variant of the pack (or unpack) function of target which
+// uses streaming stores. Threads racing for it may both generate it, only
+// one of them installs its code.
+static void compileStream(Datatype *target, bool pack) {
+    #if DDT_OPTIMIZE
+    Datatype *ddt = target->compress();
+    #else
+    Datatype *ddt = target->clone();
+    #endif
+
+    std::string repr = ddt->toString();
+    CompiledCode *code = acquireCode(ddt, repr, pack, FULL_TIER, true);
+    delete ddt;
+
+    CompiledCode *expected = NULL;
+    if (!__atomic_compare_exchange_n((pack) ? &target->packstreamcode : &target->unpackstreamcode,
+                                     &expected, code, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        releaseCode(code);
+        return;
+    }
+    __atomic_store_n((pack) ? &target->packstream : &target->unpackstream,
+                     code->function, __ATOMIC_RELEASE);
+}
+
+// Returns the function which packs (or unpacks) count elements of ddt in
+// the given streaming mode, NULL if the datatype has to be interpreted.
+// Streaming code is only generated for datatypes whose code is at the full
+// tier, until then the regular code is used.
+static inline PackFunction selectFunction(Datatype* ddt, long count, Datatype::StreamMode mode, bool pack) {
+    PackFunction function = __atomic_load_n((pack) ? &ddt->pack : &ddt->unpack, __ATOMIC_ACQUIRE);
+    if (function == NULL || mode == Datatype::STREAM_NEVER) return function;
+    if (mode == Datatype::STREAM_AUTO && count * ddt->getSize() <= TheTarget.stream_treshold) return function;
+    if (((pack) ? ddt->packtier : ddt->unpacktier) < FULL_TIER) return function;
+
+    PackFunction stream = __atomic_load_n((pack) ? &ddt->packstream : &ddt->unpackstream, __ATOMIC_ACQUIRE);
+    if (stream == NULL) {
+        compileStream(ddt, pack);
+        stream = __atomic_load_n((pack) ? &ddt->packstream : &ddt->unpackstream, __ATOMIC_ACQUIRE);
+    }
+    return stream;
+}
+
+
+/* Parallel pack and unpack (see ddt_parallel.hpp). A call is split into
+   ranges of work units, which are either its elements or, if there are
+   fewer elements than threads, the iterations of the outermost loop of
+   the elements. The packed offset of a unit follows from the size of the
+   units before it. */
+static long ParallelTreshold = PARALLEL_TRESHOLD;
+static pthread_mutex_t OuterLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns a new datatype for one iteration of the outermost loop of ddt,
+// NULL if the compressed datatype is not a loop over equally spaced
+// iterations
+static Datatype* outerIterationType(Datatype *ddt, long *iters) {
+    #if DDT_OPTIMIZE
+    Datatype *cddt = ddt->compress();
+    #else
+    Datatype *cddt = ddt->clone();
+    #endif
+
+    Datatype *outer = NULL;
+    switch (cddt->getDatatypeName()) {
+    case CONTIGUOUS: {
+        ContiguousDatatype *contig = static_cast<ContiguousDatatype*>(cddt);
+        outer = contig->getBasetype()->clone();
+        *iters = contig->getCount();
+        break;
+    }
+    case VECTOR: {
+        VectorDatatype *vec = static_cast<VectorDatatype*>(cddt);
+        if (vec->getStride() <= 0) break;
+        ContiguousDatatype block(vec->getBlocklen(), vec->getBasetype());
+        outer = new ResizedDatatype(&block, 0, (long) vec->getStride() * vec->getBasetype()->getExtent());
+        *iters = vec->getCount();
+        break;
+    }
+    case HVECTOR: {
+        HVectorDatatype *hvec = static_cast<HVectorDatatype*>(cddt);
+        if (hvec->getStride() <= 0) break;
+        ContiguousDatatype block(hvec->getBlocklen(), hvec->getBasetype());
+        outer = new ResizedDatatype(&block, 0, hvec->getStride());
+        *iters = hvec->getCount();
+        break;
+    }
+    default:
+        break;
+    }
+
+    delete cddt;
+    return outer;
+}
+
+// Returns the compiled type of one iteration of the outermost loop of
+// ddt, NULL if there is none
+static Datatype* getOuter(Datatype *ddt) {
+    if (__atomic_load_n(&ddt->outerchecked, __ATOMIC_ACQUIRE)) return ddt->outer;
+
+    pthread_mutex_lock(&OuterLock);
+    if (!ddt->outerchecked) {
+        long iters = 0;
+        Datatype *outer = outerIterationType(ddt, &iters);
+        if (outer != NULL && iters * outer->getSize() == ddt->getSize()) {
+            outer->compile(Datatype::PACK_UNPACK);
+            ddt->outer = outer;
+            ddt->outeriters = iters;
+        }
+        else {
+            delete outer;
+        }
+        __atomic_store_n(&ddt->outerchecked, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&OuterLock);
+
+    return ddt->outer;
+}
+
+struct ParallelCall {
+    char *scattered;
+    char *compact;
+    PackFunction function;  // packs (or unpacks) units
+    bool pack;
+
+    long units;
+    long unitsper;  // units per element
+    long extent;    // of the elements
+    long size;
+    long unitextent;
+    long unitsize;
+    int tasks;
+};
+
+// Handles the task-th of the tasks equal ranges of units
+static void parallelTask(void *arg, int task) {
+    ParallelCall *call = (ParallelCall*) arg;
+    long first = call->units * task / call->tasks;
+    long last = call->units * (task + 1) / call->tasks;
+
+    // The range may span several elements, the function is called for
+    // the units of each of them
+    while (first < last) {
+        long elem = first / call->unitsper;
+        long unit = first % call->unitsper;
+        long n = std::min(last - first, call->unitsper - unit);
+        char *scattered = call->scattered + elem * call->extent + unit * call->unitextent;
+        char *compact = call->compact + elem * call->size + unit * call->unitsize;
+        if (call->pack) call->function(scattered, n, compact);
+        else            call->function(compact, n, scattered);
+        first += n;
+    }
+}
+
+// Splits the pack (or unpack) of count elements of ddt between the threads
+// of the pool. Returns false if the call is too small, can not be split or
+// the pool is busy, the caller has to do it then.
+static bool parallel(char *scattered, char *compact, Datatype *ddt, long count,
+                     Datatype::StreamMode mode, bool pack) {
+    int threads = DDT_Parallel_Threads();
+    if (threads < 2 || count * ddt->getSize() < ParallelTreshold) return false;
+
+    ParallelCall call;
+    call.scattered = scattered;
+    call.compact = compact;
+    call.pack = pack;
+    call.extent = ddt->getExtent();
+    call.size = ddt->getSize();
+    call.tasks = threads;
+
+    if (count >= threads) {
+        call.function = selectFunction(ddt, count, mode, pack);
+        call.units = count;
+        call.unitsper = count;
+        call.unitextent = call.extent;
+        call.unitsize = call.size;
+    }
+    else {
+        Datatype *outer = getOuter(ddt);
+        if (outer == NULL || count * ddt->outeriters < threads) return false;
+        call.units = count * ddt->outeriters;
+        call.function = selectFunction(outer, call.units, mode, pack);
+        call.unitsper = ddt->outeriters;
+        call.unitextent = outer->getExtent();
+        call.unitsize = outer->getSize();
+    }
+    if (call.function == NULL) return false;
+
+    return DDT_Parallel_Run(parallelTask, &call, call.tasks);
+}
+
+int DDT_Set_Threads(int threads) {
+    return DDT_Parallel_Resize(threads);
+}
+
+int DDT_Get_Threads() {
+    return DDT_Parallel_Threads();
+}
+
+// this calls the pack/unpack function, or interprets the datatype if
+// there is no code for it (yet)
+void DDT_Pack_stream(void* inbuf, void* outbuf, Datatype* ddt, long count, Datatype::StreamMode mode) {
 #if LAZY
     if (ddt->pack == NULL) ddt->compile(Datatype::PACK);
 #endif
-    ddt->pack(inbuf, count, outbuf);
+    if (CountCalls) countCall(ddt, true);
+    if (parallel((char*) inbuf, (char*) outbuf, ddt, count, mode, true)) return;
+
+    PackFunction pack = selectFunction(ddt, count, mode, true);
+    if (pack != NULL) {
+        pack(inbuf, count, outbuf);
+    }
+    else {
+        __atomic_add_fetch(&Stats.interpreted_calls, 1, __ATOMIC_RELAXED);
+        ddt->packInterpret(inbuf, count, outbuf);
+    }
+}
+
+void DDT_Pack(void* inbuf, void* outbuf, Datatype* ddt, long count) {
+    DDT_Pack_stream(inbuf, outbuf, ddt, count, ddt->stream);
 }
 
 void DDT_Lazy_Unpack_Commit(Datatype* ddt) {
@@ -1304,51 +2665,132 @@ void DDT_Lazy_Unpack_Commit(Datatype* ddt) {
 #endif
 }
 
-void DDT_Unpack(void* inbuf, void* outbuf, Datatype* ddt, int count) {
+void DDT_Unpack_stream(void* inbuf, void* outbuf, Datatype* ddt, long count, Datatype::StreamMode mode) {
 #if LAZY
     DDT_Lazy_Unpack_Commit(ddt);
 #endif
-    ddt->unpack(inbuf, count, outbuf);
+    if (CountCalls) countCall(ddt, false);
+    if (parallel((char*) outbuf, (char*) inbuf, ddt, count, mode, false)) return;
+
+    PackFunction unpack = selectFunction(ddt, count, mode, false);
+    if (unpack != NULL) {
+        unpack(inbuf, count, outbuf);
+    }
+    else {
+        __atomic_add_fetch(&Stats.interpreted_calls, 1, __ATOMIC_RELAXED);
+        ddt->unpackInterpret(inbuf, count, outbuf);
+    }
+}
+
+void DDT_Unpack(void* inbuf, void* outbuf, Datatype* ddt, long count) {
+    DDT_Unpack_stream(inbuf, outbuf, ddt, count, ddt->stream);
+}
+
+void DDT_Set_Stream(Datatype* ddt, Datatype::StreamMode mode) {
+    ddt->stream = mode;
+}
+
+static void partialElement(char* scatteredbuf, char* compactbuf, Datatype* ddt,
+                           long lo, long hi, bool pack);
+
+// Packs the bytes [lo, hi) of the packed representation of count elements
+// of ddt. The whole elements in between use the generated code. Elements
+// which are cut by the window are split by their outermost loop if split
+// is set, and interpreted otherwise.
+static void partialWindow(char* scatteredbuf, char* compactbuf, Datatype* ddt, long count,
+                          long lo, long hi, bool pack, bool split) {
+    long size = ddt->getSize();
+    long extent = ddt->getExtent();
+    if (size == 0 || lo < 0) return;
+
+    hi = std::min(hi, count * size);
+    if (lo >= hi) return;
+
+    long elem = lo / size;
+    long start = lo % size;
+
+    if (start != 0) {
+        long stop = std::min(size, start + (hi - lo));
+        if (split) partialElement(scatteredbuf + elem*extent, compactbuf, ddt, start, stop, pack);
+        else       ddt->interpretPartial(scatteredbuf + elem*extent, compactbuf, start, stop, pack);
+        compactbuf += stop - start;
+        lo += stop - start;
+        elem++;
+    }
+
+    long whole = (hi - lo) / size;
+    if (whole > 0) {
+        if (pack) DDT_Pack(scatteredbuf + elem*extent, compactbuf, ddt, whole);
+        else      DDT_Unpack(compactbuf, scatteredbuf + elem*extent, ddt, whole);
+        compactbuf += whole * size;
+        lo += whole * size;
+        elem += whole;
+    }
+
+    if (lo < hi) {
+        if (split) partialElement(scatteredbuf + elem*extent, compactbuf, ddt, 0, hi - lo, pack);
+        else       ddt->interpretPartial(scatteredbuf + elem*extent, compactbuf, 0, hi - lo, pack);
+    }
+}
+
+// Packs the bytes [lo, hi) of the element of ddt at scatteredbuf. The
+// iterations of its outermost loop which are not cut use the generated
+// code of one iteration (see getOuter), so a segment of a single large
+// element only interprets the iteration cut at each end.
+static void partialElement(char* scatteredbuf, char* compactbuf, Datatype* ddt,
+                           long lo, long hi, bool pack) {
+    Datatype *outer = getOuter(ddt);
+    if (outer == NULL) {
+        ddt->interpretPartial(scatteredbuf, compactbuf, lo, hi, pack);
+        return;
+    }
+    partialWindow(scatteredbuf, compactbuf, outer, ddt->outeriters, lo, hi, pack, false);
+}
+
+static void partial(char* scatteredbuf, char* compactbuf, Datatype* ddt, long count,
+                    long offset, long length, bool pack) {
+    partialWindow(scatteredbuf, compactbuf, ddt, count, offset, offset + length, pack, true);
+}
+
+void DDT_Pack_partial(void* inbuf, void* outbuf, Datatype* ddt, long count, long offset, long length) {
+    partial((char*) inbuf, (char*) outbuf, ddt, count, offset, length, true);
+}
+
+void DDT_Unpack_partial(void* inbuf, void* outbuf, Datatype* ddt, long count, long offset, long length) {
+    partial((char*) outbuf, (char*) inbuf, ddt, count, offset, length, false);
 }
 
 void DDT_Free(Datatype* ddt) {
     delete ddt;
 }
 
-// init the JIT compiler
-void DDT_Init() {
-    InitializeNativeTarget();
-    LLVMContext &Context = getGlobalContext();
-    module = new Module("FARC-JIT", Context);
+void DDT_Get_Stats(DDT_Stats* stats) {
+    pthread_mutex_lock(&StatsLock);
+    *stats = Stats;
+    pthread_mutex_unlock(&StatsLock);
+}
 
-    // Create the JIT.  This takes ownership of the module.
+// Creates a JIT for mod, which takes ownership of the module. Tier 1 code
+// is compiled without optimizations.
+static ExecutionEngine* createEngine(Module *mod, int tier, bool mcjit) {
     std::string ErrStr;
-    EngineBuilder engine_builder(module);
+    EngineBuilder engine_builder(mod);
     engine_builder.setEngineKind(EngineKind::JIT);
-    engine_builder.setOptLevel(CodeGenOpt::Aggressive);
+    engine_builder.setUseMCJIT(mcjit);
+    engine_builder.setOptLevel((tier == FULL_TIER) ? CodeGenOpt::Aggressive : CodeGenOpt::None);
+    engine_builder.setMCPU(TheTarget.cpu);
+    engine_builder.setMAttrs(TheTarget.features);
     engine_builder.setErrorStr(&ErrStr);
 
-    TheExecutionEngine = engine_builder.create();
-
-    if (!TheExecutionEngine) {
+    ExecutionEngine *engine = engine_builder.create();
+    if (!engine) {
         fprintf(stderr, "Could not create ExecutionEngine: %s\n", ErrStr.c_str());
-        exit(1);
     }
+    return engine;
+}
 
-    // Initialize some types used by all packers
-    std::vector<Type*> FuncArgs;
-    FuncArgs.push_back(LLVM_INT8PTR);
-    FuncArgs.push_back(LLVM_INT32);
-    FuncArgs.push_back(LLVM_INT8PTR);
-    FT = FunctionType::get(LLVM_VOID, FuncArgs, false);
-
-    Args.push_back("inbuf");
-    Args.push_back("count");
-    Args.push_back("outbuf");
-
-
-#if LLVM_OPTIMIZE
-    FunctionPassManager* OurFPM = new FunctionPassManager(module);
+static FunctionPassManager* createOptimizer(Module *mod, const DataLayout *layout) {
+    FunctionPassManager* OurFPM = new FunctionPassManager(mod);
 
     /*
     PassManagerBuilder Builder;
@@ -1360,7 +2802,7 @@ void DDT_Init() {
 
     // Set up the optimizer pipeline.  Start with registering info about how the
     // target lays out data structures.
-    OurFPM->add(new DataLayout(*TheExecutionEngine->getDataLayout()));
+    OurFPM->add(new DataLayout(*layout));
 
     OurFPM->add(createBasicAliasAnalysisPass());  // -basicaa
     OurFPM->add(createPromoteMemoryToRegisterPass()); // -mem2reg
@@ -1388,14 +2830,224 @@ void DDT_Init() {
     OurFPM->add(createAggressiveDCEPass());
     OurFPM->doInitialization();
 
-    // Set the global so the code gen can use this.
-    TheFPM = OurFPM;
+    return OurFPM;
+}
+
+static CodegenState* createCodegenState() {
+    CodegenState *state = new CodegenState();
+    pthread_mutex_init(&state->lock, NULL);
+
+    state->context = new LLVMContext();
+    state->builder = new IRBuilder<>(*state->context);
+    ThreadContext = state->context;
+    Builder = state->builder;
+
+    for (int tier=0; tier<=FULL_TIER; tier++) {
+        state->module[tier] = NULL;
+        state->engine[tier] = NULL;
+    }
+    state->fpm = NULL;
+    state->codes = 0;
+    state->finalized = false;
+
+    // Initialize some types used by all packers
+    std::vector<Type*> FuncArgs;
+    FuncArgs.push_back(LLVM_INT8PTR);
+    FuncArgs.push_back(LLVM_INT64);
+    FuncArgs.push_back(LLVM_INT8PTR);
+    state->FT = FunctionType::get(LLVM_VOID, FuncArgs, false);
+
+    return state;
+}
+
+static void freeCodegenState(CodegenState *state) {
+    delete state->fpm;
+    for (int tier=0; tier<=FULL_TIER; tier++) {
+        // deleting the engine also frees the module
+        delete state->engine[tier];
+    }
+    delete state->builder;
+    delete state->context;
+    pthread_mutex_destroy(&state->lock);
+    delete state;
+}
+
+static unsigned long envCount(const char *name, unsigned long def) {
+    const char *env = getenv(name);
+    return (env != NULL && env[0] != '\0') ? strtoul(env, NULL, 10) : def;
+}
+
+// Vector extensions the host supports, including the operating system
+// saving the vector registers on context switches
+static void hostVectorFeatures(bool *avx, bool *avx2, bool *avx512) {
+    *avx = *avx2 = *avx512 = false;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) return;
+
+    unsigned int xcr0, xcr0_hi;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0 & 0x6) != 0x6) return;
+    *avx = true;
+
+    if (__get_cpuid_max(0, NULL) < 7) return;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    *avx2 = (ebx & (1 << 5)) != 0;
+    *avx512 = (ebx & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+#endif
+}
+
+// Packed data larger than half of the last level cache would evict most
+// of the working set of the application, and is unlikely to be read again
+// before it is sent
+static long hostStreamTreshold() {
+    long cache = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (cache <= 0) cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
 #endif
+    return (cache > 0) ? cache / 2 : STREAM_TRESHOLD;
+}
+
+// Picks the cpu and the copy kernel parameters for the host, the
+// environment may override them (see README.TXT)
+static void initTarget() {
+    bool avx, avx2, avx512;
+    hostVectorFeatures(&avx, &avx2, &avx512);
+
+    TheTarget.cpu = std::string(sys::getHostCPUName());
+    TheTarget.features.clear();
+    if (!avx)   TheTarget.features.push_back("-avx");
+    if (avx2)   TheTarget.features.push_back("+avx2");
+    if (avx512) TheTarget.features.push_back("+avx512f");
+
+    // 32 byte moves only pay off from Haswell (AVX2) on, earlier AVX cpus
+    // split unaligned ones. The Skylake and Cascade Lake server parts lower
+    // their clock for 64 byte moves, so they stay at 32 bytes.
+    int simd_bytes = SIMD_BYTE_SIZE;
+    if (avx2) simd_bytes = 32;
+    if (avx512 && TheTarget.cpu != "skylake-avx512" &&
+        TheTarget.cpu != "cascadelake" && TheTarget.cpu != "cooperlake") {
+        simd_bytes = 64;
+    }
+
+    const char *cpu = getenv("LIBPACK_CPU");
+    if (cpu != NULL && cpu[0] != '\0') TheTarget.cpu = cpu;
+
+    DDT_Target target = TheTarget;
+    target.simd_bytes = envCount("LIBPACK_SIMD_BYTES", simd_bytes);
+    // keep the bytes per loop iteration
+    target.copy_unroll = envCount("LIBPACK_COPY_UNROLL",
+        std::max(1, COPY_LOOP_UNROLL * SIMD_BYTE_SIZE / std::max(1, target.simd_bytes)));
+    target.copy_treshold = envCount("LIBPACK_COPY_TRESHOLD", COPY_LOOP_TRESHOLD);
+    target.copy_memcpy = false;
+    target.idxb_treshold = IDXB_LOOP_TRESHOLD;
+    target.idxb_unroll = IDXB_LOOP_UNROLL;
+    target.stream_treshold = envCount("LIBPACK_STREAM_TRESHOLD", hostStreamTreshold());
+    target.prefetch_distance = envCount("LIBPACK_PREFETCH_DISTANCE", PREFETCH_DISTANCE);
+
+    if (DDT_Set_Target(&target) != 0) {
+        fprintf(stderr, "Invalid copy parameters (simd bytes %i, unroll %i), using the defaults\n",
+                target.simd_bytes, target.copy_unroll);
+        TheTarget.simd_bytes = SIMD_BYTE_SIZE;
+        TheTarget.copy_unroll = COPY_LOOP_UNROLL;
+        TheTarget.copy_treshold = COPY_LOOP_TRESHOLD;
+        TheTarget.copy_memcpy = false;
+        TheTarget.idxb_treshold = IDXB_LOOP_TRESHOLD;
+        TheTarget.idxb_unroll = IDXB_LOOP_UNROLL;
+        TheTarget.stream_treshold = STREAM_TRESHOLD;
+        TheTarget.prefetch_distance = PREFETCH_DISTANCE;
+    }
+}
+
+void DDT_Get_Target(DDT_Target* target) {
+    *target = TheTarget;
+}
 
+int DDT_Set_Target(const DDT_Target* target) {
+    int simd_bytes = target->simd_bytes;
+    if (simd_bytes < 1 || simd_bytes > 64 || (simd_bytes & (simd_bytes-1)) != 0 ||
+        target->copy_unroll < 1 || target->copy_treshold < 0 || target->stream_treshold < 0 ||
+        target->idxb_treshold < 0 || target->idxb_unroll < 1 ||
+        target->prefetch_distance < 0) {
+        return -1;
+    }
+    TheTarget = *target;
+    return 0;
+}
+
+// init the JIT compiler
+void DDT_Init() {
+    llvm_start_multithreaded();
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    AsyncCommit = (envCount("LIBPACK_ASYNC_COMMIT", 0) != 0);
+    Tiered = (envCount("LIBPACK_TIERED", 0) != 0);
+    Tier1Calls = envCount("LIBPACK_TIER1_CALLS", Tier1Calls);
+    Tier2Calls = envCount("LIBPACK_TIER2_CALLS", Tier2Calls);
+    PrintStats = (envCount("LIBPACK_STATS", 0) != 0);
+    CountCalls = Tiered || PrintStats;
+    OptimizeFull = Tiered || LLVM_OPTIMIZE;
+    ParallelTreshold = envCount("LIBPACK_PARALLEL_TRESHOLD", PARALLEL_TRESHOLD);
+    initTarget();
+
+    // Set up the state of the calling thread, other threads get theirs
+    // when they commit their first datatype
+    getCodegenState();
+
+    DDT_Cache_Init();
+    DDT_Tuning_Init();
+    startCompilerThread();
+
+    int threads = envCount("LIBPACK_THREADS", 1);
+    if (threads > 1) DDT_Set_Threads(threads);
 }
 
+// Datatypes which are still committed keep their code, the states it
+// lives in are freed together with the last of it
 void DDT_Finalize() {
+    DDT_Parallel_Finalize();
+    stopCompilerThread();
+    DDT_Cache_Finalize();
+    DDT_Tuning_Finalize();
+
+    if (PrintStats) {
+        DDT_Stats stats;
+        DDT_Get_Stats(&stats);
+        fprintf(stderr, "libpack: %lu commits, %lu interpreted calls, %lu shared functions\n",
+                stats.commits, stats.interpreted_calls, stats.shared);
+        for (int tier=1; tier<=FULL_TIER; tier++) {
+            fprintf(stderr, "libpack: tier %i: %lu functions compiled in %.3f s\n",
+                    tier, stats.compiles[tier], stats.compile_time[tier]);
+        }
+        if (stats.tunings > 0) {
+            fprintf(stderr, "libpack: %lu datatypes tuned in %.3f s\n",
+                    stats.tunings, stats.tuning_time);
+        }
+    }
+
+    // Datatypes committed from now on do not share code with the ones
+    // committed before, which may outlive its state
+    pthread_mutex_lock(&CodeTableLock);
+    CodeTable.clear();
+    pthread_mutex_unlock(&CodeTableLock);
+
+    std::vector<CodegenState*> unused;
+    pthread_mutex_lock(&StatesLock);
+    for (size_t i=0; i<States.size(); i++) {
+        States[i]->finalized = true;
+        if (States[i]->codes == 0) unused.push_back(States[i]);
+    }
+    States.clear();
+    __atomic_store_n(&StatesGeneration, StatesGeneration + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&StatesLock);
 
+    for (size_t i=0; i<unused.size(); i++) {
+        freeCodegenState(unused[i]);
+    }
+    TheState = NULL;
 }
 
 } // namespace farc
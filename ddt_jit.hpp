@@ -22,6 +22,9 @@ class GlobalVariable;
 
 namespace farc {
 
+struct CompiledCode;
+struct CompileJob;
+
 enum DatatypeName {PRIMITIVE, CONTIGUOUS, VECTOR, HVECTOR, INDEXEDBLOCK, HINDEXED, STRUCT, RESIZED};
 
 /* Base class for all datatypes */
@@ -29,17 +32,32 @@ class Datatype {
 public:
     enum CompilationType { PACK, UNPACK, PACK_UNPACK };
 
-    Datatype() { this->pack = NULL; this->unpack = NULL; }
+    // Whether pack and unpack use non-temporal stores, which bypass the
+    // caches. By default they do for calls larger than the stream
+    // treshold of the target.
+    enum StreamMode { STREAM_AUTO, STREAM_ALWAYS, STREAM_NEVER };
+
+    Datatype() {
+        this->pack = NULL; this->unpack = NULL;
+        this->packcode = NULL; this->unpackcode = NULL;
+        this->packstream = NULL; this->unpackstream = NULL;
+        this->packstreamcode = NULL; this->unpackstreamcode = NULL;
+        this->stream = STREAM_AUTO;
+        this->packcalls = 0; this->unpackcalls = 0;
+        this->packtier = 0; this->unpacktier = 0;
+        this->job = NULL;
+        this->outer = NULL; this->outeriters = 0; this->outerchecked = false;
+    }
     virtual ~Datatype();
     virtual Datatype* clone() = 0;
 
-    virtual int getExtent() = 0;
-    virtual int getTrueExtent() = 0;
-    virtual int getSize() = 0;
-    virtual int getLowerBound() = 0;
-    virtual int getTrueLowerBound() = 0;
-    virtual int getUpperBound() = 0;
-    virtual int getTrueUpperBound() = 0;
+    virtual long getExtent() = 0;
+    virtual long getTrueExtent() = 0;
+    virtual long getSize() = 0;
+    virtual long getLowerBound() = 0;
+    virtual long getTrueLowerBound() = 0;
+    virtual long getUpperBound() = 0;
+    virtual long getTrueUpperBound() = 0;
     virtual DatatypeName getDatatypeName() = 0;
     virtual std::vector<Datatype*> getSubtypes() = 0;
 
@@ -48,39 +66,84 @@ public:
     virtual void print(bool summary = false);
 
     virtual void compile(CompilationType type);
-    void (*pack)(void*, int, void*);
-    void (*unpack)(void*, int, void*);
+    void (*pack)(void*, long, void*);
+    void (*unpack)(void*, long, void*);
+
+    // Variants of pack and unpack with streaming stores, generated on
+    // their first use
+    void (*packstream)(void*, long, void*);
+    void (*unpackstream)(void*, long, void*);
+    StreamMode stream;
 
     virtual Datatype *compress() = 0;
     virtual void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf) = 0;
     virtual void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf) = 0;
     virtual void globalCodegen(llvm::Module *mod) = 0;
 
+    // Pack and unpack without generated code (see ddt_interpret.cpp)
+    void packInterpret(void* inbuf, long count, void* outbuf);
+    void unpackInterpret(void* inbuf, long count, void* outbuf);
+    void packInterpretPartial(void* inbuf, long count, void* outbuf, long offset, long length);
+    void unpackInterpretPartial(void* inbuf, long count, void* outbuf, long offset, long length);
+    virtual void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack) = 0;
+    virtual void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack) = 0;
+
     // TODO: remove this function
     virtual void cleanup() {}
 
-    llvm::Function* fpack;
-    llvm::Function* funpack;
+    // Code of pack and unpack, shared with all structurally identical datatypes
+    CompiledCode* packcode;
+    CompiledCode* unpackcode;
+    CompiledCode* packstreamcode;
+    CompiledCode* unpackstreamcode;
+
+    // Code replaced by code of a higher tier, which may still be running
+    std::vector<CompiledCode*> retired;
+
+    // Calls to DDT_Pack and DDT_Unpack (only counted with tiered
+    // compilation or statistics enabled), and the tier of their code
+    unsigned long packcalls;
+    unsigned long unpackcalls;
+    int packtier;
+    int unpacktier;
+
+    // Pending background compilation, NULL if there is none
+    CompileJob* job;
+
+    // Type of one iteration of the outermost loop and their number, which
+    // let threads split single elements (see DDT_Set_Threads). Set up on
+    // the first call which needs them, outer stays NULL if the type has
+    // no such loop.
+    Datatype* outer;
+    long outeriters;
+    bool outerchecked;
 };
 
 /* Class for primitive types, such as MPI_INT, MPI_BYTE, etc */
 class PrimitiveDatatype : public Datatype {
 public:
-    enum PrimitiveType { BYTE, CHAR, DOUBLE, FLOAT, INT };
+    enum PrimitiveType { BYTE, CHAR, DOUBLE, FLOAT, INT,
+                         SIGNED_CHAR, UNSIGNED_CHAR, WCHAR, SHORT, UNSIGNED_SHORT,
+                         UNSIGNED, LONG, UNSIGNED_LONG, LONG_DOUBLE, LONG_LONG,
+                         UNSIGNED_LONG_LONG, INT8, INT16, INT32, INT64,
+                         UINT8, UINT16, UINT32, UINT64, BOOL, AINT, OFFSET,
+                         FLOAT_COMPLEX, DOUBLE_COMPLEX, LONG_DOUBLE_COMPLEX,
+                         NUM_PRIMITIVE_TYPES };
 
     PrimitiveDatatype(PrimitiveType type);
+    static int getTypeSize(PrimitiveType type);
     virtual ~PrimitiveDatatype(void) {};
     PrimitiveDatatype* clone();
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     std::string toString(bool summary = false);
 
@@ -88,13 +151,15 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     PrimitiveDatatype::PrimitiveType type;
 };
@@ -108,13 +173,13 @@ public:
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     int getCount();
     Datatype *getBasetype();
@@ -124,13 +189,15 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     int count;
     Datatype* basetype;
@@ -145,13 +212,13 @@ public:
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     int getCount();
     int getBlocklen();
@@ -163,13 +230,15 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     int count;
     int blocklen;
@@ -180,23 +249,23 @@ private:
 /* Class for hvector types */
 class HVectorDatatype : public Datatype {
 public:
-    HVectorDatatype(int count, int blocklen, int stride, Datatype* basetype);
+    HVectorDatatype(int count, int blocklen, long stride, Datatype* basetype);
     virtual ~HVectorDatatype(void);
     HVectorDatatype* clone();
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     int getCount();
     int getBlocklen();
-    int getStride();
+    long getStride();
     Datatype *getBasetype();
     std::string toString(bool summary = false);
 
@@ -204,17 +273,19 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     int count;
     int blocklen;
-    int stride;
+    long stride;
     Datatype* basetype;
 };
 
@@ -227,13 +298,13 @@ public:
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     std::string toString(bool summary = false);
 
@@ -241,13 +312,15 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     int count;
     int blocklen;
@@ -269,13 +342,13 @@ public:
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     std::string toString(bool summary = false);
 
@@ -283,18 +356,25 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     int count;
     std::vector<int> blocklens;
     std::vector<long> displs;
     Datatype* basetype;
+
+    llvm::GlobalVariable* displs_arr;
+    llvm::GlobalVariable* blocklens_arr;
+
+    void cleanup();
 };
 
 /* Class for struct types */
@@ -306,13 +386,13 @@ public:
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     std::string toString(bool summary = false);
 
@@ -320,36 +400,43 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     int count;
     std::vector<int> blocklens;
     std::vector<long> displs;
     std::vector<Datatype*> basetypes;
+
+    llvm::GlobalVariable* displs_arr;
+    llvm::GlobalVariable* blocklens_arr;
+
+    void cleanup();
 };
 
 /* Class for resized types */
 class ResizedDatatype : public Datatype {
 public:
-    ResizedDatatype(Datatype* basetype, int lb, int extent);
+    ResizedDatatype(Datatype* basetype, long lb, long extent);
     virtual ~ResizedDatatype(void);
     ResizedDatatype* clone();
 
     std::vector<Datatype*> getSubtypes();
     DatatypeName getDatatypeName();
-    int getExtent();
-    int getTrueExtent();
-    int getSize();
-    int getLowerBound();
-    int getTrueLowerBound();
-    int getUpperBound();
-    int getTrueUpperBound();
+    long getExtent();
+    long getTrueExtent();
+    long getSize();
+    long getLowerBound();
+    long getTrueLowerBound();
+    long getUpperBound();
+    long getTrueUpperBound();
 
     std::string toString(bool summary = false);
 
@@ -357,33 +444,92 @@ public:
     void packCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void unpackCodegen(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf);
     void globalCodegen(llvm::Module *mod);
+    void interpret(char* scatteredbuf, long count, char* compactbuf, bool pack);
+    void interpretPartial(char* scatteredbuf, char* compactbuf, long lo, long hi, bool pack);
 
 private:
-    int size;
-    int lower_bound;
-    int upper_bound;
-    int true_lower_bound;
-    int true_upper_bound;
+    long size;
+    long lower_bound;
+    long upper_bound;
+    long true_lower_bound;
+    long true_upper_bound;
 
     Datatype* basetype;
+
+    void codegenResized(llvm::Value* inbuf, llvm::Value* incount, llvm::Value* outbuf, bool pack);
 };
 
 
 
 
+/* Statistics of the code generation, see DDT_Get_Stats() */
+struct DDT_Stats {
+    unsigned long commits;
+    unsigned long interpreted_calls;
+
+    // Functions generated and the seconds spent doing so, per tier
+    unsigned long compiles[3];
+    double compile_time[3];
+
+    // Functions taken from identical datatypes instead of being generated
+    unsigned long shared;
+
+    // Datatypes tuned by the autotuner and the seconds spent doing so
+    unsigned long tunings;
+    double tuning_time;
+};
+
+/* Target of the generated code, DDT_Init() detects the host cpu and picks
+ * the parameters of the copy kernels for its microarchitecture */
+struct DDT_Target {
+    std::string cpu;
+    std::vector<std::string> features;  // e.g. "+avx2"
+
+    int simd_bytes;     // width of the vector moves, a power of two
+    int copy_unroll;    // vector moves per iteration of a copy loop
+    int copy_treshold;  // copies of fewer bytes are fully unrolled
+    bool copy_memcpy;   // copies call memcpy instead of the vector kernels
+
+    int idxb_treshold;  // indexed block types with more blocks loop over a table
+    int idxb_unroll;    // blocks per iteration of that loop
+
+    long stream_treshold;  // calls packing more bytes use streaming stores
+    long prefetch_distance;  // bytes prefetched ahead in strided loops, 0 disables
+};
+
 /* FARC Library Functions */
 void DDT_Init();
 void DDT_Finalize();
+void DDT_Get_Stats(DDT_Stats* stats);
+
+// A new target applies to datatypes compiled afterwards and must not be set
+// while other threads commit datatypes. Returns -1 for invalid parameters.
+void DDT_Get_Target(DDT_Target* target);
+int DDT_Set_Target(const DDT_Target* target);
+
+// Pack and unpack calls of at least LIBPACK_PARALLEL_TRESHOLD bytes are
+// split between threads threads, the calling one included. Must not be
+// set while other threads pack. Returns -1 if the threads can not be
+// started.
+int DDT_Set_Threads(int threads);
+int DDT_Get_Threads();
 
 void DDT_Commit(Datatype* ddt);
 void DDT_Lazy_Unpack_Commit(Datatype* ddt);  // This function should be removed
 void DDT_Free(Datatype* ddt);
 
-void DDT_Pack(void* inbuf, void* outbuf, Datatype* ddt, int count);
-void DDT_Unpack(void* inbuf, void* outbuf, Datatype* ddt, int count);
+void DDT_Pack(void* inbuf, void* outbuf, Datatype* ddt, long count);
+void DDT_Unpack(void* inbuf, void* outbuf, Datatype* ddt, long count);
+
+// Selects the streaming mode of ddt for all calls, or of a single call
+void DDT_Set_Stream(Datatype* ddt, Datatype::StreamMode mode);
+void DDT_Pack_stream(void* inbuf, void* outbuf, Datatype* ddt, long count, Datatype::StreamMode mode);
+void DDT_Unpack_stream(void* inbuf, void* outbuf, Datatype* ddt, long count, Datatype::StreamMode mode);
 
-void DDT_Pack_partial(void* inbuf, void* outbuf, Datatype* ddt, int count, int segnum);
-void DDT_Unpack_partial(void* inbuf, void* outbuf, Datatype* ddt, int count, int segnum);
+// Pack (unpack) only the bytes [offset, offset+length) of the packed
+// representation of count elements, outbuf (inbuf) holds just these bytes
+void DDT_Pack_partial(void* inbuf, void* outbuf, Datatype* ddt, long count, long offset, long length);
+void DDT_Unpack_partial(void* inbuf, void* outbuf, Datatype* ddt, long count, long offset, long length);
 
 } // namespace farc
 
@@ -0,0 +1,146 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include "ddt_parallel.hpp"
+
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+
+namespace farc {
+
+static std::vector<pthread_t> Workers;
+
+// Number of threads of the pool, which is read without locks while the
+// pool is resized under RunLock
+static int Threads = 1;
+
+// Held by the thread whose call the pool runs
+static pthread_mutex_t RunLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The current call, protected by PoolLock. Workers wake up when the
+// generation changes, take tasks until none are left and count the ones
+// they finished.
+static pthread_mutex_t PoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t WorkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t DoneCond = PTHREAD_COND_INITIALIZER;
+static unsigned long Generation = 0;
+static bool Shutdown = false;
+
+static ParallelTask Task = NULL;
+static void *TaskArg = NULL;
+static int Tasks = 0;
+static int NextTask = 0;
+static int DoneTasks = 0;
+
+// Runs tasks of the current call until none are left, PoolLock is held
+// when it is called and when it returns
+static void runTasks() {
+    while (NextTask < Tasks) {
+        int task = NextTask++;
+        ParallelTask function = Task;
+        void *arg = TaskArg;
+        pthread_mutex_unlock(&PoolLock);
+
+        function(arg, task);
+
+        pthread_mutex_lock(&PoolLock);
+        if (++DoneTasks == Tasks) pthread_cond_signal(&DoneCond);
+    }
+}
+
+static void* workerThread(void *) {
+    pthread_mutex_lock(&PoolLock);
+    unsigned long seen = Generation;
+    while (true) {
+        while (Generation == seen && !Shutdown) {
+            pthread_cond_wait(&WorkCond, &PoolLock);
+        }
+        if (Shutdown) break;
+
+        seen = Generation;
+        runTasks();
+    }
+    pthread_mutex_unlock(&PoolLock);
+
+    return NULL;
+}
+
+bool DDT_Parallel_Run(ParallelTask task, void *arg, int tasks) {
+    if (pthread_mutex_trylock(&RunLock) != 0) return false;
+
+    pthread_mutex_lock(&PoolLock);
+    Task = task;
+    TaskArg = arg;
+    Tasks = tasks;
+    NextTask = 0;
+    DoneTasks = 0;
+    Generation++;
+    pthread_cond_broadcast(&WorkCond);
+
+    runTasks();
+    while (DoneTasks < Tasks) {
+        pthread_cond_wait(&DoneCond, &PoolLock);
+    }
+    Task = NULL;
+    TaskArg = NULL;
+    Tasks = 0;
+    pthread_mutex_unlock(&PoolLock);
+
+    pthread_mutex_unlock(&RunLock);
+    return true;
+}
+
+int DDT_Parallel_Threads() {
+    return __atomic_load_n(&Threads, __ATOMIC_RELAXED);
+}
+
+static void stopWorkers() {
+    pthread_mutex_lock(&PoolLock);
+    Shutdown = true;
+    pthread_cond_broadcast(&WorkCond);
+    pthread_mutex_unlock(&PoolLock);
+
+    for (size_t i=0; i<Workers.size(); i++) {
+        pthread_join(Workers[i], NULL);
+    }
+    Workers.clear();
+    __atomic_store_n(&Threads, 1, __ATOMIC_RELAXED);
+    Shutdown = false;
+}
+
+int DDT_Parallel_Resize(int threads) {
+    if (threads < 1) return -1;
+
+    // Stopping all workers is simpler than picking some, and the pool is
+    // resized rarely
+    pthread_mutex_lock(&RunLock);
+    if ((int) Workers.size() > threads - 1) stopWorkers();
+    int res = 0;
+    while ((int) Workers.size() < threads - 1) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, workerThread, NULL) != 0) {
+            fprintf(stderr, "Could not start pack worker thread %i of %i\n",
+                    (int) Workers.size() + 1, threads - 1);
+            res = -1;
+            break;
+        }
+        Workers.push_back(worker);
+        __atomic_store_n(&Threads, (int) Workers.size() + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&RunLock);
+
+    return res;
+}
+
+void DDT_Parallel_Finalize() {
+    pthread_mutex_lock(&RunLock);
+    stopWorkers();
+    pthread_mutex_unlock(&RunLock);
+}
+
+} // namespace farc
@@ -0,0 +1,42 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#ifndef DDT_PARALLEL_H
+#define DDT_PARALLEL_H
+
+// Pack and unpack calls of fewer bytes are not split between threads,
+// unless LIBPACK_PARALLEL_TRESHOLD says otherwise
+#ifndef PARALLEL_TRESHOLD
+#define PARALLEL_TRESHOLD (1L*1024*1024)
+#endif
+
+namespace farc {
+
+/* Persistent pool of worker threads which split large pack and unpack
+ * calls with the calling thread. The workers sleep while there is nothing
+ * to do. The pool runs one call at a time, concurrent calls from other
+ * threads are not split. */
+
+typedef void (*ParallelTask)(void *arg, int task);
+
+// Runs task(arg, i) for all i in [0, tasks) on the workers and the calling
+// thread and returns once all are done. Returns false without running
+// anything if the pool is busy with another call.
+bool DDT_Parallel_Run(ParallelTask task, void *arg, int tasks);
+
+// Number of threads of the pool, including the calling thread
+int DDT_Parallel_Threads();
+
+// Starts (or stops) workers until the pool has threads threads, returns -1
+// if they can not be started
+int DDT_Parallel_Resize(int threads);
+
+void DDT_Parallel_Finalize();
+
+} // namespace farc
+
+#endif // DDT_PARALLEL_H
@@ -0,0 +1,151 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include "ddt_tune.hpp"
+#include "ddt_cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <pthread.h>
+
+namespace farc {
+
+// The parameters of DDT_Target the autotuner chooses
+struct Tuning {
+    int simd_bytes;
+    int copy_unroll;
+    int copy_treshold;
+    int copy_memcpy;
+    int idxb_treshold;
+    int idxb_unroll;
+    long prefetch_distance;
+};
+
+static bool Autotune = false;
+static std::string TuningFile;
+
+// Decisions by host cpu and hash of the datatype, "<cpu> <hash>"
+static std::map<std::string, Tuning> Tunings;
+static pthread_mutex_t TuningsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static std::string tuningKey(const std::string &cpu, unsigned long long hash) {
+    char key[128];
+    snprintf(key, sizeof(key), "%s %016llx", cpu.c_str(), hash);
+    return std::string(key);
+}
+
+// The checks of DDT_Set_Target, the file may have been edited by hand
+static bool validTuning(const Tuning &t) {
+    return t.simd_bytes >= 1 && t.simd_bytes <= 64 && (t.simd_bytes & (t.simd_bytes-1)) == 0 &&
+        t.copy_unroll >= 1 && t.copy_treshold >= 0 &&
+        t.idxb_treshold >= 0 && t.idxb_unroll >= 1 &&
+        t.prefetch_distance >= 0;
+}
+
+// Lines of the file are "<cpu> <hash> <parameters>", later lines replace
+// earlier decisions for the same cpu and datatype
+static void readTuningFile() {
+    FILE *f = fopen(TuningFile.c_str(), "r");
+    if (f == NULL) return;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#') continue;
+
+        char cpu[64];
+        unsigned long long hash;
+        Tuning t;
+        if (sscanf(line, "%63s %llx %i %i %i %i %i %i %li", cpu, &hash,
+                   &t.simd_bytes, &t.copy_unroll, &t.copy_treshold, &t.copy_memcpy,
+                   &t.idxb_treshold, &t.idxb_unroll, &t.prefetch_distance) != 9) {
+            fprintf(stderr, "Ignoring malformed line in tuning file %s\n", TuningFile.c_str());
+            continue;
+        }
+        if (!validTuning(t)) {
+            fprintf(stderr, "Ignoring invalid parameters in tuning file %s\n", TuningFile.c_str());
+            continue;
+        }
+        Tunings[tuningKey(cpu, hash)] = t;
+    }
+    fclose(f);
+}
+
+bool DDT_Autotune() {
+    return Autotune;
+}
+
+bool DDT_Tuning_Lookup(const std::string &repr, DDT_Target *target) {
+    std::string key = tuningKey(target->cpu, hashString(repr));
+
+    pthread_mutex_lock(&TuningsLock);
+    std::map<std::string, Tuning>::iterator it = Tunings.find(key);
+    bool found = (it != Tunings.end());
+    if (found) {
+        Tuning &t = it->second;
+        target->simd_bytes = t.simd_bytes;
+        target->copy_unroll = t.copy_unroll;
+        target->copy_treshold = t.copy_treshold;
+        target->copy_memcpy = (t.copy_memcpy != 0);
+        target->idxb_treshold = t.idxb_treshold;
+        target->idxb_unroll = t.idxb_unroll;
+        target->prefetch_distance = t.prefetch_distance;
+    }
+    pthread_mutex_unlock(&TuningsLock);
+
+    return found;
+}
+
+void DDT_Tuning_Record(const std::string &repr, const DDT_Target &target) {
+    unsigned long long hash = hashString(repr);
+    Tuning t;
+    t.simd_bytes = target.simd_bytes;
+    t.copy_unroll = target.copy_unroll;
+    t.copy_treshold = target.copy_treshold;
+    t.copy_memcpy = target.copy_memcpy;
+    t.idxb_treshold = target.idxb_treshold;
+    t.idxb_unroll = target.idxb_unroll;
+    t.prefetch_distance = target.prefetch_distance;
+
+    pthread_mutex_lock(&TuningsLock);
+    Tunings[tuningKey(target.cpu, hash)] = t;
+
+    // Each decision is appended with a single write, so processes sharing
+    // the file do not mix up their lines
+    if (!TuningFile.empty()) {
+        char line[256];
+        int len = snprintf(line, sizeof(line), "%s %016llx %i %i %i %i %i %i %li\n",
+                           target.cpu.c_str(), hash, t.simd_bytes, t.copy_unroll,
+                           t.copy_treshold, t.copy_memcpy, t.idxb_treshold,
+                           t.idxb_unroll, t.prefetch_distance);
+        FILE *f = fopen(TuningFile.c_str(), "a");
+        bool ok = (f != NULL) && (fwrite(line, 1, len, f) == (size_t) len);
+        if (f != NULL) ok = (fclose(f) == 0) && ok;
+        if (!ok) fprintf(stderr, "Could not write tuning file %s\n", TuningFile.c_str());
+    }
+    pthread_mutex_unlock(&TuningsLock);
+}
+
+// Autotuning is enabled by setting LIBPACK_AUTOTUNE to a nonzero value,
+// decisions are kept in LIBPACK_TUNING_FILE
+void DDT_Tuning_Init() {
+    const char *autotune = getenv("LIBPACK_AUTOTUNE");
+    Autotune = (autotune != NULL && atoi(autotune) != 0);
+
+    const char *file = getenv("LIBPACK_TUNING_FILE");
+    TuningFile = (file != NULL) ? file : "";
+    if (!TuningFile.empty()) readTuningFile();
+}
+
+void DDT_Tuning_Finalize() {
+    pthread_mutex_lock(&TuningsLock);
+    Tunings.clear();
+    pthread_mutex_unlock(&TuningsLock);
+    Autotune = false;
+}
+
+} // namespace farc
@@ -0,0 +1,52 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#ifndef DDT_TUNE_H
+#define DDT_TUNE_H
+
+#include "ddt_jit.hpp"
+
+#include <string>
+
+// Every variant is timed AUTOTUNE_RUNS times, moving at least
+// AUTOTUNE_MIN_BYTES of packed data unless that spans more than
+// AUTOTUNE_MAX_SPAN bytes of scratch memory. AUTOTUNE_PARAMS parameters are
+// tuned one after the other.
+#define AUTOTUNE_RUNS      5
+#define AUTOTUNE_MIN_BYTES (1L*1024*1024)
+#define AUTOTUNE_MAX_SPAN  (256L*1024*1024)
+#define AUTOTUNE_PARAMS    7
+
+namespace farc {
+
+/* Code generation parameters chosen by the autotuner.
+ *
+ * If autotuning is enabled (LIBPACK_AUTOTUNE), committing a datatype for
+ * which no decision exists compiles it with several variants of the
+ * parameters of DDT_Target, times them and keeps the fastest. Decisions
+ * are made per host cpu and canonical serialization of the compressed
+ * datatype. They are appended to the tuning file (LIBPACK_TUNING_FILE),
+ * one line each, and read back by later runs, which use them whether
+ * autotuning is enabled or not. Nodes of different types can share a
+ * file, each uses the decisions made for its cpu. */
+
+// Whether datatypes without a decision are tuned
+bool DDT_Autotune();
+
+// Sets the tuned parameters of target to the decision for the datatype
+// with the serialization repr, returns false if there is none
+bool DDT_Tuning_Lookup(const std::string &repr, DDT_Target *target);
+
+// Records the parameters of target as the decision for repr
+void DDT_Tuning_Record(const std::string &repr, const DDT_Target &target);
+
+void DDT_Tuning_Init();
+void DDT_Tuning_Finalize();
+
+} // namespace farc
+
+#endif // DDT_TUNE_H
@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <assert.h>
 #include <iostream>
+#include <sstream>
 #include <hrtimer.h>
 #include <algorithm>
 #include <ddt_jit.hpp>
@@ -21,6 +22,7 @@ vector<struct Datatype> datatypes;
 #define WARMUP  5
 #define NUMRUNS 10
 #define CACHE_SIZE 16e6
+#define MISALIGN_MAX 64
 
 #define CLEAR_CACHE                                    \
 do {                                                   \
@@ -75,7 +77,7 @@ void alloc_buffer(size_t size, void** buffer, int alignment) {
 		*buffer = malloc(size);
 	}
 	else {
-		posix_memalign(reinterpret_cast<void**>(buffer), 16, size);
+		posix_memalign(reinterpret_cast<void**>(buffer), alignment, size);
 	}
 	assert(buffer != NULL);
 }
@@ -136,6 +138,8 @@ void produce_report() {
         cout << setw(26) << "farc_unpack_time_cold";
         cout << setw(26) << "pack_time_spdup_cold";
         cout << setw(26) << "unpack_time_spdup_cold";
+        cout << setw(26) << "farc_pack_time_cold_nt";
+        cout << setw(26) << "farc_unpack_time_cold_nt";
     }
 
     cout << endl;
@@ -159,16 +163,20 @@ void produce_report() {
 		double mpi_unpack_time_cold  = 0.0;
 		double farc_unpack_time_cold = 0.0;
 
-		int size = datatype.farc->getSize();
+        // with streaming stores forced
+        double farc_pack_time_cold_nt   = 0.0;
+        double farc_unpack_time_cold_nt = 0.0;
+
+		long size = datatype.farc->getSize();
 		int size_mpi;
         MPI_Type_size(datatype.mpi, &size_mpi);
         if (size != size_mpi) {
-            printf("SIZE MISSMATCH: MPI size: %i FARC size: %i\n", size_mpi, size);
+            printf("SIZE MISSMATCH: MPI size: %i FARC size: %li\n", size_mpi, size);
 		    cout << setw(name_w)        << datatype.farc->toString().c_str() << std::endl;
             exit(EXIT_FAILURE);
         }
 
-		int extent = datatype.farc->getExtent();
+		long extent = datatype.farc->getExtent();
         MPI_Aint extent_mpi;
         MPI_Type_extent(datatype.mpi, &extent_mpi);
         if (datatype.farc->getExtent() != extent_mpi) {
@@ -180,12 +188,23 @@ void produce_report() {
             exit(EXIT_FAILURE);
         }
 
-        // TODO Remove this. The *4 is used to provide "centered"
-        // buffer in case of negative strides and in case of lower
-        // bounds higher than 0.  It is a workaround until farc
-        // supports these concepts.
-        extent = extent * 4;
-       
+        // The buffer covers the true extent of the datatype, which may
+        // start before the origin of the datatype (negative strides and
+        // displacements) or after it
+        long true_lb = datatype.farc->getTrueLowerBound();
+        long true_extent = datatype.farc->getTrueExtent();
+        MPI_Aint true_lb_mpi, true_extent_mpi;
+        MPI_Type_get_true_extent(datatype.mpi, &true_lb_mpi, &true_extent_mpi);
+        if (true_lb != true_lb_mpi || true_extent != true_extent_mpi) {
+            cerr << "TRUE EXTENT MISSMATCH: MPI true lb/extent: " << true_lb_mpi << "/" << true_extent_mpi
+                 << " FARC true lb/extent: " << true_lb << "/" << true_extent
+                 << setw(name_w)
+                 << datatype.farc->toString().c_str()
+                 << endl;
+            exit(EXIT_FAILURE);
+        }
+        extent = true_extent;
+
 		void *mpi_bigbuf, *mpi_smallbuf;
 		alloc_buffer(size, &mpi_smallbuf, ALIGNMENT);
 		alloc_buffer(extent, &mpi_bigbuf, ALIGNMENT);
@@ -194,9 +213,8 @@ void produce_report() {
 		alloc_buffer(size, &farc_smallbuf, ALIGNMENT);
 		alloc_buffer(extent, &farc_bigbuf, ALIGNMENT);
 
-        // TODO Remove this.
-        void *mpi_bigbuf_centered  = ((char*) mpi_bigbuf)  + (extent / 2);
-        void *farc_bigbuf_centered = ((char*) farc_bigbuf) + (extent / 2);
+        void *mpi_bigbuf_origin  = ((char*) mpi_bigbuf)  - true_lb;
+        void *farc_bigbuf_origin = ((char*) farc_bigbuf) - true_lb;
 
 		// mpi_commit
 		TIME_HOT( MPI_Type_commit(&(datatype.mpi)), mpi_commit_time );
@@ -207,18 +225,20 @@ void produce_report() {
 		// mpi_pack
         init_buffer(extent, mpi_bigbuf, true);
 		init_buffer(size, mpi_smallbuf, false);
-		TIME_HOT( {int pos=0; MPI_Pack(mpi_bigbuf_centered, 1, datatype.mpi,
+		TIME_HOT( {int pos=0; MPI_Pack(mpi_bigbuf_origin, 1, datatype.mpi,
                     mpi_smallbuf, size, &pos, MPI_COMM_WORLD);}, 
                    mpi_pack_time_hot );
-		TIME_COLD( {int pos=0; MPI_Pack(mpi_bigbuf_centered, 1, datatype.mpi,
+		TIME_COLD( {int pos=0; MPI_Pack(mpi_bigbuf_origin, 1, datatype.mpi,
                     mpi_smallbuf, size, &pos, MPI_COMM_WORLD);}, 
                    mpi_pack_time_cold );
 
 		// farc pack
 		init_buffer(extent, farc_bigbuf, true);
 		init_buffer(size, farc_smallbuf, false);
-		TIME_HOT( DDT_Pack(farc_bigbuf_centered, farc_smallbuf, datatype.farc, 1), farc_pack_time_hot);
-		TIME_COLD( DDT_Pack(farc_bigbuf_centered, farc_smallbuf, datatype.farc, 1), farc_pack_time_cold);
+		TIME_HOT( DDT_Pack(farc_bigbuf_origin, farc_smallbuf, datatype.farc, 1), farc_pack_time_hot);
+		TIME_COLD( DDT_Pack(farc_bigbuf_origin, farc_smallbuf, datatype.farc, 1), farc_pack_time_cold);
+		TIME_COLD( DDT_Pack_stream(farc_bigbuf_origin, farc_smallbuf, datatype.farc, 1,
+                                   farc::Datatype::STREAM_ALWAYS), farc_pack_time_cold_nt);
 
 		// verify
 		if (compare_buffers(extent, mpi_bigbuf, farc_bigbuf) != 0) {
@@ -236,24 +256,25 @@ void produce_report() {
 		init_buffer(size, mpi_smallbuf, true);
 		init_buffer(extent, mpi_bigbuf, false);
 		TIME_HOT( {int pos=0; MPI_Unpack(mpi_smallbuf, size, &pos,
-                   mpi_bigbuf_centered, 1, datatype.mpi, MPI_COMM_WORLD);},
+                   mpi_bigbuf_origin, 1, datatype.mpi, MPI_COMM_WORLD);},
                   mpi_unpack_time_hot);
 		TIME_COLD( {int pos=0; MPI_Unpack(mpi_smallbuf, size, &pos,
-                    mpi_bigbuf_centered, 1, datatype.mpi, MPI_COMM_WORLD);}, 
+                    mpi_bigbuf_origin, 1, datatype.mpi, MPI_COMM_WORLD);}, 
                    mpi_unpack_time_cold);
 
 		// farc unpack
 		init_buffer(size, farc_smallbuf, true);
 		init_buffer(extent, farc_bigbuf, false);
-		TIME_HOT(DDT_Unpack(farc_smallbuf, farc_bigbuf_centered, datatype.farc, 1), farc_unpack_time_hot);
-		TIME_COLD(DDT_Unpack(farc_smallbuf, farc_bigbuf_centered, datatype.farc, 1), farc_unpack_time_cold);
+		TIME_HOT(DDT_Unpack(farc_smallbuf, farc_bigbuf_origin, datatype.farc, 1), farc_unpack_time_hot);
+		TIME_COLD(DDT_Unpack(farc_smallbuf, farc_bigbuf_origin, datatype.farc, 1), farc_unpack_time_cold);
+		TIME_COLD(DDT_Unpack_stream(farc_smallbuf, farc_bigbuf_origin, datatype.farc, 1,
+                                    farc::Datatype::STREAM_ALWAYS), farc_unpack_time_cold_nt);
 
 		// verify
 		if (compare_buffers(size, mpi_smallbuf, farc_smallbuf) != 0) {
 			cerr <<  "Error: " << datatype.farc->toString().c_str() 
                  << ": MPI and FARC input buffers differ after unpacking" << endl; 
 		}
-        //TODO the *2 is used to provide "centered" buffer in case of negative strides
 		if (compare_buffers(extent, mpi_bigbuf, farc_bigbuf) != 0) {
 			cerr <<  "Error: " << datatype.farc->toString().c_str() 
                  << ": MPI and FARC output buffers differ after unpacking" << endl; 
@@ -284,14 +305,16 @@ void produce_report() {
 		    cout << setw(26) << setprecision(1) << pack_speedup_hot;
 		    cout << setw(26) << setprecision(1) << unpack_speedup_hot;
         }
-        if (args_info.time_hot_given) {
+        if (args_info.time_cold_given) {
 		    cout << setw(26) << setprecision(3) << mpi_pack_time_cold;
 		    cout << setw(26) << setprecision(3) << farc_pack_time_cold;
 		    cout << setw(26) << setprecision(3) << mpi_unpack_time_cold;
 		    cout << setw(26) << setprecision(3) << farc_unpack_time_cold;
 		    cout << setw(26) << setprecision(1) << pack_speedup_cold;
 		    cout << setw(26) << setprecision(1) << unpack_speedup_cold;
-        } 
+		    cout << setw(26) << setprecision(3) << farc_pack_time_cold_nt;
+		    cout << setw(26) << setprecision(3) << farc_unpack_time_cold_nt;
+        }
 
 		cout << endl;
 
@@ -301,8 +324,191 @@ void produce_report() {
 		free(farc_bigbuf);
 		free(farc_smallbuf);
 	}
+}
+
+// Sets a parameter of target to value, host is the target of the host
+typedef void (*target_setter)(farc::DDT_Target* target, const farc::DDT_Target& host, int value);
+
+static void set_simd_width(farc::DDT_Target* target, const farc::DDT_Target& host, int width) {
+    target->simd_bytes = width;
+    target->copy_unroll = max(1, host.copy_unroll * host.simd_bytes / max(1, width));
+}
+
+static void set_prefetch_distance(farc::DDT_Target* target, const farc::DDT_Target& host, int distance) {
+    target->prefetch_distance = distance;
+}
+
+// Parses a comma separated list of integers
+static vector<int> parse_list(const char* values) {
+    vector<int> list;
+    for (const char* v = values; *v != '\0'; ) {
+        char* end;
+        list.push_back(strtol(v, &end, 10));
+        if (end == v) break;
+        v = (*end == ',') ? end + 1 : end;
+    }
+    return list;
+}
+
+// Bandwidth of the generated pack and unpack functions in MB/s of packed
+// data, for each value of the comma separated list values of a parameter of
+// the target. Every datatype is compiled again for each value. The columns
+// are named after the value and the given prefix and suffix.
+void produce_target_report(const char* values, const char* prefix, const char* suffix,
+                           target_setter set, bool cold) {
+
+    vector<int> params = parse_list(values);
+
+    farc::DDT_Target host_target;
+    farc::DDT_Get_Target(&host_target);
+
+    int name_w = 0;
+	for (unsigned int i=0; i<datatypes.size(); i++) {
+		name_w = max(name_w, (int) datatypes[i].farc->toString(true).size());
+	}
+
+	cout << setw(name_w + 9) << "size";
+    for (unsigned int j=0; j<params.size(); j++) {
+        stringstream pack_col, unpack_col;
+        pack_col << "pack_MBps_" << prefix << params[j] << suffix;
+        unpack_col << "unpack_MBps_" << prefix << params[j] << suffix;
+        cout << setw(24) << pack_col.str() << setw(24) << unpack_col.str();
+    }
+    cout << endl;
 
-	// free datatypes
+	for (unsigned int i=0; i<datatypes.size(); i++) {
+		Datatype datatype = datatypes[i];
+
+		long size = datatype.farc->getSize();
+        long true_lb = datatype.farc->getTrueLowerBound();
+        long true_extent = datatype.farc->getTrueExtent();
+
+		void *bigbuf, *smallbuf;
+		alloc_buffer(size, &smallbuf, ALIGNMENT);
+		alloc_buffer(true_extent, &bigbuf, ALIGNMENT);
+        void *bigbuf_origin = ((char*) bigbuf) - true_lb;
+		init_buffer(true_extent, bigbuf, true);
+		init_buffer(size, smallbuf, true);
+
+		cout.flags(std::ios::left);
+		cout << setw(name_w) << datatype.farc->toString(true).c_str();
+		cout.flags(ios::right);
+		cout.flags(ios::fixed);
+		cout << setw(9) << size;
+
+        for (unsigned int j=0; j<params.size(); j++) {
+            farc::DDT_Target target = host_target;
+            set(&target, host_target, params[j]);
+            if (farc::DDT_Set_Target(&target) != 0) {
+                cerr << "Error: invalid value " << params[j] << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            farc::Datatype* ddt = datatype.farc->clone();
+            DDT_Commit(ddt);
+
+            double pack_time, unpack_time;
+            if (cold) {
+                TIME_COLD(DDT_Pack(bigbuf_origin, smallbuf, ddt, 1), pack_time);
+                TIME_COLD(DDT_Unpack(smallbuf, bigbuf_origin, ddt, 1), unpack_time);
+            }
+            else {
+                TIME_HOT(DDT_Pack(bigbuf_origin, smallbuf, ddt, 1), pack_time);
+                TIME_HOT(DDT_Unpack(smallbuf, bigbuf_origin, ddt, 1), unpack_time);
+            }
+
+            // bytes per microsecond are MB/s
+		    cout << setw(24) << setprecision(1) << size / pack_time;
+		    cout << setw(24) << setprecision(1) << size / unpack_time;
+
+            DDT_Free(ddt);
+        }
+		cout << endl;
+
+		free(bigbuf);
+		free(smallbuf);
+	}
+
+    farc::DDT_Set_Target(&host_target);
+}
+
+// Prepares the calls for value, returns the packed buffer to use, packed
+// is MISALIGN_MAX aligned and has MISALIGN_MAX spare bytes
+typedef void* (*call_setter)(void* packed, int value);
+
+static void* set_misalignment(void* packed, int offset) {
+    return ((char*) packed) + (offset % MISALIGN_MAX + MISALIGN_MAX) % MISALIGN_MAX;
+}
+
+static void* set_threads(void* packed, int threads) {
+    if (farc::DDT_Set_Threads(threads) != 0) {
+        cerr << "Error: could not start " << threads << " threads" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return packed;
+}
+
+// Bandwidth of the generated pack and unpack functions in MB/s of packed
+// data, for each value of the comma separated list values of a property
+// of the calls. The datatypes are compiled once. The columns are named
+// after the value and the given prefix.
+void produce_call_report(const char* values, const char* prefix, call_setter set) {
+
+    vector<int> params = parse_list(values);
+
+    int name_w = 0;
+	for (unsigned int i=0; i<datatypes.size(); i++) {
+		name_w = max(name_w, (int) datatypes[i].farc->toString(true).size());
+	}
+
+	cout << setw(name_w + 9) << "size";
+    for (unsigned int j=0; j<params.size(); j++) {
+        stringstream pack_col, unpack_col;
+        pack_col << "pack_MBps_" << prefix << params[j];
+        unpack_col << "unpack_MBps_" << prefix << params[j];
+        cout << setw(24) << pack_col.str() << setw(24) << unpack_col.str();
+    }
+    cout << endl;
+
+	for (unsigned int i=0; i<datatypes.size(); i++) {
+		Datatype datatype = datatypes[i];
+
+		long size = datatype.farc->getSize();
+        long true_lb = datatype.farc->getTrueLowerBound();
+        long true_extent = datatype.farc->getTrueExtent();
+
+		void *bigbuf, *smallbuf;
+		alloc_buffer(size + MISALIGN_MAX, &smallbuf, MISALIGN_MAX);
+		alloc_buffer(true_extent, &bigbuf, MISALIGN_MAX);
+        void *bigbuf_origin = ((char*) bigbuf) - true_lb;
+		init_buffer(true_extent, bigbuf, true);
+		init_buffer(size + MISALIGN_MAX, smallbuf, true);
+
+		cout.flags(std::ios::left);
+		cout << setw(name_w) << datatype.farc->toString(true).c_str();
+		cout.flags(ios::right);
+		cout.flags(ios::fixed);
+		cout << setw(9) << size;
+
+        for (unsigned int j=0; j<params.size(); j++) {
+            void *packed = set(smallbuf, params[j]);
+
+            double pack_time, unpack_time;
+            TIME_HOT(DDT_Pack(bigbuf_origin, packed, datatype.farc, 1), pack_time);
+            TIME_HOT(DDT_Unpack(packed, bigbuf_origin, datatype.farc, 1), unpack_time);
+
+            // bytes per microsecond are MB/s
+		    cout << setw(24) << setprecision(1) << size / pack_time;
+		    cout << setw(24) << setprecision(1) << size / unpack_time;
+        }
+		cout << endl;
+
+		free(bigbuf);
+		free(smallbuf);
+	}
+}
+
+void free_datatypes() {
 	for (unsigned int i=0; i<datatypes.size(); i++) {
 		Datatype datatype = datatypes[i];
 
@@ -334,6 +540,25 @@ int main(int argc, char **argv) {
 	if (yyparse() == 0) {
 		produce_report();
 		printf("\n");
+        if (args_info.simd_widths_given) {
+            produce_target_report(args_info.simd_widths_arg, "", "B", set_simd_width, false);
+            printf("\n");
+        }
+        if (args_info.prefetch_distances_given) {
+            produce_target_report(args_info.prefetch_distances_arg, "cold_pf", "", set_prefetch_distance, true);
+            printf("\n");
+        }
+        if (args_info.misalignments_given) {
+            produce_call_report(args_info.misalignments_arg, "off", set_misalignment);
+            printf("\n");
+        }
+        if (args_info.threads_given) {
+            int threads = farc::DDT_Get_Threads();
+            produce_call_report(args_info.threads_arg, "threads", set_threads);
+            farc::DDT_Set_Threads(threads);
+            printf("\n");
+        }
+        free_datatypes();
 	}
 
     cmdline_parser_free(&args_info);
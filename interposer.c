@@ -15,8 +15,9 @@ Link this into your application to use FARC DDTs (see the pmpi-tests Makefile fo
 #include "interposer_common.h"
 
 int MPI_Init(int *argc, char ***argv) {
+    int ret = PMPI_Init(argc, argv);
     interposer_init();
-    return PMPI_Init(argc, argv);
+    return ret;
 }
 
 int MPI_Finalize(void) {
@@ -98,12 +99,18 @@ int MPI_Type_extent(MPI_Datatype datatype, int *extent) {
 }
 
 int MPI_Send(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) {
-    // TODO check other primitive types!
-    if ((datatype != MPI_DOUBLE) && (datatype != MPI_FLOAT) && (datatype != MPI_INT) && (datatype != MPI_BYTE) && (datatype != MPI_CHAR) && (datatype != MPI_PACKED)) {
-        int outsize;
+    if (interposer_is_derived(datatype)) {
+        if (interposer_pipelined(count, datatype, dest, comm)) {
+            return interposer_send_pipelined(buf, count, datatype, dest, tag, comm);
+        }
+
+        MPI_Aint outsize;
         void *outbuf = interposer_pack(buf, count, datatype, &outsize);
 
-        PMPI_Send(outbuf, outsize, MPI_BYTE, dest, tag, comm);
+        int bytecount;
+        MPI_Datatype bytetype = interposer_bytes_type(outsize, &bytecount);
+        PMPI_Send(outbuf, bytecount, bytetype, dest, tag, comm);
+        interposer_bytes_type_free(&bytetype);
 
         interposer_buffer_free(outbuf);
         return MPI_SUCCESS;
@@ -116,17 +123,18 @@ int MPI_Send(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI
 }
 
 int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status) {
-    // TODO check other primitive types!
-    if ((datatype != MPI_DOUBLE) && (datatype != MPI_FLOAT) && (datatype != MPI_INT) && (datatype != MPI_BYTE) && (datatype != MPI_CHAR) && (datatype != MPI_PACKED)) {
-        int insize;
-        void* inbuf = interposer_buffer_alloc(count, datatype, &insize);
-
-        PMPI_Recv(inbuf, insize, MPI_BYTE, source, tag, comm, status);
-
-        interposer_unpack(buf, count, datatype, inbuf);
-        interposer_buffer_free(inbuf);
-
-        return MPI_SUCCESS;
+    if (interposer_is_derived(datatype)) {
+        // The message may be the header of a pipelined one
+        MPI_Aint insize;
+        void* inbuf = interposer_recv_buffer_alloc(count, datatype, &insize);
+
+        int bytecount;
+        MPI_Datatype bytetype = interposer_bytes_type(insize, &bytecount);
+        PMPI_Recv(inbuf, bytecount, bytetype, source, tag, comm, status);
+        interposer_bytes_type_free(&bytetype);
+
+        // Frees inbuf
+        return interposer_recv_complete(inbuf, insize, buf, count, datatype, status);
     }
     else {
         PMPI_Recv(buf, count, datatype, source, tag, comm, status);
@@ -136,12 +144,14 @@ int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, M
 }
 
 int MPI_Isend(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request) {
-    // TODO check other primitive types!
-    if ((datatype != MPI_DOUBLE) && (datatype != MPI_FLOAT) && (datatype != MPI_INT) && (datatype != MPI_BYTE) && (datatype != MPI_CHAR) && (datatype != MPI_PACKED)) {
-        int outsize;
+    if (interposer_is_derived(datatype)) {
+        MPI_Aint outsize;
         void *outbuf = interposer_pack(buf, count, datatype, &outsize);
-    
-        PMPI_Isend(outbuf, outsize, MPI_BYTE, dest, tag, comm, request);
+
+        int bytecount;
+        MPI_Datatype bytetype = interposer_bytes_type(outsize, &bytecount);
+        PMPI_Isend(outbuf, bytecount, bytetype, dest, tag, comm, request);
+        interposer_bytes_type_free(&bytetype);
 
         interposer_request_register(outbuf, NULL, 0, 0, request);
         return MPI_SUCCESS;
@@ -155,12 +165,14 @@ int MPI_Isend(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MP
 }
 
 int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request) {
-    // TODO check other primitive types!
-    if ((datatype != MPI_DOUBLE) && (datatype != MPI_FLOAT) && (datatype != MPI_INT) && (datatype != MPI_BYTE) && (datatype != MPI_CHAR) && (datatype != MPI_PACKED)) {
-        int insize;
-        void* inbuf = interposer_buffer_alloc(count, datatype, &insize);
-
-        PMPI_Irecv(inbuf, insize, MPI_BYTE, source, tag, comm, request);
+    if (interposer_is_derived(datatype)) {
+        MPI_Aint insize;
+        void* inbuf = interposer_recv_buffer_alloc(count, datatype, &insize);
+
+        int bytecount;
+        MPI_Datatype bytetype = interposer_bytes_type(insize, &bytecount);
+        PMPI_Irecv(inbuf, bytecount, bytetype, source, tag, comm, request);
+        interposer_bytes_type_free(&bytetype);
 
         interposer_request_register(inbuf, buf, count, datatype, request);
         return MPI_SUCCESS;
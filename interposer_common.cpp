@@ -7,11 +7,16 @@
 
 #include "interposer_common.h"
 
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
 #include <string>
-#include <map>
-#include <queue>
-#include <list>
+#include <vector>
+#include <tr1/unordered_map>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <mpi.h>
 
 #include "ddt_jit.hpp"
@@ -22,119 +27,401 @@
 
 using namespace farc;
 
-struct Request {
-    MPI_Request *mpi_req;
+/* Pipelining of large messages (see interposer_send_pipelined) */
+static int g_pipeline_segments = 1;
+static int g_pipeline_min_segment = 64 * 1024;
+
+/* Segments of pipelined messages travel in a duplicate of MPI_COMM_WORLD,
+   each message with a tag of its own */
+static MPI_Comm g_segment_comm = MPI_COMM_NULL;
+static int g_segment_tag_ub = 32767;
+static unsigned long g_segment_tags = 0;
 
+static bool g_print_stats = false;
+
+struct Request {
     void* tmpbuf;
 
     // If it is a Irecv op
     void* usrbuf;
     int count;
     MPI_Datatype datatype;
+    MPI_Aint insize;
+    struct Pipeline* pipeline;  // set once the request received a pipeline header
 };
 
 static inline bool is_recv(Request req) {
     return req.usrbuf != NULL;
 }
 
-static std::list<struct Request> g_outstanding_requests; 
+// Outstanding requests which use a temporary buffer, by their handle.
+// Requests without one are not tracked at all.
+typedef std::tr1::unordered_map<MPI_Request, struct Request> RequestTable;
+static RequestTable g_outstanding_requests;
 
-/* Datatype lookup data structures */
-#define DDT_FAST_CACHE_SIZE 50
-static Datatype* g_types[DDT_FAST_CACHE_SIZE];
-static std::queue<int> g_types_freelist;
-static std::map<MPI_Datatype, Datatype*> g_types_fallback;
+// Threads register and complete requests concurrently. The number of
+// entries is updated under the lock and read without it, to skip the table
+// when there is nothing to complete.
+static pthread_mutex_t g_requests_lock = PTHREAD_MUTEX_INITIALIZER;
+static long g_requests_count = 0;
 
-static PrimitiveDatatype farc_double(PrimitiveDatatype::DOUBLE);
-static PrimitiveDatatype farc_float(PrimitiveDatatype::FLOAT);
-static PrimitiveDatatype farc_int(PrimitiveDatatype::INT);
-static PrimitiveDatatype farc_byte(PrimitiveDatatype::BYTE);
-static PrimitiveDatatype farc_char(PrimitiveDatatype::CHAR);
-//TODO add other primitive types here
+static inline bool requests_tracked() {
+    return __atomic_load_n(&g_requests_count, __ATOMIC_RELAXED) != 0;
+}
 
-static inline MPI_Datatype datatype_handle_create() {
+static void request_put(MPI_Request request, const Request &req) {
+    pthread_mutex_lock(&g_requests_lock);
+    g_outstanding_requests[request] = req;
+    __atomic_store_n(&g_requests_count, (long) g_outstanding_requests.size(), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_requests_lock);
+}
 
-    if (! g_types_freelist.empty()) {
-        MPI_Datatype ddt = (MPI_Datatype)g_types_freelist.front();
-        g_types_freelist.pop();
-        return ddt;
-   }
-   else {
-        int nexttype = DDT_FAST_CACHE_SIZE + g_types_fallback.size();
-        g_types_fallback[nexttype] = NULL;
-        return ((MPI_Datatype) nexttype);
-   }
+static bool request_take(MPI_Request request, Request *req) {
+    pthread_mutex_lock(&g_requests_lock);
+    RequestTable::iterator it = g_outstanding_requests.find(request);
+    bool found = (it != g_outstanding_requests.end());
+    if (found) {
+        *req = it->second;
+        g_outstanding_requests.erase(it);
+        __atomic_store_n(&g_requests_count, (long) g_outstanding_requests.size(), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_requests_lock);
+    return found;
+}
+
+/* Datatype lookup data structures
+ *
+ * Handles of derived datatypes are indices into a table of chunks, or'ed
+ * with HANDLE_TAG. The tag sets bits which are used by no predefined handle
+ * of MPICH (its datatype handles are 0x4c..., 0x8c... or 0xcc..., the null
+ * handle is 0x0c000000), so our handles can not be mistaken for them.
+ * Chunks are never moved or freed before interposer_finalize(), so lookups
+ * only need two loads and no lock, while creating and freeing handles is
+ * serialized by g_types_lock.
+ *
+ * This relies on datatype handles being ints laid out as in MPICH and its
+ * derivatives. Implementations with pointer handles (Open MPI) are refused
+ * at compile time, interposer_init() checks the predefined handles. */
+#if !defined(MPICH_VERSION) && !defined(MPICH2_VERSION)
+#error "The MPI interposer encodes datatype handles for MPICH and its derivatives only"
+#endif
+
+#define HANDLE_TAG 0x3c000000
+#define HANDLE_MASK 0x03ffffff
+#define TYPES_CHUNK_BITS 12
+#define TYPES_CHUNK_SIZE (1 << TYPES_CHUNK_BITS)
+#define TYPES_CHUNKS ((HANDLE_MASK + 1) / TYPES_CHUNK_SIZE)
+
+static Datatype** g_types[TYPES_CHUNKS];
+static int g_types_next = 0;
+static std::vector<int> g_types_freelist;
+static pthread_mutex_t g_types_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Predefined MPI types and the primitive types they are packed as. The
+ * Fortran types are mapped to the C types of the same width. The pair types
+ * used by MINLOC and MAXLOC (MPI_DOUBLE_INT etc.) have holes and are not
+ * supported. */
+struct predefined_type {
+    MPI_Datatype mpi;
+    PrimitiveDatatype farc;
+};
 
+static predefined_type g_predefined[] = {
+    {MPI_CHAR,                   PrimitiveDatatype(PrimitiveDatatype::CHAR)},
+    {MPI_SIGNED_CHAR,            PrimitiveDatatype(PrimitiveDatatype::SIGNED_CHAR)},
+    {MPI_UNSIGNED_CHAR,          PrimitiveDatatype(PrimitiveDatatype::UNSIGNED_CHAR)},
+    {MPI_BYTE,                   PrimitiveDatatype(PrimitiveDatatype::BYTE)},
+    {MPI_WCHAR,                  PrimitiveDatatype(PrimitiveDatatype::WCHAR)},
+    {MPI_SHORT,                  PrimitiveDatatype(PrimitiveDatatype::SHORT)},
+    {MPI_UNSIGNED_SHORT,         PrimitiveDatatype(PrimitiveDatatype::UNSIGNED_SHORT)},
+    {MPI_INT,                    PrimitiveDatatype(PrimitiveDatatype::INT)},
+    {MPI_UNSIGNED,               PrimitiveDatatype(PrimitiveDatatype::UNSIGNED)},
+    {MPI_LONG,                   PrimitiveDatatype(PrimitiveDatatype::LONG)},
+    {MPI_UNSIGNED_LONG,          PrimitiveDatatype(PrimitiveDatatype::UNSIGNED_LONG)},
+    {MPI_FLOAT,                  PrimitiveDatatype(PrimitiveDatatype::FLOAT)},
+    {MPI_DOUBLE,                 PrimitiveDatatype(PrimitiveDatatype::DOUBLE)},
+    {MPI_LONG_DOUBLE,            PrimitiveDatatype(PrimitiveDatatype::LONG_DOUBLE)},
+    {MPI_LONG_LONG_INT,          PrimitiveDatatype(PrimitiveDatatype::LONG_LONG)},
+    {MPI_LONG_LONG,              PrimitiveDatatype(PrimitiveDatatype::LONG_LONG)},
+    {MPI_UNSIGNED_LONG_LONG,     PrimitiveDatatype(PrimitiveDatatype::UNSIGNED_LONG_LONG)},
+    {MPI_INT8_T,                 PrimitiveDatatype(PrimitiveDatatype::INT8)},
+    {MPI_INT16_T,                PrimitiveDatatype(PrimitiveDatatype::INT16)},
+    {MPI_INT32_T,                PrimitiveDatatype(PrimitiveDatatype::INT32)},
+    {MPI_INT64_T,                PrimitiveDatatype(PrimitiveDatatype::INT64)},
+    {MPI_UINT8_T,                PrimitiveDatatype(PrimitiveDatatype::UINT8)},
+    {MPI_UINT16_T,               PrimitiveDatatype(PrimitiveDatatype::UINT16)},
+    {MPI_UINT32_T,               PrimitiveDatatype(PrimitiveDatatype::UINT32)},
+    {MPI_UINT64_T,               PrimitiveDatatype(PrimitiveDatatype::UINT64)},
+    {MPI_C_BOOL,                 PrimitiveDatatype(PrimitiveDatatype::BOOL)},
+    {MPI_AINT,                   PrimitiveDatatype(PrimitiveDatatype::AINT)},
+    {MPI_OFFSET,                 PrimitiveDatatype(PrimitiveDatatype::OFFSET)},
+    {MPI_C_FLOAT_COMPLEX,        PrimitiveDatatype(PrimitiveDatatype::FLOAT_COMPLEX)},
+    {MPI_C_DOUBLE_COMPLEX,       PrimitiveDatatype(PrimitiveDatatype::DOUBLE_COMPLEX)},
+    {MPI_C_LONG_DOUBLE_COMPLEX,  PrimitiveDatatype(PrimitiveDatatype::LONG_DOUBLE_COMPLEX)},
+    {MPI_CHARACTER,              PrimitiveDatatype(PrimitiveDatatype::CHAR)},
+    {MPI_INTEGER,                PrimitiveDatatype(PrimitiveDatatype::INT)},
+    {MPI_LOGICAL,                PrimitiveDatatype(PrimitiveDatatype::INT)},
+    {MPI_REAL,                   PrimitiveDatatype(PrimitiveDatatype::FLOAT)},
+    {MPI_DOUBLE_PRECISION,       PrimitiveDatatype(PrimitiveDatatype::DOUBLE)},
+    {MPI_COMPLEX,                PrimitiveDatatype(PrimitiveDatatype::FLOAT_COMPLEX)},
+    {MPI_DOUBLE_COMPLEX,         PrimitiveDatatype(PrimitiveDatatype::DOUBLE_COMPLEX)},
+};
+
+static inline bool is_derived_handle(MPI_Datatype dt_handle) {
+    return (((int) dt_handle) & ~HANDLE_MASK) == HANDLE_TAG;
 }
 
-static inline void datatype_handle_free(MPI_Datatype* ddt_handle) {
+static inline MPI_Datatype datatype_handle_create() {
 
-    if (((int)*ddt_handle) < DDT_FAST_CACHE_SIZE) {
-        g_types_freelist.push(*ddt_handle);
+    pthread_mutex_lock(&g_types_lock);
+
+    int index;
+    if (!g_types_freelist.empty()) {
+        index = g_types_freelist.back();
+        g_types_freelist.pop_back();
     }
     else {
-        g_types_fallback.erase((int)*ddt_handle);
+        index = g_types_next++;
+        if (index > HANDLE_MASK) {
+            fprintf(stderr, "Too many datatypes\n");
+            exit(EXIT_FAILURE);
+        }
+
+        int chunk = index >> TYPES_CHUNK_BITS;
+        if (g_types[chunk] == NULL) {
+            Datatype** types = (Datatype**) calloc(TYPES_CHUNK_SIZE, sizeof(Datatype*));
+            __atomic_store_n(&g_types[chunk], types, __ATOMIC_RELEASE);
+        }
     }
 
+    pthread_mutex_unlock(&g_types_lock);
+
+    return (MPI_Datatype) (HANDLE_TAG | index);
+
 }
 
 static inline void datatype_store(MPI_Datatype dt_handle, Datatype *dt) {
 
-    if ((int)dt_handle < DDT_FAST_CACHE_SIZE) {
-        g_types[(int)dt_handle] = dt;
+    int index = ((int) dt_handle) & HANDLE_MASK;
+    Datatype** types = __atomic_load_n(&g_types[index >> TYPES_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    __atomic_store_n(&types[index & (TYPES_CHUNK_SIZE-1)], dt, __ATOMIC_RELEASE);
+
+}
+
+static inline void datatype_handle_free(MPI_Datatype* ddt_handle) {
+
+    if (!is_derived_handle(*ddt_handle)) return;
+
+    datatype_store(*ddt_handle, NULL);
+
+    pthread_mutex_lock(&g_types_lock);
+    g_types_freelist.push_back(((int) *ddt_handle) & HANDLE_MASK);
+    pthread_mutex_unlock(&g_types_lock);
+
+}
+
+static inline Datatype* datatype_retrieve(MPI_Datatype dt_handle) {
+
+    if (is_derived_handle(dt_handle)) {
+        int index = ((int) dt_handle) & HANDLE_MASK;
+        Datatype** types = __atomic_load_n(&g_types[index >> TYPES_CHUNK_BITS], __ATOMIC_ACQUIRE);
+        if (types == NULL) return NULL;
+        return __atomic_load_n(&types[index & (TYPES_CHUNK_SIZE-1)], __ATOMIC_ACQUIRE);
     }
-    else {
-        g_types_fallback[dt_handle] = dt;
+
+    // Implementations without Fortran bindings define the Fortran types as
+    // MPI_DATATYPE_NULL
+    if (dt_handle == MPI_DATATYPE_NULL) return NULL;
+    for (size_t i=0; i<sizeof(g_predefined)/sizeof(g_predefined[0]); i++) {
+        if (g_predefined[i].mpi == dt_handle) return &g_predefined[i].farc;
     }
 
+    return NULL;
 }
 
-static inline Datatype* datatype_retrieve(MPI_Datatype dt_handle) {
+/* Pool of temporary buffers
+ *
+ * Buffers are handed out from power of two size classes, the first
+ * POOL_HEADER bytes of every block hold its size class. Blocks of freed
+ * buffers are kept per class, and every POOL_TRIM_INTERVAL frees of a class
+ * the cached blocks which exceed the peak usage of the class since the last
+ * trim are given back to the system. Blocks from POOL_HUGE_CLASS up are
+ * aligned to and advised to be backed by (transparent) huge pages, blocks
+ * above POOL_MAX_CLASS are not cached at all. */
+#define POOL_HEADER 64
+#define POOL_MIN_CLASS 12
+#define POOL_HUGE_CLASS 21
+#define POOL_MAX_CLASS 28
+#define POOL_TRIM_INTERVAL 1024
+
+struct PoolClass {
+    pthread_mutex_t lock;
+    std::vector<char*> blocks;
+    int inuse;
+    int highwater;
+    int frees;
+};
 
-    switch (dt_handle) {
-        case MPI_DOUBLE:
-            return &farc_double;
-            break;
-        case MPI_INT:
-            return &farc_int;
-            break;
-        case MPI_BYTE:
-            return &farc_byte;
-            break;
-        case MPI_CHAR:
-            return &farc_char;
-            break;
-        case MPI_FLOAT:
-            return &farc_float;
-            break;
+static PoolClass g_pool[POOL_MAX_CLASS+1];
+static struct interposer_pool_stats g_pool_stats;
+
+static void pool_init() {
+    for (int c=POOL_MIN_CLASS; c<=POOL_MAX_CLASS; c++) {
+        pthread_mutex_init(&g_pool[c].lock, NULL);
+        g_pool[c].inuse = 0;
+        g_pool[c].highwater = 0;
+        g_pool[c].frees = 0;
+    }
+}
+
+static void pool_finalize() {
+    for (int c=POOL_MIN_CLASS; c<=POOL_MAX_CLASS; c++) {
+        pthread_mutex_lock(&g_pool[c].lock);
+        for (size_t i=0; i<g_pool[c].blocks.size(); i++) {
+            free(g_pool[c].blocks[i]);
+        }
+        g_pool[c].blocks.clear();
+        pthread_mutex_unlock(&g_pool[c].lock);
     }
+}
+
+static inline int pool_class(size_t size) {
+    int c = POOL_MIN_CLASS;
+    while ((((size_t) 1) << c) < size + POOL_HEADER) c++;
+    return c;
+}
 
-    Datatype* res = NULL;
+static char* pool_new_block(int c) {
+    size_t size = ((size_t) 1) << c;
+    void* block = NULL;
 
-    if (((int)dt_handle) < DDT_FAST_CACHE_SIZE) {
-        res = g_types[(int)dt_handle];
+    if (c >= POOL_HUGE_CLASS) {
+        if (posix_memalign(&block, ((size_t) 1) << POOL_HUGE_CLASS, size) != 0) block = NULL;
+#ifdef MADV_HUGEPAGE
+        if (block != NULL) madvise(block, size, MADV_HUGEPAGE);
+#endif
     }
     else {
-        res = g_types_fallback[dt_handle];
+        if (posix_memalign(&block, POOL_HEADER, size) != 0) block = NULL;
     }
 
-    return res;
+    if (block == NULL) {
+        fprintf(stderr, "Could not allocate a temporary buffer of %lu bytes\n", (unsigned long) size);
+        exit(EXIT_FAILURE);
+    }
+    return (char*) block;
 }
 
+static void* pool_alloc(size_t size) {
+    int c = pool_class(size);
+    char* block = NULL;
+
+    if (c <= POOL_MAX_CLASS) {
+        PoolClass& pc = g_pool[c];
+        pthread_mutex_lock(&pc.lock);
+        if (!pc.blocks.empty()) {
+            block = pc.blocks.back();
+            pc.blocks.pop_back();
+        }
+        pc.inuse++;
+        if (pc.inuse > pc.highwater) pc.highwater = pc.inuse;
+        pthread_mutex_unlock(&pc.lock);
+    }
+
+    if (block != NULL) {
+        __sync_fetch_and_add(&g_pool_stats.hits, 1);
+    }
+    else {
+        __sync_fetch_and_add(&g_pool_stats.misses, 1);
+        block = pool_new_block(c);
+    }
+
+    *((int*) block) = c;
+    return block + POOL_HEADER;
+}
+
+static void pool_free(void* buf) {
+    char* block = ((char*) buf) - POOL_HEADER;
+    int c = *((int*) block);
+
+    if (c > POOL_MAX_CLASS) {
+        free(block);
+        return;
+    }
+
+    // blocks are trimmed outside of the lock
+    std::vector<char*> trimmed;
+
+    PoolClass& pc = g_pool[c];
+    pthread_mutex_lock(&pc.lock);
+    pc.inuse--;
+    pc.blocks.push_back(block);
+    if (++pc.frees >= POOL_TRIM_INTERVAL) {
+        while (pc.inuse + (int) pc.blocks.size() > pc.highwater) {
+            trimmed.push_back(pc.blocks.back());
+            pc.blocks.pop_back();
+        }
+        pc.highwater = pc.inuse;
+        pc.frees = 0;
+    }
+    pthread_mutex_unlock(&pc.lock);
+
+    for (size_t i=0; i<trimmed.size(); i++) {
+        free(trimmed[i]);
+    }
+    if (!trimmed.empty()) __sync_fetch_and_add(&g_pool_stats.trimmed, trimmed.size());
+}
+
+void interposer_get_pool_stats(struct interposer_pool_stats* stats) {
+    *stats = g_pool_stats;
+}
+
+
 void interposer_init() {
-    // Populate the free list (primitive datatype locations become dead slots)
-    // Note: MPICH has no primitive datatypes in the range 0:49, but that might
-    //       not hold for other MPI implementations or the future so a more 
-    //       robust solution should remove all primitive datatypes from the 
-    //       freelist if they are there
-    for (int i=0; i < DDT_FAST_CACHE_SIZE; ++i) {
-        g_types_freelist.push(i);
-    } 
+    const char* env = getenv("LIBPACK_PIPELINE_SEGMENTS");
+    if (env != NULL && atoi(env) > 0) g_pipeline_segments = atoi(env);
+    env = getenv("LIBPACK_PIPELINE_MIN_SEGMENT");
+    if (env != NULL && atoi(env) > 0) g_pipeline_min_segment = atoi(env);
+    env = getenv("LIBPACK_STATS");
+    g_print_stats = (env != NULL && atoi(env) != 0);
+
+    for (size_t i=0; i<sizeof(g_predefined)/sizeof(g_predefined[0]); i++) {
+        if (is_derived_handle(g_predefined[i].mpi)) {
+            fprintf(stderr, "Predefined datatype handle %#x collides with the handles of libpack\n",
+                    (unsigned) (int) g_predefined[i].mpi);
+            exit(EXIT_FAILURE);
+        }
+    }
 
+    pool_init();
     DDT_Init();
+
+    // Called after MPI_Init, which is also why the tag upper bound is known
+    PMPI_Comm_dup(MPI_COMM_WORLD, &g_segment_comm);
+    int* tag_ub;
+    int flag;
+    PMPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+    if (flag) g_segment_tag_ub = *tag_ub;
 }
 
 void interposer_finalize() {
+    if (g_print_stats) {
+        fprintf(stderr, "libpack: %lu buffer pool hits, %lu misses, %lu buffers trimmed\n",
+                g_pool_stats.hits, g_pool_stats.misses, g_pool_stats.trimmed);
+    }
+    pool_finalize();
+    if (g_segment_comm != MPI_COMM_NULL) PMPI_Comm_free(&g_segment_comm);
+    // Types the application did not free, each one owns clones of the
+    // types it was made of
+    for (int c=0; c<TYPES_CHUNKS && g_types[c] != NULL; c++) {
+        for (int i=0; i<TYPES_CHUNK_SIZE; i++) {
+            if (g_types[c][i] != NULL) DDT_Free(g_types[c][i]);
+        }
+        free(g_types[c]);
+        g_types[c] = NULL;
+    }
+    g_types_next = 0;
+    g_types_freelist.clear();
     DDT_Finalize();
 }
 
@@ -243,6 +530,11 @@ void interposer_free(MPI_Datatype *datatype) {
     datatype_handle_free(datatype);
 }
 
+// Predefined types are contiguous and passed to MPI as they are
+int interposer_is_derived(MPI_Datatype datatype) {
+    return is_derived_handle(datatype);
+}
+
 int interposer_type_size(MPI_Datatype datatype) {
     return datatype_retrieve(datatype)->getSize();
 }
@@ -252,33 +544,45 @@ int interposer_type_extent(MPI_Datatype datatype) {
 }
 
 
-// TODO: Implement segmenting (and possibly reduce buffer size)
-const int scratch_size = 2 * 1024 * 1024;
-bool scratch_in_use = false;
-static char scratch[scratch_size];
+void* interposer_buffer_alloc(int count, MPI_Datatype datatype, MPI_Aint* buf_size) {
+    *buf_size = datatype_retrieve(datatype)->getSize() * (MPI_Aint) count;
+    return pool_alloc(*buf_size);
+}
 
-void* interposer_buffer_alloc(int count, MPI_Datatype datatype, int* buf_size) {
-    *buf_size = datatype_retrieve(datatype)->getSize() * count;
+// MPI counts are ints, so packed buffers of more than INT_MAX bytes are
+// transferred as a single element of a type made of BYTES_CHUNK sized
+// pieces. The type can be freed right after the operation was started.
+#define BYTES_CHUNK (1 << 30)
 
-    if (*buf_size <= scratch_size && !scratch_in_use) {
-        scratch_in_use = true;
-        return scratch;
-    }
-    else {
-        return malloc(*buf_size);
+MPI_Datatype interposer_bytes_type(MPI_Aint size, int *count) {
+    if (size <= INT_MAX) {
+        *count = size;
+        return MPI_BYTE;
     }
+
+    MPI_Datatype chunktype, bytestype;
+    PMPI_Type_contiguous(BYTES_CHUNK, MPI_BYTE, &chunktype);
+
+    int blocklens[2] = {(int) (size / BYTES_CHUNK), (int) (size % BYTES_CHUNK)};
+    MPI_Aint displs[2] = {0, (size / BYTES_CHUNK) * (MPI_Aint) BYTES_CHUNK};
+    MPI_Datatype types[2] = {chunktype, MPI_BYTE};
+    PMPI_Type_create_struct(2, blocklens, displs, types, &bytestype);
+    PMPI_Type_commit(&bytestype);
+    PMPI_Type_free(&chunktype);
+
+    *count = 1;
+    return bytestype;
+}
+
+void interposer_bytes_type_free(MPI_Datatype *type) {
+    if (*type != MPI_BYTE) PMPI_Type_free(type);
 }
 
 void interposer_buffer_free(void* tmpbuf) {
-    if (tmpbuf != scratch) {
-        free(tmpbuf);
-    }
-    else {
-        scratch_in_use = true;
-    }
+    pool_free(tmpbuf);
 }
 
-void* interposer_pack(void *data, int count, MPI_Datatype datatype, int *buf_size) {
+void* interposer_pack(void *data, int count, MPI_Datatype datatype, MPI_Aint *buf_size) {
     void* buf = interposer_buffer_alloc(count, datatype, buf_size);
     DDT_Pack(data, buf, datatype_retrieve(datatype), count);
     return buf;
@@ -292,167 +596,538 @@ void interposer_unpack(void *data, int count, MPI_Datatype datatype, void* buf)
     DDT_Unpack(buf, data, datatype_retrieve(datatype), count);
 }
 
+void interposer_set_pipeline(int segments, int min_segment_size) {
+    g_pipeline_segments = (segments > 0) ? segments : 1;
+    g_pipeline_min_segment = (min_segment_size > 0) ? min_segment_size : 1;
+}
+
+// A pipelined message is announced by a header message, so the sender alone
+// decides whether and how a message is split. The magic number and the check
+// word tell it apart from the packed data of a message which is not
+// pipelined.
+#define PIPELINE_MAGIC 0x6c69627061636b50L
+
+struct pipeline_header {
+    long magic;
+    long size;          // packed bytes of the whole message
+    long segsize;       // packed bytes of all but the last segment
+    int source;         // rank of the sender in the communicator
+    int tag;
+    int segsource;      // rank of the sender in g_segment_comm
+    int segtag;         // tag of the segments in g_segment_comm
+    long check;
+};
+
+// A receive which got the header of a pipelined message goes on with the
+// receives of its segments, one in flight while the one before is unpacked
+struct Pipeline {
+    pipeline_header header;
+    long offset;        // packed offset of the segment the request receives
+    MPI_Request next;   // receive of the segment after it
+};
+
+static inline long pipeline_header_check(const pipeline_header *header) {
+    return header->magic ^ header->size ^ header->segsize ^
+           ((long) header->source << 32) ^ (long) (unsigned) header->tag ^
+           ((long) header->segsource << 16) ^ ((long) header->segtag << 40);
+}
+
+static int pipeline_segment_size(long packed_size) {
+    long segsize = (packed_size + g_pipeline_segments - 1) / g_pipeline_segments;
+    if (segsize < g_pipeline_min_segment) segsize = g_pipeline_min_segment;
+    if (segsize > BYTES_CHUNK) segsize = BYTES_CHUNK;
+    return segsize;
+}
+
+// Rank of a process of comm in g_segment_comm, MPI_UNDEFINED if it is not
+// part of MPI_COMM_WORLD
+static int segment_rank(MPI_Comm comm, int rank) {
+    if (comm == MPI_COMM_WORLD) return rank;
+
+    MPI_Group group, worldgroup;
+    int segrank;
+    PMPI_Comm_group(comm, &group);
+    PMPI_Comm_group(g_segment_comm, &worldgroup);
+    PMPI_Group_translate_ranks(group, 1, &rank, worldgroup, &segrank);
+    PMPI_Group_free(&group);
+    PMPI_Group_free(&worldgroup);
+    return segrank;
+}
+
+// Only the sending side is asked, the receivers follow the header. Messages
+// smaller than the header are never split, so a matching receive has room
+// for it. Segments are addressed by rank in MPI_COMM_WORLD, so messages on
+// intercommunicators or to spawned processes are sent in one piece.
+int interposer_pipelined(int count, MPI_Datatype datatype, int dest, MPI_Comm comm) {
+    if (g_pipeline_segments <= 1 || g_segment_comm == MPI_COMM_NULL) return 0;
+
+    long packed_size = datatype_retrieve(datatype)->getSize() * (long) count;
+    if (packed_size < (long) sizeof(pipeline_header)) return 0;
+    if (packed_size <= pipeline_segment_size(packed_size)) return 0;
+
+    int inter;
+    PMPI_Comm_test_inter(comm, &inter);
+    if (inter || dest == MPI_PROC_NULL) return 0;
+    return segment_rank(comm, dest) != MPI_UNDEFINED;
+}
+
+// The header goes to the receive the application posted, the segments
+// follow in g_segment_comm with a tag of their own, so no other receive of
+// the application can match them. While one segment is in flight, the next
+// one is packed into the second buffer.
+int interposer_send_pipelined(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) {
+    Datatype* ddt = datatype_retrieve(datatype);
+    long packed_size = ddt->getSize() * (long) count;
+    long segsize = pipeline_segment_size(packed_size);
+    int segdest = segment_rank(comm, dest);
+
+    pipeline_header header;
+    header.magic = PIPELINE_MAGIC;
+    header.size = packed_size;
+    header.segsize = segsize;
+    PMPI_Comm_rank(comm, &header.source);
+    header.tag = tag;
+    PMPI_Comm_rank(g_segment_comm, &header.segsource);
+    header.segtag = __sync_fetch_and_add(&g_segment_tags, 1) % ((unsigned long) g_segment_tag_ub + 1);
+    header.check = pipeline_header_check(&header);
+    int ret = PMPI_Send(&header, sizeof(header), MPI_BYTE, dest, tag, comm);
+
+    char* segbuf[2];
+    segbuf[0] = (char*) pool_alloc(2 * segsize);
+    segbuf[1] = segbuf[0] + segsize;
+    MPI_Request reqs[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+
+    long offset = 0;
+    for (int i=0; offset<packed_size && ret == MPI_SUCCESS; offset+=segsize, i++) {
+        int b = i % 2;
+        int len = std::min(segsize, packed_size - offset);
+
+        if (reqs[b] != MPI_REQUEST_NULL) PMPI_Wait(&reqs[b], MPI_STATUS_IGNORE);
+        DDT_Pack_partial(buf, segbuf[b], ddt, count, offset, len);
+        ret = PMPI_Isend(segbuf[b], len, MPI_BYTE, segdest, header.segtag, g_segment_comm, &reqs[b]);
+    }
+
+    PMPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+    pool_free(segbuf[0]);
+
+    return ret;
+}
+
+void* interposer_recv_buffer_alloc(int count, MPI_Datatype datatype, MPI_Aint* buf_size) {
+    void* buf = interposer_buffer_alloc(count, datatype, buf_size);
+
+    // A pool buffer may still hold the header of an earlier message
+    if (*buf_size >= (MPI_Aint) sizeof(long)) memset(buf, 0, sizeof(long));
+    return buf;
+}
+
+static bool pipeline_header_read(const Request &req, pipeline_header *header) {
+    if (req.insize < (MPI_Aint) sizeof(*header)) return false;
+
+    memcpy(header, req.tmpbuf, sizeof(*header));
+    return header->magic == PIPELINE_MAGIC && header->check == pipeline_header_check(header);
+}
+
+// Posts the receive of the segment of a pipelined message at offset, or sets
+// request to MPI_REQUEST_NULL if the message ends before it
+static int segment_post(const Request &req, long offset, MPI_Request *request) {
+    const pipeline_header &header = req.pipeline->header;
+    *request = MPI_REQUEST_NULL;
+    if (offset >= header.size) return MPI_SUCCESS;
+
+    int len = std::min(header.segsize, header.size - offset);
+    return PMPI_Irecv((char*) req.tmpbuf + offset, len, MPI_BYTE, header.segsource, header.segtag,
+                      g_segment_comm, request);
+}
+
+static void segment_cancel(MPI_Request *request) {
+    if (*request == MPI_REQUEST_NULL) return;
+    PMPI_Cancel(request);
+    PMPI_Wait(request, MPI_STATUS_IGNORE);
+}
+
+// The status of the last segment is made to describe the whole message as it
+// was sent by the application
+static void pipeline_status(const pipeline_header &header, MPI_Status *status) {
+    if (status == MPI_STATUS_IGNORE) return;
+
+    status->MPI_SOURCE = header.source;
+    status->MPI_TAG = header.tag;
+
+    int bytecount;
+    MPI_Datatype bytetype = interposer_bytes_type(header.size, &bytecount);
+    PMPI_Status_set_elements(status, bytetype, bytecount);
+    interposer_bytes_type_free(&bytetype);
+}
+
+// Called when the MPI request of req has completed, with status as MPI left
+// it. Returns false if req goes on with the receive of the next segment of a
+// pipelined message, which is stored in *request. Otherwise req is done, its
+// buffer is freed and *err is set to the result of the operation.
+static bool request_advance(Request &req, MPI_Request *request, MPI_Status *status, int *err) {
+    *err = MPI_SUCCESS;
+
+    if (!is_recv(req)) {
+        interposer_buffer_free(req.tmpbuf);
+        return true;
+    }
+
+    Datatype* ddt = datatype_retrieve(req.datatype);
+    if (req.pipeline == NULL) {
+        pipeline_header header;
+        if (!pipeline_header_read(req, &header)) {
+            DDT_Unpack(req.tmpbuf, req.usrbuf, ddt, req.count);
+            interposer_buffer_free(req.tmpbuf);
+            return true;
+        }
+        if (header.size > req.insize || header.segsize <= 0) {
+            fprintf(stderr, "Pipelined message of %li bytes does not match a receive of %li bytes\n",
+                    header.size, (long) req.insize);
+            interposer_buffer_free(req.tmpbuf);
+            *err = MPI_ERR_TRUNCATE;
+            return true;
+        }
+
+        // The message is received into the buffer which held the header, two
+        // segments at a time
+        req.pipeline = new Pipeline;
+        req.pipeline->header = header;
+        req.pipeline->offset = 0;
+        req.pipeline->next = MPI_REQUEST_NULL;
+        *err = segment_post(req, 0, request);
+        if (*err == MPI_SUCCESS) *err = segment_post(req, header.segsize, &req.pipeline->next);
+    }
+    else {
+        Pipeline* p = req.pipeline;
+        long offset = p->offset;
+        int len = std::min(p->header.segsize, p->header.size - offset);
+
+        // The segment after the next one is posted before this one is unpacked
+        *request = p->next;
+        p->offset += p->header.segsize;
+        *err = segment_post(req, p->offset + p->header.segsize, &p->next);
+        DDT_Unpack_partial((char*) req.tmpbuf + offset, req.usrbuf, ddt, req.count, offset, len);
+    }
+
+    if (*err == MPI_SUCCESS && *request != MPI_REQUEST_NULL) return false;
+
+    if (*err == MPI_SUCCESS) {
+        pipeline_status(req.pipeline->header, status);
+    }
+    else {
+        segment_cancel(request);
+        segment_cancel(&req.pipeline->next);
+    }
+    delete req.pipeline;
+    interposer_buffer_free(req.tmpbuf);
+    return true;
+}
+
+int interposer_recv_complete(void *inbuf, MPI_Aint insize, void *usrbuf, int count, MPI_Datatype datatype,
+                             MPI_Status *status) {
+    Request req;
+    req.tmpbuf = inbuf;
+    req.usrbuf = usrbuf;
+    req.count = count;
+    req.datatype = datatype;
+    req.insize = insize;
+    req.pipeline = NULL;
+
+    MPI_Request request;
+    int err;
+    while (!request_advance(req, &request, status, &err)) {
+        PMPI_Wait(&request, status);
+    }
+    return err;
+}
+
 void interposer_request_register(void *tmpbuf, void *usrbuf, int count, MPI_Datatype datatype, MPI_Request *request) {
-    struct Request req;
-    req.mpi_req = request;
+    if (tmpbuf == NULL) return;
 
+    struct Request req;
     req.tmpbuf = tmpbuf;
 
     req.usrbuf = usrbuf;
     req.count = count;
     req.datatype = datatype;
-    g_outstanding_requests.push_back(req);
+    req.insize = 0;
+    req.pipeline = NULL;
 
-    if (tmpbuf != NULL && is_recv(req)) {
-        DDT_Lazy_Unpack_Commit(datatype_retrieve(datatype));
+    if (is_recv(req)) {
+        Datatype* ddt = datatype_retrieve(datatype);
+        req.insize = ddt->getSize() * (MPI_Aint) count;
+        DDT_Lazy_Unpack_Commit(ddt);
     }
+    request_put(*request, req);
 }
 
-void interposer_request_free(MPI_Request *request) {
-    for (std::list<Request>::iterator req = g_outstanding_requests.begin();
-            req != g_outstanding_requests.end(); req++) {
-        if (req->mpi_req == request) {
-            if (req->tmpbuf != NULL) {
-                // If it was a recv request then unpack it 
-                if (is_recv(*req)) {
-                    DDT_Unpack(req->tmpbuf, req->usrbuf, datatype_retrieve(req->datatype), req->count);
-                }
-                interposer_buffer_free(req->tmpbuf);
-            }
+// Called with the handle a request had before it completed, MPI sets the
+// handle itself to MPI_REQUEST_NULL. Returns false if the request goes on
+// as *request, which is then tracked instead. Otherwise *err is set to the
+// result of the operation.
+static bool interposer_request_complete(MPI_Request oldrequest, MPI_Request *request, MPI_Status *status, int *err) {
+    *err = MPI_SUCCESS;
 
+    Request req;
+    if (!request_take(oldrequest, &req)) return true;
 
-            g_outstanding_requests.erase(req);
-            break;
-        }
-    }
+    if (request_advance(req, request, status, err)) return true;
+    request_put(*request, req);
+    return false;
+}
+
+// The handles of requests in an array have to be copied before the array is
+// passed to MPI, small arrays are copied to the stack
+#define REQUEST_COPY_STACK 64
+
+static inline MPI_Request* requests_copy(int count, MPI_Request* requests, MPI_Request* stackbuf) {
+    MPI_Request* copy = stackbuf;
+    if (count > REQUEST_COPY_STACK) copy = (MPI_Request*) malloc(count * sizeof(MPI_Request));
+    memcpy(copy, requests, count * sizeof(MPI_Request));
+    return copy;
+}
+
+static inline void requests_free(MPI_Request* copy, MPI_Request* stackbuf) {
+    if (copy != stackbuf) free(copy);
+}
+
+static inline MPI_Status* status_at(MPI_Status* statuses, int i) {
+    return (statuses == MPI_STATUSES_IGNORE) ? MPI_STATUS_IGNORE : &statuses[i];
 }
 
 //**********************************************************
 
+// A pipelined receive completes in several steps: its request completes
+// first with the header and then with each segment. Until the last one, the
+// wait and test calls below go on with the request of the next segment,
+// which replaces the handle of the application.
 
-//TODO we should also implement testany, testsome, waitany, waitsome to be complete, but who uses those :D
 int MPI_Wait(MPI_Request *request, MPI_Status *status) {
-    int ret;
+    while (true) {
+        MPI_Request oldrequest = *request;
 
-    if (*request != MPI_REQUEST_NULL) {
-        ret = PMPI_Wait(request, status);
-        interposer_request_free(request);
-    }
-    else {
-        ret = PMPI_Wait(request, status);
-    }
+        int ret = PMPI_Wait(request, status);
+        if (oldrequest == MPI_REQUEST_NULL || !requests_tracked() || ret != MPI_SUCCESS) {
+            return ret;
+        }
 
-    return ret;
+        int err;
+        if (interposer_request_complete(oldrequest, request, status, &err)) return err;
+    }
 }
 
 int MPI_Waitall(int count, MPI_Request *array_of_requests, MPI_Status *array_of_statuses) {
 
-    // we need to copy the old requests here :-( (they will become MPI_REQUEST_NULL)
-    // OPT: Allocate these on the stack
-    MPI_Request* oldrequests = (MPI_Request*) malloc(count * sizeof(MPI_Request));
-    for (int i=0; i<count; i++) {
-        oldrequests[i] = array_of_requests[i];
+    if (!requests_tracked()) {
+        return PMPI_Waitall(count, array_of_requests, array_of_statuses);
     }
 
+    // we need to copy the old requests here (they will become MPI_REQUEST_NULL)
+    MPI_Request stackbuf[REQUEST_COPY_STACK];
+    MPI_Request* oldrequests = requests_copy(count, array_of_requests, stackbuf);
+
     int ret = PMPI_Waitall(count, array_of_requests, array_of_statuses);
 
-    // now go over them and unpack recv requests and free buffers
+    // now go over them, unpack recv requests and free buffers, pipelined
+    // receives are waited for one by one
     for (int i=0; i<count; i++) {
-        if (oldrequests[i] != MPI_REQUEST_NULL) {
-            interposer_request_free(&array_of_requests[i]);
-        }
+        if (oldrequests[i] == MPI_REQUEST_NULL) continue;
 
-        /*
-             //check if it was a Request, if yes, unpack TODO this is expensive :-(
-            std::map<MPI_Request, struct Request>::iterator it;
-            it = g_my_recv_requests.find(oldrequests[i]);
-            if (it != g_my_recv_requests.end()) {
-                DDT_Unpack(it->second.tmpbuf, it->second.usrbuf, datatype_retrieve(it->second.datatype), it->second.count);
-                g_my_recv_requests.erase(it);
-            }
-            interposer_buffer_free(g_my_buffers[oldrequests[i]]);
-            g_my_buffers.erase(oldrequests[i]);
+        MPI_Status* status = status_at(array_of_statuses, i);
+        int err;
+        if (!interposer_request_complete(oldrequests[i], &array_of_requests[i], status, &err)) {
+            err = MPI_Wait(&array_of_requests[i], status);
+        }
+        if (err != MPI_SUCCESS) {
+            if (status != MPI_STATUS_IGNORE) status->MPI_ERROR = err;
+            ret = MPI_ERR_IN_STATUS;
         }
-        */
     }
 
-    free(oldrequests);
+    requests_free(oldrequests, stackbuf);
 
     return ret;
 }
 
+int MPI_Waitany(int count, MPI_Request *array_of_requests, int *index, MPI_Status *status) {
 
-// TODO: MPI_Test and MPI_TestAll look buggy to me... How can we free buffers if
-//       we don't check whether the test passed?
-int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status) {
+    if (!requests_tracked()) {
+        return PMPI_Waitany(count, array_of_requests, index, status);
+    }
+
+    MPI_Request stackbuf[REQUEST_COPY_STACK];
+    MPI_Request* oldrequests = requests_copy(count, array_of_requests, stackbuf);
 
     int ret;
+    while (true) {
+        ret = PMPI_Waitany(count, array_of_requests, index, status);
+        if (*index == MPI_UNDEFINED || ret != MPI_SUCCESS) break;
 
-    if (*request != MPI_REQUEST_NULL) {
-        ret = PMPI_Test(request, flag, status);
-        interposer_request_free(request);
-        
-        /*    
-        The following line must surely be a bug?
-//        if (*request == MPI_REQUEST_NULL) {
-             //check if it was a Request, if yes, unpack TODO this is expensive :-(
-            std::map<MPI_Request, struct Request>::iterator it;
-            it = g_my_recv_requests.find(oldrequest);
-            if (it != g_my_recv_requests.end()) {
-                DDT_Unpack(it->second.tmpbuf, it->second.usrbuf, datatype_retrieve(it->second.datatype), it->second.count);
-                g_my_recv_requests.erase(it);
-            }
-           
-            interposer_buffer_free(g_my_buffers[oldrequest]);
-            g_my_buffers.erase(oldrequest);
+        int err;
+        if (interposer_request_complete(oldrequests[*index], &array_of_requests[*index], status, &err)) {
+            ret = err;
+            break;
         }
-        */
+        oldrequests[*index] = array_of_requests[*index];
     }
-    else {
-        ret = PMPI_Test(request, flag, status);
+
+    requests_free(oldrequests, stackbuf);
+
+    return ret;
+}
+
+// Drops the requests which go on with another segment from the indices and
+// statuses MPI returned. Returns MPI_ERR_IN_STATUS if one of the others
+// failed.
+static int requests_complete_some(MPI_Request *oldrequests, MPI_Request *array_of_requests, int *outcount,
+                                  int *array_of_indices, MPI_Status *array_of_statuses) {
+    int ret = MPI_SUCCESS;
+    int done = 0;
+    for (int i=0; i<*outcount; i++) {
+        int index = array_of_indices[i];
+        MPI_Status* status = status_at(array_of_statuses, i);
+
+        int err;
+        if (!interposer_request_complete(oldrequests[index], &array_of_requests[index], status, &err)) {
+            oldrequests[index] = array_of_requests[index];
+            continue;
+        }
+
+        array_of_indices[done] = index;
+        if (status != MPI_STATUS_IGNORE) {
+            if (err != MPI_SUCCESS) status->MPI_ERROR = err;
+            array_of_statuses[done] = *status;
+        }
+        if (err != MPI_SUCCESS) ret = MPI_ERR_IN_STATUS;
+        done++;
+    }
+    *outcount = done;
+    return ret;
+}
+
+int MPI_Waitsome(int incount, MPI_Request *array_of_requests, int *outcount, int *array_of_indices, MPI_Status *array_of_statuses) {
+
+    if (!requests_tracked()) {
+        return PMPI_Waitsome(incount, array_of_requests, outcount, array_of_indices, array_of_statuses);
+    }
+
+    MPI_Request stackbuf[REQUEST_COPY_STACK];
+    MPI_Request* oldrequests = requests_copy(incount, array_of_requests, stackbuf);
+
+    int ret;
+    do {
+        ret = PMPI_Waitsome(incount, array_of_requests, outcount, array_of_indices, array_of_statuses);
+        if (*outcount == MPI_UNDEFINED || ret != MPI_SUCCESS) break;
+
+        ret = requests_complete_some(oldrequests, array_of_requests, outcount, array_of_indices, array_of_statuses);
+    } while (*outcount == 0);
+
+    requests_free(oldrequests, stackbuf);
+
+    return ret;
+}
+
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status) {
+    MPI_Request oldrequest = *request;
+
+    int ret = PMPI_Test(request, flag, status);
+    if (*flag && oldrequest != MPI_REQUEST_NULL && requests_tracked() && ret == MPI_SUCCESS) {
+        int err;
+        if (interposer_request_complete(oldrequest, request, status, &err)) {
+            ret = err;
+        }
+        else {
+            *flag = 0;
+        }
     }
 
     return ret;
 
 }
 
+// A pipelined receive which is not done yet makes the whole call report
+// that not all requests have completed. The others have completed anyway,
+// their handles are MPI_REQUEST_NULL and they are reported with an empty
+// status by the next call.
 int MPI_Testall(int count, MPI_Request *array_of_requests, int *flag, MPI_Status *array_of_statuses) {
 
-    // we need to copy the old requests here :-( (they will become MPI_REQUEST_NULL)
-    MPI_Request* oldrequests = (MPI_Request*) malloc(count * sizeof(MPI_Request));
-    for (int i=0; i<count; i++) {
-        oldrequests[i] = array_of_requests[i];
+    if (!requests_tracked()) {
+        return PMPI_Testall(count, array_of_requests, flag, array_of_statuses);
     }
 
+    // we need to copy the old requests here (they will become MPI_REQUEST_NULL)
+    MPI_Request stackbuf[REQUEST_COPY_STACK];
+    MPI_Request* oldrequests = requests_copy(count, array_of_requests, stackbuf);
+
     int ret = PMPI_Testall(count, array_of_requests, flag, array_of_statuses);
 
     // now go over them and unpack recv requests and free buffers
-    for (int i=0; i<count; i++) {
-        if ((oldrequests[i] != MPI_REQUEST_NULL) && (array_of_requests[i] == MPI_REQUEST_NULL)) {
+    if (*flag) {
+        for (int i=0; i<count; i++) {
+            if (oldrequests[i] == MPI_REQUEST_NULL) continue;
+
+            MPI_Status* status = status_at(array_of_statuses, i);
+            int err;
+            if (!interposer_request_complete(oldrequests[i], &array_of_requests[i], status, &err)) {
+                *flag = 0;
+            }
+            else if (err != MPI_SUCCESS) {
+                if (status != MPI_STATUS_IGNORE) status->MPI_ERROR = err;
+                ret = MPI_ERR_IN_STATUS;
+            }
+        }
+    }
 
-            interposer_request_free(&array_of_requests[i]);
+    requests_free(oldrequests, stackbuf);
 
-            /*
-             //check if it was a Request, if yes, unpack TODO this is expensive :-(
-            std::map<MPI_Request, struct Request>::iterator it;
-            it = g_my_recv_requests.find(oldrequests[i]);
-            if (it != g_my_recv_requests.end()) {
-                DDT_Unpack( it->second.tmpbuf, it->second.usrbuf, datatype_retrieve(it->second.datatype), it->second.count);
-                g_my_recv_requests.erase(it);
-            }
-            interposer_buffer_free(g_my_buffers[oldrequests[i]]);
-            g_my_buffers.erase(oldrequests[i]);
-            */
+    return ret;
+
+}
+
+int MPI_Testany(int count, MPI_Request *array_of_requests, int *index, int *flag, MPI_Status *status) {
 
+    if (!requests_tracked()) {
+        return PMPI_Testany(count, array_of_requests, index, flag, status);
+    }
+
+    MPI_Request stackbuf[REQUEST_COPY_STACK];
+    MPI_Request* oldrequests = requests_copy(count, array_of_requests, stackbuf);
+
+    int ret = PMPI_Testany(count, array_of_requests, index, flag, status);
+    if (*flag && *index != MPI_UNDEFINED && ret == MPI_SUCCESS) {
+        int err;
+        if (interposer_request_complete(oldrequests[*index], &array_of_requests[*index], status, &err)) {
+            ret = err;
+        }
+        else {
+            *flag = 0;
+            *index = MPI_UNDEFINED;
         }
     }
 
-    free(oldrequests);
+    requests_free(oldrequests, stackbuf);
 
     return ret;
-
 }
 
+int MPI_Testsome(int incount, MPI_Request *array_of_requests, int *outcount, int *array_of_indices, MPI_Status *array_of_statuses) {
+
+    if (!requests_tracked()) {
+        return PMPI_Testsome(incount, array_of_requests, outcount, array_of_indices, array_of_statuses);
+    }
+
+    MPI_Request stackbuf[REQUEST_COPY_STACK];
+    MPI_Request* oldrequests = requests_copy(incount, array_of_requests, stackbuf);
+
+    int ret = PMPI_Testsome(incount, array_of_requests, outcount, array_of_indices, array_of_statuses);
+    if (*outcount != MPI_UNDEFINED && ret == MPI_SUCCESS) {
+        ret = requests_complete_some(oldrequests, array_of_requests, outcount, array_of_indices, array_of_statuses);
+    }
+
+    requests_free(oldrequests, stackbuf);
+
+    return ret;
+}
 
 
 
@@ -507,7 +1182,10 @@ extern "C" {
     }
 
     void* interposer_buffer_alloc_(int count, MPI_Datatype datatype, int* buf_size) {
-        return interposer_buffer_alloc(count, datatype, buf_size);
+        MPI_Aint size;
+        void* buf = interposer_buffer_alloc(count, datatype, &size);
+        *buf_size = size;
+        return buf;
     }
 
     void interposer_buffer_free_(void* tmpbuf) {
@@ -519,7 +1197,10 @@ extern "C" {
     }
 
     void* interposer_pack_(void *data, int count, MPI_Datatype datatype, int *buf_size) {
-        return interposer_pack(data, count, datatype, buf_size);
+        MPI_Aint size;
+        void* buf = interposer_pack(data, count, datatype, &size);
+        *buf_size = size;
+        return buf;
     }
 
     void interposer_unpack_(void *data, int count, MPI_Datatype datatype, void* buf) {
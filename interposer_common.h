@@ -10,6 +10,12 @@
 
 #include <mpi.h>
 
+struct interposer_pool_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long trimmed;
+};
+
 void interposer_init();
 void interposer_finalize();
 void interposer_hvector(int count, int blocklength, MPI_Aint stride, MPI_Datatype oldtype, MPI_Datatype *newtype);
@@ -22,14 +28,23 @@ void interposer_hindexed(int count, int array_of_blocklengths[], MPI_Aint array_
 void interposer_indexed_block(int count, int blocklength, int array_of_displacements[], MPI_Datatype oldtype, MPI_Datatype *newtype);
 void interposer_contiguous(int count, MPI_Datatype oldtype, MPI_Datatype *newtype);
 void interposer_commit(MPI_Datatype *datatype);
+int interposer_is_derived(MPI_Datatype datatype);
 void interposer_free(MPI_Datatype *datatype);
 int interposer_type_size(MPI_Datatype datatype);
 int interposer_type_extent(MPI_Datatype datatype);
-void* interposer_buffer_alloc(int count, MPI_Datatype datatype, int* buf_size);
+void* interposer_buffer_alloc(int count, MPI_Datatype datatype, MPI_Aint* buf_size);
 void interposer_buffer_free(void* buf);
+void interposer_get_pool_stats(struct interposer_pool_stats* stats);
 void interposer_request_register(void *tmpbuf, void *usrbuf, int count, MPI_Datatype datatype, MPI_Request *request);
-void* interposer_pack(void *data, int count, MPI_Datatype datatype, int *buf_size);
+void* interposer_pack(void *data, int count, MPI_Datatype datatype, MPI_Aint *buf_size);
+MPI_Datatype interposer_bytes_type(MPI_Aint size, int *count);
+void interposer_bytes_type_free(MPI_Datatype *type);
 void interposer_pack_providedbuf(void* inbuf, int incount, MPI_Datatype datatype, void *outbuf);
 void interposer_unpack(void *data, int count, MPI_Datatype datatype, void* buf);
+void interposer_set_pipeline(int segments, int min_segment_size);
+int interposer_pipelined(int count, MPI_Datatype datatype, int dest, MPI_Comm comm);
+int interposer_send_pipelined(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm);
+void* interposer_recv_buffer_alloc(int count, MPI_Datatype datatype, MPI_Aint* buf_size);
+int interposer_recv_complete(void *inbuf, MPI_Aint insize, void *usrbuf, int count, MPI_Datatype datatype, MPI_Status *status);
 
 #endif
@@ -7,8 +7,8 @@
 
       subroutine MPI_INIT(ierr)
       integer ierr
-      call interposer_init()
       call PMPI_INIT(ierr)
+      call interposer_init()
       end
 
       subroutine MPI_FINALIZE(ierr)
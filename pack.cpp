@@ -18,30 +18,50 @@ int LPK_Finalize() {
     return 0;
 }
 
+// The libpack primitive type of every LPK_* constant, in their order
+static const farc::PrimitiveDatatype::PrimitiveType lpk_primitives[] = {
+    farc::PrimitiveDatatype::CHAR,              // LPK_CHAR
+    farc::PrimitiveDatatype::SIGNED_CHAR,       // LPK_SIGNED_CHAR
+    farc::PrimitiveDatatype::UNSIGNED_CHAR,     // LPK_UNSIGNED_CHAR
+    farc::PrimitiveDatatype::BYTE,              // LPK_BYTE
+    farc::PrimitiveDatatype::WCHAR,             // LPK_WCHAR
+    farc::PrimitiveDatatype::SHORT,             // LPK_SHORT
+    farc::PrimitiveDatatype::UNSIGNED_SHORT,    // LPK_UNSIGNED_SHORT
+    farc::PrimitiveDatatype::INT,               // LPK_INT
+    farc::PrimitiveDatatype::UNSIGNED,          // LPK_UNSIGNED
+    farc::PrimitiveDatatype::LONG,              // LPK_LONG
+    farc::PrimitiveDatatype::UNSIGNED_LONG,     // LPK_UNSIGNED_LONG
+    farc::PrimitiveDatatype::FLOAT,             // LPK_FLOAT
+    farc::PrimitiveDatatype::DOUBLE,            // LPK_DOUBLE
+    farc::PrimitiveDatatype::LONG_DOUBLE,       // LPK_LONG_DOUBLE
+    farc::PrimitiveDatatype::LONG_LONG,         // LPK_LONG_LONG_INT
+    farc::PrimitiveDatatype::UNSIGNED_LONG_LONG,// LPK_UNSIGNED_LONG_LONG
+    farc::PrimitiveDatatype::LONG_LONG,         // LPK_LONG_LONG
+    farc::PrimitiveDatatype::INT8,              // LPK_INT8_T
+    farc::PrimitiveDatatype::INT16,             // LPK_INT16_T
+    farc::PrimitiveDatatype::INT32,             // LPK_INT32_T
+    farc::PrimitiveDatatype::INT64,             // LPK_INT64_T
+    farc::PrimitiveDatatype::UINT8,             // LPK_UINT8_T
+    farc::PrimitiveDatatype::UINT16,            // LPK_UINT16_T
+    farc::PrimitiveDatatype::UINT32,            // LPK_UINT32_T
+    farc::PrimitiveDatatype::UINT64,            // LPK_UINT64_T
+    farc::PrimitiveDatatype::BOOL,              // LPK_C_BOOL
+    farc::PrimitiveDatatype::AINT,              // LPK_AINT
+    farc::PrimitiveDatatype::OFFSET,            // LPK_OFFSET
+    farc::PrimitiveDatatype::FLOAT_COMPLEX,     // LPK_C_FLOAT_COMPLEX
+    farc::PrimitiveDatatype::DOUBLE_COMPLEX,    // LPK_C_DOUBLE_COMPLEX
+    farc::PrimitiveDatatype::LONG_DOUBLE_COMPLEX// LPK_C_LONG_DOUBLE_COMPLEX
+};
+
 int LPK_Primitive(LPK_Primitivetype primitivetype, LPK_Datatype *newtype_p) {
 
-    farc::Datatype* ddt = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
-
-    switch (primitivetype) {
-        case LPK_CHAR:
-            ddt = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::CHAR);
-            break;
-        case LPK_BYTE:
-            ddt = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::BYTE);
-            break;
-        case LPK_DOUBLE:
-            ddt = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
-            break;
-        case LPK_FLOAT:
-            ddt = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::FLOAT);
-            break;
-        case LPK_INT:
-            ddt = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
-            break;
-        default:
-            fprintf(stderr, "Error in %s line %i: primitive datatype not implemented\n", __FILE__, __LINE__);
+    if (primitivetype < 0 || primitivetype > LPK_C_LONG_DOUBLE_COMPLEX) {
+        fprintf(stderr, "Error in %s line %i: unknown primitive datatype %i\n", __FILE__, __LINE__, primitivetype);
+        *newtype_p = NULL;
+        return -1;
     }
 
+    farc::Datatype* ddt = new farc::PrimitiveDatatype(lpk_primitives[primitivetype]);
     *newtype_p = (void*) ddt;
 
     return 0;
@@ -122,15 +142,15 @@ int LPK_Compile(LPK_Datatype *ddt) {
 
 }
 
-int LPK_Pack(void* inbuf, int incount, LPK_Datatype intype, void* outbuf) {
+int LPK_Pack(void* inbuf, LPK_Aint incount, LPK_Datatype intype, void* outbuf) {
 
-    farc::DDT_Unpack(inbuf, outbuf, reinterpret_cast<farc::Datatype*>(intype), incount);
+    farc::DDT_Pack(inbuf, outbuf, reinterpret_cast<farc::Datatype*>(intype), incount);
 
     return 0;
 
 }
 
-int LPK_Unpack(void* inbuf, void* outbuf, int outcount, LPK_Datatype outtype) {
+int LPK_Unpack(void* inbuf, void* outbuf, LPK_Aint outcount, LPK_Datatype outtype) {
 
     farc::DDT_Unpack(inbuf, outbuf, reinterpret_cast<farc::Datatype*>(outtype), outcount);
 
@@ -138,6 +158,38 @@ int LPK_Unpack(void* inbuf, void* outbuf, int outcount, LPK_Datatype outtype) {
 
 }
 
+int LPK_Set_stream(LPK_Datatype datatype, int mode) {
+
+    if (mode < LPK_STREAM_AUTO || mode > LPK_STREAM_NEVER) return -1;
+    farc::DDT_Set_Stream(reinterpret_cast<farc::Datatype*>(datatype),
+                         static_cast<farc::Datatype::StreamMode>(mode));
+
+    return 0;
+
+}
+
+int LPK_Set_threads(int threads) {
+
+    return farc::DDT_Set_Threads(threads);
+
+}
+
+int LPK_Pack_partial(void* inbuf, LPK_Aint incount, LPK_Datatype intype, void* outbuf, LPK_Aint offset, LPK_Aint length) {
+
+    farc::DDT_Pack_partial(inbuf, outbuf, reinterpret_cast<farc::Datatype*>(intype), incount, offset, length);
+
+    return 0;
+
+}
+
+int LPK_Unpack_partial(void* inbuf, void* outbuf, LPK_Aint outcount, LPK_Datatype outtype, LPK_Aint offset, LPK_Aint length) {
+
+    farc::DDT_Unpack_partial(inbuf, outbuf, reinterpret_cast<farc::Datatype*>(outtype), outcount, offset, length);
+
+    return 0;
+
+}
+
 int LPK_Get_extent(LPK_Datatype datatype, LPK_Aint *lb, LPK_Aint *extent) {
 
     *extent = reinterpret_cast<farc::Datatype*>(datatype)->getExtent();
@@ -147,7 +199,7 @@ int LPK_Get_extent(LPK_Datatype datatype, LPK_Aint *lb, LPK_Aint *extent) {
 
 }
 
-int LPK_Get_size(LPK_Datatype datatype, int *size) {
+int LPK_Get_size(LPK_Datatype datatype, LPK_Aint *size) {
 
     *size = reinterpret_cast<farc::Datatype*>(datatype)->getSize();
 
@@ -32,9 +32,28 @@ typedef int   LPK_Primitivetype;
 #define LPK_LONG_LONG_INT      14
 #define LPK_UNSIGNED_LONG_LONG 15
 #define LPK_LONG_LONG          16
+#define LPK_INT8_T             17
+#define LPK_INT16_T            18
+#define LPK_INT32_T            19
+#define LPK_INT64_T            20
+#define LPK_UINT8_T            21
+#define LPK_UINT16_T           22
+#define LPK_UINT32_T           23
+#define LPK_UINT64_T           24
+#define LPK_C_BOOL             25
+#define LPK_AINT               26
+#define LPK_OFFSET             27
+#define LPK_C_FLOAT_COMPLEX    28
+#define LPK_C_DOUBLE_COMPLEX   29
+#define LPK_C_LONG_DOUBLE_COMPLEX 30
 
 typedef long LPK_Aint;
 
+/* Streaming modes, see LPK_Set_stream */
+#define LPK_STREAM_AUTO         0
+#define LPK_STREAM_ALWAYS       1
+#define LPK_STREAM_NEVER        2
+
 
 /* Functions */
 int LPK_Init();
@@ -54,11 +73,15 @@ int LPK_Compile(LPK_Datatype *ddt);
 //int LPK_Compile_pack(LPK_Datatype *ddt);
 //int LPK_Compile_unpack(LPK_Datatype *ddt);
 
-int LPK_Pack(void* inbuf, int incount, LPK_Datatype intype, void* outbuf);
-int LPK_Unpack(void* inbuf, void* outbuf, int outcount, LPK_Datatype outtype);
+int LPK_Pack(void* inbuf, LPK_Aint incount, LPK_Datatype intype, void* outbuf);
+int LPK_Unpack(void* inbuf, void* outbuf, LPK_Aint outcount, LPK_Datatype outtype);
+int LPK_Set_stream(LPK_Datatype datatype, int mode);
+int LPK_Set_threads(int threads);
+int LPK_Pack_partial(void* inbuf, LPK_Aint incount, LPK_Datatype intype, void* outbuf, LPK_Aint offset, LPK_Aint length);
+int LPK_Unpack_partial(void* inbuf, void* outbuf, LPK_Aint outcount, LPK_Datatype outtype, LPK_Aint offset, LPK_Aint length);
 
 int LPK_Get_extent(LPK_Datatype datatype, LPK_Aint *lb, LPK_Aint *extent);
-int LPK_Get_size(LPK_Datatype datatype, int *size);
+int LPK_Get_size(LPK_Datatype datatype, LPK_Aint *size);
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,90 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include "test.hpp"
+#include "../interposer_common.h"
+
+#include <mpi.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv) {
+
+    // split the 12000 byte message into segments of 2000 bytes, which do
+    // not end at block boundaries
+    setenv("LIBPACK_PIPELINE_SEGMENTS", "6", 1);
+    setenv("LIBPACK_PIPELINE_MIN_SEGMENT", "1", 1);
+
+    MPI_Init(&argc, &argv);
+
+    int rank, peer, commsize;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &commsize);
+    if (rank % 2) peer = rank - 1 % commsize;
+    else peer = rank + 1 % commsize;
+
+    if (commsize % 2 != 0) {
+        fprintf(stderr, "Use even number of processes.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // only the even ranks split their messages, the odd ones follow the
+    // sender, also when they receive with MPI_Irecv and wildcards
+    if (rank % 2) interposer_set_pipeline(1, 1);
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* pmpi_inbuf;
+    char* pmpi_outbuf;
+
+    test_start("send/recv (2, vector[[int], count=500, blklen=3, stride=5]) [pipelined by the sender]");
+    init_buffers(5000*sizeof(int), &mpi_inbuf, &pmpi_inbuf, &mpi_outbuf, &pmpi_outbuf);
+
+    MPI_Datatype vector_ddt;
+    MPI_Type_vector(500, 3, 5, MPI_INT, &vector_ddt);
+    MPI_Type_commit(&vector_ddt);
+
+    MPI_Datatype pmpi_vector_ddt;
+    PMPI_Type_vector(500, 3, 5, MPI_INT, &pmpi_vector_ddt);
+    PMPI_Type_commit(&pmpi_vector_ddt);
+
+    int res = 0;
+    if (rank % 2 == 0) {
+        MPI_Send(mpi_inbuf, 2, vector_ddt, peer, 0, MPI_COMM_WORLD);
+        MPI_Recv(mpi_outbuf, 2, vector_ddt, peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);       
+
+        PMPI_Send(pmpi_inbuf, 2, pmpi_vector_ddt, peer, 0, MPI_COMM_WORLD);
+        PMPI_Recv(pmpi_outbuf, 2, pmpi_vector_ddt, peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);       
+    }
+    else {
+        // the status describes the whole message, not its last segment
+        MPI_Request req;
+        MPI_Status status;
+        int flag = 0;
+        MPI_Irecv(mpi_outbuf, 2, vector_ddt, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &req);
+        while (!flag) MPI_Test(&req, &flag, &status);
+
+        int bytes;
+        MPI_Get_count(&status, MPI_BYTE, &bytes);
+        if (status.MPI_SOURCE != peer || status.MPI_TAG != 0 || bytes != (int) (2*500*3*sizeof(int))) res = 1;
+        MPI_Send(mpi_inbuf, 2, vector_ddt, peer, 0, MPI_COMM_WORLD);
+
+        PMPI_Recv(pmpi_outbuf, 2, pmpi_vector_ddt, peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);       
+        PMPI_Send(pmpi_inbuf, 2, pmpi_vector_ddt, peer, 0, MPI_COMM_WORLD);
+    }
+
+    if (compare_buffers(5000*sizeof(int), &mpi_inbuf, &pmpi_inbuf, &mpi_outbuf, &pmpi_outbuf) != 0) res = 1;
+    free_buffers(&mpi_inbuf, &pmpi_inbuf, &mpi_outbuf, &pmpi_outbuf);
+    MPI_Type_free(&vector_ddt);
+    PMPI_Type_free(&pmpi_vector_ddt);
+
+    test_result(res);
+
+    MPI_Finalize();
+
+}
+
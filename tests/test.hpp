@@ -130,8 +130,8 @@ void free_buffers(char** mpi_inbuf, char** farc_inbuf, char** mpi_outbuf, char**
 
 int compare_ddt_info(MPI_Datatype mpitype, farc::Datatype* farctype) {
 
-    MPI_Aint mpi_lb, mpi_extent;
-    int farc_lb, farc_extent;
+    MPI_Aint mpi_lb, mpi_extent, mpi_true_lb, mpi_true_extent;
+    long farc_lb, farc_extent, farc_true_lb, farc_true_extent;
 
     MPI_Type_get_extent(mpitype, &mpi_lb, &mpi_extent);
     farc_lb = farctype->getLowerBound();
@@ -141,6 +141,14 @@ int compare_ddt_info(MPI_Datatype mpitype, farc::Datatype* farctype) {
         return -1;
     }
 
+    MPI_Type_get_true_extent(mpitype, &mpi_true_lb, &mpi_true_extent);
+    farc_true_lb = farctype->getTrueLowerBound();
+    farc_true_extent = farctype->getTrueExtent();
+
+    if ((farc_true_lb != mpi_true_lb) || (farc_true_extent != mpi_true_extent)) {
+        return -1;
+    }
+
     return 0;
 
 }
@@ -148,14 +156,14 @@ int compare_ddt_info(MPI_Datatype mpitype, farc::Datatype* farctype) {
 void inspect_ddt_info(MPI_Datatype mpitype, farc::Datatype* farctype) {
 
     MPI_Aint mpi_lb, mpi_extent;
-    int farc_lb, farc_extent;
+    long farc_lb, farc_extent;
 
     MPI_Type_get_extent(mpitype, &mpi_lb, &mpi_extent);
     farc_lb = farctype->getLowerBound();
     farc_extent = farctype->getExtent();
 
-    printf("mpi extent: %i mpi lb: %i farc extent: %i farc lb: %i\n", 
-                    mpi_extent, mpi_lb, farc_extent, farc_lb);
+    printf("mpi extent: %li mpi lb: %li farc extent: %li farc lb: %li\n",
+                    (long) mpi_extent, (long) mpi_lb, farc_extent, farc_lb);
 
 }
 
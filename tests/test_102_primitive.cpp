@@ -0,0 +1,46 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+
+    test_start("pack(3, vector[[MPI_SHORT], count=4, blklen=3, stride=5])");
+    init_buffers(60*sizeof(short), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::SHORT);
+    farc::Datatype* t2 = new farc::VectorDatatype(4, 3, 5, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 3);
+
+    MPI_Datatype newtype;
+    MPI_Type_vector(4, 3, 5, MPI_SHORT, &newtype);
+    MPI_Type_commit(&newtype);
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 3, newtype, mpi_outbuf, 60*sizeof(short), &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(newtype, t2);
+    res += compare_buffers(60*sizeof(short), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
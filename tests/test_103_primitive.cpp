@@ -0,0 +1,48 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+
+    // the elements are wider than a vector register
+    test_start("unpack(3, hvector[[MPI_C_LONG_DOUBLE_COMPLEX], count=2, blklen=2, stride=5*sizeof(long double _Complex)])");
+    int elemsize = 2*sizeof(long double);
+    init_buffers(30*elemsize, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::LONG_DOUBLE_COMPLEX);
+    farc::Datatype* t2 = new farc::HVectorDatatype(2, 2, 5*elemsize, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t2, 3);
+
+    MPI_Datatype newtype;
+    MPI_Type_create_hvector(2, 2, 5*elemsize, MPI_C_LONG_DOUBLE_COMPLEX, &newtype);
+    MPI_Type_commit(&newtype);
+    int position = 0;
+    MPI_Unpack(mpi_inbuf, 30*elemsize, &position, mpi_outbuf, 3, newtype, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(newtype, t2);
+    res += compare_buffers(30*elemsize, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,59 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // the two inner levels collapse into one vector, the outer one is
+    // generated as a loop nest around it
+    test_start("pack(2, hvector[hvector[vector[[int], count=4, blklen=3, stride=5], count=2, blklen=1, stride=80], count=3, blklen=1, stride=1000]) [loop nest]");
+    init_buffers(1100*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::VectorDatatype(4, 3, 5, t1);
+    farc::Datatype* t3 = new farc::HVectorDatatype(2, 1, 80, t2);
+    farc::Datatype* t4 = new farc::HVectorDatatype(3, 1, 1000, t3);
+    farc::DDT_Commit(t4);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t4, 2);
+
+    MPI_Datatype vectype, hvectype, newtype;
+    MPI_Type_vector(4, 3, 5, MPI_INT, &vectype);
+    MPI_Type_create_hvector(2, 1, 80, vectype, &hvectype);
+    MPI_Type_create_hvector(3, 1, 1000, hvectype, &newtype);
+    MPI_Type_commit(&newtype);
+
+    int res = compare_ddt_info(newtype, t4);
+
+    farc::Datatype* t5 = t4->compress();
+    if (t5->toString() != "hvec(3 1 1000)[vec(8 3 5)[int]]") res = -1;
+    delete t5;
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, newtype, mpi_outbuf, 1100*sizeof(int), &position, MPI_COMM_WORLD);
+
+    res += compare_buffers(1100*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
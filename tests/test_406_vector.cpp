@@ -0,0 +1,50 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // the blocks are 8 KB apart, which are prefetched
+    test_start("pack(2, vector[[double], count=64, blklen=3, stride=1024]) [prefetched]");
+    init_buffers(2*64*1024*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+    farc::Datatype* t2 = new farc::VectorDatatype(64, 3, 1024, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 2);
+
+    MPI_Datatype newtype;
+    MPI_Type_vector(64, 3, 1024, MPI_DOUBLE, &newtype);
+    MPI_Type_commit(&newtype);
+
+    int res = compare_ddt_info(newtype, t2);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, newtype, mpi_outbuf, 2*64*1024*sizeof(double), &position, MPI_COMM_WORLD);
+
+    res += compare_buffers(2*64*1024*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
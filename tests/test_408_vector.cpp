@@ -0,0 +1,50 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // single elements below the origin, unpacked by the gather kernel
+    test_start("unpack(2, vector[[float], count=20, blklen=1, stride=-3]) [gather]");
+    init_buffers(200*sizeof(float), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::FLOAT);
+    farc::Datatype* t2 = new farc::VectorDatatype(20, 1, -3, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf + 100*sizeof(float), t2, 2);
+
+    MPI_Datatype newtype;
+    MPI_Type_vector(20, 1, -3, MPI_FLOAT, &newtype);
+    MPI_Type_commit(&newtype);
+
+    int res = compare_ddt_info(newtype, t2);
+
+    int position = 0;
+    MPI_Unpack(mpi_inbuf, 200*sizeof(float), &position, mpi_outbuf + 100*sizeof(float), 2, newtype, MPI_COMM_WORLD);
+
+    res += compare_buffers(200*sizeof(float), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
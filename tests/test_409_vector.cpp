@@ -0,0 +1,55 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // the lower bound of the basetype is below its data, so lb != true_lb
+    test_start("pack(2, vector[resized(lb=-8, extent=16, [contiguous[MPI_INT, count=2]]), count=4, blklen=1, stride=2])");
+    init_buffers(64*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype ctgtype, restype, newtype;
+    MPI_Type_contiguous(2, MPI_INT, &ctgtype);
+    MPI_Type_create_resized(ctgtype, -8, 16, &restype);
+    MPI_Type_vector(4, 1, 2, restype, &newtype);
+    MPI_Type_commit(&newtype);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::ContiguousDatatype(2, t1);
+    farc::Datatype* t3 = new farc::ResizedDatatype(t2, -8, 16);
+    farc::Datatype* t4 = new farc::VectorDatatype(4, 1, 2, t3);
+    farc::DDT_Commit(t4);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t4, 2);
+
+    int res = compare_ddt_info(restype, t3);
+    res += compare_ddt_info(newtype, t4);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, newtype, mpi_outbuf, 64*sizeof(int), &position, MPI_COMM_WORLD);
+
+    res += compare_buffers(64*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
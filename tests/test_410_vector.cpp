@@ -0,0 +1,71 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    MPI_Init(&argc, &argv);
+
+    // the types are larger than 2^31 bytes, so they are only described and
+    // compressed, not packed
+    test_start("info(vector[[MPI_BYTE], count=65536, blklen=65536, stride=65536]) [4 GiB]");
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::BYTE);
+    farc::Datatype* t2 = new farc::VectorDatatype(65536, 65536, 65536, t1);
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(65536, 65536, 65536, MPI_BYTE, &vectype);
+    MPI_Type_commit(&vectype);
+
+    int res = compare_ddt_info(vectype, t2);
+    if (t2->getSize() != 1L << 32 || t2->getExtent() != 1L << 32) res = -1;
+
+    // the element count does not fit into the count of a contiguous type
+    farc::Datatype* t3 = t2->compress();
+    if (t3->getSize() != 1L << 32 || t3->getExtent() != 1L << 32) res = -1;
+    delete t3;
+
+    MPI_Type_free(&vectype);
+    test_result(res);
+
+    test_start("info(hvector[contiguous[MPI_BYTE, count=4], count=2, blklen=2^30, stride=2^32]) [8 GiB]");
+
+    farc::Datatype* t4 = new farc::ContiguousDatatype(4, t1);
+    farc::Datatype* t5 = new farc::HVectorDatatype(2, 1 << 30, 1L << 32, t4);
+
+    MPI_Datatype ctgtype, hvectype;
+    MPI_Type_contiguous(4, MPI_BYTE, &ctgtype);
+    MPI_Type_create_hvector(2, 1 << 30, 1L << 32, ctgtype, &hvectype);
+    MPI_Type_commit(&hvectype);
+
+    res = compare_ddt_info(hvectype, t5);
+    if (t5->getSize() != 1L << 33 || t5->getExtent() != 1L << 33) res = -1;
+
+    // neither the contiguous basetype can be merged into the block length
+    // nor the hvector be promoted to a contiguous type
+    farc::Datatype* t6 = t5->compress();
+    if (t6->getSize() != 1L << 33 || t6->getExtent() != 1L << 33) res = -1;
+    delete t6;
+
+    MPI_Type_free(&hvectype);
+    MPI_Type_free(&ctgtype);
+    test_result(res);
+
+    farc::DDT_Free(t5);
+    farc::DDT_Free(t4);
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,75 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+#define NBLOCKS 100
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // the run of int blocks is long enough to loop over the tables
+    test_start("pack(2, struct[{2*MPI_CHAR, 96*(1 or 2*MPI_INT), 2*MPI_DOUBLE}])");
+    init_buffers(1000*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype mpitype; 
+    MPI_Datatype type[NBLOCKS];
+    int blocklen[NBLOCKS];
+    MPI_Aint disp[NBLOCKS];
+
+    farc::DDT_Init();
+    farc::Datatype* types_f[NBLOCKS];
+    for (int i=0; i<NBLOCKS; i++) {
+        disp[i] = i * 16;
+        if (i < 2) {
+            type[i] = MPI_CHAR;
+            types_f[i] = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::CHAR);
+            blocklen[i] = 3;
+        }
+        else if (i < NBLOCKS-2) {
+            type[i] = MPI_INT;
+            types_f[i] = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+            blocklen[i] = 1 + i % 2;
+        }
+        else {
+            type[i] = MPI_DOUBLE;
+            types_f[i] = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+            blocklen[i] = 1;
+        }
+    }
+
+    MPI_Type_create_struct(NBLOCKS, blocklen, disp, type, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::Datatype* t1 = new farc::StructDatatype(NBLOCKS, blocklen, disp, types_f);
+    farc::DDT_Commit(t1);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t1, 2);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, mpitype, mpi_outbuf, 1000*sizeof(int), &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(mpitype, t1);
+    res += compare_buffers(1000*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,66 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // the nested struct is flattened and all fields touch, so this is
+    // compressed to a single contiguous byte copy
+    test_start("pack(3, struct[{3*struct[{1*MPI_DOUBLE, 2*MPI_INT}], 1*MPI_DOUBLE}]) [compressed to contiguous]");
+    init_buffers(100*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype innertype, mpitype; 
+    MPI_Datatype innertypes[2] = {MPI_DOUBLE, MPI_INT};
+    int innerblocklen[2] = {1, 2};
+    MPI_Aint innerdisp[2] = {0, 8};
+    MPI_Type_create_struct(2, innerblocklen, innerdisp, innertypes, &innertype);
+
+    MPI_Datatype types[2] = {innertype, MPI_DOUBLE};
+    int blocklen[2] = {3, 1};
+    MPI_Aint disp[2] = {0, 48};
+    MPI_Type_create_struct(2, blocklen, disp, types, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::DDT_Init();
+    farc::Datatype* innertypes_f[2] = {new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE), new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT)};
+    farc::Datatype* t1 = new farc::StructDatatype(2, innerblocklen, innerdisp, innertypes_f);
+    farc::Datatype* types_f[2] = {t1, new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE)};
+    farc::Datatype* t2 = new farc::StructDatatype(2, blocklen, disp, types_f);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 3);
+
+    int res = compare_ddt_info(mpitype, t2);
+
+    farc::Datatype* t3 = t2->compress();
+    if (t3->toString().compare(0, 4, "ctg(") != 0) res = -1;
+    delete t3;
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 3, mpitype, mpi_outbuf, 100*sizeof(int), &position, MPI_COMM_WORLD);
+
+    res += compare_buffers(100*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
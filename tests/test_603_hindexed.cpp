@@ -0,0 +1,64 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+#define NBLOCKS 40
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // pairs of touching blocks with a constant stride are compressed into a vector
+    test_start("pack(2, hindexed[{(1*MPI_INT, offset=i/2*32+i%2*4) for i < 40}]) [compressed to vector]");
+    init_buffers(200*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype mpitype; 
+    int blocklen[NBLOCKS];
+    MPI_Aint disp[NBLOCKS];
+    for (int i=0; i<NBLOCKS; i++) {
+        blocklen[i] = 1;
+        disp[i] = i/2 * 32 + i%2 * 4;
+    }
+
+    MPI_Type_create_hindexed(NBLOCKS, blocklen, disp, MPI_INT, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::HIndexedDatatype(NBLOCKS, blocklen, disp, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 2);
+
+    int res = compare_ddt_info(mpitype, t2);
+
+    farc::Datatype* t3 = t2->compress();
+    if (t3->toString().compare(0, 4, "vec(") != 0) res = -1;
+    delete t3;
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, mpitype, mpi_outbuf, 200*sizeof(int), &position, MPI_COMM_WORLD);
+
+    res += compare_buffers(200*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,54 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // single elements at the displacements of a table, packed by the
+    // gather kernel
+    test_start("pack(2, indexed_block[blocklen=1, disp=(0,10,20,30,40,19,...), MPI_INT]) [gather]");
+    init_buffers(400*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype mpitype;
+    int disp[27];
+    for (int i=0; i<27; i++) disp[i] = (i*7) % 31 + 3*i;
+    int blocklen = 1;
+
+    MPI_Type_create_indexed_block(27, blocklen, disp, MPI_INT, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::IndexedBlockDatatype(27, blocklen, disp, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 2);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, mpitype, mpi_outbuf, 400*sizeof(int), &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(mpitype, t2);
+    res += compare_buffers(400*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
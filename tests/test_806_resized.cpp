@@ -0,0 +1,55 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+
+    // an array of C structs {int a; double b; double c;} of which only a
+    // and b are transferred
+    test_start("pack(4, resized(lb=0, extent=24, [struct[{1*MPI_INT, offset=0}, {1*MPI_DOUBLE, offset=8}]]))");
+    init_buffers(100*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype structtype, mpitype;
+    MPI_Datatype types[2] = {MPI_INT, MPI_DOUBLE};
+    int blocklen[2] = {1, 1};
+    MPI_Aint disp[2] = {0, 8};
+    MPI_Type_create_struct(2, blocklen, disp, types, &structtype);
+    MPI_Type_create_resized(structtype, 0, 24, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::DDT_Init();
+    farc::Datatype* types_f[2] = {new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT), new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE)};
+    farc::Datatype* t1 = new farc::StructDatatype(2, blocklen, disp, types_f);
+    farc::Datatype* t2 = new farc::ResizedDatatype(t1, 0, 24);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 4);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 4, mpitype, mpi_outbuf, 100*sizeof(int), &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(mpitype, t2);
+    res += compare_buffers(100*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
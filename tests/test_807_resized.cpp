@@ -0,0 +1,52 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+
+    test_start("unpack(3, resized(lb=0, extent=48, [hindexed[{(1*MPI_INT, offset=4), (3*MPI_INT, offset=16)}]]))");
+    init_buffers(50*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype hindexedtype, mpitype;
+    int blocklen[2] = {1, 3};
+    MPI_Aint disp[2] = {4, 16};
+    MPI_Type_create_hindexed(2, blocklen, disp, MPI_INT, &hindexedtype);
+    MPI_Type_create_resized(hindexedtype, 0, 48, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::HIndexedDatatype(2, blocklen, disp, t1);
+    farc::Datatype* t3 = new farc::ResizedDatatype(t2, 0, 48);
+    farc::DDT_Commit(t3);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t3, 3);
+
+    int position = 0;
+    MPI_Unpack(mpi_inbuf, 50*sizeof(int), &position, mpi_outbuf, 3, mpitype, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(mpitype, t3);
+    res += compare_buffers(50*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
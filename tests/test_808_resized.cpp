@@ -0,0 +1,61 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+
+    // only the outer resize survives compression
+    test_start("pack(2, resized(lb=-8, extent=40, [resized(lb=0, extent=8, [indexed_block[MPI_INT, blklen=1, displs={0,2,5}]])]))");
+    init_buffers(50*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype idxtype, innertype, mpitype;
+    int displs[3] = {0, 2, 5};
+    MPI_Type_create_indexed_block(3, 1, displs, MPI_INT, &idxtype);
+    MPI_Type_create_resized(idxtype, 0, 8, &innertype);
+    MPI_Type_create_resized(innertype, -8, 40, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::DDT_Init();
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::IndexedBlockDatatype(3, 1, displs, t1);
+    farc::Datatype* t3 = new farc::ResizedDatatype(t2, 0, 8);
+    farc::Datatype* t4 = new farc::ResizedDatatype(t3, -8, 40);
+    farc::DDT_Commit(t4);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t4, 2);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, mpitype, mpi_outbuf, 50*sizeof(int), &position, MPI_COMM_WORLD);
+
+    // the true lb of both resized types is the one of the indexed block
+    int res = compare_ddt_info(mpitype, t4);
+    res += compare_ddt_info(innertype, t3);
+
+    farc::Datatype* t5 = t4->compress();
+    if (t5->toString().find("resized(", 1) != std::string::npos) res = -1;
+    delete t5;
+
+    res += compare_buffers(50*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    MPI_Finalize();
+
+    return 0;
+
+}
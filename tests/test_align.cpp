@@ -0,0 +1,88 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <cstdio>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    const size_t size = 2*4*301*sizeof(double);
+    char name[128];
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(4, 300, 301, MPI_DOUBLE, &vectype);
+    MPI_Type_commit(&vectype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+    farc::Datatype* t2 = new farc::VectorDatatype(4, 300, 301, t1);
+    farc::DDT_Commit(t2);
+
+    // both buffers misaligned by the same offset, the loads of the
+    // peeled loop are aligned as well
+    test_start("pack(2, vector[[double], count=4, blklen=300, stride=301]) [equally misaligned buffers]");
+    init_buffers_unaligned(size, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 2);
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, vectype, mpi_outbuf, size, &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(vectype, t2);
+    res += compare_buffers(size, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers_unaligned(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // the packed buffer at every offset from an aligned address
+    for (int offset=1; offset<16; offset+=3) {
+        snprintf(name, sizeof(name), "pack(2, vector[[double], count=4, blklen=300, stride=301]) [packed buffer at offset %i]", offset);
+        test_start(name);
+        init_buffers_aligned(size + 16, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        farc::DDT_Pack(farc_inbuf, farc_outbuf + offset, t2, 2);
+        position = 0;
+        MPI_Pack(mpi_inbuf, 2, vectype, mpi_outbuf + offset, size, &position, MPI_COMM_WORLD);
+
+        res = compare_buffers(size + 16, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        test_result(res);
+    }
+
+    for (int offset=1; offset<16; offset+=3) {
+        snprintf(name, sizeof(name), "unpack(2, vector[[double], count=4, blklen=300, stride=301]) [packed buffer at offset %i]", offset);
+        test_start(name);
+        init_buffers_aligned(size + 16, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        farc::DDT_Unpack(farc_inbuf + offset, farc_outbuf, t2, 2);
+        position = 0;
+        MPI_Unpack(mpi_inbuf + offset, size, &position, mpi_outbuf, 2, vectype, MPI_COMM_WORLD);
+
+        res = compare_buffers(size + 16, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        test_result(res);
+    }
+
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,78 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <unistd.h>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+    setenv("LIBPACK_ASYNC_COMMIT", "1", 1);
+    farc::DDT_Init();
+
+    int blocklen[3] = {1, 3, 2};
+    MPI_Aint disp[3] = {4, 40, 96};
+
+    MPI_Datatype vectype, mpitype;
+    MPI_Type_vector(2, 2, 3, MPI_INT, &vectype);
+    MPI_Type_create_hindexed(3, blocklen, disp, vectype, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::VectorDatatype(2, 2, 3, t1);
+    farc::Datatype* t3 = new farc::HIndexedDatatype(3, blocklen, disp, t2);
+    farc::DDT_Commit(t3);
+
+    // packing right after the commit interprets the datatype
+    test_start("pack(2, hindexed[{(1,4), (3,40), (2,96)}][vector[int, 2, 2, 3]]) [interpreted during async commit]");
+    init_buffers(80*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t3, 2);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, mpitype, mpi_outbuf, 80*sizeof(int), &position, MPI_COMM_WORLD);
+
+    int res = compare_buffers(80*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // wait for the compiler thread to install the generated code
+    for (int i=0; i<1000 && (t3->pack == NULL || t3->unpack == NULL); i++) {
+        usleep(10000);
+    }
+
+    test_start("pack(2, hindexed[{(1,4), (3,40), (2,96)}][vector[int, 2, 2, 3]]) [compiled after async commit]");
+    init_buffers(80*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t3, 2);
+
+    position = 0;
+    MPI_Pack(mpi_inbuf, 2, mpitype, mpi_outbuf, 80*sizeof(int), &position, MPI_COMM_WORLD);
+
+    res = compare_buffers(80*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    if (t3->pack == NULL) res = -1;
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    MPI_Type_free(&mpitype);
+    MPI_Type_free(&vectype);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
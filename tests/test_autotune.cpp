@@ -0,0 +1,99 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+// Number of decisions in the tuning file
+static int tuningLines(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return 0;
+    int lines = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) lines++;
+    fclose(f);
+    return lines;
+}
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    char tuningfile[] = "/tmp/libpack-tuning-XXXXXX";
+    int fd = mkstemp(tuningfile);
+    if (fd >= 0) close(fd);
+    setenv("LIBPACK_AUTOTUNE", "1", 1);
+    setenv("LIBPACK_TUNING_FILE", tuningfile, 1);
+
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    test_start("pack(2, vector[[double], count=8, blklen=100, stride=120]) [autotuned]");
+    init_buffers(2*8*120*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(8, 100, 120, MPI_DOUBLE, &vectype);
+    MPI_Type_commit(&vectype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+    farc::Datatype* t2 = new farc::VectorDatatype(8, 100, 120, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 2);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, vectype, mpi_outbuf, 2*8*120*sizeof(double), &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(vectype, t2);
+    res += compare_buffers(2*8*120*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Stats stats;
+    farc::DDT_Get_Stats(&stats);
+    if (stats.tunings != 1 || tuningLines(tuningfile) != 1) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // an identical datatype reuses the decision; t2 is freed first, so its
+    // code is gone and t3 is compiled again instead of sharing it
+    test_start("unpack(2, vector[[double], count=8, blklen=100, stride=120]) [tuned before]");
+    init_buffers(2*8*120*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Free(t2);
+    unsigned long shared = stats.shared;
+    farc::Datatype* t3 = new farc::VectorDatatype(8, 100, 120, t1);
+    farc::DDT_Commit(t3);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t3, 2);
+
+    position = 0;
+    MPI_Unpack(mpi_inbuf, 2*8*120*sizeof(double), &position, mpi_outbuf, 2, vectype, MPI_COMM_WORLD);
+
+    res = compare_buffers(2*8*120*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    farc::DDT_Get_Stats(&stats);
+    if (stats.tunings != 1 || tuningLines(tuningfile) != 1) res = -1;
+    if (stats.shared != shared) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t1);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+    unlink(tuningfile);
+
+    return 0;
+
+}
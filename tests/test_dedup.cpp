@@ -0,0 +1,59 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <mpi.h>
+
+#include "../ddt_jit.hpp"
+#include "test.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    test_start("pack(2, vector[[int], count=2, blklen=3, stride=5]) [shared with an identical, freed type]");
+    init_buffers(20*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    // two separately created but identical datatypes share their code
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::VectorDatatype(2, 3, 5, t1);
+    farc::Datatype* t3 = new farc::VectorDatatype(2, 3, 5, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Commit(t3);
+
+    int res = 0;
+    if (t2->pack != t3->pack || t2->unpack != t3->unpack) res = -1;
+
+    // the shared code must stay alive until the last user is freed
+    farc::DDT_Free(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t3, 2);
+
+    int position = 0;
+    MPI_Datatype vectype;
+    MPI_Type_vector(2, 3, 5, MPI_INT, &vectype);
+    MPI_Type_commit(&vectype);
+    MPI_Pack(mpi_inbuf, 2, vectype, mpi_outbuf, 20*sizeof(int), &position, MPI_COMM_WORLD);
+
+    if (compare_buffers(20*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf) != 0) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t1);
+    MPI_Type_free(&vectype);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
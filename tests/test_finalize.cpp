@@ -0,0 +1,78 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    // a datatype committed before DDT_Finalize keeps its code
+    test_start("pack(3, vector[[double], count=20, blklen=5, stride=7]) [after DDT_Finalize]");
+    init_buffers(3*20*7*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(20, 5, 7, MPI_DOUBLE, &vectype);
+    MPI_Type_commit(&vectype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+    farc::Datatype* t2 = new farc::VectorDatatype(20, 5, 7, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Finalize();
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 3);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 3, vectype, mpi_outbuf, 3*20*7*sizeof(double), &position, MPI_COMM_WORLD);
+
+    int res = compare_buffers(3*20*7*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // after a new DDT_Init an identical datatype gets code of its own, and
+    // the old one can still be freed
+    test_start("unpack(3, vector[[double], count=20, blklen=5, stride=7]) [initialized again]");
+    init_buffers(3*20*7*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Init();
+    farc::DDT_Stats stats;
+    farc::DDT_Get_Stats(&stats);
+    unsigned long shared = stats.shared;
+
+    farc::Datatype* t3 = new farc::VectorDatatype(20, 5, 7, t1);
+    farc::DDT_Commit(t3);
+    farc::DDT_Free(t2);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t3, 3);
+
+    position = 0;
+    MPI_Unpack(mpi_inbuf, 3*20*7*sizeof(double), &position, mpi_outbuf, 3, vectype, MPI_COMM_WORLD);
+
+    res = compare_buffers(3*20*7*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    farc::DDT_Get_Stats(&stats);
+    if (stats.shared != shared) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t1);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,117 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <cstdlib>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    // small calls are split too, so the tests stay small
+    setenv("LIBPACK_PARALLEL_TRESHOLD", "1024", 1);
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+    int res = farc::DDT_Set_Threads(4);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+
+    // more elements than threads, split by elements
+    test_start("pack(11, vector[[double], count=5, blklen=7, stride=9]) [4 threads]");
+    init_buffers(11*5*9*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(5, 7, 9, MPI_DOUBLE, &vectype);
+    MPI_Type_commit(&vectype);
+
+    farc::Datatype* t2 = new farc::VectorDatatype(5, 7, 9, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 11);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 11, vectype, mpi_outbuf, 11*5*9*sizeof(double), &position, MPI_COMM_WORLD);
+
+    res += compare_ddt_info(vectype, t2);
+    res += compare_buffers(11*5*9*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // a single element, split by the iterations of the vector
+    test_start("pack(1, vector[[double], count=1000, blklen=3, stride=5]) [4 threads]");
+    init_buffers(1000*5*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype vectype2;
+    MPI_Type_vector(1000, 3, 5, MPI_DOUBLE, &vectype2);
+    MPI_Type_commit(&vectype2);
+
+    farc::Datatype* t3 = new farc::VectorDatatype(1000, 3, 5, t1);
+    farc::DDT_Commit(t3);
+    farc::DDT_Pack(farc_inbuf, farc_outbuf, t3, 1);
+
+    position = 0;
+    MPI_Pack(mpi_inbuf, 1, vectype2, mpi_outbuf, 1000*5*sizeof(double), &position, MPI_COMM_WORLD);
+
+    res = compare_ddt_info(vectype2, t3);
+    res += compare_buffers(1000*5*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    if (t3->outer == NULL) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // two elements, the ranges of the threads cross the element boundary
+    test_start("unpack(2, vector[[double], count=1000, blklen=3, stride=5]) [4 threads]");
+    init_buffers(2*1000*5*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t3, 2);
+
+    position = 0;
+    MPI_Unpack(mpi_inbuf, 2*1000*5*sizeof(double), &position, mpi_outbuf, 2, vectype2, MPI_COMM_WORLD);
+
+    res = compare_buffers(2*1000*5*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // a single contiguous element
+    test_start("unpack(1, contiguous[[double], count=3001]) [4 threads]");
+    init_buffers(3001*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype contigtype;
+    MPI_Type_contiguous(3001, MPI_DOUBLE, &contigtype);
+    MPI_Type_commit(&contigtype);
+
+    farc::Datatype* t4 = new farc::ContiguousDatatype(3001, t1);
+    farc::DDT_Commit(t4);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t4, 1);
+
+    position = 0;
+    MPI_Unpack(mpi_inbuf, 3001*sizeof(double), &position, mpi_outbuf, 1, contigtype, MPI_COMM_WORLD);
+
+    res = compare_ddt_info(contigtype, t4);
+    res += compare_buffers(3001*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t4);
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,122 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <cstring>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+#define BUFSIZE (120*sizeof(int))
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    int blocklen[3] = {1, 3, 2};
+    MPI_Aint disp[3] = {4, 40, 96};
+
+    MPI_Datatype vectype, mpitype;
+    MPI_Type_vector(2, 2, 3, MPI_INT, &vectype);
+    MPI_Type_create_hindexed(3, blocklen, disp, vectype, &mpitype);
+    MPI_Type_commit(&mpitype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::VectorDatatype(2, 2, 3, t1);
+    farc::Datatype* t3 = new farc::HIndexedDatatype(3, blocklen, disp, t2);
+    farc::DDT_Commit(t3);
+
+    int packsize = 3 * t3->getSize();
+
+    // segment sizes which do not divide the element size, the segments
+    // start and end in the middle of blocks and primitives
+    int segsizes[3] = {7, 100, 1000};
+
+    for (int s=0; s<3; s++) {
+        char name[256];
+        snprintf(name, sizeof(name), "pack(3, hindexed[{(1,4), (3,40), (2,96)}][vector[int, 2, 2, 3]]) [segments of %i bytes]", segsizes[s]);
+        test_start(name);
+        init_buffers(BUFSIZE, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        for (int offset=0; offset<packsize; offset+=segsizes[s]) {
+            farc::DDT_Pack_partial(farc_inbuf, farc_outbuf + offset, t3, 3, offset, segsizes[s]);
+        }
+
+        int position = 0;
+        MPI_Pack(mpi_inbuf, 3, mpitype, mpi_outbuf, BUFSIZE, &position, MPI_COMM_WORLD);
+
+        int res = compare_buffers(BUFSIZE, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        test_result(res);
+    }
+
+    for (int s=0; s<3; s++) {
+        char name[256];
+        snprintf(name, sizeof(name), "unpack(3, hindexed[{(1,4), (3,40), (2,96)}][vector[int, 2, 2, 3]]) [segments of %i bytes]", segsizes[s]);
+        test_start(name);
+        init_buffers(BUFSIZE, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        int position = 0;
+        MPI_Pack(mpi_inbuf, 3, mpitype, mpi_outbuf, BUFSIZE, &position, MPI_COMM_WORLD);
+        memcpy(farc_outbuf, mpi_outbuf, BUFSIZE);
+        memset(mpi_inbuf, 0, BUFSIZE);
+        memset(farc_inbuf, 0, BUFSIZE);
+
+        position = 0;
+        MPI_Unpack(mpi_outbuf, BUFSIZE, &position, mpi_inbuf, 3, mpitype, MPI_COMM_WORLD);
+        for (int offset=0; offset<packsize; offset+=segsizes[s]) {
+            farc::DDT_Unpack_partial(farc_outbuf + offset, farc_inbuf, t3, 3, offset, segsizes[s]);
+        }
+
+        int res = compare_buffers(BUFSIZE, &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        test_result(res);
+    }
+
+    // a single element larger than the segments, which is split by the
+    // iterations of its vector
+    test_start("pack(1, vector[int, count=100, blklen=3, stride=5]) [segments of 50 bytes]");
+    init_buffers(100*5*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype bigtype;
+    MPI_Type_vector(100, 3, 5, MPI_INT, &bigtype);
+    MPI_Type_commit(&bigtype);
+
+    farc::Datatype* t4 = new farc::VectorDatatype(100, 3, 5, t1);
+    farc::DDT_Commit(t4);
+    for (int offset=0; offset<100*3*(int)sizeof(int); offset+=50) {
+        farc::DDT_Pack_partial(farc_inbuf, farc_outbuf + offset, t4, 1, offset, 50);
+    }
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 1, bigtype, mpi_outbuf, 100*5*sizeof(int), &position, MPI_COMM_WORLD);
+
+    int res = compare_buffers(100*5*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    if (t4->outer == NULL) res = -1;
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t4);
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    MPI_Type_free(&bigtype);
+    MPI_Type_free(&mpitype);
+    MPI_Type_free(&vectype);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,100 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    // blocks long enough for the copy loop, packed with streaming stores
+    test_start("pack(2, vector[[double], count=4, blklen=300, stride=301]) [streaming stores]");
+    init_buffers_aligned(2*4*301*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(4, 300, 301, MPI_DOUBLE, &vectype);
+    MPI_Type_commit(&vectype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::DOUBLE);
+    farc::Datatype* t2 = new farc::VectorDatatype(4, 300, 301, t1);
+    farc::DDT_Commit(t2);
+    farc::DDT_Pack_stream(farc_inbuf, farc_outbuf, t2, 2, farc::Datatype::STREAM_ALWAYS);
+
+    int position = 0;
+    MPI_Pack(mpi_inbuf, 2, vectype, mpi_outbuf, 2*4*301*sizeof(double), &position, MPI_COMM_WORLD);
+
+    int res = compare_ddt_info(vectype, t2);
+    res += compare_buffers(2*4*301*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    if (t2->packstream == NULL) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // single doubles, unpacked with streaming stores of 8 bytes
+    test_start("unpack(3, vector[[double], count=64, blklen=1, stride=3]) [streaming stores]");
+    init_buffers(3*64*3*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype vectype2;
+    MPI_Type_vector(64, 1, 3, MPI_DOUBLE, &vectype2);
+    MPI_Type_commit(&vectype2);
+
+    farc::Datatype* t3 = new farc::VectorDatatype(64, 1, 3, t1);
+    farc::DDT_Commit(t3);
+    farc::DDT_Set_Stream(t3, farc::Datatype::STREAM_ALWAYS);
+    farc::DDT_Unpack(farc_inbuf, farc_outbuf, t3, 3);
+
+    position = 0;
+    MPI_Unpack(mpi_inbuf, 3*64*3*sizeof(double), &position, mpi_outbuf, 3, vectype2, MPI_COMM_WORLD);
+
+    res = compare_ddt_info(vectype2, t3);
+    res += compare_buffers(3*64*3*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    if (t3->unpackstream == NULL) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    // the number of bytes is only known at runtime, the copy streams anyway
+    test_start("pack(3, contiguous[[double], count=1001]) [streaming stores]");
+    init_buffers(3*1001*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+    MPI_Datatype contigtype;
+    MPI_Type_contiguous(1001, MPI_DOUBLE, &contigtype);
+    MPI_Type_commit(&contigtype);
+
+    farc::Datatype* t4 = new farc::ContiguousDatatype(1001, t1);
+    farc::DDT_Commit(t4);
+    farc::DDT_Pack_stream(farc_inbuf, farc_outbuf, t4, 3, farc::Datatype::STREAM_ALWAYS);
+
+    position = 0;
+    MPI_Pack(mpi_inbuf, 3, contigtype, mpi_outbuf, 3*1001*sizeof(double), &position, MPI_COMM_WORLD);
+
+    res = compare_ddt_info(contigtype, t4);
+    res += compare_buffers(3*1001*sizeof(double), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    if (t4->packstream == NULL) res = -1;
+
+    free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+    test_result(res);
+
+    farc::DDT_Free(t4);
+    farc::DDT_Free(t3);
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
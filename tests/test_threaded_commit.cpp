@@ -0,0 +1,84 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <pthread.h>
+#include <mpi.h>
+
+#include "../ddt_jit.hpp"
+#include "test.hpp"
+
+#define NUM_THREADS 4
+#define BUFSIZE     (64*sizeof(int))
+
+struct thread_args {
+    int stride;
+    char* inbuf;
+    char* outbuf;
+    farc::Datatype* basetype;
+};
+
+// every thread commits a different type and packs with it while the other
+// threads are still committing
+void* commit_and_pack(void* arg) {
+    thread_args* args = (thread_args*) arg;
+
+    farc::Datatype* t = new farc::VectorDatatype(4, 2, args->stride, args->basetype);
+    farc::DDT_Commit(t);
+    farc::DDT_Pack(args->inbuf, args->outbuf, t, 2);
+    farc::DDT_Free(t);
+
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf[NUM_THREADS];
+    char* mpi_outbuf[NUM_THREADS];
+    char* farc_inbuf[NUM_THREADS];
+    char* farc_outbuf[NUM_THREADS];
+    pthread_t threads[NUM_THREADS];
+    thread_args args[NUM_THREADS];
+
+    MPI_Init(&argc, &argv);
+    farc::DDT_Init();
+
+    test_start("pack(2, vector[[int], count=4, blklen=2, stride=3..6]) [committed by 4 threads concurrently]");
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    for (int i=0; i<NUM_THREADS; i++) {
+        init_buffers(BUFSIZE, &mpi_inbuf[i], &farc_inbuf[i], &mpi_outbuf[i], &farc_outbuf[i]);
+        args[i].stride = 3+i;
+        args[i].inbuf = farc_inbuf[i];
+        args[i].outbuf = farc_outbuf[i];
+        args[i].basetype = t1;
+        pthread_create(&threads[i], NULL, commit_and_pack, &args[i]);
+    }
+
+    int res = 0;
+    for (int i=0; i<NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+
+        int position = 0;
+        MPI_Datatype vectype;
+        MPI_Type_vector(4, 2, 3+i, MPI_INT, &vectype);
+        MPI_Type_commit(&vectype);
+        MPI_Pack(mpi_inbuf[i], 2, vectype, mpi_outbuf[i], BUFSIZE, &position, MPI_COMM_WORLD);
+        MPI_Type_free(&vectype);
+
+        if (compare_buffers(BUFSIZE, &mpi_inbuf[i], &farc_inbuf[i], &mpi_outbuf[i], &farc_outbuf[i]) != 0) res = -1;
+        free_buffers(&mpi_inbuf[i], &farc_inbuf[i], &mpi_outbuf[i], &farc_outbuf[i]);
+    }
+
+    test_result(res);
+
+    farc::DDT_Free(t1);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}
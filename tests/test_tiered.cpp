@@ -0,0 +1,71 @@
+// Copyright 2013 Timo Schneider and Fredrik Berg Kjolstad
+//
+// This file is part of the libpack packing library.
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT in the top level directory for details.
+
+#include <string>
+#include <mpi.h>
+
+#include "test.hpp"
+#include "../ddt_jit.hpp"
+
+int main(int argc, char** argv) {
+
+    char* mpi_inbuf;
+    char* mpi_outbuf;
+    char* farc_inbuf;
+    char* farc_outbuf;
+
+    MPI_Init(&argc, &argv);
+
+    // interpret the first call, tier 1 from the second, tier 2 from the fourth
+    setenv("LIBPACK_TIERED", "1", 1);
+    setenv("LIBPACK_TIER1_CALLS", "2", 1);
+    setenv("LIBPACK_TIER2_CALLS", "4", 1);
+    farc::DDT_Init();
+
+    MPI_Datatype vectype;
+    MPI_Type_vector(3, 2, 5, MPI_INT, &vectype);
+    MPI_Type_commit(&vectype);
+
+    farc::Datatype* t1 = new farc::PrimitiveDatatype(farc::PrimitiveDatatype::INT);
+    farc::Datatype* t2 = new farc::VectorDatatype(3, 2, 5, t1);
+    farc::DDT_Commit(t2);
+
+    int expected_tier[5] = {0, 1, 1, 2, 2};
+    for (int call=0; call<5; call++) {
+        char name[128];
+        snprintf(name, sizeof(name), "pack(2, vector[[int], count=3, blklen=2, stride=5]) [call %i, tier %i]", call+1, expected_tier[call]);
+        test_start(name);
+        init_buffers(40*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+
+        farc::DDT_Pack(farc_inbuf, farc_outbuf, t2, 2);
+
+        int position = 0;
+        MPI_Pack(mpi_inbuf, 2, vectype, mpi_outbuf, 40*sizeof(int), &position, MPI_COMM_WORLD);
+
+        int res = compare_buffers(40*sizeof(int), &mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        if (t2->packtier != expected_tier[call]) res = -1;
+        free_buffers(&mpi_inbuf, &farc_inbuf, &mpi_outbuf, &farc_outbuf);
+        test_result(res);
+    }
+
+    test_start("tiered compilation statistics");
+    farc::DDT_Stats stats;
+    farc::DDT_Get_Stats(&stats);
+    int res = 0;
+    if (stats.interpreted_calls != 1 || stats.compiles[1] != 1 || stats.compiles[2] != 1) res = -1;
+    if (t2->packcalls != 5 || t2->unpacktier != 0) res = -1;
+    test_result(res);
+
+    farc::DDT_Free(t2);
+    farc::DDT_Free(t1);
+    MPI_Type_free(&vectype);
+    farc::DDT_Finalize();
+    MPI_Finalize();
+
+    return 0;
+
+}